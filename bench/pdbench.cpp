@@ -0,0 +1,475 @@
+/* Microbenchmarks for the detection, tracking and result output hot paths.
+ *
+ * Each benchmark runs its body repeatedly until a minimum amount of time has
+ * passed, then reports per-iteration timings. Results are written as JSON in a
+ * fixed schema so they can be compared across commits:
+ *
+ *   {"schema":1,"tag":"...","benchmarks":[
+ *     {"name":"...","iterations":N,"mean_ns":...,"min_ns":...,
+ *      "median_ns":...,"max_ns":...}, ...]}
+ */
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+#include "opencv2/tracking.hpp"
+
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "algorithm.hpp"
+#include "algorithms/acf.hpp"
+#include "algorithms/arena.hpp"
+#include "algorithms/grouping.hpp"
+#include "algorithms/hog_kernel.hpp"
+#include "algorithms/models.hpp"
+#include "algorithms/ocv.hpp"
+#include "algorithms/preprocess.hpp"
+#include "algorithms/tracking.hpp"
+#include "media/capture.hpp"
+#include "results/metadump.hpp"
+#include "results/network.hpp"
+
+#define BENCH_SCHEMA 1
+
+using namespace std;
+namespace po = boost::program_options;
+
+static double nowNs() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec * 1.0e9 + (double)t.tv_nsec;
+}
+
+struct BenchResult {
+    string name;
+    long iterations;
+    double mean_ns, min_ns, median_ns, max_ns;
+};
+
+class BenchRunner {
+public:
+    BenchRunner(double min_time, const string& filter) :
+        m_min_time(min_time), m_filter(filter) {}
+
+    /** \brief Run a benchmark body until the minimum time has elapsed
+     *
+     * The body is run once untimed first, so lazy initialization doesn't end
+     * up in the figures.
+     */
+    void run(const string& name, const function<void()>& body) {
+        if(!m_filter.empty() && name.find(m_filter) == string::npos) return;
+
+        body();
+        vector<double> samples;
+        double start = nowNs(), end = start + m_min_time * 1.0e9;
+        for(double t = start;t < end || samples.size() < 3;) {
+            body();
+            double t2 = nowNs();
+            samples.push_back(t2 - t);
+            t = t2;
+        }
+
+        sort(samples.begin(), samples.end());
+        double sum = 0.0;
+        for(auto s : samples) sum += s;
+
+        BenchResult r = { name, (long)samples.size(), sum / samples.size(),
+            samples.front(), samples[samples.size() / 2], samples.back() };
+        m_results.push_back(r);
+        fprintf(stderr, "%-40s %10ld iters %14.0f ns/iter\n", name.c_str(),
+                r.iterations, r.mean_ns);
+    }
+
+    void write(ostream& out, const string& tag) const {
+        mdump::JSONWriter json(out, mdump::JSONWriter::OBJECT);
+        json("schema", BENCH_SCHEMA);
+        json("tag", tag);
+        json.array("benchmarks");
+        for(auto& r : m_results) {
+            json.object();
+            json("name", r.name);
+            json("iterations", r.iterations);
+            json("mean_ns", r.mean_ns);
+            json("min_ns", r.min_ns);
+            json("median_ns", r.median_ns);
+            json("max_ns", r.max_ns);
+            json.end();
+        }
+        json.end();
+    }
+
+private:
+    double m_min_time;
+    string m_filter;
+    vector<BenchResult> m_results;
+};
+
+/** \brief Socket target that completes every send immediately
+ *
+ * Isolates the queueing cost of SocketTarget from any real network I/O.
+ */
+class NullSocketTarget : public mdump::SocketTarget {
+public:
+    void write(const string& data) { enqueue_send(mdump::asio::buffer(data)); }
+
+    //! Block until everything queued so far has been "sent"
+    void drain() {
+        for(;;) {
+            {
+                lock_guard<mutex> l(m_queue_mut);
+                if(m_queue.empty()) return;
+            }
+            this_thread::yield();
+        }
+    }
+
+protected:
+    bool attempt_send(const mdump::asio::const_buffer buf) {
+        // called with the queue locks held, so complete from the io thread
+        m_svc->post([this]() { on_transmit_succeed(); });
+        return true;
+    }
+};
+
+class NullDumpTarget : public mdump::DumpTarget {
+public:
+    void write(const string& data) { m_bytes += data.size(); }
+    size_t m_bytes = 0;
+};
+
+//! Random rectangles clustered around a few centres, like raw HOG hits
+static vector<cv::Rect> clusteredRects(mt19937& rng, int clusters, int per,
+        const cv::Size& frame) {
+    uniform_int_distribution<int> cx(0, frame.width - 64);
+    uniform_int_distribution<int> cy(0, frame.height - 128);
+    uniform_int_distribution<int> jitter(-6, 6);
+
+    vector<cv::Rect> out;
+    for(int c = 0;c < clusters;c++) {
+        int x = cx(rng), y = cy(rng);
+        for(int i = 0;i < per;i++)
+            out.push_back(cv::Rect(x + jitter(rng), y + jitter(rng), 64, 128));
+    }
+    return out;
+}
+
+static ml::TrackList makeTracks(const vector<cv::Rect>& rects,
+        const cv::Mat& img) {
+    ml::TrackList tracks;
+    unsigned int id = 1;
+    for(auto r : rects) {
+        ml::TrackingInfo inf;
+        inf.tracker = ml::createTracker("MEDIANFLOW");
+        inf.tracker->init(img, r);
+        inf.last_pos = r;
+        inf.id = id++;
+        inf.confirm_frames = 0;
+        tracks.push_back(inf);
+    }
+    return tracks;
+}
+
+int main(int argc, char** argv) {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Print this help message")
+        ("input,i", po::value<string>()->default_value(PDBENCH_DEFAULT_INPUT),
+            "Capture spec to take the benchmark frame from")
+        ("filter,f", po::value<string>()->default_value(""),
+            "Only run benchmarks whose name contains this string")
+        ("min-time", po::value<double>()->default_value(0.5),
+            "Minimum time to spend in each benchmark, in seconds")
+        ("tag", po::value<string>()->default_value(""),
+            "Free-form tag stored with the results, e.g. a commit hash")
+        ("out,o", po::value<string>(), "Write JSON results to this file");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch(po::error& e) {
+        cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+    if(vm.count("help") > 0) {
+        cout << desc << '\n';
+        return 0;
+    }
+
+    // grab a reference frame
+    cv::Mat frame;
+    try {
+        vio::CaptureBackend* cap = vio::openBackend(
+                vm["input"].as<string>(), false);
+        cap->getFrame(frame);
+        delete cap;
+    } catch(const exception& e) {
+        fprintf(stderr, "Error: Cannot read benchmark frame: %s\n", e.what());
+        return 1;
+    }
+
+    BenchRunner bench(vm["min-time"].as<double>(), vm["filter"].as<string>());
+    mt19937 rng(1);
+
+    // HOG detection at the resolutions we see in practice
+    {
+        cv::HOGDescriptor hog;
+        hog.setSVMDetector(cv::HOGDescriptor::getDefaultPeopleDetector());
+        const cv::Size sizes[] = {
+            cv::Size(320, 240), cv::Size(640, 480), cv::Size(1280, 720) };
+        for(auto sz : sizes) {
+            cv::Mat img;
+            cv::resize(frame, img, sz);
+            vector<cv::Rect> locs;
+            ostringstream name;
+            name << "hog/detectMultiScale/" << sz.width << 'x' << sz.height;
+            bench.run(name.str(), [&]() {
+                locs.clear();
+                hog.detectMultiScale(img, locs, 0.5, cv::Size(8,8),
+                        cv::Size(32,32),
+                        pow((double)img.rows / 128, 1.0 / 24), 2);
+            });
+        }
+    }
+
+    // one pyramid level scored by OpenCV and by the compiled kernels
+    {
+        cv::Mat img;
+        cv::resize(frame, img, cv::Size(640, 480));
+        const char* models[] = { "default", "daimler" };
+        for(auto name : models) {
+            auto model = ml::ModelStore::get().hog(name);
+            std::unique_ptr<ml::hogcpu::Kernel> kernel(
+                    ml::hogcpu::makeKernel(*model));
+            cv::Size win = model->winSize();
+            ostringstream suffix;
+            suffix << win.width << 'x' << win.height << "/640x480";
+
+            vector<cv::Point> hits;
+            vector<double> weights;
+            bench.run("hog/detect/" + suffix.str(), [&]() {
+                hits.clear();
+                model->descriptor().detect(img, hits, weights, 0.0,
+                        cv::Size(8, 8), cv::Size(0, 0));
+            });
+
+            ml::hogcpu::Level level;
+            bench.run("hog-cpu/detect/" + suffix.str(), [&]() {
+                kernel->detect(img, *model, 0.0, 1, level);
+            });
+        }
+    }
+
+    // ACF channel pyramids, computed exactly at every level or only at
+    // octaves with the levels in between approximated
+    {
+        const int perOctave = 8, shrink = 4, orients = 6;
+        cv::Mat img;
+        cv::resize(frame, img, cv::Size(640, 480));
+        vector<double> scales;
+        for(int i = 0;img.rows * pow(2.0, -(double)i / perOctave) >= 128;i++)
+            scales.push_back(pow(2.0, -(double)i / perOctave));
+        vector<ml::acf::Channels> levels(scales.size());
+
+        bench.run("acf/pyramid/exact/640x480", [&]() {
+            for(size_t i = 0;i < scales.size();i++) {
+                cv::Mat r;
+                cv::resize(img, r, cv::Size(), scales[i], scales[i],
+                        cv::INTER_AREA);
+                ml::acf::computeChannels(r, shrink, orients, levels[i]);
+                levels[i].scale = scales[i];
+            }
+        });
+        bench.run("acf/pyramid/approximate/640x480", [&]() {
+            for(size_t i = 0;i < scales.size();i += perOctave) {
+                cv::Mat r;
+                cv::resize(img, r, cv::Size(), scales[i], scales[i],
+                        cv::INTER_AREA);
+                ml::acf::computeChannels(r, shrink, orients, levels[i]);
+                levels[i].scale = scales[i];
+            }
+            for(size_t i = 0;i < scales.size();i++) {
+                if(i % perOctave == 0) continue;
+                size_t ref = i / perOctave * perOctave;
+                ml::acf::approximateChannels(levels[ref], scales[i],
+                        cvRound(img.cols * scales[i]) / shrink,
+                        cvRound(img.rows * scales[i]) / shrink, levels[i]);
+            }
+        });
+    }
+
+    // tracker updates, one target each
+    {
+        const char* types[] = { "TLD", "KCF", "MIL", "BOOSTING", "MEDIANFLOW" };
+        cv::Rect target(frame.cols / 2 - 32, frame.rows / 2 - 64, 64, 128);
+        for(auto type : types) {
+            cv::Ptr<cv::Tracker> tracker = ml::createTracker(type);
+            if(!tracker) continue;
+            tracker->init(frame, target);
+            cv::Rect2d r;
+            bench.run(string("tracker/update/") + type,
+                    [&]() { tracker->update(frame, r); });
+        }
+    }
+
+    // track deduplication and detection association
+    {
+        const int counts[] = { 10, 50 };
+        for(auto n : counts) {
+            vector<cv::Rect> rects = clusteredRects(rng, n, 2, frame.size());
+            ml::TrackList base = makeTracks(rects, frame);
+
+            bench.run("tracking/dedup/" + to_string(n * 2), [&]() {
+                ml::TrackList t = base;
+                ml::dedupTracks(t, 0.5);
+            });
+
+            vector<cv::Rect> dets = clusteredRects(rng, n, 1, frame.size());
+            bench.run("tracking/associate/" + to_string(n * 2), [&]() {
+                vector<cv::Rect> d = dets;
+                ml::associateDetections(base, d, frame, 0.5, false);
+            });
+        }
+    }
+
+    // weighted rectangle grouping, as used on FPGA output
+    {
+        const int counts[] = { 10, 100 };
+        for(auto n : counts) {
+            vector<cv::Rect> rects = clusteredRects(rng, n, 8, frame.size());
+            vector<double> weights(rects.size(), 1.0);
+            bench.run("grouping/groupRectangles/" + to_string(rects.size()),
+                    [&]() {
+                vector<cv::Rect> r = rects;
+                vector<double> w = weights;
+                ml::groupRectangles(r, w, 1, 0.2);
+            });
+        }
+    }
+
+    // the same out of a frame arena, which stops touching the heap once it
+    // has grown to size
+    {
+        ml::FrameArena arena;
+        const int counts[] = { 10, 100 };
+        for(auto n : counts) {
+            vector<cv::Rect> rects = clusteredRects(rng, n, 8, frame.size());
+            vector<double> weights(rects.size(), 1.0);
+            string name = "grouping/groupRectangles/arena/" +
+                to_string(rects.size());
+            auto body = [&]() {
+                ml::FrameArena::Scope scope(arena);
+                ml::ArenaVector<cv::Rect> r(rects.begin(), rects.end(), arena);
+                ml::ArenaVector<double> w(weights.begin(), weights.end(), arena);
+                ml::groupRectangles(r, w, 1, 0.2, arena);
+            };
+            bench.run(name, body);
+
+#ifdef PDDEMO_COUNT_ALLOCS
+            ml::AllocationCounter allocs;
+            body();
+            allocs.start();
+            body();
+            allocs.stop();
+            fprintf(stderr, "%s: %ld allocations per iteration\n",
+                    name.c_str(), allocs.count());
+#endif
+        }
+    }
+
+#ifdef PDDEMO_COUNT_ALLOCS
+    // everything a whole frame of detection and tracking costs the heap,
+    // OpenCV included, which the detectors' own check leaves out. Only the
+    // calling thread is counted, not OpenCV's workers.
+    {
+        const int frames = 10;
+        ml::ocv::OCVAlgorithm algo;
+        for(int i = 0;i < ARENA_WARMUP_FRAMES;i++) algo.analyze(frame);
+        ml::AllocationCounter allocs;
+        allocs.start();
+        for(int i = 0;i < frames;i++) algo.analyze(frame);
+        allocs.stop();
+        fprintf(stderr, "ocv-hog-svm/analyze: %ld allocations per frame\n",
+                allocs.count() / frames);
+    }
+#endif
+
+    // metadata serialization and queueing
+    {
+        ml::BoundingBoxesResult boxes;
+        for(auto r : clusteredRects(rng, 50, 1, frame.size())) {
+            ml::BoundingBox b;
+            b.id = rng();
+            b.tag = 0;
+            b.bounds = r;
+            boxes.boxes.push_back(b);
+        }
+        boxes.type = ml::RT_BOUNDING_BOXES;
+        vector<ml::AlgorithmResult*> res(1, &boxes);
+
+        NullDumpTarget* sink = new NullDumpTarget();
+        mdump::Metadumper dumper{unique_ptr<mdump::DumpTarget>(sink)};
+        long n = 0;
+        bench.run("metadump/json/50-boxes", [&]() {
+            dumper.accept(res, 15, n++, false, 0.0, 30.0, 33);
+        });
+
+        // the target starts an io thread which never exits, so leak it
+        NullSocketTarget* sock = new NullSocketTarget();
+        string payload(512, 'x');
+        bench.run("network/SocketTarget/enqueue-512", [&]() {
+            sock->write(payload);
+        });
+        sock->drain();
+    }
+
+    // input preparation: OpenCV one step at a time against the fused pass
+    {
+        const cv::Size sizes[] = { cv::Size(640, 480), cv::Size(1920, 1080) };
+        for(auto sz : sizes) {
+            cv::Mat img, out, tmp, tmp2;
+            cv::resize(frame, img, sz);
+            ostringstream size;
+            size << sz.width << 'x' << sz.height;
+
+            // what the FPGA host gets
+            bench.run("preprocess/cvtColor-BGR2BGRA/" + size.str(),
+                    [&]() { cv::cvtColor(img, out, CV_BGR2BGRA); });
+            ml::Preprocessor bgra(ml::InputSpec(4));
+            bench.run("preprocess/fused-BGR2BGRA/" + size.str(),
+                    [&]() { bgra.run(img, out); });
+
+            // grey, half size, 32 pixels of border
+            bench.run("preprocess/separate-grey-half-pad32/" + size.str(),
+                    [&]() {
+                cv::cvtColor(img, tmp, CV_BGR2GRAY);
+                cv::resize(tmp, tmp2, cv::Size(sz.width / 2, sz.height / 2));
+                cv::copyMakeBorder(tmp2, out, 32, 32, 32, 32,
+                        cv::BORDER_REPLICATE);
+            });
+            ml::Preprocessor grey(ml::InputSpec(1, 2.0, 32));
+            bench.run("preprocess/fused-grey-half-pad32/" + size.str(),
+                    [&]() { grey.run(img, out); });
+        }
+    }
+
+    if(vm.count("out") > 0) {
+        ofstream out(vm["out"].as<string>().c_str());
+        bench.write(out, vm["tag"].as<string>());
+    } else {
+        bench.write(cout, vm["tag"].as<string>());
+    }
+    return 0;
+}
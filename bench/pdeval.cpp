@@ -0,0 +1,346 @@
+/* Accuracy versus throughput evaluation.
+ *
+ * Runs registered algorithms over annotated sequences in MOTChallenge layout
+ * (seqinfo.ini, img1/, gt/gt.txt) and reports tracking accuracy (MOTA, IDF1,
+ * AP at IoU 0.5) together with throughput and per-frame latency. Parameter
+ * grids given with --grid are swept exhaustively, and for each algorithm the
+ * configurations on the speed/accuracy Pareto frontier are marked.
+ */
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "algorithm.hpp"
+#include "eval/mot.hpp"
+#include "media/synth.hpp"
+#include "results/metadump.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+typedef vector<pair<string, string> > ParamSet;
+
+static double getTime() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (((double)t.tv_nsec) / 1.0e9);
+}
+
+//! An annotated image sequence
+struct Sequence {
+    string name;
+    vector<fs::path> frames;
+    eval::GroundTruth gt;
+    string synth; // synthetic capture spec, if this sequence is generated
+};
+
+/** Frame source over either an image sequence or a synthetic capture */
+class SequenceReader {
+public:
+    SequenceReader(const Sequence& seq) : m_seq(seq), m_frame(0) {
+        if(!seq.synth.empty())
+            m_synth.reset(new vio::SyntheticCaptureBackend(seq.synth));
+    }
+
+    //! Read the next frame and its ground truth
+    bool next(cv::Mat& img, eval::FrameObjects& gt) {
+        if(m_synth) {
+            if(!m_synth->getFrame(img)) return false;
+            gt.clear();
+            for(auto& t : m_synth->getTruth()) {
+                eval::Object o = { t.id, t.bounds };
+                gt.push_back(o);
+            }
+        } else {
+            if(m_frame >= (long)m_seq.frames.size()) return false;
+            img = cv::imread(m_seq.frames[m_frame].string());
+            if(img.empty())
+                throw runtime_error("Cannot read " +
+                        m_seq.frames[m_frame].string());
+            gt = m_seq.gt[m_frame];
+        }
+        m_frame++;
+        return true;
+    }
+
+private:
+    const Sequence& m_seq;
+    unique_ptr<vio::SyntheticCaptureBackend> m_synth;
+    long m_frame;
+};
+
+/** Load a sequence in MOTChallenge layout, or set up a synthetic one */
+static Sequence loadSequence(const string& spec) {
+    Sequence seq;
+    if(spec.compare(0, 6, "synth:") == 0) {
+        seq.name = spec;
+        seq.synth = spec.substr(6);
+        if(seq.synth.find("frames=") == string::npos)
+            throw invalid_argument("Synthetic sequences need a frame count");
+        return seq;
+    }
+
+    fs::path dir(spec);
+    seq.name = dir.filename().string();
+
+    string imdir = "img1", ext = ".jpg";
+    long length = -1;
+    if(fs::exists(dir / "seqinfo.ini")) {
+        boost::property_tree::ptree ini;
+        boost::property_tree::read_ini((dir / "seqinfo.ini").string(), ini);
+        seq.name = ini.get<string>("Sequence.name", seq.name);
+        imdir = ini.get<string>("Sequence.imDir", imdir);
+        ext = ini.get<string>("Sequence.imExt", ext);
+        length = ini.get<long>("Sequence.seqLength", -1);
+    }
+
+    if(length >= 0) {
+        for(long i = 1;i <= length;i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "%06ld", i);
+            seq.frames.push_back(dir / imdir / (name + ext));
+        }
+    } else {
+        for(auto e : fs::directory_iterator(dir / imdir))
+            if(e.path().extension() == ext) seq.frames.push_back(e.path());
+        sort(seq.frames.begin(), seq.frames.end());
+    }
+
+    seq.gt = eval::GroundTruth::loadMOT((dir / "gt" / "gt.txt").string());
+    return seq;
+}
+
+/** Expand name=v1,v2,... grid specs into every combination */
+static vector<ParamSet> expandGrid(const vector<string>& specs,
+        const ParamSet& fixed) {
+    vector<ParamSet> out(1, fixed);
+    for(auto& spec : specs) {
+        size_t eq = spec.find('=');
+        if(eq == string::npos)
+            throw invalid_argument("Grid parameters must be name=v1,v2,...");
+        string name = spec.substr(0, eq), list = spec.substr(eq+1);
+        vector<string> values;
+        boost::split(values, list, boost::is_any_of(","));
+
+        vector<ParamSet> next;
+        for(auto& base : out) {
+            for(auto& v : values) {
+                ParamSet p = base;
+                p.push_back(make_pair(name, v));
+                next.push_back(p);
+            }
+        }
+        out = next;
+    }
+    return out;
+}
+
+static string describe(const ParamSet& params) {
+    if(params.empty()) return "defaults";
+    string s;
+    for(auto& p : params) {
+        if(!s.empty()) s += ' ';
+        s += p.first + "=" + p.second;
+    }
+    return s;
+}
+
+struct Run {
+    string algorithm;
+    ParamSet params;
+    vector<pair<string, eval::Metrics> > sequences;
+    eval::Metrics total;
+    bool pareto;
+};
+
+//! Unloads an algorithm when it goes out of scope, even on errors
+struct LoadedAlgorithm {
+    ml::Algorithm* algo;
+    ~LoadedAlgorithm() { ml::AlgorithmRegistry::get().unload(algo); }
+};
+
+/** Evaluate one algorithm configuration over all sequences */
+static Run evaluate(const string& algoName, const ParamSet& params,
+        const vector<Sequence>& seqs) {
+    ml::AlgorithmRegistry& reg = ml::AlgorithmRegistry::get();
+    Run run = { algoName, params };
+    eval::Accumulator total;
+
+    for(auto& seq : seqs) {
+        SequenceReader reader(seq);
+        cv::Mat img;
+        eval::FrameObjects gt;
+        if(!reader.next(img, gt)) continue;
+
+        // fresh instance per sequence so no tracks leak between them
+        reg.setSize(cv::Size(img.cols, img.rows));
+        reg.setSeed(1);
+        ml::Algorithm* algo = reg.load(algoName);
+        if(algo == NULL) throw runtime_error("Cannot load " + algoName);
+        LoadedAlgorithm loaded = { algo };
+        for(auto& p : params) {
+            if(!algo->setParam(p.first, p.second))
+                throw runtime_error("Parameter rejected: " + p.first);
+        }
+        eval::Accumulator acc;
+        do {
+            double t = getTime();
+            const vector<ml::AlgorithmResult*>& res = algo->analyze(img);
+            double dtime = getTime() - t;
+            acc.frame(gt, eval::hypotheses(res), dtime);
+        } while(reader.next(img, gt));
+
+        run.sequences.push_back(make_pair(seq.name, acc.summary()));
+        total.merge(acc);
+    }
+    run.total = total.summary();
+    run.pareto = false;
+    return run;
+}
+
+/** Mark each algorithm's runs that no other run beats on both FPS and MOTA */
+static void markPareto(vector<Run>& runs) {
+    for(auto& a : runs) {
+        a.pareto = true;
+        for(auto& b : runs) {
+            if(&a == &b || a.algorithm != b.algorithm) continue;
+            if(b.total.fps >= a.total.fps && b.total.mota >= a.total.mota &&
+                    (b.total.fps > a.total.fps || b.total.mota > a.total.mota)) {
+                a.pareto = false;
+                break;
+            }
+        }
+    }
+}
+
+static void writeMetrics(mdump::JSONWriter& json, const eval::Metrics& m) {
+    json("frames", m.frames);
+    json("mota", m.mota);
+    json("motp", m.motp);
+    json("idf1", m.idf1);
+    json("ap50", m.ap50);
+    json("precision", m.precision);
+    json("recall", m.recall);
+    json("tp", m.tp);
+    json("fp", m.fp);
+    json("fn", m.fn);
+    json("idsw", m.idsw);
+    json("fps", m.fps);
+    json("latency_mean_ms", m.latency_mean);
+    json("latency_p50_ms", m.latency_p50);
+    json("latency_p95_ms", m.latency_p95);
+}
+
+int main(int argc, char** argv) {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Print this help message")
+        ("sequence,s", po::value<vector<string> >()->required(),
+            "Annotated sequence directory (MOTChallenge layout), or a "
+            "synth: capture spec with a frame count")
+        ("algorithm,a",
+             po::value<vector<string> >()->default_value({"ocv-hog-svm"},
+                 "ocv-hog-svm"),
+            "Algorithm to evaluate (may be repeated)")
+        ("param,p", po::value<vector<string> >(),
+            "Fixed algorithm parameter, as name=value")
+        ("grid,g", po::value<vector<string> >(),
+            "Parameter to sweep, as name=v1,v2,...")
+        ("out,o", po::value<string>(), "Write JSON results to this file");
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if(vm.count("help") > 0) {
+            cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    } catch(po::error& e) {
+        cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    vector<Run> runs;
+    try {
+        vector<Sequence> seqs;
+        for(auto& s : vm["sequence"].as<vector<string> >())
+            seqs.push_back(loadSequence(s));
+
+        ParamSet fixed;
+        if(vm.count("param") > 0) {
+            for(auto& p : vm["param"].as<vector<string> >()) {
+                size_t eq = p.find('=');
+                if(eq == string::npos)
+                    throw invalid_argument("Parameters must be name=value");
+                fixed.push_back(make_pair(p.substr(0, eq), p.substr(eq+1)));
+            }
+        }
+        vector<ParamSet> grid = expandGrid(vm.count("grid") > 0 ?
+                vm["grid"].as<vector<string> >() : vector<string>(), fixed);
+
+        for(auto& a : vm["algorithm"].as<vector<string> >()) {
+            for(auto& params : grid) {
+                fprintf(stderr, "Evaluating %s (%s)...\n", a.c_str(),
+                        describe(params).c_str());
+                runs.push_back(evaluate(a, params, seqs));
+            }
+        }
+    } catch(const exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    markPareto(runs);
+
+    printf("%-16s %-32s %7s %7s %7s %8s %9s %9s  %s\n", "algorithm", "params",
+            "MOTA", "IDF1", "AP50", "FPS", "mean ms", "p95 ms", "pareto");
+    for(auto& r : runs) {
+        printf("%-16s %-32s %7.3f %7.3f %7.3f %8.2f %9.2f %9.2f  %s\n",
+                r.algorithm.c_str(), describe(r.params).c_str(),
+                r.total.mota, r.total.idf1, r.total.ap50, r.total.fps,
+                r.total.latency_mean, r.total.latency_p95,
+                r.pareto ? "*" : "");
+    }
+
+    if(vm.count("out") > 0) {
+        ofstream out(vm["out"].as<string>().c_str());
+        mdump::JSONWriter json(out, mdump::JSONWriter::ARRAY);
+        for(auto& r : runs) {
+            json.object();
+            json("algorithm", r.algorithm);
+            json.object("params");
+            for(auto& p : r.params) json(p.first, p.second);
+            json.end();
+            json("pareto", r.pareto);
+            json.object("total");
+            writeMetrics(json, r.total);
+            json.end();
+            json.array("sequences");
+            for(auto& s : r.sequences) {
+                json.object();
+                json("name", s.first);
+                writeMetrics(json, s.second);
+                json.end();
+            }
+            json.end();
+            json.end();
+        }
+    }
+    return 0;
+}
@@ -2,12 +2,14 @@
 
 // built-in algorithms
 #include "algorithms/ocv.hpp"
+#include "log/log.hpp"
 
 #include <stdio.h>
 #include <string.h>
 #include <dlfcn.h>
 
 #include <stdexcept>
+#include <algorithm>
 
 using namespace ml;
 
@@ -63,13 +65,20 @@ const std::vector<AlgorithmResult*>& CompositeAlgorithm::analyze(const cv::Mat&
     return m_results;
 }
 
+bool CompositeAlgorithm::setParam(const std::string& name,
+        const std::string& value) {
+    bool accepted = false;
+    for(auto a : m_contents) accepted |= a->setParam(name, value);
+    return accepted;
+}
+
 const char* algorithm_init_error::what() const noexcept {
     return m_reason.c_str();
 }
 
 static AlgorithmRegistry* registryInstance = NULL;
 
-AlgorithmRegistry::AlgorithmRegistry() {
+AlgorithmRegistry::AlgorithmRegistry() : m_seed(1), m_nloaded(0) {
     Algorithm::Info *ocvInfo = ml::ocv::describe(0);
     ocvInfo->file = "<built in>";
     m_compiled.push_back(std::make_pair(ocvInfo, (void*)&ml::ocv::build));
@@ -100,6 +109,11 @@ void AlgorithmRegistry::setSize(const cv::Size& sz) {
     m_imsize = sz;
 }
 
+void AlgorithmRegistry::setSeed(unsigned int seed) {
+    m_seed = seed;
+    m_nloaded = 0;
+}
+
 Algorithm* AlgorithmRegistry::load(const std::string& name) {
     Algorithm::Info* info = NULL;
     for(auto e : m_known) {
@@ -140,8 +154,9 @@ Algorithm* AlgorithmRegistry::load(const Algorithm::Info& info) {
         build_ptr = dlsym(lib, "build");
     }
     if(build_ptr == NULL) {
-        fprintf(stderr, "FATAL: Algorithm entry point is NULL.\n"
-                "       This should be impossible.\n");
+        LOG_ERROR("algorithm", "FATAL: Algorithm entry point is NULL. "
+                "This should be impossible.");
+        logging::stop();
         abort();
     }
 
@@ -150,11 +165,20 @@ Algorithm* AlgorithmRegistry::load(const Algorithm::Info& info) {
 
     // instantiate the object
     Algorithm* algo = build(info.index, m_imsize);
+    algo->seed(m_seed + m_nloaded++);
     m_algos[lib].push_back(algo);
     return algo;
 }
 
 void AlgorithmRegistry::unload(Algorithm* algo) {
+    for(auto& e : m_algos) {
+        auto itr = std::find(e.second.begin(), e.second.end(), algo);
+        if(itr != e.second.end()) {
+            e.second.erase(itr);
+            delete algo;
+            return;
+        }
+    }
 }
 
 void AlgorithmRegistry::search(fs::path dir) {
@@ -176,7 +200,7 @@ void AlgorithmRegistry::rebuildDatabase() {
             for(auto e : fs::directory_iterator(p))
                 indexDirectory(e.path());
         } catch(fs::filesystem_error& e) {
-            fprintf(stderr, "Failed to read %s: %s. Skipping",
+            LOG_WARN("algorithm", "Failed to read %s: %s. Skipping",
                     p.c_str(), e.what());
             continue;
         }
@@ -190,7 +214,7 @@ void AlgorithmRegistry::indexDirectory(fs::path pth) {
     // try opening it
     void* lib = dlopen(pth.c_str(), RTLD_NOW | RTLD_LOCAL);
     if(lib == NULL) {
-        fprintf(stderr, "%s\n", dlerror());
+        LOG_WARN("algorithm", "%s", dlerror());
         return;
     }
 
@@ -209,10 +233,9 @@ void AlgorithmRegistry::indexDirectory(fs::path pth) {
     void (*f_iface_vsn)(int*,int*) = (void (*)(int*,int*))iface_vsn;
     f_iface_vsn(&major, &minor);
     if(major != IFACE_VERSION_MAJOR || minor != IFACE_VERSION_MINOR) {
-        fprintf(stderr, "Warning: Library '%s' is using incompatible interface"
-                        " version.\n         Are both the library and demo "
-                        "application up-to-date?\n",
-                        pth.c_str());
+        LOG_WARN("algorithm", "Library '%s' is using incompatible interface "
+                "version. Are both the library and demo application "
+                "up-to-date?", pth.c_str());
         dlclose(lib);
         return;
     }
@@ -6,13 +6,14 @@
 #include <string>
 #include <map>
 #include <stdexcept>
+#include <random>
 
 #include <boost/filesystem.hpp>
 
 #include "opencv2/core/core.hpp"
 
 #define IFACE_VERSION_MAJOR 0
-#define IFACE_VERSION_MINOR 4
+#define IFACE_VERSION_MINOR 6
 
 namespace ml {
 
@@ -100,14 +101,42 @@ public:
         bool fpga; //!< Whether this algorithm runs on an FPGA
     };
 
+    virtual ~Algorithm() {}
+
     //! Query the algorithm for its properties
     virtual Info getInfo()=0;
 
     //! Nondestructively process a frame
     virtual const std::vector<AlgorithmResult*>& analyze(const cv::Mat& mat)=0;
 
+    /** \brief Seed the algorithm's object ID generator
+     *
+     * Two instances given the same seed and the same input frames hand out
+     * the same IDs, which makes runs reproducible.
+     */
+    void seed(unsigned int s) { m_rng.seed(s); }
+
+    /** \brief Set a named parameter
+     *
+     * Parameters are passed as strings and parsed by the algorithm. Unknown
+     * names and unparseable values are rejected.
+     *
+     * \return Whether the parameter was accepted
+     */
+    virtual bool setParam(const std::string& name, const std::string& value) {
+        return false;
+    }
+
 protected:
+    //! Get a new object ID. Never returns zero.
+    unsigned int nextId() {
+        unsigned int id;
+        do { id = m_rng(); } while(id == 0);
+        return id;
+    }
+
     std::vector<AlgorithmResult*> m_results;
+    std::mt19937 m_rng;
 };
 
 //! Composite algorithm for executing one or more child algorithms
@@ -129,6 +158,9 @@ public:
     Algorithm::Info getInfo();
     const std::vector<AlgorithmResult*>& analyze(const cv::Mat& mat);
 
+    //! Pass a parameter to every child. Accepted if any child accepts it.
+    bool setParam(const std::string& name, const std::string& value);
+
 private:
     Algorithm::Info *m_info;
     std::vector<Algorithm*> m_contents;
@@ -142,6 +174,13 @@ public:
     //! Set the default image siz
     void setSize(const cv::Size& size);
 
+    /** \brief Set the seed for algorithms loaded from now on
+     *
+     * Each loaded algorithm gets the seed plus the number of algorithms loaded
+     * before it, so composites don't share ID sequences.
+     */
+    void setSeed(unsigned int seed);
+
     //! Get a list of all known algorithms
     const std::vector<Algorithm::Info*> getList() const;
 
@@ -168,8 +207,8 @@ public:
 
     /**\brief Unload the given algorithm
      *
-     * This will unload the given algorithm, potentially closing its library if
-     * it was loaded from a file.
+     * This will delete the given algorithm. Its library stays open, since
+     * other instances may still be using it.
      */
     void unload(Algorithm* algo);
 
@@ -185,6 +224,8 @@ private:
     ~AlgorithmRegistry();
 
     cv::Size m_imsize;
+    unsigned int m_seed;
+    unsigned int m_nloaded;
 
     //! Rebuild database by searching known paths
     void rebuildDatabase();
@@ -0,0 +1,448 @@
+#include "acf.hpp"
+#include "levels.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
+
+#define DEFAULT_MODEL "acf_model.yml"
+#define NORM_RADIUS 5
+#define NORM_CONST 0.005f
+
+// Power-law exponents for approximating channels across scales, from
+// Dollar et al., "Fast Feature Pyramids for Object Detection" (2014)
+#define LAMBDA_COLOR 0.0
+#define LAMBDA_GRADIENT 0.1105
+
+#define CONF_LIMIT 20
+#define INTERSECT_THRESHOLD 0.5
+
+using namespace ml;
+using namespace ml::acf;
+
+void Model::load(const std::string& fname) {
+    cv::FileStorage fs(fname, cv::FileStorage::READ);
+    if(!fs.isOpened())
+        throw algorithm_init_error("Cannot load ACF model",
+                "No such file or directory");
+
+    cv::Mat fidMat, thrMat, hsMat;
+    fs["window_width"] >> window.width;
+    fs["window_height"] >> window.height;
+    fs["shrink"] >> shrink;
+    fs["orients"] >> orients;
+    fs["depth"] >> depth;
+    fs["cascade_threshold"] >> cascade;
+    fs["fids"] >> fidMat;
+    fs["thresholds"] >> thrMat;
+    fs["leaves"] >> hsMat;
+
+    nodes = (1 << (depth + 1)) - 1;
+    trees = fidMat.rows;
+    if(shrink <= 0 || orients <= 0 || depth <= 0 ||
+            window.width % shrink != 0 || window.height % shrink != 0)
+        throw algorithm_init_error("Cannot load ACF model",
+                "Invalid model geometry");
+    if(fidMat.type() != CV_32S || thrMat.type() != CV_32F ||
+            hsMat.type() != CV_32F || fidMat.cols != nodes ||
+            thrMat.cols != nodes || hsMat.cols != nodes ||
+            thrMat.rows != trees || hsMat.rows != trees)
+        throw algorithm_init_error("Cannot load ACF model",
+                "Tree arrays have the wrong shape");
+
+    fids.resize(trees * nodes);
+    thrs.resize(trees * nodes);
+    hs.resize(trees * nodes);
+    uint32_t nfeatures = channels() * (window.width / shrink) *
+        (window.height / shrink);
+    for(int t = 0;t < trees;t++) {
+        for(int n = 0;n < nodes;n++) {
+            int32_t f = fidMat.at<int32_t>(t, n);
+            if(f < 0 || (uint32_t)f >= nfeatures)
+                throw algorithm_init_error("Cannot load ACF model",
+                        "Feature index out of range");
+            fids[t*nodes + n] = f;
+            thrs[t*nodes + n] = thrMat.at<float>(t, n);
+            hs[t*nodes + n] = hsMat.at<float>(t, n);
+        }
+    }
+}
+
+// Pick the orientation bin for one gradient: the bin whose centre direction
+// has the largest absolute projection, i.e. the nearest one modulo pi.
+static inline int orientBin(float gx, float gy, int orients,
+        const float* cosv, const float* sinv) {
+    float best = -1.0f;
+    int bin = 0;
+    for(int k = 0;k < orients;k++) {
+        float p = fabsf(gx * cosv[k] + gy * sinv[k]);
+        if(p > best) {
+            best = p;
+            bin = k;
+        }
+    }
+    return bin;
+}
+
+/* Gradient magnitude and orientation bin for one row, using central
+ * differences. The orientation search is done as projections rather than
+ * atan2 so that it vectorizes. */
+static void gradientRow(const float* prev, const float* cur, const float* next,
+        int w, int orients, const float* cosv, const float* sinv,
+        float* mag, int* bin) {
+    // left edge uses a one-sided difference
+    {
+        float gx = cur[1] - cur[0], gy = next[0] - prev[0];
+        mag[0] = sqrtf(gx*gx + gy*gy);
+        bin[0] = orientBin(gx, gy, orients, cosv, sinv);
+    }
+
+    int x = 1;
+#if CV_SIMD128
+    cv::v_float32x4 zero = cv::v_setzero_f32();
+    for(;x <= w - 5;x += 4) {
+        cv::v_float32x4 gx = cv::v_load(cur + x + 1) - cv::v_load(cur + x - 1);
+        cv::v_float32x4 gy = cv::v_load(next + x) - cv::v_load(prev + x);
+        cv::v_store(mag + x, cv::v_sqrt(gx*gx + gy*gy));
+
+        cv::v_float32x4 best = cv::v_setall_f32(-1.0f), idx = zero;
+        for(int k = 0;k < orients;k++) {
+            cv::v_float32x4 p = gx * cv::v_setall_f32(cosv[k]) +
+                gy * cv::v_setall_f32(sinv[k]);
+            p = cv::v_max(p, zero - p);
+            cv::v_float32x4 better = p > best;
+            best = cv::v_select(better, p, best);
+            idx = cv::v_select(better, cv::v_setall_f32((float)k), idx);
+        }
+        cv::v_store(bin + x, cv::v_round(idx));
+    }
+#endif
+    for(;x < w - 1;x++) {
+        float gx = cur[x+1] - cur[x-1], gy = next[x] - prev[x];
+        mag[x] = sqrtf(gx*gx + gy*gy);
+        bin[x] = orientBin(gx, gy, orients, cosv, sinv);
+    }
+
+    // right edge
+    {
+        float gx = cur[w-1] - cur[w-2], gy = next[w-1] - prev[w-1];
+        mag[w-1] = sqrtf(gx*gx + gy*gy);
+        bin[w-1] = orientBin(gx, gy, orients, cosv, sinv);
+    }
+}
+
+void ml::acf::computeChannels(const cv::Mat& img, int shrink, int orients,
+        Channels& out) {
+    // crop to a multiple of the aggregation factor
+    int w = img.cols / shrink * shrink, h = img.rows / shrink * shrink;
+    cv::Mat src = img(cv::Rect(0, 0, w, h)), bgr;
+    if(src.channels() == 4) cv::cvtColor(src, bgr, cv::COLOR_BGRA2BGR);
+    else if(src.channels() == 1) cv::cvtColor(src, bgr, cv::COLOR_GRAY2BGR);
+    else bgr = src;
+
+    out.width = w / shrink;
+    out.height = h / shrink;
+    out.count = 4 + orients;
+    out.data.assign(out.count * out.width * out.height, 0.0f);
+    cv::Size osz(out.width, out.height);
+
+    // LUV, rescaled to about [0, 1]
+    cv::Mat f, luv;
+    std::vector<cv::Mat> planes;
+    bgr.convertTo(f, CV_32F, 1.0/255);
+    cv::cvtColor(f, luv, cv::COLOR_BGR2Luv);
+    cv::split(luv, planes);
+    planes[0].convertTo(planes[0], CV_32F, 1.0/100);
+    planes[1].convertTo(planes[1], CV_32F, 1.0/354, 134.0/354);
+    planes[2].convertTo(planes[2], CV_32F, 1.0/262, 140.0/262);
+
+    // gradients of the lightness channel
+    std::vector<float> cosv(orients), sinv(orients);
+    for(int k = 0;k < orients;k++) {
+        cosv[k] = cos(M_PI * k / orients);
+        sinv[k] = sin(M_PI * k / orients);
+    }
+    const cv::Mat& L = planes[0];
+    cv::Mat mag(h, w, CV_32F), bins(h, w, CV_32S);
+    for(int y = 0;y < h;y++) {
+        gradientRow(L.ptr<float>(y > 0 ? y - 1 : y), L.ptr<float>(y),
+                L.ptr<float>(y < h - 1 ? y + 1 : y), w, orients,
+                &cosv[0], &sinv[0], mag.ptr<float>(y), bins.ptr<int>(y));
+    }
+
+    // normalize magnitude by its local average
+    cv::Mat avg;
+    cv::boxFilter(mag, avg, CV_32F,
+            cv::Size(2*NORM_RADIUS + 1, 2*NORM_RADIUS + 1));
+    avg += cv::Scalar::all(NORM_CONST);
+    cv::divide(mag, avg, mag);
+
+    // aggregate colour and magnitude by area averaging, straight into place
+    for(int c = 0;c < 3;c++) {
+        cv::Mat dst(osz, CV_32F, out.plane(c));
+        cv::resize(planes[c], dst, osz, 0, 0, cv::INTER_AREA);
+    }
+    cv::Mat mdst(osz, CV_32F, out.plane(3));
+    cv::resize(mag, mdst, osz, 0, 0, cv::INTER_AREA);
+
+    // orientation histograms, scaled to match the area averages
+    float norm = 1.0f / (shrink * shrink);
+    for(int y = 0;y < h;y++) {
+        const float* m = mag.ptr<float>(y);
+        const int* b = bins.ptr<int>(y);
+        int row = (y / shrink) * out.width;
+        for(int x = 0;x < w;x++)
+            out.plane(4 + b[x])[row + x / shrink] += m[x] * norm;
+    }
+}
+
+void ml::acf::approximateChannels(const Channels& src, double scale,
+        int width, int height, Channels& out) {
+    double ratio = scale / src.scale;
+    out.width = width;
+    out.height = height;
+    out.count = src.count;
+    out.scale = scale;
+    out.data.resize(out.count * width * height);
+
+    for(int c = 0;c < src.count;c++) {
+        cv::Mat in(src.height, src.width, CV_32F,
+                const_cast<float*>(src.plane(c)));
+        cv::Mat dst(height, width, CV_32F, out.plane(c));
+        cv::resize(in, dst, dst.size(), 0, 0, cv::INTER_LINEAR);
+
+        // colour is scale-invariant; gradient energy follows a power law
+        double lambda = c < 3 ? LAMBDA_COLOR : LAMBDA_GRADIENT;
+        if(lambda != 0.0) dst.convertTo(dst, CV_32F, pow(ratio, -lambda));
+    }
+}
+
+ACFAlgorithm::ACFAlgorithm(const cv::Size& size) : m_perOctave(8),
+        m_stride(1), m_hitThreshold(0.0f), m_nmsOverlap(0.65f),
+        m_approximate(true) {
+    // a missing default is fine if another model is set before first use
+    m_model.trees = 0;
+    if(fs::exists(DEFAULT_MODEL)) m_model.load(DEFAULT_MODEL);
+
+    m_res = new BoundingBoxesResult();
+    m_res->type = RT_BOUNDING_BOXES;
+    m_results.push_back(m_res);
+}
+
+ACFAlgorithm::~ACFAlgorithm() {
+    delete m_res;
+}
+
+Algorithm::Info ACFAlgorithm::getInfo() {
+    return m_info;
+}
+
+void ACFAlgorithm::detectLevel(const Channels& ch,
+        std::vector<cv::Rect>& boxes, std::vector<float>& scores) const {
+    const Model& m = m_model;
+    int ww = m.window.width / m.shrink, wh = m.window.height / m.shrink;
+    if(ch.width < ww || ch.height < wh) return;
+
+    // translate feature IDs to offsets within this level's planes
+    std::vector<int> cids(m.fids.size());
+    for(size_t i = 0;i < m.fids.size();i++) {
+        int c = m.fids[i] / (ww * wh), r = m.fids[i] % (ww * wh);
+        cids[i] = c * ch.width * ch.height + (r / ww) * ch.width + r % ww;
+    }
+
+    for(int y = 0;y <= ch.height - wh;y += m_stride) {
+        for(int x = 0;x <= ch.width - ww;x += m_stride) {
+            const float* base = &ch.data[y * ch.width + x];
+            float h = 0.0f;
+            int t;
+            for(t = 0;t < m.trees;t++) {
+                int off = t * m.nodes, k = 0;
+                for(int d = 0;d < m.depth;d++)
+                    k = 2*k + (base[cids[off + k]] < m.thrs[off + k] ? 1 : 2);
+                h += m.hs[off + k];
+                if(h <= m.cascade) break; // soft cascade rejection
+            }
+            if(t < m.trees || h <= m_hitThreshold) continue;
+
+            boxes.push_back(cv::Rect(
+                        cvRound(x * m.shrink / ch.scale),
+                        cvRound(y * m.shrink / ch.scale),
+                        cvRound(m.window.width / ch.scale),
+                        cvRound(m.window.height / ch.scale)));
+            scores.push_back(h);
+        }
+    }
+}
+
+/* Greedy non-maximum suppression: keep the best-scoring box, drop anything
+ * covering more than `overlap` of the smaller of the two, and repeat. */
+static void suppress(std::vector<cv::Rect>& boxes, std::vector<float>& scores,
+        float overlap) {
+    std::vector<size_t> order(boxes.size());
+    for(size_t i = 0;i < order.size();i++) order[i] = i;
+    std::sort(order.begin(), order.end(),
+            [&scores](size_t a, size_t b) { return scores[a] > scores[b]; });
+
+    std::vector<bool> dead(boxes.size(), false);
+    std::vector<cv::Rect> keptBoxes;
+    std::vector<float> keptScores;
+    for(size_t i = 0;i < order.size();i++) {
+        size_t a = order[i];
+        if(dead[a]) continue;
+        keptBoxes.push_back(boxes[a]);
+        keptScores.push_back(scores[a]);
+        for(size_t j = i + 1;j < order.size();j++) {
+            size_t b = order[j];
+            if(dead[b]) continue;
+            double isect = (boxes[a] & boxes[b]).area();
+            if(isect > overlap * std::min(boxes[a].area(), boxes[b].area()))
+                dead[b] = true;
+        }
+    }
+    boxes.swap(keptBoxes);
+    scores.swap(keptScores);
+}
+
+const std::vector<AlgorithmResult*>& ACFAlgorithm::analyze(const cv::Mat& mat) {
+    if(m_model.trees == 0)
+        throw algorithm_init_error("Cannot load ACF model",
+                "No model loaded; set one with the model parameter");
+    m_res->boxes.clear();
+    m_locs.clear();
+
+    updateTracks(m_track, mat);
+    dedupTracks(m_track, INTERSECT_THRESHOLD);
+
+    // pyramid scales, from full size down to the detection window
+    std::vector<double> scales;
+    for(int i = 0;;i++) {
+        double s = pow(2.0, -(double)i / m_perOctave);
+        if(mat.cols * s < m_model.window.width ||
+                mat.rows * s < m_model.window.height)
+            break;
+        scales.push_back(s);
+    }
+
+    int n = scales.size();
+    m_levels.resize(n);
+    auto exact = [&](int i) { return !m_approximate || i % m_perOctave == 0; };
+
+    // compute channels from the image at every level, or only at octaves
+    cv::parallel_for_(cv::Range(0, n), LevelBody([&](int i) {
+        if(!exact(i)) return;
+        cv::Mat img;
+        if(scales[i] == 1.0) img = mat;
+        else cv::resize(mat, img, cv::Size(), scales[i], scales[i],
+                cv::INTER_AREA);
+
+        computeChannels(img, m_model.shrink, m_model.orients, m_levels[i]);
+        m_levels[i].scale = scales[i];
+    }));
+
+    // resample the nearest octave for everything in between
+    if(m_approximate) {
+        cv::parallel_for_(cv::Range(0, n), LevelBody([&](int i) {
+            if(exact(i)) return;
+            int ref = i / m_perOctave * m_perOctave;
+            if(i - ref > m_perOctave / 2 && ref + m_perOctave < n)
+                ref += m_perOctave;
+            approximateChannels(m_levels[ref], scales[i],
+                    cvRound(mat.cols * scales[i]) / m_model.shrink,
+                    cvRound(mat.rows * scales[i]) / m_model.shrink,
+                    m_levels[i]);
+        }));
+    }
+
+    std::vector<std::vector<cv::Rect> > levelBoxes(n);
+    std::vector<std::vector<float> > levelScores(n);
+    cv::parallel_for_(cv::Range(0, n), LevelBody([&](int i) {
+        detectLevel(m_levels[i], levelBoxes[i], levelScores[i]);
+    }));
+
+    std::vector<float> scores;
+    for(size_t i = 0;i < scales.size();i++) {
+        m_locs.insert(m_locs.end(), levelBoxes[i].begin(), levelBoxes[i].end());
+        scores.insert(scores.end(), levelScores[i].begin(),
+                levelScores[i].end());
+    }
+    suppress(m_locs, scores, m_nmsOverlap);
+
+    associateDetections(m_track, m_locs, mat, INTERSECT_THRESHOLD, false);
+    retireTracks(m_track, CONF_LIMIT);
+
+    // create new tracking bounds for others
+    for(auto r : m_locs) {
+        TrackingInfo inf;
+        inf.tracker = createTracker("TLD");
+        inf.last_pos = r;
+        inf.id = nextId();
+        inf.confirm_frames = 0;
+        inf.tracker->init(mat, r);
+        m_track.push_back(inf);
+    }
+
+    for(auto t : m_track) {
+        BoundingBox b;
+        b.id = t.id;
+        b.tag = 0;
+        b.bounds = t.last_pos;
+        m_res->boxes.push_back(b);
+    }
+    return m_results;
+}
+
+bool ACFAlgorithm::setParam(const std::string& name, const std::string& value) {
+    try {
+        if(name == "model") {
+            Model m;
+            m.load(value);
+            m_model = m;
+        } else if(name == "scales_per_octave") {
+            int v = std::stoi(value);
+            if(v <= 0) return false;
+            m_perOctave = v;
+        } else if(name == "stride") {
+            int v = std::stoi(value);
+            if(v <= 0) return false;
+            m_stride = v;
+        } else if(name == "hit_threshold") {
+            m_hitThreshold = std::stof(value);
+        } else if(name == "cascade_threshold") {
+            m_model.cascade = std::stof(value);
+        } else if(name == "approximate") {
+            m_approximate = std::stoi(value) != 0;
+        } else if(name == "nms_overlap") {
+            m_nmsOverlap = std::stof(value);
+        } else {
+            return false;
+        }
+    } catch(const std::logic_error& e) { // includes algorithm_init_error
+        return false;
+    }
+    return true;
+}
+
+int ml::acf::count(void) {
+    return 1;
+}
+
+ml::Algorithm* ml::acf::build(int idx, const cv::Size& sz) {
+    return new ACFAlgorithm(sz);
+}
+
+ml::Algorithm::Info* ml::acf::describe(int idx) {
+    return new ml::Algorithm::Info(
+        "Aggregated Channel Features", "acf-detector",
+        "Boosted-tree pedestrian detector over LUV and gradient channels",
+        0,     // index
+        true,  // tracks
+        false  // fpga
+    );
+}
+
+void ml::acf::interface_version(int* major, int* minor) {
+    *major = IFACE_VERSION_MAJOR;
+    *minor = IFACE_VERSION_MINOR;
+}
@@ -0,0 +1,128 @@
+#ifndef ALGORITHM_ACF_HPP
+#define ALGORITHM_ACF_HPP
+
+#include "opencv2/core/core.hpp"
+#include "../algorithm.hpp"
+#include "tracking.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ml {
+namespace acf {
+
+/** \brief A boosted decision tree ensemble over aggregated channels
+ *
+ * Trees are complete binary trees of a fixed depth, stored breadth-first:
+ * node k has children 2k+1 (feature below threshold) and 2k+2. Internal nodes
+ * use fids and thrs, leaves use hs.
+ *
+ * A feature ID indexes the aggregated channels of one detection window,
+ * row-major within each channel: ((channel * height) + y) * width + x, where
+ * width and height are the window size divided by the shrink factor.
+ */
+struct Model {
+    cv::Size window;  //!< Detection window, in pixels
+    int shrink;       //!< Channel aggregation factor
+    int orients;      //!< Number of gradient orientation channels
+    int depth;        //!< Tree depth
+    int nodes;        //!< Nodes per tree
+    int trees;        //!< Number of trees
+    float cascade;    //!< Soft cascade rejection threshold
+
+    std::vector<uint32_t> fids;
+    std::vector<float> thrs;
+    std::vector<float> hs;
+
+    //! Number of channels a window holds
+    int channels() const { return 4 + orients; }
+
+    //! Load a model written by tools/convert_acf_model.py
+    void load(const std::string& fname);
+};
+
+/** \brief Aggregated channels for one pyramid level
+ *
+ * Planes are stored one after another: L, U, V, normalized gradient
+ * magnitude, then one plane per gradient orientation.
+ */
+struct Channels {
+    int width, height, count;
+    double scale; //!< Level size relative to the input frame
+    std::vector<float> data;
+
+    const float* plane(int c) const { return &data[c * width * height]; }
+    float* plane(int c) { return &data[c * width * height]; }
+};
+
+/** \brief Compute aggregated channels for an image
+ *
+ * \param img The input image, 8-bit BGR
+ * \param shrink Aggregation factor; each output cell covers shrink*shrink px
+ * \param orients Number of orientation bins over [0, pi)
+ */
+void computeChannels(const cv::Mat& img, int shrink, int orients,
+        Channels& out);
+
+/** \brief Approximate channels at another scale from an existing level
+ *
+ * Resamples each plane of src to width x height, then corrects for the
+ * change in scale with a per-channel power law, which is much cheaper than
+ * recomputing channels from a resized image. Accuracy falls off with the
+ * scale ratio, so src should be within an octave of scale.
+ */
+void approximateChannels(const Channels& src, double scale, int width,
+        int height, Channels& out);
+
+/** \brief Pedestrian detector using Aggregated Channel Features
+ *
+ * Scores every window position of a multi-scale channel pyramid with a
+ * soft-cascade of boosted trees, suppresses overlapping hits, and tracks the
+ * surviving detections between frames. By default only one pyramid level per
+ * octave is computed from the image; the rest are approximated from it.
+ */
+class ACFAlgorithm : public Algorithm {
+public:
+    ACFAlgorithm(const cv::Size& size);
+    ~ACFAlgorithm();
+
+    Info getInfo();
+    const std::vector<AlgorithmResult*>& analyze(const cv::Mat& mat);
+    bool setParam(const std::string& name, const std::string& value);
+
+private:
+    //! Score every window of one level, appending hits above threshold
+    void detectLevel(const Channels& ch, std::vector<cv::Rect>& boxes,
+            std::vector<float>& scores) const;
+
+    Model m_model;
+    int m_perOctave;   // pyramid levels per octave
+    int m_stride;      // window stride, in aggregated cells
+    float m_hitThreshold;
+    float m_nmsOverlap;
+    bool m_approximate; // only compute octave levels exactly
+
+    std::vector<Channels> m_levels;
+
+    BoundingBoxesResult* m_res;
+    TrackList m_track;
+    std::vector<cv::Rect> m_locs;
+
+    Algorithm::Info m_info = Algorithm::Info(
+            "Aggregated Channel Features", "acf-detector",
+            "Boosted-tree pedestrian detector over LUV and gradient channels",
+            0, true, false);
+};
+
+extern "C" int count();
+
+extern "C" Algorithm* build(int idx, const cv::Size& sz);
+
+extern "C" Algorithm::Info* describe(int idx);
+
+extern "C" void interface_version(int* major, int* minor);
+};
+};
+
+#endif
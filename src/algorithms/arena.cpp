@@ -0,0 +1,68 @@
+#include "arena.hpp"
+#include "../log/log.hpp"
+
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+
+using namespace ml;
+
+FrameArena::FrameArena(size_t blockSize) : m_blockSize(blockSize),
+        m_current(0), m_offset(0), m_used(0) {
+}
+
+FrameArena::~FrameArena() {
+    for(auto& b : m_blocks) free(b.data);
+}
+
+void* FrameArena::allocate(size_t bytes, size_t align) {
+    // blocks come from malloc, so their start is suitably aligned already
+    for(;m_current < m_blocks.size();m_current++, m_offset = 0) {
+        Block& b = m_blocks[m_current];
+        size_t start = (m_offset + align - 1) & ~(align - 1);
+        if(start + bytes <= b.size) {
+            m_offset = start + bytes;
+            m_used += bytes;
+            return b.data + start;
+        }
+    }
+
+    Block b;
+    b.size = std::max(m_blockSize, bytes);
+    b.data = static_cast<char*>(malloc(b.size));
+    if(!b.data) throw std::bad_alloc();
+    m_blocks.push_back(b);
+    m_current = m_blocks.size() - 1;
+    m_offset = bytes;
+    m_used += bytes;
+    return b.data;
+}
+
+void FrameArena::reset() {
+    if(m_current > 0) {
+        // the frame overflowed its first block; make one that holds it all
+        size_t total = 0;
+        for(auto& b : m_blocks) {
+            total += b.size;
+            free(b.data);
+        }
+        m_blocks.clear();
+
+        Block b;
+        b.size = total;
+        b.data = static_cast<char*>(malloc(total));
+        if(b.data) m_blocks.push_back(b);
+    }
+    m_current = 0;
+    m_offset = 0;
+    m_used = 0;
+}
+
+void ml::checkSteadyState(const char* who, long frame,
+        AllocationCounter& counter) {
+    if(counter.count() > 0 && frame >= ARENA_WARMUP_FRAMES) {
+        LOG_WARN(who, "%ld allocations outside the arena in frame %ld",
+                counter.count(), frame);
+    }
+    counter.reset();
+}
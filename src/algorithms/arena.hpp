@@ -0,0 +1,141 @@
+#ifndef ALGORITHM_ARENA_HPP
+#define ALGORITHM_ARENA_HPP
+
+#include <stddef.h>
+#include <vector>
+
+// Frames a detector gets to settle its arena before allocations are reported
+#define ARENA_WARMUP_FRAMES 10
+
+namespace ml {
+
+/** \brief Bump allocator for memory that only lives for one frame
+ *
+ * Allocation moves a pointer along a block; nothing is freed individually,
+ * and reset() makes the whole arena available again. If a frame needed more
+ * than one block, reset() replaces them with a single block of the combined
+ * size, so once frames stop growing the arena stops calling malloc.
+ *
+ * An arena isn't thread-safe; give each thread that needs one its own.
+ */
+class FrameArena {
+public:
+    explicit FrameArena(size_t blockSize=64 * 1024);
+    ~FrameArena();
+
+    //! Get \p bytes of memory aligned to \p align, which must be a power of 2
+    void* allocate(size_t bytes, size_t align);
+
+    //! Release everything allocated since the last reset
+    void reset();
+
+    //! Bytes handed out since the last reset
+    size_t used() const { return m_used; }
+
+    //! Resets an arena when it goes out of scope
+    class Scope {
+    public:
+        Scope(FrameArena& arena) : m_arena(arena) { }
+        ~Scope() { m_arena.reset(); }
+    private:
+        FrameArena& m_arena;
+    };
+
+private:
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> m_blocks;
+    size_t m_blockSize;
+    size_t m_current;   // block being allocated from
+    size_t m_offset;    // next free byte in that block
+    size_t m_used;
+};
+
+//! Standard library allocator which takes its memory from a FrameArena
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    ArenaAllocator(FrameArena& arena) : m_arena(&arena) { }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.arena()) { }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) { }
+
+    FrameArena* arena() const { return m_arena; }
+
+private:
+    FrameArena* m_arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() != b.arena();
+}
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+#ifdef PDDEMO_COUNT_ALLOCS
+/** \brief Number of global operator new calls made by the calling thread
+ *
+ * Defined by the executable, which replaces operator new to count calls.
+ */
+long threadAllocations();
+#endif
+
+/** \brief Counts global allocations over a set of code sections
+ *
+ * Sections are bracketed with start() and stop(). Without PDDEMO_COUNT_ALLOCS
+ * this compiles to nothing and always counts zero.
+ */
+class AllocationCounter {
+public:
+#ifdef PDDEMO_COUNT_ALLOCS
+    AllocationCounter() : m_count(0), m_start(0) { }
+    void start() { m_start = threadAllocations(); }
+    void stop() { m_count += threadAllocations() - m_start; }
+    long count() const { return m_count; }
+    void reset() { m_count = 0; }
+private:
+    long m_count, m_start;
+#else
+    void start() { }
+    void stop() { }
+    long count() const { return 0; }
+    void reset() { }
+#endif
+};
+
+/** \brief Report allocations in a frame that should have run out of arenas
+ *
+ * Prints to stderr if \p counter saw any allocations and \p frame is past
+ * the warm-up, then resets the counter.
+ */
+void checkSteadyState(const char* who, long frame, AllocationCounter& counter);
+
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "brisk_area_match.hpp"
+#include "../log/log.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/calib3d/calib3d.hpp"
@@ -130,7 +131,7 @@ void BRISKRegionMatchAlgorithm::read_database(fs::path loc) {
 
         // store the entry
         m_database.push_back(ObjectData(title, points, descriptors));
-        printf("Read '%s'\n", title);
+        LOG_INFO("brisk", "Read '%s'", title);
     }
 }
 
@@ -157,7 +158,7 @@ const std::vector<AlgorithmResult*>& BRISKRegionMatchAlgorithm::analyze(const cv
 
     for(auto obj : m_database) {
         float score = obj.match(keypts, descriptors);
-        printf("%s -> %.5f\n", obj.name.c_str(), score);
+        LOG_DEBUG("brisk", "%s -> %.5f", obj.name.c_str(), score);
     }
 
     return m_results;
@@ -0,0 +1,404 @@
+#include "dnn.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+
+#define DEFAULT_MODEL "person_detector.caffemodel"
+#define DEFAULT_CONFIG "person_detector.prototxt"
+
+#define CONF_LIMIT 20
+#define INTERSECT_THRESHOLD 0.5
+
+// how long the number of concurrent callers is remembered for, in ms
+#define CALLER_WINDOW 1000
+
+using namespace ml;
+using namespace ml::dnn;
+
+std::string NetConfig::key() const {
+    std::ostringstream s;
+    s << model << '|' << config << '|' << input.width << 'x' << input.height
+        << '|' << scale << '|' << mean << '|' << swapRB << '|' << format
+        << '|' << backend << '|' << target << '|' << maxBatch << '|' << waitMs;
+    return s.str();
+}
+
+std::mutex Batcher::s_lock;
+std::map<std::string, std::weak_ptr<Batcher> > Batcher::s_batchers;
+
+std::shared_ptr<Batcher> Batcher::acquire(const NetConfig& cfg) {
+    std::lock_guard<std::mutex> lk(s_lock);
+    std::weak_ptr<Batcher>& slot = s_batchers[cfg.key()];
+    std::shared_ptr<Batcher> b = slot.lock();
+    if(!b) {
+        b.reset(new Batcher(cfg));
+        slot = b;
+    }
+
+    std::lock_guard<std::mutex> blk(b->m_lock);
+    b->m_users++;
+    return b;
+}
+
+Batcher::Batcher(const NetConfig& cfg) : m_cfg(cfg), m_busy(false),
+        m_users(0), m_inside(0), m_window(std::chrono::steady_clock::now()) {
+    m_peak[0] = m_peak[1] = 0;
+    try {
+        m_net = cv::dnn::readNet(cfg.model, cfg.config);
+    } catch(const cv::Exception& e) {
+        throw algorithm_init_error("Cannot load network", e.msg);
+    }
+    if(m_net.empty())
+        throw algorithm_init_error("Cannot load network",
+                "Unrecognized model format");
+
+    m_net.setPreferableBackend(cfg.backend);
+    m_net.setPreferableTarget(cfg.target);
+    m_outputs = m_net.getUnconnectedOutLayersNames();
+
+    int dims[] = { cfg.maxBatch, 3, cfg.input.height, cfg.input.width };
+    m_blob.create(4, dims, CV_32F);
+}
+
+Batcher::~Batcher() {
+}
+
+void Batcher::detach() {
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_users--;
+    m_cond.notify_all(); // a waiting batch may now be complete
+}
+
+size_t Batcher::wanted() const {
+    // instances sharing a thread only ever count as one caller
+    size_t callers = std::max(std::max(m_peak[0], m_peak[1]), 1u);
+    return std::min<size_t>(m_cfg.maxBatch,
+            std::min<size_t>(callers, std::max(m_users, 1u)));
+}
+
+void Batcher::run(const cv::Mat& input, std::vector<Detection>& out) {
+    typedef std::chrono::steady_clock clock;
+    Slot slot = { &input, &out, false, std::exception_ptr() };
+    out.clear();
+
+    std::unique_lock<std::mutex> lk(m_lock);
+    clock::time_point now = clock::now();
+    if(now - m_window > std::chrono::milliseconds(CALLER_WINDOW)) {
+        m_peak[1] = m_peak[0];
+        m_peak[0] = 0;
+        m_window = now;
+    }
+    m_inside++;
+    m_peak[0] = std::max(m_peak[0], m_inside);
+
+    m_pending.push_back(&slot);
+    m_cond.notify_all();
+    clock::time_point deadline = now +
+        std::chrono::milliseconds(m_cfg.waitMs);
+
+    while(!slot.done) {
+        bool ready = m_pending.size() >= wanted() ||
+            clock::now() >= deadline;
+
+        if(!m_busy && ready) {
+            // take the oldest frames and run them ourselves
+            size_t n = std::min<size_t>(m_pending.size(), m_cfg.maxBatch);
+            std::vector<Slot*> batch(m_pending.begin(),
+                    m_pending.begin() + n);
+            m_pending.erase(m_pending.begin(), m_pending.begin() + n);
+            m_busy = true;
+            lk.unlock();
+
+            std::exception_ptr err;
+            try {
+                forward(batch);
+            } catch(...) {
+                err = std::current_exception();
+            }
+
+            lk.lock();
+            for(auto s : batch) {
+                // every frame in a failed pass fails, not just the runner's
+                if(err) s->out->clear();
+                s->error = err;
+                s->done = true;
+            }
+            m_busy = false;
+            m_cond.notify_all();
+        } else if(m_busy || ready) {
+            m_cond.wait(lk);
+        } else {
+            m_cond.wait_until(lk, deadline);
+        }
+    }
+    m_inside--;
+    if(slot.error) std::rethrow_exception(slot.error);
+}
+
+void Batcher::forward(const std::vector<Slot*>& batch) {
+    int n = batch.size();
+    size_t plane = 3 * m_cfg.input.width * m_cfg.input.height;
+    for(int i = 0;i < n;i++) {
+        memcpy(m_blob.ptr<float>() + i * plane, batch[i]->input->ptr<float>(),
+                plane * sizeof(float));
+    }
+
+    // view the first n images of the preallocated blob
+    int dims[] = { n, 3, m_cfg.input.height, m_cfg.input.width };
+    cv::Mat blob(4, dims, CV_32F, m_blob.data);
+    m_net.setInput(blob);
+    m_net.forward(m_outBlobs, m_outputs);
+
+    for(auto& out : m_outBlobs) {
+        if(m_cfg.format == OF_SSD) decodeSSD(out, batch);
+        else decodeYOLO(out, batch);
+    }
+}
+
+void Batcher::decodeSSD(const cv::Mat& out, const std::vector<Slot*>& batch) {
+    const float* r = out.ptr<float>();
+    size_t rows = out.total() / 7;
+    for(size_t i = 0;i < rows;i++, r += 7) {
+        int img = (int)r[0];
+        if(img < 0 || img >= (int)batch.size()) continue; // padding rows
+        Detection d = { (int)r[1], r[2], r[3], r[4], r[5], r[6] };
+        batch[img]->out->push_back(d);
+    }
+}
+
+void Batcher::decodeYOLO(const cv::Mat& out, const std::vector<Slot*>& batch) {
+    // region outputs stack each image's candidate rows
+    int per = out.rows / batch.size();
+    for(int i = 0;i < out.rows;i++) {
+        const float* r = out.ptr<float>(i);
+        int best = 5;
+        for(int c = 6;c < out.cols;c++)
+            if(r[c] > r[best]) best = c;
+        if(r[best] <= 0.0f) continue;
+
+        Detection d = { best - 5, r[best], r[0] - r[2]/2, r[1] - r[3]/2,
+            r[0] + r[2]/2, r[1] + r[3]/2 };
+        batch[std::min<int>(i / per, batch.size() - 1)]->out->push_back(d);
+    }
+}
+
+DNNAlgorithm::DNNAlgorithm() : m_personClass(15), m_confidence(0.5f),
+        m_nms(0.45f), m_trackerType("TLD") {
+    // MobileNet-SSD conventions
+    m_cfg.model = DEFAULT_MODEL;
+    m_cfg.config = DEFAULT_CONFIG;
+    m_cfg.input = cv::Size(300, 300);
+    m_cfg.scale = 1.0 / 127.5;
+    m_cfg.mean = 127.5;
+    m_cfg.swapRB = false;
+    m_cfg.format = OF_SSD;
+    m_cfg.backend = cv::dnn::DNN_BACKEND_OPENCV;
+    m_cfg.target = cv::dnn::DNN_TARGET_CPU;
+    m_cfg.maxBatch = 4;
+    m_cfg.waitMs = 5;
+
+    m_res = new BoundingBoxesResult();
+    m_res->type = RT_BOUNDING_BOXES;
+    m_results.push_back(m_res);
+}
+
+DNNAlgorithm::~DNNAlgorithm() {
+    releaseNet();
+    delete m_res;
+}
+
+Algorithm::Info DNNAlgorithm::getInfo() {
+    return Algorithm::Info(
+        "OpenCV DNN person detector", "dnn-detector",
+        "Single-shot network person detector, batched across streams",
+        0,
+        true,  // tracks
+        false  // fpga
+    );
+}
+
+void DNNAlgorithm::releaseNet() {
+    if(m_batcher) m_batcher->detach();
+    m_batcher.reset();
+    m_input.release();
+}
+
+void DNNAlgorithm::preprocess(const cv::Mat& mat) {
+    const cv::Size& sz = m_cfg.input;
+    if(m_input.empty()) {
+        // planes are views into m_input, so split() writes in place
+        m_input.create(3 * sz.height, sz.width, CV_32F);
+        m_planes.clear();
+        for(int c = 0;c < 3;c++)
+            m_planes.push_back(m_input.rowRange(c * sz.height,
+                        (c + 1) * sz.height));
+        if(m_cfg.swapRB) std::swap(m_planes[0], m_planes[2]);
+    }
+
+    // to BGR at the network's size in one pass
+    if(m_prep.spec().size != sz) {
+        InputSpec spec;
+        spec.size = sz;
+        m_prep.setSpec(spec);
+    }
+    m_prep.run(mat, m_resized);
+    m_resized.convertTo(m_float, CV_32F, m_cfg.scale,
+            -m_cfg.mean * m_cfg.scale);
+    cv::split(m_float, m_planes);
+}
+
+const std::vector<AlgorithmResult*>& DNNAlgorithm::analyze(const cv::Mat& mat) {
+    m_res->boxes.clear();
+    m_locs.clear();
+    if(!m_batcher) m_batcher = Batcher::acquire(m_cfg);
+
+    updateTracks(m_track, mat);
+    dedupTracks(m_track, INTERSECT_THRESHOLD);
+
+    preprocess(mat);
+    m_batcher->run(m_input, m_dets);
+
+    std::vector<cv::Rect> cand;
+    std::vector<float> scores;
+    cv::Rect frame(0, 0, mat.cols, mat.rows);
+    for(auto& d : m_dets) {
+        if(d.label != m_personClass || d.confidence < m_confidence) continue;
+        cv::Rect r(cvRound(d.x1 * mat.cols), cvRound(d.y1 * mat.rows),
+                cvRound((d.x2 - d.x1) * mat.cols),
+                cvRound((d.y2 - d.y1) * mat.rows));
+        r &= frame;
+        if(r.area() <= 0) continue;
+        cand.push_back(r);
+        scores.push_back(d.confidence);
+    }
+    std::vector<int> keep;
+    cv::dnn::NMSBoxes(cand, scores, m_confidence, m_nms, keep);
+    for(auto k : keep) m_locs.push_back(cand[k]);
+
+    associateDetections(m_track, m_locs, mat, INTERSECT_THRESHOLD, false);
+    retireTracks(m_track, CONF_LIMIT);
+
+    // create new tracking bounds for others
+    for(auto r : m_locs) {
+        TrackingInfo inf;
+        inf.tracker = createTracker(m_trackerType);
+        inf.last_pos = r;
+        inf.id = nextId();
+        inf.confirm_frames = 0;
+        inf.tracker->init(mat, r);
+        m_track.push_back(inf);
+    }
+
+    for(auto t : m_track) {
+        BoundingBox b;
+        b.id = t.id;
+        b.tag = 0;
+        b.bounds = t.last_pos;
+        m_res->boxes.push_back(b);
+    }
+    return m_results;
+}
+
+bool DNNAlgorithm::setParam(const std::string& name, const std::string& value) {
+    NetConfig cfg = m_cfg;
+    try {
+        if(name == "model") {
+            cfg.model = value;
+        } else if(name == "config") {
+            cfg.config = value;
+        } else if(name == "input_width") {
+            cfg.input.width = std::stoi(value);
+        } else if(name == "input_height") {
+            cfg.input.height = std::stoi(value);
+        } else if(name == "scale") {
+            cfg.scale = std::stod(value);
+        } else if(name == "mean") {
+            cfg.mean = std::stod(value);
+        } else if(name == "swap_rb") {
+            cfg.swapRB = std::stoi(value) != 0;
+        } else if(name == "format") {
+            if(value == "ssd") cfg.format = OF_SSD;
+            else if(value == "yolo") cfg.format = OF_YOLO;
+            else return false;
+        } else if(name == "backend") {
+            if(value == "default")
+                cfg.backend = cv::dnn::DNN_BACKEND_DEFAULT;
+            else if(value == "opencv")
+                cfg.backend = cv::dnn::DNN_BACKEND_OPENCV;
+            else if(value == "inference_engine")
+                cfg.backend = cv::dnn::DNN_BACKEND_INFERENCE_ENGINE;
+            else return false;
+        } else if(name == "precision") {
+            // int8 comes from a quantized IR model, which only the Inference
+            // Engine backend can execute
+            if(value == "fp32") {
+                cfg.target = cv::dnn::DNN_TARGET_CPU;
+            } else if(value == "fp16") {
+                cfg.target = cv::dnn::DNN_TARGET_OPENCL_FP16;
+            } else if(value == "int8") {
+                cfg.backend = cv::dnn::DNN_BACKEND_INFERENCE_ENGINE;
+                cfg.target = cv::dnn::DNN_TARGET_CPU;
+            } else {
+                return false;
+            }
+        } else if(name == "batch") {
+            cfg.maxBatch = std::stoi(value);
+        } else if(name == "batch_wait_ms") {
+            cfg.waitMs = std::stoi(value);
+        } else if(name == "person_class") {
+            m_personClass = std::stoi(value);
+            return true;
+        } else if(name == "confidence") {
+            m_confidence = std::stof(value);
+            return true;
+        } else if(name == "nms") {
+            m_nms = std::stof(value);
+            return true;
+        } else if(name == "tracker") {
+            if(!createTracker(value)) return false;
+            m_trackerType = value;
+            return true;
+        } else {
+            return false;
+        }
+    } catch(const std::logic_error& e) { // unparseable number
+        return false;
+    }
+
+    if(cfg.input.width <= 0 || cfg.input.height <= 0 || cfg.maxBatch <= 0 ||
+            cfg.waitMs < 0)
+        return false;
+
+    // the network is loaded again on the next frame
+    releaseNet();
+    m_cfg = cfg;
+    return true;
+}
+
+int ml::dnn::count(void) {
+    return 1;
+}
+
+ml::Algorithm* ml::dnn::build(int idx, const cv::Size& sz) {
+    return new DNNAlgorithm();
+}
+
+ml::Algorithm::Info* ml::dnn::describe(int idx) {
+    return new ml::Algorithm::Info(
+        "OpenCV DNN person detector", "dnn-detector",
+        "Single-shot network person detector, batched across streams",
+        0,     // index
+        true,  // tracks
+        false  // fpga
+    );
+}
+
+void ml::dnn::interface_version(int* major, int* minor) {
+    *major = IFACE_VERSION_MAJOR;
+    *minor = IFACE_VERSION_MINOR;
+}
@@ -0,0 +1,175 @@
+#ifndef ALGORITHM_DNN_HPP
+#define ALGORITHM_DNN_HPP
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/dnn.hpp"
+#include "../algorithm.hpp"
+#include "preprocess.hpp"
+#include "tracking.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ml {
+namespace dnn {
+
+//! Output layouts we know how to decode
+enum OutputFormat {
+    OF_SSD,  //!< DetectionOutput rows: image, label, conf, x1, y1, x2, y2
+    OF_YOLO, //!< Region rows: cx, cy, w, h, objectness, class scores...
+};
+
+//! Everything needed to load a network and shape its input
+struct NetConfig {
+    std::string model;  //!< Weights file
+    std::string config; //!< Topology file, if the framework uses one
+    cv::Size input;     //!< Network input size
+    double scale;       //!< Multiplier applied to pixel values
+    double mean;        //!< Subtracted from pixel values before scaling
+    bool swapRB;        //!< Feed RGB instead of BGR
+    OutputFormat format;
+    int backend;        //!< cv::dnn backend ID
+    int target;         //!< cv::dnn target ID
+    int maxBatch;       //!< Largest batch to run in one forward pass
+    int waitMs;         //!< How long to hold a partial batch for other streams
+
+    //! A string identifying networks that can be shared
+    std::string key() const;
+};
+
+//! A raw detection, in coordinates normalized to [0, 1]
+struct Detection {
+    int label;
+    float confidence;
+    float x1, y1, x2, y2;
+};
+
+/** \brief A network shared by every detector instance with the same config
+ *
+ * Each instance submits its preprocessed frame and blocks. A forward pass
+ * runs as soon as as many frames are waiting as there have recently been
+ * callers in run() at once, or the oldest frame has waited waitMs, whichever
+ * comes first. Instances that share a thread can never submit together, so
+ * they (like a single stream) never wait, while streams on their own threads
+ * share one batched pass. The thread that triggers the pass runs it; the
+ * others sleep until their results are ready.
+ */
+class Batcher {
+public:
+    /** \brief Get the batcher for a configuration, loading it if needed
+     *
+     * Throws algorithm_init_error if the network cannot be loaded.
+     */
+    static std::shared_ptr<Batcher> acquire(const NetConfig& cfg);
+
+    ~Batcher();
+
+    //! Stop waiting for frames from an instance that is letting go of this
+    void detach();
+
+    /** \brief Run one frame through the network
+     *
+     * \param input A preprocessed 3 x H x W float planar image
+     * \param out Filled with the detections for this frame
+     * \throw cv::Exception If the forward pass this frame was part of failed
+     */
+    void run(const cv::Mat& input, std::vector<Detection>& out);
+
+    const NetConfig& config() const { return m_cfg; }
+
+private:
+    struct Slot {
+        const cv::Mat* input;
+        std::vector<Detection>* out;
+        bool done;
+        std::exception_ptr error;   // from the pass that ran it
+    };
+
+    //! How many frames a batch waits for
+    size_t wanted() const;
+
+    Batcher(const NetConfig& cfg);
+    void forward(const std::vector<Slot*>& batch);
+    void decodeSSD(const cv::Mat& out, const std::vector<Slot*>& batch);
+    void decodeYOLO(const cv::Mat& out, const std::vector<Slot*>& batch);
+
+    NetConfig m_cfg;
+    cv::dnn::Net m_net;
+    cv::Mat m_blob; // maxBatch x 3 x H x W, allocated once
+    std::vector<std::string> m_outputs;
+    std::vector<cv::Mat> m_outBlobs;
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::vector<Slot*> m_pending;
+    bool m_busy;
+    unsigned int m_users; // attached instances
+
+    // callers inside run() now, and the most at once in the current and the
+    // previous window
+    unsigned int m_inside;
+    unsigned int m_peak[2];
+    std::chrono::steady_clock::time_point m_window;
+
+    static std::mutex s_lock;
+    static std::map<std::string, std::weak_ptr<Batcher> > s_batchers;
+};
+
+/** \brief Person detector running a single-shot network through cv::dnn
+ *
+ * Loads an SSD or YOLO style network on first use, resizes each frame into
+ * a preallocated input plane, runs it through a Batcher shared with every
+ * other instance using the same network, and tracks the people it finds.
+ */
+class DNNAlgorithm : public Algorithm {
+public:
+    DNNAlgorithm();
+    ~DNNAlgorithm();
+
+    Info getInfo();
+    const std::vector<AlgorithmResult*>& analyze(const cv::Mat& mat);
+    bool setParam(const std::string& name, const std::string& value);
+
+private:
+    //! Fill m_input from a frame
+    void preprocess(const cv::Mat& mat);
+
+    //! Drop the network, so the next frame loads it with the current config
+    void releaseNet();
+
+    NetConfig m_cfg;
+    std::shared_ptr<Batcher> m_batcher;
+
+    int m_personClass;
+    float m_confidence;
+    float m_nms;
+    std::string m_trackerType;
+
+    Preprocessor m_prep;
+    cv::Mat m_resized, m_float;  // preprocessing scratch
+    cv::Mat m_input;             // 3 x H x W planes
+    std::vector<cv::Mat> m_planes;
+    std::vector<Detection> m_dets;
+
+    BoundingBoxesResult* m_res;
+    TrackList m_track;
+    std::vector<cv::Rect> m_locs;
+};
+
+extern "C" int count();
+
+extern "C" Algorithm* build(int idx, const cv::Size& sz);
+
+extern "C" Algorithm::Info* describe(int idx);
+
+extern "C" void interface_version(int* major, int* minor);
+};
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "grouping.hpp"
+
+namespace {
+/** \brief Partition rectangles into classes of similar rectangles
+ *
+ * The same union-find as cv::partition() with cv::SimilarRects, but with its
+ * node storage in an arena.
+ *
+ * \return The number of classes
+ */
+int partitionRects(const cv::Rect* rects, int n, int* labels, double eps,
+        ml::FrameArena& scratch) {
+    const int PARENT = 0, RANK = 1;
+    ml::ArenaVector<int> nodes(n * 2, 0, scratch);
+    cv::SimilarRects similar(eps);
+
+    for(int i = 0;i < n;i++) {
+        nodes[i*2 + PARENT] = -1;
+        nodes[i*2 + RANK] = 0;
+    }
+
+    for(int i = 0;i < n;i++) {
+        int root = i;
+        while(nodes[root*2 + PARENT] >= 0) root = nodes[root*2 + PARENT];
+
+        for(int j = 0;j < n;j++) {
+            if(i == j || !similar(rects[i], rects[j])) continue;
+            int root2 = j;
+            while(nodes[root2*2 + PARENT] >= 0)
+                root2 = nodes[root2*2 + PARENT];
+            if(root2 == root) continue;
+
+            // join the trees, by rank
+            int rank = nodes[root*2 + RANK], rank2 = nodes[root2*2 + RANK];
+            if(rank > rank2) {
+                nodes[root2*2 + PARENT] = root;
+            } else {
+                nodes[root*2 + PARENT] = root2;
+                if(rank == rank2) nodes[root2*2 + RANK]++;
+                root = root2;
+            }
+
+            // compress the paths from both nodes
+            for(int k = j, parent;
+                    (parent = nodes[k*2 + PARENT]) >= 0;k = parent)
+                nodes[k*2 + PARENT] = root;
+            for(int k = i, parent;
+                    (parent = nodes[k*2 + PARENT]) >= 0;k = parent)
+                nodes[k*2 + PARENT] = root;
+        }
+    }
+
+    // number the classes
+    int nclasses = 0;
+    for(int i = 0;i < n;i++) {
+        int root = i;
+        while(nodes[root*2 + PARENT] >= 0) root = nodes[root*2 + PARENT];
+        if(nodes[root*2 + RANK] >= 0) nodes[root*2 + RANK] = ~nclasses++;
+        labels[i] = ~nodes[root*2 + RANK];
+    }
+    return nclasses;
+}
+};
+
+template<typename RectAlloc, typename WeightAlloc>
+void ml::groupRectangles(std::vector<cv::Rect, RectAlloc>& rectList,
+        std::vector<double, WeightAlloc>& weights,
+        int groupThreshold,
+        double eps,
+        FrameArena& scratch) {
+    if(groupThreshold <= 0 || rectList.empty()) return;
+
+    CV_Assert(rectList.size() == weights.size());
+
+    int i, j, nlabels = (int)rectList.size();
+    ArenaVector<int> labels(nlabels, 0, scratch);
+    int nclasses = partitionRects(rectList.data(), nlabels, labels.data(),
+            eps, scratch);
+
+    ArenaVector<cv::Rect_<double> > rrects(nclasses, cv::Rect_<double>(),
+            scratch);
+    ArenaVector<int> numInClass(nclasses, 0, scratch);
+    ArenaVector<double> foundWeights(nclasses, DBL_MIN, scratch);
+
+    for( i = 0; i < nlabels; i++ )
+    {
+        int cls = labels[i];
+        rrects[cls].x += rectList[i].x;
+        rrects[cls].y += rectList[i].y;
+        rrects[cls].width += rectList[i].width;
+        rrects[cls].height += rectList[i].height;
+        foundWeights[cls] = cv::max(foundWeights[cls], weights[i]);
+        numInClass[cls]++;
+    }
+
+    for( i = 0; i < nclasses; i++ )
+    {
+        // find the average of all ROI in the cluster
+        cv::Rect_<double> r = rrects[i];
+        double s = 1.0/numInClass[i];
+        rrects[i] = cv::Rect_<double>(cv::saturate_cast<double>(r.x*s),
+                cv::saturate_cast<double>(r.y*s),
+                cv::saturate_cast<double>(r.width*s),
+                cv::saturate_cast<double>(r.height*s));
+    }
+
+    // there are never more results than inputs, so this reuses capacity
+    rectList.clear();
+    weights.clear();
+
+    for( i = 0; i < nclasses; i++ )
+    {
+        cv::Rect r1 = rrects[i];
+        int n1 = numInClass[i];
+        double w1 = foundWeights[i];
+        if( n1 <= groupThreshold )
+            continue;
+        for( j = 0; j < nclasses; j++ )
+        {
+            int n2 = numInClass[j];
+
+            if( j == i || n2 <= groupThreshold )
+                continue;
+
+            cv::Rect r2 = rrects[j];
+
+            int dx = cv::saturate_cast<int>( r2.width * eps );
+            int dy = cv::saturate_cast<int>( r2.height * eps );
+
+            if( r1.x >= r2.x - dx &&
+                    r1.y >= r2.y - dy &&
+                    r1.x + r1.width <= r2.x + r2.width + dx &&
+                    r1.y + r1.height <= r2.y + r2.height + dy &&
+                    (n2 > std::max(3, n1) || n1 < 3) )
+                break;
+        }
+
+        if( j == nclasses )
+        {
+            rectList.push_back(r1);
+            weights.push_back(w1);
+        }
+    }
+}
+
+void ml::groupRectangles(std::vector<cv::Rect>& rectList,
+        std::vector<double>& weights,
+        int groupThreshold,
+        double eps) {
+    static thread_local FrameArena scratch;
+    FrameArena::Scope scope(scratch);
+    groupRectangles(rectList, weights, groupThreshold, eps, scratch);
+}
+
+namespace ml {
+template void groupRectangles(std::vector<cv::Rect>&, std::vector<double>&,
+        int, double, FrameArena&);
+template void groupRectangles(std::vector<cv::Rect>&, ArenaVector<double>&,
+        int, double, FrameArena&);
+template void groupRectangles(ArenaVector<cv::Rect>&, ArenaVector<double>&,
+        int, double, FrameArena&);
+};
@@ -0,0 +1,39 @@
+#ifndef ALGORITHM_GROUPING_HPP
+#define ALGORITHM_GROUPING_HPP
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+#include "arena.hpp"
+
+#include <vector>
+
+namespace ml {
+
+/** \brief Cluster overlapping detections into single rectangles
+ *
+ * A weighted variant of cv::groupRectangles. Rectangles are partitioned into
+ * classes of similar rectangles, each class with more than \p groupThreshold
+ * members is averaged into one rectangle carrying the class's highest weight,
+ * and classes nested inside a larger, better supported class are dropped.
+ *
+ * The results replace the contents of \p rectList and \p weights. Working
+ * storage comes from \p scratch, which isn't reset, so nothing here touches
+ * the heap once the vectors and the arena have grown to size. Instantiated
+ * for std::allocator and ArenaAllocator vectors.
+ */
+template<typename RectAlloc, typename WeightAlloc>
+void groupRectangles(std::vector<cv::Rect, RectAlloc>& rectList,
+        std::vector<double, WeightAlloc>& weights,
+        int groupThreshold,
+        double eps,
+        FrameArena& scratch);
+
+//! As above, with scratch space from a per-thread arena
+void groupRectangles(std::vector<cv::Rect>& rectList,
+        std::vector<double>& weights,
+        int groupThreshold,
+        double eps);
+
+};
+
+#endif
@@ -0,0 +1,233 @@
+#include "hog_cpu.hpp"
+#include "grouping.hpp"
+#include "levels.hpp"
+#include "../log/log.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/tracking.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
+
+#define DEFAULT_MODEL "default"
+
+#define CONF_LIMIT 20
+#define INTERSECT_THRESHOLD 0.5
+
+using namespace ml;
+using namespace ml::hogcpu;
+
+HogCpuAlgorithm::HogCpuAlgorithm() : m_hitThreshold(0.5), m_stride(1),
+        m_scale(0.0), m_groupThreshold(2), m_detect(true), m_maxLevels(0),
+        m_approximate(true) {
+    if(!setModel(DEFAULT_MODEL))
+        throw algorithm_init_error("Cannot load HOG model", DEFAULT_MODEL);
+
+    m_res = new BoundingBoxesResult();
+    m_res->type = RT_BOUNDING_BOXES;
+    m_results.push_back(m_res);
+}
+
+HogCpuAlgorithm::~HogCpuAlgorithm() {
+    delete m_res;
+}
+
+Algorithm::Info HogCpuAlgorithm::getInfo() {
+    return m_info;
+}
+
+bool HogCpuAlgorithm::setModel(const std::string& name) {
+    std::shared_ptr<const HogModel> model;
+    try {
+        model = ModelStore::get().hog(name);
+    } catch(const algorithm_init_error& e) {
+        LOG_ERROR("hog-cpu", "%s", e.what());
+        return false;
+    }
+
+    Kernel* k = makeKernel(*model);
+    if(k == NULL) {
+        const cv::HOGDescriptor& d = model->descriptor();
+        LOG_ERROR("hog-cpu", "No kernel for %dx%d windows with %d pixel "
+                "cells and %d bins", d.winSize.width, d.winSize.height,
+                d.cellSize.width, d.nbins);
+        return false;
+    }
+    m_model = model;
+    m_kernel.reset(k);
+    return true;
+}
+
+const std::vector<AlgorithmResult*>& HogCpuAlgorithm::analyze(
+        const cv::Mat& mat) {
+    FrameArena::Scope frameScope(m_arena);
+    m_res->boxes.clear();
+    m_locs.clear();
+    m_weights.clear();
+
+    updateTracks(m_track, mat);
+    dedupTracks(m_track, INTERSECT_THRESHOLD);
+    if(!m_detect) {
+        retireTracks(m_track, CONF_LIMIT);
+        return report();
+    }
+
+    // pyramid scales, from the prepared frame down to the detection window
+    const cv::Mat& in = m_input.run(mat);
+    cv::Size win = m_kernel->winSize();
+    double range = (double)in.rows / win.height;
+    double step = m_scale > 0 ? m_scale : pow(range, 1.0 / 24);
+    if(m_maxLevels > 0) step = std::max(step, pow(range, 1.0 / m_maxLevels));
+    ArenaVector<double> scales(m_arena);
+    for(double s = 1;cvRound(in.cols / s) >= win.width &&
+            cvRound(in.rows / s) >= win.height;s *= step) {
+        scales.push_back(s);
+        if(step <= 1) break;
+    }
+    int n = scales.size();
+    if((int)m_levels.size() < n) m_levels.resize(n);
+
+    // the first level of each octave is computed from the image; the others
+    // take their cells from the nearest of those
+    ArenaVector<int> source(m_arena);
+    for(int i = 0;i < n;i++) {
+        bool exact = !m_approximate || i == 0 ||
+            floor(log2(scales[i])) > floor(log2(scales[i-1]));
+        source.push_back(exact ? i : source[i-1]);
+    }
+    for(int i = n - 1, next = -1;i >= 0;i--) {
+        if(source[i] == i) next = i;
+        else if(next >= 0 &&
+                scales[next] / scales[i] < scales[i] / scales[source[i]])
+            source[i] = next;
+    }
+
+    cv::parallel_for_(cv::Range(0, n), LevelBody([&](int i) {
+        if(source[i] != i) return;
+        Level& l = m_levels[i];
+        l.scale = scales[i];
+        if(l.scale != 1) cv::resize(in, l.image, cv::Size(
+                    cvRound(in.cols / l.scale), cvRound(in.rows / l.scale)));
+        m_kernel->cells(l.scale == 1 ? in : l.image, l);
+    }));
+
+    const cv::HOGDescriptor& desc = m_model->descriptor();
+    int cell = desc.cellSize.width;
+    cv::parallel_for_(cv::Range(0, n), LevelBody([&](int i) {
+        Level& l = m_levels[i];
+        if(source[i] != i) {
+            const Level& from = m_levels[source[i]];
+            l.scale = scales[i];
+            approximateCells(from, cv::Size(cvRound(in.cols / l.scale) / cell,
+                        cvRound(in.rows / l.scale) / cell), desc.nbins,
+                    from.scale / l.scale, l);
+        }
+        m_kernel->score(*m_model, m_hitThreshold, m_stride, l);
+    }));
+
+    for(size_t i = 0;i < scales.size();i++) {
+        const Level& l = m_levels[i];
+        for(size_t j = 0;j < l.hits.size();j++) {
+            m_locs.push_back(m_input.toFrame(cv::Rect(
+                            cvRound(l.hits[j].x * l.scale),
+                            cvRound(l.hits[j].y * l.scale),
+                            cvRound(win.width * l.scale),
+                            cvRound(win.height * l.scale))));
+            m_weights.push_back(l.scores[j]);
+        }
+    }
+    groupRectangles(m_locs, m_weights, m_groupThreshold, 0.2, m_arena);
+
+    associateDetections(m_track, m_locs, mat, INTERSECT_THRESHOLD, false);
+    retireTracks(m_track, CONF_LIMIT);
+
+    // create new tracking bounds for others
+    for(auto r : m_locs) {
+        TrackingInfo inf;
+        inf.tracker = createTracker("TLD");
+        inf.last_pos = r;
+        inf.id = nextId();
+        inf.confirm_frames = 0;
+        inf.tracker->init(mat, r);
+        m_track.push_back(inf);
+    }
+    return report();
+}
+
+const std::vector<AlgorithmResult*>& HogCpuAlgorithm::report() {
+    for(auto t : m_track) {
+        BoundingBox b;
+        b.id = t.id;
+        b.tag = 0;
+        b.bounds = t.last_pos;
+        m_res->boxes.push_back(b);
+    }
+    return m_results;
+}
+
+bool HogCpuAlgorithm::setParam(const std::string& name,
+        const std::string& value) {
+    try {
+        if(name == "model") {
+            return setModel(value);
+        } else if(name == "hit_threshold") {
+            m_hitThreshold = std::stod(value);
+        } else if(name == "stride") {
+            int v = std::stoi(value);
+            if(v <= 0) return false;
+            m_stride = v;
+        } else if(name == "scale") {
+            double v = std::stod(value);
+            if(v != 0 && v <= 1.0) return false;
+            m_scale = v;
+        } else if(name == "group_threshold") {
+            m_groupThreshold = std::stoi(value);
+        } else if(name == "detect") {
+            m_detect = std::stoi(value) != 0;
+        } else if(name == "max_levels") {
+            int v = std::stoi(value);
+            if(v < 0) return false;
+            m_maxLevels = v;
+        } else if(name == "approximate") {
+            m_approximate = std::stoi(value) != 0;
+        } else if(name == "input_scale") {
+            InputSpec spec = m_input.spec();
+            spec.scale = std::stod(value);
+            if(spec.scale < 1.0) return false;
+            m_input.setSpec(spec);
+        } else if(name == "padding") {
+            InputSpec spec = m_input.spec();
+            spec.border = std::stoi(value);
+            if(spec.border < 0) return false;
+            m_input.setSpec(spec);
+        } else {
+            return false;
+        }
+    } catch(const std::logic_error& e) { // unparseable number
+        return false;
+    }
+    return true;
+}
+
+int ml::hogcpu::count(void) {
+    return 1;
+}
+
+ml::Algorithm* ml::hogcpu::build(int idx, const cv::Size& sz) {
+    return new HogCpuAlgorithm();
+}
+
+ml::Algorithm::Info* ml::hogcpu::describe(int idx) {
+    return new ml::Algorithm::Info(
+        "Compiled HOG SVM", "hog-cpu",
+        "HOG SVM detector with kernels specialised per window geometry",
+        0,     // index
+        true,  // tracks
+        false  // fpga
+    );
+}
+
+void ml::hogcpu::interface_version(int* major, int* minor) {
+    *major = IFACE_VERSION_MAJOR;
+    *minor = IFACE_VERSION_MINOR;
+}
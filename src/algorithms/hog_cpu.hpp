@@ -0,0 +1,77 @@
+#ifndef ALGORITHM_HOG_CPU_HPP
+#define ALGORITHM_HOG_CPU_HPP
+
+#include "opencv2/core/core.hpp"
+#include "../algorithm.hpp"
+#include "arena.hpp"
+#include "hog_kernel.hpp"
+#include "preprocess.hpp"
+#include "tracking.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace ml {
+namespace hogcpu {
+
+/** \brief HOG pedestrian detector built on the compiled kernels
+ *
+ * Takes any model from the ModelStore that a kernel exists for, chosen when
+ * the model is set, and tracks detections between frames. Frames can be
+ * downscaled and padded on the way in (the input_scale and padding
+ * parameters), so the pyramid starts smaller and windows reach the edges.
+ * Only the first pyramid level of each octave is computed from the image; the
+ * others resample its cells, unless the approximate parameter is zero.
+ */
+class HogCpuAlgorithm : public Algorithm {
+public:
+    HogCpuAlgorithm();
+    ~HogCpuAlgorithm();
+
+    Info getInfo();
+    const std::vector<AlgorithmResult*>& analyze(const cv::Mat& mat);
+    bool setParam(const std::string& name, const std::string& value);
+
+private:
+    //! Make \p model current. False if no kernel handles it.
+    bool setModel(const std::string& name);
+
+    //! Fill the result with the current tracks
+    const std::vector<AlgorithmResult*>& report();
+
+    std::shared_ptr<const HogModel> m_model;
+    std::unique_ptr<Kernel> m_kernel;
+
+    double m_hitThreshold;
+    int m_stride;       // window stride, in cells
+    double m_scale;     // pyramid step; zero to pick from the frame height
+    int m_groupThreshold;
+    bool m_detect;      // false to only update trackers
+    int m_maxLevels;    // pyramid level cap; zero for none
+    bool m_approximate; // only compute each octave's first level exactly
+    Preprocessor m_input;
+
+    std::vector<Level> m_levels;
+    FrameArena m_arena;
+    BoundingBoxesResult* m_res;
+    TrackList m_track;
+    std::vector<cv::Rect> m_locs;
+    std::vector<double> m_weights;
+
+    Algorithm::Info m_info = Algorithm::Info(
+            "Compiled HOG SVM", "hog-cpu",
+            "HOG SVM detector with kernels specialised per window geometry",
+            0, true, false);
+};
+
+extern "C" int count();
+
+extern "C" Algorithm* build(int idx, const cv::Size& sz);
+
+extern "C" Algorithm::Info* describe(int idx);
+
+extern "C" void interface_version(int* major, int* minor);
+};
+};
+
+#endif
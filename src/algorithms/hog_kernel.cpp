@@ -0,0 +1,201 @@
+#include "hog_kernel.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#define L2HYS_THRESHOLD 0.2f
+
+// power-law exponent for gradient histograms across scales
+#define LAMBDA_HOG 0.1105
+
+using namespace ml;
+using namespace ml::hogcpu;
+
+namespace {
+template<int WIN_W, int WIN_H, int CELL, int NBINS>
+class FixedKernel : public Kernel {
+public:
+    static constexpr int CELLS_X = WIN_W / CELL, CELLS_Y = WIN_H / CELL;
+    static constexpr int BLOCKS_X = CELLS_X - 1, BLOCKS_Y = CELLS_Y - 1;
+    static constexpr int BLOCK_HIST = 4 * NBINS;
+    static_assert(WIN_W % CELL == 0 && WIN_H % CELL == 0,
+            "Windows must be a whole number of cells");
+
+    FixedKernel() {
+        for(int i = 0;i < 256;i++) m_gamma[i] = sqrtf((float)i);
+
+        // a pixel's vote is split between the cell centres either side of it
+        for(int o = 0;o < CELL;o++) {
+            float f = (o + 0.5f) / CELL - 0.5f;
+            m_cellOfs[o] = f < 0 ? -1 : 0;
+            m_weight[o] = f - m_cellOfs[o];
+        }
+    }
+
+    cv::Size winSize() const { return cv::Size(WIN_W, WIN_H); }
+
+    void cells(const cv::Mat& img, Level& level) const {
+        level.grid = cv::Size(img.cols / CELL, img.rows / CELL);
+        cellHistograms(img, level.grid.width, level.grid.height, level.cells);
+    }
+
+    void score(const HogModel& model, double threshold, int stride,
+            Level& level) const {
+        level.hits.clear();
+        level.scores.clear();
+        int ncx = level.grid.width, ncy = level.grid.height;
+        if(ncx < CELLS_X || ncy < CELLS_Y) return;
+
+        normalizeBlocks(level.cells, ncx, ncy, level.blocks);
+
+        // blocks in the model run down each column of the window in turn
+        const float* weights = model.weights();
+        const float* blocks = level.blocks.data();
+        int nbx = ncx - 1;
+        for(int cy = 0;cy <= ncy - CELLS_Y;cy += stride) {
+            for(int cx = 0;cx <= ncx - CELLS_X;cx += stride) {
+                float s = model.bias();
+                for(int bx = 0;bx < BLOCKS_X;bx++) {
+                    for(int by = 0;by < BLOCKS_Y;by++) {
+                        const float* f = blocks +
+                            ((cy + by) * nbx + cx + bx) * BLOCK_HIST;
+                        const float* w = weights +
+                            (bx * BLOCKS_Y + by) * BLOCK_HIST;
+                        for(int k = 0;k < BLOCK_HIST;k++) s += f[k] * w[k];
+                    }
+                }
+                if(s < threshold) continue;
+                level.hits.push_back(cv::Point(cx * CELL, cy * CELL));
+                level.scores.push_back(s);
+            }
+        }
+    }
+
+private:
+    void cellHistograms(const cv::Mat& img, int ncx, int ncy,
+            std::vector<float>& out) const {
+        out.assign(ncx * ncy * NBINS, 0.0f);
+        float* cells = out.data();
+        const int cn = img.channels(), colours = std::min(cn, 3);
+        const float binScale = NBINS / CV_PI;
+
+        for(int y = 0;y < ncy * CELL;y++) {
+            const uchar* row = img.ptr<uchar>(y);
+            const uchar* up = img.ptr<uchar>(std::max(y - 1, 0));
+            const uchar* down = img.ptr<uchar>(std::min(y + 1, img.rows - 1));
+            int cy0 = y / CELL + m_cellOfs[y % CELL];
+            float wy1 = m_weight[y % CELL], wy0 = 1.0f - wy1;
+
+            for(int x = 0;x < ncx * CELL;x++) {
+                int xl = std::max(x - 1, 0) * cn;
+                int xr = std::min(x + 1, img.cols - 1) * cn;
+
+                // the channel with the strongest gradient
+                float gx = 0, gy = 0, best = -1;
+                for(int c = 0;c < colours;c++) {
+                    float dx = m_gamma[row[xr + c]] - m_gamma[row[xl + c]];
+                    float dy = m_gamma[down[x*cn + c]] - m_gamma[up[x*cn + c]];
+                    float m2 = dx*dx + dy*dy;
+                    if(m2 > best) {
+                        best = m2;
+                        gx = dx;
+                        gy = dy;
+                    }
+                }
+                if(best <= 0) continue;
+
+                // unsigned orientation, shared between the nearest two bins
+                float mag = sqrtf(best);
+                float angle = atan2f(gy, gx);
+                if(angle < 0) angle += (float)CV_PI;
+                float a = angle * binScale - 0.5f;
+                int b0 = cvFloor(a);
+                a -= b0;
+                if(b0 < 0) b0 += NBINS;
+                else if(b0 >= NBINS) b0 -= NBINS;
+                int b1 = b0 + 1 < NBINS ? b0 + 1 : 0;
+                float v0 = mag * (1.0f - a), v1 = mag * a;
+
+                int cx0 = x / CELL + m_cellOfs[x % CELL];
+                float wx1 = m_weight[x % CELL], wx0 = 1.0f - wx1;
+                const int cxs[2] = { cx0, cx0 + 1 }, cys[2] = { cy0, cy0 + 1 };
+                const float wxs[2] = { wx0, wx1 }, wys[2] = { wy0, wy1 };
+                for(int j = 0;j < 2;j++) {
+                    if(cys[j] < 0 || cys[j] >= ncy) continue;
+                    for(int i = 0;i < 2;i++) {
+                        if(cxs[i] < 0 || cxs[i] >= ncx) continue;
+                        float* h = cells + (cys[j] * ncx + cxs[i]) * NBINS;
+                        float w = wxs[i] * wys[j];
+                        h[b0] += v0 * w;
+                        h[b1] += v1 * w;
+                    }
+                }
+            }
+        }
+    }
+
+    void normalizeBlocks(const std::vector<float>& cells, int ncx, int ncy,
+            std::vector<float>& out) const {
+        int nbx = ncx - 1, nby = ncy - 1;
+        out.resize(nbx * nby * BLOCK_HIST);
+        for(int by = 0;by < nby;by++) {
+            for(int bx = 0;bx < nbx;bx++) {
+                float* h = &out[(by * nbx + bx) * BLOCK_HIST];
+
+                // cells in OpenCV's order: down the left column, then right
+                const float* c = &cells[(by * ncx + bx) * NBINS];
+                const float* src[4] = { c, c + ncx * NBINS, c + NBINS,
+                    c + (ncx + 1) * NBINS };
+                for(int i = 0;i < 4;i++)
+                    for(int k = 0;k < NBINS;k++) h[i*NBINS + k] = src[i][k];
+
+                // L2-Hys: normalize, clip, normalize again
+                float sum = 0;
+                for(int k = 0;k < BLOCK_HIST;k++) sum += h[k] * h[k];
+                float scale = 1.0f / (sqrtf(sum) + BLOCK_HIST * 0.1f);
+                sum = 0;
+                for(int k = 0;k < BLOCK_HIST;k++) {
+                    h[k] = std::min(h[k] * scale, L2HYS_THRESHOLD);
+                    sum += h[k] * h[k];
+                }
+                scale = 1.0f / (sqrtf(sum) + 1e-3f);
+                for(int k = 0;k < BLOCK_HIST;k++) h[k] *= scale;
+            }
+        }
+    }
+
+    float m_gamma[256];     // gamma correction, as cv::HOGDescriptor does it
+    int m_cellOfs[CELL];    // first cell a pixel votes in, relative to its own
+    float m_weight[CELL];   // share of the vote going to the next cell
+};
+};
+
+void ml::hogcpu::approximateCells(const Level& src, const cv::Size& grid,
+        int nbins, double ratio, Level& out) {
+    out.grid = grid;
+    out.cells.resize(grid.area() * nbins);
+    if(grid.area() == 0 || src.grid.area() == 0) return;
+
+    // a cell's bins are adjacent, so they resample as one multi-channel image
+    cv::Mat in(src.grid, CV_32FC(nbins), const_cast<float*>(src.cells.data()));
+    cv::Mat dst(grid, CV_32FC(nbins), out.cells.data());
+    cv::resize(in, dst, grid, 0, 0, cv::INTER_LINEAR);
+    if(ratio != 1.0) dst.convertTo(dst, dst.type(), pow(ratio, -LAMBDA_HOG));
+}
+
+Kernel* ml::hogcpu::makeKernel(const HogModel& model) {
+    const cv::HOGDescriptor& d = model.descriptor();
+    int cell = d.cellSize.width;
+    if(d.cellSize.height != cell || d.blockStride != d.cellSize ||
+            d.blockSize != cv::Size(2 * cell, 2 * cell) || d.nbins != 9)
+        return NULL;
+
+    if(cell == 8 && d.winSize == cv::Size(64, 128))
+        return new FixedKernel<64, 128, 8, 9>();
+    if(cell == 8 && d.winSize == cv::Size(48, 96))
+        return new FixedKernel<48, 96, 8, 9>();
+    if(cell == 4 && d.winSize == cv::Size(32, 64))
+        return new FixedKernel<32, 64, 4, 9>();
+    return NULL;
+}
@@ -0,0 +1,92 @@
+#ifndef ALGORITHM_HOG_KERNEL_HPP
+#define ALGORITHM_HOG_KERNEL_HPP
+
+#include "opencv2/core/core.hpp"
+#include "models.hpp"
+
+#include <vector>
+
+namespace ml {
+namespace hogcpu {
+
+//! One pyramid level's working storage, kept between frames
+struct Level {
+    cv::Mat image;
+    double scale;                   //!< Level size relative to the frame
+    cv::Size grid;                  //!< Cells across and down
+    std::vector<float> cells;       //!< Cell histograms, row-major
+    std::vector<float> blocks;      //!< Normalized block histograms
+    std::vector<cv::Point> hits;    //!< Window origins, in level pixels
+    std::vector<double> scores;
+};
+
+/** \brief HOG features and linear SVM scoring for one window geometry
+ *
+ * Each implementation is compiled for a fixed window size, cell size and
+ * number of bins, with 2x2 cell blocks stepped one cell at a time. Those are
+ * what the loops run over, so their bounds are constant and the histogram
+ * and dot product loops unroll.
+ *
+ * Features follow cv::HOGDescriptor: gamma-corrected centred gradients taking
+ * the strongest colour channel, unsigned orientations interpolated between
+ * the two nearest bins, and L2-Hys block normalization. Votes are spread
+ * bilinearly between the four nearest cells of the whole image rather than
+ * Gaussian-weighted within each block, so scores come close to OpenCV's but
+ * aren't identical.
+ */
+class Kernel {
+public:
+    virtual ~Kernel() { }
+
+    virtual cv::Size winSize() const = 0;
+
+    /** \brief Fill in a level's cell histograms from an image
+     *
+     * \param img 8-bit, 1, 3 or 4 channel image; colour is BGR(A)
+     */
+    virtual void cells(const cv::Mat& img, Level& level) const = 0;
+
+    /** \brief Score every window of a level against a model
+     *
+     * The level's cells must be filled in, from an image or approximated.
+     * Windows are placed every \p stride cells. Those scoring at least
+     * \p threshold are written to the level's hits and scores.
+     */
+    virtual void score(const HogModel& model, double threshold, int stride,
+            Level& level) const = 0;
+
+    //! Compute an image's cells and score them
+    void detect(const cv::Mat& img, const HogModel& model, double threshold,
+            int stride, Level& level) const {
+        cells(img, level);
+        score(model, threshold, stride, level);
+    }
+};
+
+/** \brief Approximate a level's cells by resampling another level's
+ *
+ * Histograms are interpolated onto the new grid and scaled by a power law in
+ * the size ratio, as gradient energy changes with scale (Dollar et al., "Fast
+ * Feature Pyramids for Object Detection"). Close to computing the level from
+ * the image within an octave, for far less work.
+ *
+ * \param src A level with its cells filled in
+ * \param grid Cells across and down in the new level
+ * \param nbins Orientation bins per cell
+ * \param ratio Size of the new level relative to \p src
+ */
+void approximateCells(const Level& src, const cv::Size& grid, int nbins,
+        double ratio, Level& out);
+
+/** \brief Get the kernel compiled for a model's geometry
+ *
+ * Kernels exist for 64x128 and 48x96 windows with 8 pixel cells, and 32x64
+ * windows with 4 pixel cells, all with 9 bins.
+ *
+ * \return NULL if there's none for this model
+ */
+Kernel* makeKernel(const HogModel& model);
+};
+};
+
+#endif
@@ -1,12 +1,16 @@
 #include "hog_ocl_fpga.hpp"
 #include "AOCLUtils/aocl_utils.h"
+#include "grouping.hpp"
+#include "../log/log.hpp"
+
+#include <algorithm>
 
-#define SCALE_GRAN 256
-#define NBINS 9
-#define BLOCK_SIZE 2
-#define CELL_SIZE 8
-#define BLOCK_HIST (NBINS * BLOCK_SIZE * BLOCK_SIZE)
 #define HIT_THRESHOLD 0.01
+// both thresholds are in the SVM kernel's fixed-point units: scores are 16 bit
+// sums that start from SVM_base (-27328) in pedestrian_detect.cl, and hits are
+// anything above zero. The coarse one lets through windows within an eighth of
+// the score range of a hit.
+#define COARSE_THRESHOLD -4096
 
 #define CONF_LIMIT 20
 #define INTERSECT_THRESHOLD 0.5
@@ -15,84 +19,23 @@ using namespace aocl_utils;
 using namespace ml;
 using namespace ml::altera;
 
-void cleanup() { }
+namespace {
+// the geometry the bitstream is built for; see pedestrian_detect.cl
+constexpr int SCALE_GRAN = 256;
+constexpr int NBINS = 9;
+constexpr int BLOCK_SIZE = 2;   // cells per block side
+constexpr int CELL_SIZE = 8;
+constexpr int BLOCK_HIST = NBINS * BLOCK_SIZE * BLOCK_SIZE;
+constexpr int WIN_WIDTH = 64, WIN_HEIGHT = 128;
+constexpr int WIN_CELLS_X = WIN_WIDTH / CELL_SIZE;
+constexpr int WIN_CELLS_Y = WIN_HEIGHT / CELL_SIZE;
+
+//! Cells covering \p pixels, counting a partial cell
+constexpr int cells(int pixels) { return (pixels + CELL_SIZE - 1) / CELL_SIZE; }
+};
 
-void groupRectangles(std::vector<cv::Rect>& rectList,
-        std::vector<double>& weights,
-        int groupThreshold,
-        double eps) {
-    if(groupThreshold <= 0 || rectList.empty()) return;
-
-    CV_Assert(rectList.size() == weights.size());
-
-    std::vector<int> labels;
-    int nclasses = partition(rectList, labels, cv::SimilarRects(eps));
-
-    std::vector<cv::Rect_<double> > rrects(nclasses);
-    std::vector<int> numInClass(nclasses, 0);
-    std::vector<double> foundWeights(nclasses, DBL_MIN);
-    std::vector<double> totalFactorsPerClass(nclasses, 1);
-    int i, j, nlabels = (int)labels.size();
-
-    for( i = 0; i < nlabels; i++ )
-    {
-        int cls = labels[i];
-        rrects[cls].x += rectList[i].x;
-        rrects[cls].y += rectList[i].y;
-        rrects[cls].width += rectList[i].width;
-        rrects[cls].height += rectList[i].height;
-        foundWeights[cls] = cv::max(foundWeights[cls], weights[i]);
-        numInClass[cls]++;
-    }
-
-    for( i = 0; i < nclasses; i++ )
-    {
-        // find the average of all ROI in the cluster
-        cv::Rect_<double> r = rrects[i];
-        double s = 1.0/numInClass[i];
-        rrects[i] = cv::Rect_<double>(cv::saturate_cast<double>(r.x*s),
-                cv::saturate_cast<double>(r.y*s),
-                cv::saturate_cast<double>(r.width*s),
-                cv::saturate_cast<double>(r.height*s));
-    }
-
-    rectList.clear();
-    weights.clear();
-
-    for( i = 0; i < nclasses; i++ )
-    {
-        cv::Rect r1 = rrects[i];
-        int n1 = numInClass[i];
-        double w1 = foundWeights[i];
-        if( n1 <= groupThreshold )
-            continue;
-        for( j = 0; j < nclasses; j++ )
-        {
-            int n2 = numInClass[j];
-
-            if( j == i || n2 <= groupThreshold )
-                continue;
-
-            cv::Rect r2 = rrects[j];
-
-            int dx = cv::saturate_cast<int>( r2.width * eps );
-            int dy = cv::saturate_cast<int>( r2.height * eps );
-
-            if( r1.x >= r2.x - dx &&
-                    r1.y >= r2.y - dy &&
-                    r1.x + r1.width <= r2.x + r2.width + dx &&
-                    r1.y + r1.height <= r2.y + r2.height + dy &&
-                    (n2 > std::max(3, n1) || n1 < 3) )
-                break;
-        }
+void cleanup() { }
 
-        if( j == nclasses )
-        {
-            rectList.push_back(r1);
-            weights.push_back(w1);
-        }
-    }
-}
 void AlteraHOGAlgorithm::check_ocl_rc(cl_int stat, const char* op) {
     if(stat == CL_SUCCESS) return;
 
@@ -106,7 +49,13 @@ void AlteraHOGAlgorithm::check_ocl_rc_run(cl_int stat, const char* op) {
     throw std::runtime_error(op);
 }
 
-AlteraHOGAlgorithm::AlteraHOGAlgorithm(const cv::Size& size) {
+AlteraHOGAlgorithm::AlteraHOGAlgorithm(const cv::Size& size) :
+        m_hitThreshold(HIT_THRESHOLD), m_twoStage(false),
+        m_coarseThreshold(COARSE_THRESHOLD), m_frame(0), m_size(size) {
+    InputSpec spec(4);
+    spec.size = size;
+    m_input.setSpec(spec);
+
     m_res = new BoundingBoxesResult();
     m_results.push_back(m_res);
 
@@ -204,12 +153,60 @@ Algorithm::Info AlteraHOGAlgorithm::getInfo() {
     return m_info;
 }
 
+void AlteraHOGAlgorithm::decodeLevel(const int* res, int blX, int blY,
+        double scale, const cv::Size& pad, ArenaVector<cv::Rect>& locations,
+        ArenaVector<double>& weights) {
+    // window positions, as laid out by the SVM kernel
+    int rows = blY - WIN_CELLS_Y, cols = blX - WIN_CELLS_X + 2;
+    if(rows <= 0 || cols <= 0) return;
+
+    auto emit = [&](int by, int bx) {
+        float s = res[by * cols + bx];
+        if(s < m_hitThreshold) return;
+        int x = bx * CELL_SIZE - pad.width, y = by * CELL_SIZE - pad.height;
+        locations.push_back(cv::Rect(
+                    (int)(x * scale),
+                    (int)((y + CELL_SIZE) * scale),
+                    (int)(WIN_WIDTH * scale),
+                    (int)(WIN_HEIGHT * scale)));
+        weights.push_back(s);
+    };
+
+    if(!m_twoStage) {
+        for(int by = 0;by < rows;by++)
+            for(int bx = 0;bx < cols;bx++) emit(by, bx);
+        return;
+    }
+
+    // coarse pass at a 16 pixel stride, then the full 8 pixel grid only
+    // around windows that clear the low first-stage threshold
+    m_visited.assign(rows * cols, 0);
+    for(int by = 0;by < rows;by += 2) {
+        for(int bx = 0;bx < cols;bx += 2) {
+            if(res[by * cols + bx] < m_coarseThreshold) continue;
+            int y1 = std::min(by + 1, rows - 1), x1 = std::min(bx + 1, cols - 1);
+            for(int ny = std::max(by - 1, 0);ny <= y1;ny++) {
+                for(int nx = std::max(bx - 1, 0);nx <= x1;nx++) {
+                    char& v = m_visited[ny * cols + nx];
+                    if(v) continue;
+                    v = 1;
+                    emit(ny, nx);
+                }
+            }
+        }
+    }
+}
+
 const std::vector<AlgorithmResult*>& AlteraHOGAlgorithm::analyze(const cv::Mat& mat) {
-    double scale = 1;
-    double scale0 = pow(mat.rows / 128, 1.0/LEVELS);
+    FrameArena::Scope frameScope(m_arena);
+    // converted, and fitted to the size the device buffers were made for,
+    // straight into the buffer the device copy is made from
+    cv::Mat in(m_size, CV_8UC4, d_imgBuffer);
+    m_input.run(mat, in);
 
-    int inSize = mat.rows * mat.cols * mat.elemSize();
-    memcpy(d_imgBuffer, mat.data, inSize);
+    double scale = 1;
+    double scale0 = pow((double)in.rows / WIN_HEIGHT, 1.0/LEVELS);
+    int inSize = in.rows * in.cols * in.elemSize();
     cl_int status = clEnqueueWriteBuffer(q0,
             d_originalData, CL_TRUE, 0,
             inSize, d_imgBuffer, 0, NULL, NULL);
@@ -219,27 +216,27 @@ const std::vector<AlgorithmResult*>& AlteraHOGAlgorithm::analyze(const cv::Mat&
         normalized[LEVELS], svmed[LEVELS];
     cv::Size _paddingTL(32, 32);
     cv::Size _paddingBR(32, 32);
-    std::vector<cv::Rect> locations;
-    std::vector<double> weights;
+    ArenaVector<cv::Rect> locations(m_arena);
+    ArenaVector<double> weights(m_arena);
 
     for(int level=0;level < LEVELS;level++) {
         cl_int scale_int = cvRound((float)SCALE_GRAN / scale);
 
         cv::Size sz(
-                cvRound(mat.cols*scale_int/SCALE_GRAN),
-                cvFloor(mat.rows*scale_int/SCALE_GRAN));
+                cvRound(in.cols*scale_int/SCALE_GRAN),
+                cvFloor(in.rows*scale_int/SCALE_GRAN));
         cv::Size gradsize (sz.width + _paddingTL.width + _paddingBR.width,
                 sz.height + _paddingTL.height + _paddingBR.height);
 
-        int blX = (gradsize.width + 7) / 8;
-        int blY = (gradsize.height + 7) / 8;
+        int blX = cells(gradsize.width);
+        int blY = cells(gradsize.height);
 
         int delta = (_paddingTL.width + _paddingTL.height *
                 (sz.width + _paddingTL.width + _paddingBR.width));
         int padding = _paddingTL.width;
 
         // enqueue resize kernel
-        cl_int mrows = mat.rows, mcols = mat.cols;
+        cl_int mrows = in.rows, mcols = in.cols;
         check_ocl_rc_run(clSetKernelArg(k_resize, 0, sizeof(cl_int),
                     &scale_int), "Failed to configure resize kernel");
         check_ocl_rc_run(clSetKernelArg(k_resize, 1, sizeof(cl_mem),
@@ -277,9 +274,8 @@ const std::vector<AlgorithmResult*>& AlteraHOGAlgorithm::analyze(const cv::Mat&
         int pixels = (blX*blY+2)*BLOCK_HIST;
         check_ocl_rc_run(clSetKernelArg(k_norm, 2, sizeof(cl_int),
                     &pixels), "Failed to configure norm kernel");
-        int pixwrite = (gradsize.height) / CELL_SIZE * ((
-                        gradsize.width + CELL_SIZE - 1)
-                        / CELL_SIZE)*BLOCK_HIST;
+        int pixwrite = gradsize.height / CELL_SIZE * cells(gradsize.width) *
+            BLOCK_HIST;
         check_ocl_rc_run(clSetKernelArg(k_norm, 3, sizeof(cl_int),
                     &pixwrite), "Failed to configure norm kernel");
         check_ocl_rc_run(clEnqueueTask(q3, k_norm, 0, NULL, NULL),
@@ -299,9 +295,9 @@ const std::vector<AlgorithmResult*>& AlteraHOGAlgorithm::analyze(const cv::Mat&
         clEnqueueReadBuffer(q4, d_inData[level], CL_FALSE, 0,
                 outSize, h_results[level], 0, NULL, NULL);
 
-        // update scale
-        if(cvRound(mat.cols / scale) < 64 || cvRound(mat.rows / scale) < 64
-                || scale0 <= 1)
+        // update scale; the same test as decoding, so no level is wasted
+        if(cvRound(in.cols / scale) < WIN_WIDTH ||
+                cvRound(in.rows / scale) < WIN_HEIGHT || scale0 <= 1)
             break;
         scale *= scale0;
         scale = SCALE_GRAN / scale;
@@ -313,33 +309,19 @@ const std::vector<AlgorithmResult*>& AlteraHOGAlgorithm::analyze(const cv::Mat&
     scale = 1;
     for(int level = 0;level < LEVELS;level++) {
         cv::Size sz(
-                cvFloor(mat.cols/scale),
-                cvFloor(mat.rows/scale));
+                cvFloor(in.cols/scale),
+                cvFloor(in.rows/scale));
         int scale_int = cvRound((float)SCALE_GRAN / scale);
         cv::Size gradsize(
                 sz.width + _paddingTL.width + _paddingBR.width,
                 sz.height + _paddingTL.height + _paddingBR.height);
-        int blX = (gradsize.width + 7) / 8; 
-        int blY = (gradsize.height + 7) / 8; 
-        int outSize = blX * blY * sizeof(float);
-        int where = 0;
-
-        for(int y = -_paddingTL.height, by = 0;by < (blY - 16);by++, y += 8) {
-            for (int x = -_paddingTL.width, bx = 0; bx < blX - 8 + 2; bx++, x += 8) {
-                float s = h_results[level][where++];
-                if (s >= HIT_THRESHOLD) {
-                    locations.push_back(cv::Rect(
-                                (int)(x * scale),
-                                (int)((y + 8) * scale),
-                                (int)(64 * scale),
-                                (int)(128 * scale)));
-                    weights.push_back(s);
-                }
-            }
-        }
+        int blX = cells(gradsize.width);
+        int blY = cells(gradsize.height);
+        decodeLevel(h_results[level], blX, blY, scale, _paddingTL,
+                locations, weights);
 
-        if( cvRound(mat.cols/scale) < 64 ||
-                cvRound(mat.rows/scale) < 128 ||
+        if( cvRound(in.cols/scale) < WIN_WIDTH ||
+                cvRound(in.rows/scale) < WIN_HEIGHT ||
                 scale0 <= 1 )
             break;
         scale *= scale0;
@@ -349,72 +331,47 @@ const std::vector<AlgorithmResult*>& AlteraHOGAlgorithm::analyze(const cv::Mat&
         scale = SCALE_GRAN / scale;
     }
 
-    groupRectangles(locations, weights, 1, 0.2);
-
+    m_allocs.start();
+    groupRectangles(locations, weights, 1, 0.2, m_arena);
+    for(auto& r : locations) r = m_input.toFrame(r);
     m_res->boxes.clear();
+    m_allocs.stop();
 
     // update all trackers
-    for(std::list<TrackingInfo>::iterator i = m_track.begin();
-            i != m_track.end();) {
-        cv::Rect2d r;
-        if(!i->tracker->update(mat, r)) {
-            i = m_track.erase(i);
-            continue;
-        }
-        i->last_pos = r;
-        i->confirm_frames++;
-        i++;
-    }
+    updateTracks(m_track, mat);
 
     // isolate bounds that already have detected people
-    for(auto i : m_track) {
-        for(int j = 0;j < locations.size();j++) {
-            cv::Rect r_t = i.last_pos;
-            cv::Rect r_d = locations[j];
-            if(r_t.contains(r_d.tl()) && r_t.contains(r_d.br())) {
-                // readjust tracking rectangle
-                i.confirm_frames = 0;
-                i.last_pos = r_t;
-                i.tracker->init(mat, r_t);
-                locations.erase(locations.begin()+j);
-                j--; // revisit the same index next time around
-                continue;
-            }
-            cv::Rect isect = r_t & r_d;
-            if((isect.area() >= INTERSECT_THRESHOLD*r_t.area()) &&
-                    (isect.area() >= INTERSECT_THRESHOLD*r_d.area())) {
-                // they intersect - update the confirm count
-                i.confirm_frames = 0;
-                locations.erase(locations.begin()+j);
-                j--; // revisit the same index next time around
-            }
-        }
-    }
+    m_allocs.start();
+    associateDetections(m_track, locations, mat, INTERSECT_THRESHOLD, true);
 
     // delete old trackers
-    m_track.remove_if(
-            [](TrackingInfo i) { return i.confirm_frames > CONF_LIMIT; });
+    retireTracks(m_track, CONF_LIMIT);
+    m_allocs.stop();
 
     // create new tracking bounds for others
     for(auto r : locations) {
         TrackingInfo inf;
-        inf.tracker = cv::Tracker::create("TLD");
+        inf.tracker = createTracker("TLD");
         inf.last_pos = r;
-        inf.id = rand();
+        inf.id = nextId();
         inf.confirm_frames = 0;
         inf.tracker->init(mat, r);
         m_track.push_back(inf);
     }
 
     // construct results
+    m_allocs.start();
     for(auto t : m_track) {
         BoundingBox b;
         b.id = t.id;
         b.tag = 0;
         b.bounds = t.last_pos;
         m_res->boxes.push_back(b);
-        printf("%d\n", t.confirm_frames);
+        LOG_DEBUG("hog-ocl-fpga", "Track %u confirmed for %u frames", t.id,
+                t.confirm_frames);
     }
+    m_allocs.stop();
+    checkSteadyState("hog-ocl-fpga", m_frame++, m_allocs);
 
     /*
     for(int i = 0;i < locations.size();i++) {
@@ -437,6 +394,20 @@ const std::vector<AlgorithmResult*>& AlteraHOGAlgorithm::analyze(const cv::Mat&
     return m_results;
 }
 
+bool AlteraHOGAlgorithm::setParam(const std::string& name,
+        const std::string& value) {
+    try {
+        if(name == "hit_threshold") m_hitThreshold = std::stod(value);
+        else if(name == "two_stage") m_twoStage = std::stoi(value) != 0;
+        else if(name == "coarse_threshold")
+            m_coarseThreshold = std::stod(value);
+        else return false;
+    } catch(const std::logic_error& e) {
+        return false;
+    }
+    return true;
+}
+
 extern "C" int count() {
     return 1;
 }
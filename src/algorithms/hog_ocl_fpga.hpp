@@ -6,6 +6,9 @@
 #include "opencv2/tracking.hpp"
 #include "AOCLUtils/aocl_utils.h"
 #include "../algorithm.hpp"
+#include "arena.hpp"
+#include "preprocess.hpp"
+#include "tracking.hpp"
 
 #include <vector>
 
@@ -14,13 +17,6 @@
 namespace ml {
 namespace altera {
 
-struct TrackingInfo {
-    cv::Ptr<cv::Tracker> tracker;
-    cv::Rect last_pos;
-    unsigned int id;
-    unsigned int confirm_frames;
-};
-
 class AlteraHOGAlgorithm : public Algorithm {
 private:
     cl_context ctx;
@@ -28,8 +24,9 @@ private:
     cl_program pgm;
     cl_kernel k_svm, k_resize, k_gradient, k_histogram, k_norm;
 
-    // original image data buffer
+    // original image data buffer, written by the preprocessor as BGRA
     char* d_imgBuffer;
+    Preprocessor m_input;
 
     // temporary buffers
     cl_mem d_originalData;
@@ -39,13 +36,28 @@ private:
     int* h_results[LEVELS];
 
     BoundingBoxesResult* m_res;
-    std::list<TrackingInfo> m_track;
+    TrackList m_track;
+
+    double m_hitThreshold;
+    bool m_twoStage;           // decode coarse-to-fine
+    double m_coarseThreshold;  // first stage threshold
+    std::vector<char> m_visited;
+
+    FrameArena m_arena;         // per-frame detections and grouping
+    AllocationCounter m_allocs;
+    long m_frame;
+    cv::Size m_size;            // frame size the device buffers are for
 
     Algorithm::Info m_info = Algorithm::Info(
             "OpenCL FPGA-based HOG SVM", "hog-ocl-fpga",
             "Altera's HOG SVM classifier running on an FPGA via OpenCL",
             0, false, true);
 
+    //! Turn one level's SVM scores into detection windows
+    void decodeLevel(const int* res, int blX, int blY, double scale,
+            const cv::Size& pad, ArenaVector<cv::Rect>& locations,
+            ArenaVector<double>& weights);
+
     //! Raise an appropriate exception if the given OCL op failed
     void check_ocl_rc(cl_int stat, const char* op);
 
@@ -58,6 +70,7 @@ public:
 
     Info getInfo();
     const std::vector<AlgorithmResult*>& analyze(const cv::Mat& mat);
+    bool setParam(const std::string& name, const std::string& value);
 };
 
 extern "C" int count();
@@ -0,0 +1,27 @@
+#ifndef ALGORITHM_LEVELS_HPP
+#define ALGORITHM_LEVELS_HPP
+
+#include "opencv2/core/core.hpp"
+
+#include <functional>
+
+namespace ml {
+
+/** \brief Runs one pyramid level per iteration of cv::parallel_for_
+ *
+ * Lets the detectors hand their per-level work to OpenCV's thread pool as a
+ * lambda taking the level's index.
+ */
+class LevelBody : public cv::ParallelLoopBody {
+public:
+    typedef std::function<void(int)> Fn;
+    LevelBody(const Fn& fn) : m_fn(fn) {}
+    void operator()(const cv::Range& r) const {
+        for(int i = r.start;i < r.end;i++) m_fn(i);
+    }
+private:
+    Fn m_fn;
+};
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "models.hpp"
+#include "../algorithm.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ml;
+
+static_assert(sizeof(HogModelHeader) == 128, "HogModelHeader must be packed");
+
+namespace {
+//! A descriptor with the defaults of cv::HOGDescriptor(), gamma correction on
+cv::HOGDescriptor makeDescriptor(cv::Size win, cv::Size block, cv::Size stride,
+        cv::Size cell, int nbins) {
+    return cv::HOGDescriptor(win, block, stride, cell, nbins, 1, -1,
+            cv::HOGDescriptor::L2Hys, 0.2, true);
+}
+};
+
+HogModel::HogModel() : m_weights(NULL), m_length(0), m_bias(0),
+        m_map(NULL), m_mapSize(0) {
+}
+
+HogModel::~HogModel() {
+    if(m_map) munmap(m_map, m_mapSize);
+}
+
+HogModel* HogModel::builtin(const std::string& name, cv::Size win,
+        const std::vector<float>& detector) {
+    HogModel* m = new HogModel();
+    m->m_name = name;
+    m->m_builtin.assign(detector.begin(), detector.end() - 1);
+    m->m_weights = m->m_builtin.data();
+    m->m_length = m->m_builtin.size();
+    m->m_bias = detector.back();
+    m->m_hog = makeDescriptor(win, cv::Size(16, 16), cv::Size(8, 8),
+            cv::Size(8, 8), 9);
+    m->m_hog.setSVMDetector(detector);
+    return m;
+}
+
+HogModel* HogModel::map(const fs::path& file) {
+    const std::string what = "Cannot load HOG model " + file.string();
+    int fd = open(file.c_str(), O_RDONLY);
+    if(fd < 0) throw algorithm_init_error(what, strerror(errno));
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(HogModelHeader)) {
+        close(fd);
+        throw algorithm_init_error(what, "File is too short");
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if(p == MAP_FAILED) throw algorithm_init_error(what, strerror(err));
+
+    // from here the mapping belongs to the model
+    std::unique_ptr<HogModel> m(new HogModel());
+    m->m_map = p;
+    m->m_mapSize = st.st_size;
+
+    // files are little-endian, as is everything this runs on
+    const HogModelHeader& h = *static_cast<const HogModelHeader*>(p);
+    if(memcmp(h.magic, HOG_MODEL_MAGIC, sizeof(h.magic)) != 0)
+        throw algorithm_init_error(what, "Not a HOG model file");
+    if(h.version != HOG_MODEL_VERSION || h.headerSize < sizeof(h)) {
+        throw algorithm_init_error(what,
+                "Unsupported model version " + std::to_string(h.version));
+    }
+    if(h.winWidth <= 0 || h.winHeight <= 0 || h.nbins <= 0 ||
+            h.blockWidth <= 0 || h.blockHeight <= 0 ||
+            h.strideX <= 0 || h.strideY <= 0 ||
+            h.cellWidth <= 0 || h.cellHeight <= 0 ||
+            h.blockWidth > h.winWidth || h.blockHeight > h.winHeight ||
+            (h.winWidth - h.blockWidth) % h.strideX != 0 ||
+            (h.winHeight - h.blockHeight) % h.strideY != 0 ||
+            h.blockWidth % h.cellWidth != 0 ||
+            h.blockHeight % h.cellHeight != 0)
+        throw algorithm_init_error(what, "Invalid window geometry");
+
+    m->m_hog = makeDescriptor(cv::Size(h.winWidth, h.winHeight),
+            cv::Size(h.blockWidth, h.blockHeight),
+            cv::Size(h.strideX, h.strideY),
+            cv::Size(h.cellWidth, h.cellHeight), h.nbins);
+    if(h.length != m->m_hog.getDescriptorSize())
+        throw algorithm_init_error(what, "Weights don't match the geometry");
+    if(h.dataOffset % HOG_MODEL_ALIGN != 0 || h.dataOffset < h.headerSize ||
+            h.dataOffset + (size_t)h.length * sizeof(float) > m->m_mapSize)
+        throw algorithm_init_error(what, "Weights are misplaced or truncated");
+
+    m->m_name = std::string(h.name, strnlen(h.name, sizeof(h.name)));
+    m->m_weights = reinterpret_cast<const float*>(
+            static_cast<const char*>(p) + h.dataOffset);
+    m->m_length = h.length;
+    m->m_bias = h.bias;
+
+    // OpenCV keeps its own copy; it's made once per model, not per detector
+    std::vector<float> detector(m->m_weights, m->m_weights + m->m_length);
+    detector.push_back(m->m_bias);
+    m->m_hog.setSVMDetector(detector);
+    return m.release();
+}
+
+static ModelStore* storeInstance = NULL;
+
+ModelStore::ModelStore() {
+    fs::path models("models");
+    if(fs::exists(models) && fs::is_directory(models))
+        m_searchPaths.push_back(models);
+    m_searchPaths.push_back(fs::path("."));
+}
+
+ModelStore& ModelStore::get() {
+    static std::once_flag once;
+    std::call_once(once, []() { storeInstance = new ModelStore(); });
+    return *storeInstance;
+}
+
+std::shared_ptr<const HogModel> ModelStore::hog(const std::string& name) {
+    std::lock_guard<std::mutex> l(m_lock);
+
+    // built-in models are keyed by name, files by where they really are
+    std::string key = name;
+    fs::path file;
+    if(name != "default" && name != "daimler") {
+        file = name;
+        for(auto itr = m_searchPaths.begin();
+                itr != m_searchPaths.end() && !fs::is_regular_file(file);
+                itr++)
+            file = *itr / (name + HOG_MODEL_EXTENSION);
+        if(!fs::is_regular_file(file)) {
+            throw algorithm_init_error("Cannot load HOG model " + name,
+                    "No such model");
+        }
+        key = fs::canonical(file).string();
+    }
+
+    auto itr = m_hog.find(key);
+    if(itr != m_hog.end()) return itr->second;
+
+    HogModel* m;
+    if(name == "default") {
+        m = HogModel::builtin("OpenCV default people detector",
+                cv::Size(64, 128),
+                cv::HOGDescriptor::getDefaultPeopleDetector());
+    } else if(name == "daimler") {
+        m = HogModel::builtin("OpenCV Daimler people detector",
+                cv::Size(48, 96),
+                cv::HOGDescriptor::getDaimlerPeopleDetector());
+    } else {
+        m = HogModel::map(file);
+    }
+    std::shared_ptr<const HogModel> model(m);
+    m_hog[key] = model;
+    return model;
+}
+
+void ModelStore::search(fs::path dir) {
+    if(!fs::exists(dir) || !fs::is_directory(dir))
+        throw std::invalid_argument("Not a valid search directory");
+    std::lock_guard<std::mutex> l(m_lock);
+    m_searchPaths.push_back(dir);
+}
+
+std::vector<std::string> ModelStore::list() const {
+    std::vector<std::string> names = { "default", "daimler" };
+    std::lock_guard<std::mutex> l(m_lock);
+    for(auto p : m_searchPaths) {
+        try {
+            for(auto e : fs::directory_iterator(p)) {
+                if(e.path().extension() == HOG_MODEL_EXTENSION)
+                    names.push_back(e.path().stem().string());
+            }
+        } catch(fs::filesystem_error& e) {
+            continue;
+        }
+    }
+    return names;
+}
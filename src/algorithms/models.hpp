@@ -0,0 +1,130 @@
+#ifndef ALGORITHM_MODELS_HPP
+#define ALGORITHM_MODELS_HPP
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/filesystem.hpp>
+
+#define HOG_MODEL_MAGIC "PDHOGSVM"
+#define HOG_MODEL_VERSION 1
+#define HOG_MODEL_EXTENSION ".hogmodel"
+#define HOG_MODEL_ALIGN 64  // weights start on a cache line
+
+namespace ml {
+
+namespace fs = boost::filesystem;
+
+/** \brief Header of a `.hogmodel` file
+ *
+ * All fields are little-endian. The weights follow at dataOffset as `length`
+ * float32s in HOG descriptor order: one block after another, in the order
+ * cv::HOGDescriptor walks them, each block's cells and bins contiguous. That's
+ * the order the scoring loop reads them in, so they're used straight from the
+ * mapping. tools/export_hog_model.py writes these.
+ */
+struct HogModelHeader {
+    char magic[8];          //!< HOG_MODEL_MAGIC, without a terminator
+    uint32_t version;       //!< HOG_MODEL_VERSION
+    uint32_t headerSize;    //!< sizeof(HogModelHeader)
+    int32_t winWidth, winHeight;
+    int32_t blockWidth, blockHeight;
+    int32_t strideX, strideY;
+    int32_t cellWidth, cellHeight;
+    int32_t nbins;
+    uint32_t length;        //!< Number of weights, not counting the bias
+    float bias;
+    uint32_t dataOffset;    //!< Start of the weights; a multiple of 64
+    char name[64];          //!< NUL-terminated description
+};
+
+/** \brief An immutable HOG linear SVM
+ *
+ * Models are only made by the ModelStore, and shared between every detector
+ * using them. File-backed models are mapped read-only.
+ */
+class HogModel {
+public:
+    ~HogModel();
+
+    const std::string& name() const { return m_name; }
+    cv::Size winSize() const { return m_hog.winSize; }
+
+    //! The SVM weights in descriptor order, without the bias
+    const float* weights() const { return m_weights; }
+    size_t length() const { return m_length; }
+    float bias() const { return m_bias; }
+
+    /** \brief A HOG descriptor set up with this model
+     *
+     * cv::HOGDescriptor's detection methods are const, so one descriptor
+     * serves any number of detectors and threads.
+     */
+    const cv::HOGDescriptor& descriptor() const { return m_hog; }
+
+private:
+    friend class ModelStore;
+
+    HogModel();
+    HogModel(const HogModel&) = delete;
+    HogModel& operator=(const HogModel&) = delete;
+
+    //! Make a model from one of OpenCV's built-in detectors
+    static HogModel* builtin(const std::string& name, cv::Size win,
+            const std::vector<float>& detector);
+
+    //! Map a `.hogmodel` file. Throws algorithm_init_error if it's invalid.
+    static HogModel* map(const fs::path& file);
+
+    std::string m_name;
+    const float* m_weights;
+    size_t m_length;
+    float m_bias;
+    cv::HOGDescriptor m_hog;
+
+    std::vector<float> m_builtin;   // weights of a built-in model
+    void* m_map;                    // mapping of a file-backed model
+    size_t m_mapSize;
+};
+
+/** \brief Loads detector models once and shares them
+ *
+ * Models are named either by a path to a model file, by the name of a file
+ * in one of the search paths without its extension, or by one of the models
+ * built into OpenCV: `default` (64x128 people) and `daimler` (48x96 people).
+ * The first request for a model loads it; later ones get the same instance.
+ * Models stay loaded until the program exits.
+ */
+class ModelStore {
+public:
+    static ModelStore& get();
+
+    /** \brief Get a HOG model
+     *
+     * \throws algorithm_init_error if it can't be found or loaded
+     */
+    std::shared_ptr<const HogModel> hog(const std::string& name);
+
+    //! Add a directory to search for model files
+    void search(fs::path dir);
+
+    //! Names of the built-in models and the model files in the search paths
+    std::vector<std::string> list() const;
+
+private:
+    ModelStore();
+
+    mutable std::mutex m_lock;
+    std::vector<fs::path> m_searchPaths;
+    std::map<std::string, std::shared_ptr<const HogModel> > m_hog;
+};
+};
+
+#endif
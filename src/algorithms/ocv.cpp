@@ -1,14 +1,26 @@
 #include "ocv.hpp"
+#include "grouping.hpp"
+#include "levels.hpp"
+#include "../log/log.hpp"
+#include <algorithm>
 #include <vector>
+#include <string>
+#include <stdexcept>
 
 #define CONF_LIMIT 20
 #define INTERSECT_THRESHOLD 0.5
 
+using namespace ml;
 using namespace ml::ocv;
 using namespace cv;
 
-OCVAlgorithm::OCVAlgorithm() {
-    m_hog.setSVMDetector(HOGDescriptor::getDefaultPeopleDetector());
+OCVAlgorithm::OCVAlgorithm() : m_hitThreshold(0.5), m_winStride(8),
+        m_scale(0.0), m_groupThreshold(2), m_trackerType("TLD"),
+        m_detect(true), m_maxLevels(0),
+        m_local(false), m_fullInterval(10), m_searchMargin(0.5), m_frame(0),
+        m_twoStage(false), m_coarseStride(16), m_fineStride(4),
+        m_coarseThreshold(0.0) {
+    m_model = ModelStore::get().hog("default");
 
     m_results.push_back(new BoundingBoxesResult());
 }
@@ -27,99 +39,173 @@ ml::Algorithm::Info OCVAlgorithm::getInfo() {
     return info;
 }
 
+void OCVAlgorithm::detectTwoStage(const Mat& img, double scale,
+        std::vector<Rect>& found) {
+    const HOGDescriptor& hog = m_model->descriptor();
+    Size win = hog.winSize, pad(32, 32);
+    ArenaVector<double> levels(m_arena);
+    for(double s = 1;cvRound(img.cols / s) >= win.width &&
+            cvRound(img.rows / s) >= win.height;s *= scale) {
+        levels.push_back(s);
+        if(scale <= 1) break;
+    }
+    if(m_levels.size() < levels.size()) m_levels.resize(levels.size());
+
+    parallel_for_(Range(0, levels.size()), LevelBody([&](int i) {
+        double s = levels[i];
+        LevelScratch& sc = m_levels[i];
+        sc.rects.clear();
+        sc.weights.clear();
+        if(s != 1) resize(img, sc.image, Size(cvRound(img.cols / s),
+                    cvRound(img.rows / s)));
+        const Mat& level = s == 1 ? img : sc.image;
+
+        // cheap sparse pass with a permissive threshold
+        std::vector<Point>& hits = sc.hits;
+        std::vector<double>& w = sc.weights;
+        hits.clear();
+        hog.detect(level, hits, w, m_coarseThreshold,
+                Size(m_coarseStride, m_coarseStride), pad);
+
+        // dense windows filling in the coarse grid around each candidate; a
+        // fine stride wider than the coarse one only rescores the candidates
+        std::vector<Point>& around = sc.around;
+        around.clear();
+        int reach = std::max(m_coarseStride - m_fineStride, 0);
+        for(auto p : hits)
+            for(int dy = -reach;dy <= reach;dy += m_fineStride)
+                for(int dx = -reach;dx <= reach;dx += m_fineStride)
+                    around.push_back(p + Point(dx, dy));
+        w.clear();
+        if(around.empty()) return;
+        std::sort(around.begin(), around.end(),
+                [](const Point& a, const Point& b) {
+                    return a.y < b.y || (a.y == b.y && a.x < b.x); });
+        around.erase(std::unique(around.begin(), around.end()), around.end());
+
+        hits.clear();
+        hog.detect(level, hits, w, m_hitThreshold,
+                Size(m_fineStride, m_fineStride), pad, around);
+        for(size_t j = 0;j < hits.size();j++) {
+            sc.rects.push_back(Rect(cvRound(hits[j].x * s),
+                        cvRound(hits[j].y * s), cvRound(win.width * s),
+                        cvRound(win.height * s)));
+        }
+    }));
+
+    m_allocs.start();
+    ArenaVector<double> allWeights(m_arena);
+    for(size_t i = 0;i < levels.size();i++) {
+        found.insert(found.end(), m_levels[i].rects.begin(),
+                m_levels[i].rects.end());
+        allWeights.insert(allWeights.end(), m_levels[i].weights.begin(),
+                m_levels[i].weights.end());
+    }
+    groupRectangles(found, allWeights, m_groupThreshold, 0.2, m_arena);
+    m_allocs.stop();
+}
+
+bool OCVAlgorithm::verifyTrack(const Mat& img, const TrackingInfo& t,
+        double step) {
+    const HOGDescriptor& hog = m_model->descriptor();
+    Size win = hog.winSize;
+    Rect pos = t.last_pos;
+    int mx = pos.width * m_searchMargin, my = pos.height * m_searchMargin;
+    Rect roi = Rect(pos.x - mx, pos.y - my, pos.width + 2*mx,
+            pos.height + 2*my) & Rect(0, 0, img.cols, img.rows);
+    if(roi.area() == 0) return false;
+
+    // the track's own pyramid level and one either side of it, unless a step
+    // that doesn't shrink would make those the same level again
+    double level = (double)pos.height / win.height;
+    int spread = step > 1 ? 1 : 0;
+    double best = -1;
+    Rect found;
+    for(int k = -spread;k <= spread;k++) {
+        double s = level * pow(step, k);
+        Size sz(cvRound(roi.width / s), cvRound(roi.height / s));
+        if(sz.width < win.width || sz.height < win.height) continue;
+
+        resize(img(roi), m_search, sz);
+        m_hits.clear();
+        m_weights.clear();
+        hog.detect(m_search, m_hits, m_weights, m_hitThreshold,
+                Size(m_winStride, m_winStride), Size(0, 0));
+        for(size_t i = 0;i < m_hits.size();i++) {
+            if(m_weights[i] <= best) continue;
+            best = m_weights[i];
+            found = Rect(roi.x + cvRound(m_hits[i].x * s),
+                    roi.y + cvRound(m_hits[i].y * s),
+                    cvRound(win.width * s), cvRound(win.height * s));
+        }
+    }
+    if(best < 0) return false;
+
+    // only accept a hit that's still on the tracked person
+    Rect isect = found & pos;
+    return isect.area() >= INTERSECT_THRESHOLD * std::min(found.area(),
+            pos.area());
+}
+
 const std::vector<ml::AlgorithmResult*>& OCVAlgorithm::analyze(const Mat& img) {
+    // per-frame temporaries come from the arena, which is reset on return
+    FrameArena::Scope frameScope(m_arena);
     BoundingBoxesResult& res = *dynamic_cast<BoundingBoxesResult*>(m_results[0]);
     res.boxes.clear();
     m_locs.clear();
 
-    // update all trackers
-    for(std::list<TrackingInfo>::iterator i = m_track.begin();
-            i != m_track.end();) {
-        Rect2d r;
-        if(!i->tracker->update(img, r)) {
-            i = m_track.erase(i);
-            continue;
-        }
-        i->last_pos = r;
-        i->confirm_frames++;
-        i++;
-    }
+    // update all trackers, then drop any that have converged on each other
+    updateTracks(m_track, img);
+    dedupTracks(m_track, INTERSECT_THRESHOLD);
 
-    // pairwise rectangle intersection/deduplication
-    {
-        std::list<TrackingInfo>::iterator i,j;
-        for(i = m_track.begin();i != m_track.end();i++) {
-            j = i;
-            j++;
-            for(;j != m_track.end();) {
-                Rect ri = i->last_pos;
-                Rect rj = j->last_pos;
-                Rect join = ri & rj;
-                if(join.area() == 0) {
-                    j++;
-                    continue;
-                }
-
-                if((join == rj) ||
-                        (join.area() >= INTERSECT_THRESHOLD*rj.area())) {
-                    // eliminate the second
-                    j = m_track.erase(j);
-                    continue;
-                }
-                j++;
-            }
-        }
+    double range = (double)img.rows / m_model->winSize().height;
+    double scale = m_scale > 0 ? m_scale : pow(range, 1.0 / 24);
+    if(m_maxLevels > 0) scale = std::max(scale, pow(range, 1.0 / m_maxLevels));
+
+    if(m_local && m_detect) {
+        // confirm each track by searching only around it
+        for(auto& t : m_track)
+            if(verifyTrack(img, t, scale)) t.confirm_frames = 0;
     }
 
-    m_hog.detectMultiScale(img, m_locs,
-            0.5,        // hitThreshold
-            Size(8,8),  // winStride
-            Size(32,32),// padding
-            pow(img.rows / 128, 1.0 / 24),     // scale
-            2);         // finalThreshold
-
-    // isolate bounds that already have detected people
-    for(auto i : m_track) {
-        for(int j = 0;j < m_locs.size();j++) {
-            Rect r_t = i.last_pos;
-            Rect r_d = m_locs[j];
-            if(r_t.contains(r_d.tl()) && r_t.contains(r_d.br())) {
-                // readjust tracking rectangle
-                i.confirm_frames = 0;
-                i.last_pos = r_t;
-                i.tracker->init(img, r_t);
-                m_locs.erase(m_locs.begin()+j);
-                j--; // revisit the same index next time around
-                continue;
-            }
-            Rect isect = r_t & r_d;
-            if((isect.area() >= INTERSECT_THRESHOLD*r_t.area()) ||
-                    (isect.area() >= INTERSECT_THRESHOLD*r_d.area())) {
-                // they intersect - update the confirm count
-                i.confirm_frames = 0;
-                i.last_pos |= r_d;
-                m_locs.erase(m_locs.begin()+j);
-                j--; // revisit the same index next time around
-            }
+    // a full-frame search finds people we aren't tracking yet
+    if(m_detect && (!m_local || m_frame % m_fullInterval == 0)) {
+        if(m_twoStage) {
+            detectTwoStage(img, scale, m_locs);
+        } else {
+            m_model->descriptor().detectMultiScale(img, m_locs,
+                    m_hitThreshold,
+                    Size(m_winStride, m_winStride),
+                    Size(32,32),// padding
+                    scale,
+                    m_groupThreshold); // finalThreshold
         }
+
+        // isolate bounds that already have detected people
+        m_allocs.start();
+        associateDetections(m_track, m_locs, img, INTERSECT_THRESHOLD, false);
+        m_allocs.stop();
     }
+    m_frame++;
 
     // delete old trackers
-    m_track.remove_if(
-            [](TrackingInfo i) { return i.confirm_frames > CONF_LIMIT; });
+    m_allocs.start();
+    retireTracks(m_track, CONF_LIMIT);
+    m_allocs.stop();
 
     // create new tracking bounds for others
     for(auto r : m_locs) {
         TrackingInfo inf;
-        inf.tracker = Tracker::create("TLD");
+        inf.tracker = createTracker(m_trackerType);
         inf.last_pos = r;
-        inf.id = rand();
+        inf.id = nextId();
         inf.confirm_frames = 0;
         inf.tracker->init(img, r);
         m_track.push_back(inf);
     }
 
     // construct results
+    m_allocs.start();
     for(auto t : m_track) {
         BoundingBox b;
         b.id = t.id;
@@ -127,10 +213,75 @@ const std::vector<ml::AlgorithmResult*>& OCVAlgorithm::analyze(const Mat& img) {
         b.bounds = t.last_pos;
         res.boxes.push_back(b);
     }
+    m_allocs.stop();
+    checkSteadyState("ocv-hog-svm", m_frame, m_allocs);
 
     return m_results;
 }
 
+bool OCVAlgorithm::setParam(const std::string& name, const std::string& value) {
+    try {
+        if(name == "hit_threshold") {
+            m_hitThreshold = std::stod(value);
+        } else if(name == "win_stride") {
+            int v = std::stoi(value);
+            if(v <= 0) return false;
+            m_winStride = v;
+        } else if(name == "scale") {
+            double v = std::stod(value);
+            if(v != 0 && v <= 1.0) return false;
+            m_scale = v;
+        } else if(name == "group_threshold") {
+            m_groupThreshold = std::stoi(value);
+        } else if(name == "detect") {
+            m_detect = std::stoi(value) != 0;
+        } else if(name == "max_levels") {
+            int v = std::stoi(value);
+            if(v < 0) return false;
+            m_maxLevels = v;
+        } else if(name == "tracker") {
+            if(!createTracker(value)) return false;
+            m_trackerType = value;
+        } else if(name == "mode") {
+            if(value == "full") m_local = false;
+            else if(value == "local") m_local = true;
+            else return false;
+        } else if(name == "full_interval") {
+            int v = std::stoi(value);
+            if(v <= 0) return false;
+            m_fullInterval = v;
+        } else if(name == "two_stage") {
+            m_twoStage = std::stoi(value) != 0;
+        } else if(name == "coarse_stride") {
+            int v = std::stoi(value);
+            if(v <= 0) return false;
+            m_coarseStride = v;
+        } else if(name == "fine_stride") {
+            int v = std::stoi(value);
+            if(v <= 0) return false;
+            m_fineStride = v;
+        } else if(name == "coarse_threshold") {
+            m_coarseThreshold = std::stod(value);
+        } else if(name == "model") {
+            try {
+                m_model = ModelStore::get().hog(value);
+            } catch(const algorithm_init_error& e) {
+                LOG_ERROR("ocv-hog-svm", "%s", e.what());
+                return false;
+            }
+        } else if(name == "search_margin") {
+            double v = std::stod(value);
+            if(v < 0) return false;
+            m_searchMargin = v;
+        } else {
+            return false;
+        }
+    } catch(const std::logic_error& e) { // unparseable number
+        return false;
+    }
+    return true;
+}
+
 int ml::ocv::count(void) {
     return 1;
 }
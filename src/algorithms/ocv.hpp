@@ -5,20 +5,17 @@
 #include "opencv2/objdetect/objdetect.hpp"
 #include "opencv2/tracking.hpp"
 #include "../algorithm.hpp"
+#include "arena.hpp"
+#include "models.hpp"
+#include "tracking.hpp"
 
 #include <vector>
 #include <list>
+#include <memory>
 
 namespace ml {
 namespace ocv {
 
-struct TrackingInfo {
-    cv::Ptr<cv::Tracker> tracker;
-    cv::Rect last_pos;
-    unsigned int id;
-    unsigned int confirm_frames;
-};
-
 class OCVAlgorithm : public Algorithm {
 public:
     OCVAlgorithm();
@@ -27,10 +24,67 @@ public:
     // virtual implementations
     Info getInfo();
     const std::vector<AlgorithmResult*>& analyze(const cv::Mat& mat);
+    bool setParam(const std::string& name, const std::string& value);
 
 private:
-    cv::HOGDescriptor m_hog;
-    std::list<TrackingInfo> m_track;
+    /** \brief Look for the tracked person near where the tracker put them
+     *
+     * Runs the HOG classifier over a window around the track, at the track's
+     * pyramid level and one level either side.
+     *
+     * \param step The scale step between pyramid levels
+     * \return Whether a detection still covers the track
+     */
+    bool verifyTrack(const cv::Mat& img, const TrackingInfo& t, double step);
+
+    /** \brief Full-frame detection in two passes
+     *
+     * A sparse pass at m_coarseStride with the permissive m_coarseThreshold
+     * picks candidates, then only the windows at m_fineStride around them
+     * are scored against m_hitThreshold.
+     */
+    void detectTwoStage(const cv::Mat& img, double scale,
+            std::vector<cv::Rect>& found);
+
+    // detection parameters
+    double m_hitThreshold;
+    int m_winStride;
+    double m_scale; // zero to pick from the frame height
+    int m_groupThreshold;
+    std::string m_trackerType;
+
+    // load shedding: trackers only, and a cap on pyramid levels
+    bool m_detect;
+    int m_maxLevels; // zero for no cap
+
+    // local verification: search around tracks every frame, and search the
+    // whole frame only every m_fullInterval frames
+    bool m_local;
+    int m_fullInterval;
+    double m_searchMargin; // search window border, relative to track size
+    long m_frame;
+
+    // coarse-to-fine full-frame search
+    bool m_twoStage;
+    int m_coarseStride, m_fineStride;
+    double m_coarseThreshold;
+
+    //! Per pyramid level buffers for detectTwoStage, kept between frames
+    struct LevelScratch {
+        cv::Mat image;
+        std::vector<cv::Point> hits, around;
+        std::vector<double> weights;
+        std::vector<cv::Rect> rects;
+    };
+
+    std::shared_ptr<const HogModel> m_model;
+    std::vector<LevelScratch> m_levels;
+    FrameArena m_arena;
+    AllocationCounter m_allocs;
+    cv::Mat m_search;
+    std::vector<cv::Point> m_hits;
+    std::vector<double> m_weights;
+    TrackList m_track;
     std::vector<cv::Rect> m_locs;
 };
 
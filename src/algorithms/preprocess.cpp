@@ -0,0 +1,278 @@
+#include "preprocess.hpp"
+#include "opencv2/core/hal/intrin.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <math.h>
+
+using namespace ml;
+
+namespace {
+// bilinear weights are fixed point with this many fractional bits
+const int WBITS = 8;
+const int WONE = 1 << WBITS;
+
+//! Read one pixel as BGR
+template<int SCN>
+inline void get(const uchar* s, int& b, int& g, int& r) {
+    if(SCN == 1) {
+        b = g = r = s[0];
+    } else {
+        b = s[0];
+        g = s[1];
+        r = s[2];
+    }
+}
+
+//! Write one BGR pixel, converted to DCN channels
+template<int DCN>
+inline void put(uchar* d, int b, int g, int r) {
+    if(DCN == 1) {
+        // the same fixed-point weights as cvtColor
+        d[0] = (uchar)((b * 1868 + g * 9617 + r * 4899 + (1 << 13)) >> 14);
+    } else {
+        d[0] = (uchar)b;
+        d[1] = (uchar)g;
+        d[2] = (uchar)r;
+        if(DCN == 4) d[3] = 255;
+    }
+}
+
+//! Convert a row of the frame without resampling
+template<int SCN, int DCN>
+void directRow(const uchar* s, uchar* d, int width) {
+    int x = 0;
+#if CV_SIMD128
+    if(SCN == 3 && DCN == 4) {
+        cv::v_uint8x16 a = cv::v_setall_u8(255);
+        for(;x <= width - 16;x += 16) {
+            cv::v_uint8x16 b, g, r;
+            cv::v_load_deinterleave(s + x * 3, b, g, r);
+            cv::v_store_interleave(d + x * 4, b, g, r, a);
+        }
+    } else if(SCN == 4 && DCN == 3) {
+        for(;x <= width - 16;x += 16) {
+            cv::v_uint8x16 b, g, r, a;
+            cv::v_load_deinterleave(s + x * 4, b, g, r, a);
+            cv::v_store_interleave(d + x * 3, b, g, r);
+        }
+    }
+#endif
+    if(SCN == DCN) {
+        memcpy(d + x * DCN, s + x * SCN, (width - x) * SCN);
+        return;
+    }
+    for(;x < width;x++) {
+        int b, g, r;
+        get<SCN>(s + x * SCN, b, g, r);
+        put<DCN>(d + x * DCN, b, g, r);
+    }
+}
+
+//! Bilinearly sample and convert a whole output row, border included
+template<int SCN, int DCN>
+void sampleRow(const uchar* r0, const uchar* r1, int wy, const int* xofs,
+        const short* xw, uchar* d, int width) {
+    const int N = SCN == 1 ? 1 : 3, wy0 = WONE - wy;
+    for(int x = 0;x < width;x++, d += DCN) {
+        const int x0 = xofs[2 * x], x1 = xofs[2 * x + 1];
+        const int w1 = xw[x], w0 = WONE - w1;
+        int v[3];
+        for(int c = 0;c < N;c++) {
+            int top = r0[x0 + c] * w0 + r0[x1 + c] * w1;
+            int bottom = r1[x0 + c] * w0 + r1[x1 + c] * w1;
+            v[c] = (top * wy0 + bottom * wy + (1 << (2 * WBITS - 1))) >>
+                (2 * WBITS);
+        }
+        if(N == 1) v[1] = v[2] = v[0];
+        put<DCN>(d, v[0], v[1], v[2]);
+    }
+}
+
+typedef void (*DirectFn)(const uchar*, uchar*, int);
+typedef void (*SampleFn)(const uchar*, const uchar*, int, const int*,
+        const short*, uchar*, int);
+
+//! Index of a supported channel count in the dispatch tables
+int cnIndex(int cn) {
+    switch(cn) {
+    case 1: return 0;
+    case 3: return 1;
+    case 4: return 2;
+    default: return -1;
+    }
+}
+
+const DirectFn directFns[3][3] = {
+    { directRow<1, 1>, directRow<1, 3>, directRow<1, 4> },
+    { directRow<3, 1>, directRow<3, 3>, directRow<3, 4> },
+    { directRow<4, 1>, directRow<4, 3>, directRow<4, 4> }
+};
+
+const SampleFn sampleFns[3][3] = {
+    { sampleRow<1, 1>, sampleRow<1, 3>, sampleRow<1, 4> },
+    { sampleRow<3, 1>, sampleRow<3, 3>, sampleRow<3, 4> },
+    { sampleRow<4, 1>, sampleRow<4, 3>, sampleRow<4, 4> }
+};
+
+//! Produces a stripe of output rows
+class RowBody : public cv::ParallelLoopBody {
+public:
+    RowBody(const cv::Mat& src, cv::Mat& dst, int border, int inner,
+            bool direct, const std::vector<int>& xofs,
+            const std::vector<short>& xw, const std::vector<int>& yofs,
+            const std::vector<short>& yw) :
+        m_src(src), m_dst(dst), m_border(border), m_inner(inner),
+        m_direct(direct),
+        m_xofs(xofs), m_xw(xw), m_yofs(yofs), m_yw(yw) {
+        int s = cnIndex(src.channels()), d = cnIndex(dst.channels());
+        m_directFn = directFns[s][d];
+        m_sampleFn = sampleFns[s][d];
+    }
+
+    void operator()(const cv::Range& r) const {
+        const int dcn = m_dst.channels(), b = m_border;
+        for(int y = r.start;y < r.end;y++) {
+            // border rows repeat the nearest inner row
+            int iy = std::min(std::max(y - b, 0), m_inner - 1);
+            uchar* d = m_dst.ptr<uchar>(y);
+            if(!m_direct) {
+                int sy = m_yofs[iy];
+                int sy1 = std::min(sy + 1, m_src.rows - 1);
+                m_sampleFn(m_src.ptr<uchar>(sy), m_src.ptr<uchar>(sy1),
+                        m_yw[iy], m_xofs.data(), m_xw.data(), d, m_dst.cols);
+                continue;
+            }
+
+            m_directFn(m_src.ptr<uchar>(iy), d + b * dcn, m_src.cols);
+            const uchar* first = d + b * dcn;
+            const uchar* last = d + (b + m_src.cols - 1) * dcn;
+            for(int x = 0;x < b;x++) {
+                memcpy(d + x * dcn, first, dcn);
+                memcpy(d + (b + m_src.cols + x) * dcn, last, dcn);
+            }
+        }
+    }
+
+private:
+    const cv::Mat& m_src;
+    cv::Mat& m_dst;
+    int m_border;
+    int m_inner;        // output rows inside the border
+    bool m_direct;
+    const std::vector<int>& m_xofs;
+    const std::vector<short>& m_xw;
+    const std::vector<int>& m_yofs;
+    const std::vector<short>& m_yw;
+    DirectFn m_directFn;
+    SampleFn m_sampleFn;
+};
+
+//! Source index and weight for output pixel \p i, as cv::resize places them
+void sampleAt(int i, double f, int n, int& i0, int& i1, short& w) {
+    double s = (i + 0.5) * f - 0.5;
+    int s0 = (int)floor(s);
+    w = (short)cvRound((s - s0) * WONE);
+    if(s0 < 0) {
+        s0 = 0;
+        w = 0;
+    } else if(s0 >= n - 1) {
+        s0 = n - 1;
+        w = 0;
+    }
+    i0 = s0;
+    i1 = std::min(s0 + 1, n - 1);
+}
+};
+
+Preprocessor::Preprocessor(const InputSpec& spec) : m_frameChannels(0),
+        m_fx(1), m_fy(1), m_direct(true) {
+    setSpec(spec);
+}
+
+void Preprocessor::setSpec(const InputSpec& spec) {
+    if(cnIndex(spec.channels) < 0)
+        throw std::invalid_argument("Input must have 1, 3 or 4 channels");
+    if(spec.size.area() == 0 && spec.scale <= 0)
+        throw std::invalid_argument("Input scale must be positive");
+    if(spec.border < 0)
+        throw std::invalid_argument("Input border can't be negative");
+    m_spec = spec;
+    m_frame = cv::Size();   // replan on the next frame
+}
+
+cv::Size Preprocessor::outputSize(const cv::Size& frame) const {
+    cv::Size inner = m_spec.size.area() > 0 ? m_spec.size :
+        cv::Size(cvRound(frame.width / m_spec.scale),
+                cvRound(frame.height / m_spec.scale));
+    return cv::Size(inner.width + 2 * m_spec.border,
+            inner.height + 2 * m_spec.border);
+}
+
+void Preprocessor::plan(const cv::Mat& frame) {
+    const int b = m_spec.border, scn = frame.channels();
+    cv::Size out = outputSize(frame.size());
+    m_inner = cv::Size(out.width - 2 * b, out.height - 2 * b);
+    if(m_inner.width <= 0 || m_inner.height <= 0)
+        throw std::invalid_argument("Frame is too small for the input scale");
+    m_frame = frame.size();
+    m_frameChannels = scn;
+    m_fx = (double)m_frame.width / m_inner.width;
+    m_fy = (double)m_frame.height / m_inner.height;
+    m_direct = m_inner == m_frame;
+    if(m_direct) return;
+
+    // columns cover the border too, rows are clamped as they're written
+    m_xofs.resize(2 * out.width);
+    m_xw.resize(out.width);
+    for(int x = 0;x < out.width;x++) {
+        int ix = std::min(std::max(x - b, 0), m_inner.width - 1), x0, x1;
+        sampleAt(ix, m_fx, m_frame.width, x0, x1, m_xw[x]);
+        m_xofs[2 * x] = x0 * scn;
+        m_xofs[2 * x + 1] = x1 * scn;
+    }
+    m_yofs.resize(m_inner.height);
+    m_yw.resize(m_inner.height);
+    for(int y = 0;y < m_inner.height;y++) {
+        int y1;
+        sampleAt(y, m_fy, m_frame.height, m_yofs[y], y1, m_yw[y]);
+    }
+}
+
+const cv::Mat& Preprocessor::run(const cv::Mat& frame) {
+    if(frame.channels() == m_spec.channels && m_spec.border == 0 &&
+            outputSize(frame.size()) == frame.size()) {
+        // nothing to do, but keep toFrame() right
+        if(frame.size() != m_frame || frame.channels() != m_frameChannels)
+            plan(frame);
+        m_out = frame;
+        return m_out;
+    }
+    // don't write into a frame passed through last time
+    if(m_out.data == frame.data) m_out.release();
+    run(frame, m_out);
+    return m_out;
+}
+
+void Preprocessor::run(const cv::Mat& frame, cv::Mat& out) {
+    if(frame.depth() != CV_8U || cnIndex(frame.channels()) < 0)
+        throw std::invalid_argument("Frames must be 8-bit grey, BGR or BGRA");
+    if(frame.size() != m_frame || frame.channels() != m_frameChannels)
+        plan(frame);
+
+    cv::Size sz = outputSize(frame.size());
+    int type = CV_MAKETYPE(CV_8U, m_spec.channels);
+    if(out.size() != sz || out.type() != type) out.create(sz, type);
+
+    RowBody body(frame, out, m_spec.border, m_inner.height, m_direct,
+            m_xofs, m_xw, m_yofs, m_yw);
+    cv::parallel_for_(cv::Range(0, sz.height), body,
+            sz.area() / (64.0 * 1024));
+}
+
+cv::Rect Preprocessor::toFrame(const cv::Rect& r) const {
+    const int b = m_spec.border;
+    return cv::Rect(cvRound((r.x - b) * m_fx), cvRound((r.y - b) * m_fy),
+            cvRound(r.width * m_fx), cvRound(r.height * m_fy));
+}
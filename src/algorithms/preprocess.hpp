@@ -0,0 +1,75 @@
+#ifndef ALGORITHM_PREPROCESS_HPP
+#define ALGORITHM_PREPROCESS_HPP
+
+#include "opencv2/core/core.hpp"
+
+#include <vector>
+
+namespace ml {
+
+/** \brief The form an algorithm wants its input frames in */
+struct InputSpec {
+    int channels;   //!< 1 for grey, 3 for BGR or 4 for BGRA
+    double scale;   //!< Frame size over output size, when no size is given
+    cv::Size size;  //!< Output size before padding; empty to use the scale
+    int border;     //!< Replicated border added on every side, in pixels
+
+    InputSpec(int channels=3, double scale=1.0, int border=0) :
+        channels(channels), scale(scale), border(border) {}
+};
+
+/** \brief Colour conversion, downscaling and padding in a single pass
+ *
+ * Each output row is sampled straight from the frame, converted and padded
+ * as it's written, so a frame is read once instead of once per step. Rows
+ * are split between threads; sampling tables are kept until the frame size
+ * changes.
+ */
+class Preprocessor {
+public:
+    explicit Preprocessor(const InputSpec& spec=InputSpec());
+
+    const InputSpec& spec() const { return m_spec; }
+    void setSpec(const InputSpec& spec);
+
+    /** \brief Prepare a frame into a buffer owned by the preprocessor
+     *
+     * \param frame 8-bit grey, BGR or BGRA
+     * \return The prepared frame, valid until the next call. A frame that
+     *         already matches the spec is returned without copying.
+     */
+    const cv::Mat& run(const cv::Mat& frame);
+
+    /** \brief Prepare a frame into \p out
+     *
+     * \p out is written in place if it already has the right size and type,
+     * so it can wrap an external buffer; otherwise it is reallocated.
+     */
+    void run(const cv::Mat& frame, cv::Mat& out);
+
+    //! Output size for frames of size \p frame, border included
+    cv::Size outputSize(const cv::Size& frame) const;
+
+    //! Map a rectangle in the last output back onto the frame
+    cv::Rect toFrame(const cv::Rect& r) const;
+
+private:
+    //! Work out sampling for frames like \p frame
+    void plan(const cv::Mat& frame);
+
+    InputSpec m_spec;
+    cv::Mat m_out;
+
+    cv::Size m_frame;       // frame size and channels the tables are for
+    int m_frameChannels;
+    cv::Size m_inner;       // output size inside the border
+    double m_fx, m_fy;      // frame pixels per output pixel
+    bool m_direct;          // no resampling, only conversion and padding
+    std::vector<int> m_xofs;    // per output column: left and right source
+    std::vector<short> m_xw;    // weight of the right source column
+    std::vector<int> m_yofs;    // per inner row: upper source row
+    std::vector<short> m_yw;    // weight of the row below it
+};
+};
+
+#endif
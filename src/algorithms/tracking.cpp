@@ -0,0 +1,111 @@
+#include "tracking.hpp"
+
+#include <functional>
+#include <map>
+
+// OpenCV releases that still create trackers from their names
+#define CV_NAMED_TRACKERS (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR < 3)
+
+cv::Ptr<cv::Tracker> ml::createTracker(const std::string& name) {
+#if CV_NAMED_TRACKERS
+    return cv::Tracker::create(name);
+#else
+    typedef std::function<cv::Ptr<cv::Tracker>()> Factory;
+    static const std::map<std::string, Factory> factories = {
+        { "BOOSTING", []() { return cv::TrackerBoosting::create(); } },
+        { "MIL", []() { return cv::TrackerMIL::create(); } },
+        { "KCF", []() { return cv::TrackerKCF::create(); } },
+        { "TLD", []() { return cv::TrackerTLD::create(); } },
+        { "MEDIANFLOW", []() { return cv::TrackerMedianFlow::create(); } },
+        { "GOTURN", []() { return cv::TrackerGOTURN::create(); } },
+#if CV_VERSION_MAJOR > 3 || CV_VERSION_MINOR >= 4
+        { "MOSSE", []() { return cv::TrackerMOSSE::create(); } },
+        { "CSRT", []() { return cv::TrackerCSRT::create(); } },
+#endif
+    };
+    auto it = factories.find(name);
+    if(it == factories.end()) return cv::Ptr<cv::Tracker>();
+    return it->second();
+#endif
+}
+
+void ml::updateTracks(TrackList& tracks, const cv::Mat& img) {
+    for(TrackList::iterator i = tracks.begin();i != tracks.end();) {
+        cv::Rect2d r;
+        if(!i->tracker->update(img, r)) {
+            i = tracks.erase(i);
+            continue;
+        }
+        i->last_pos = r;
+        i->confirm_frames++;
+        i++;
+    }
+}
+
+void ml::dedupTracks(TrackList& tracks, double threshold) {
+    TrackList::iterator i,j;
+    for(i = tracks.begin();i != tracks.end();i++) {
+        j = i;
+        j++;
+        for(;j != tracks.end();) {
+            cv::Rect ri = i->last_pos;
+            cv::Rect rj = j->last_pos;
+            cv::Rect join = ri & rj;
+            if(join.area() == 0) {
+                j++;
+                continue;
+            }
+
+            if((join == rj) ||
+                    (join.area() >= threshold*rj.area())) {
+                // eliminate the second
+                j = tracks.erase(j);
+                continue;
+            }
+            j++;
+        }
+    }
+}
+
+template<typename Alloc>
+void ml::associateDetections(TrackList& tracks,
+        std::vector<cv::Rect, Alloc>& dets,
+        const cv::Mat& img, double threshold, bool strict) {
+    for(auto& i : tracks) {
+        for(int j = 0;j < dets.size();j++) {
+            cv::Rect r_t = i.last_pos;
+            cv::Rect r_d = dets[j];
+            if(r_t.contains(r_d.tl()) && r_t.contains(r_d.br())) {
+                // readjust tracking rectangle
+                i.confirm_frames = 0;
+                i.last_pos = r_t;
+                i.tracker->init(img, r_t);
+                dets.erase(dets.begin()+j);
+                j--; // revisit the same index next time around
+                continue;
+            }
+            cv::Rect isect = r_t & r_d;
+            bool t_covered = isect.area() >= threshold*r_t.area();
+            bool d_covered = isect.area() >= threshold*r_d.area();
+            if(strict ? (t_covered && d_covered) : (t_covered || d_covered)) {
+                // they intersect - update the confirm count
+                i.confirm_frames = 0;
+                if(!strict) i.last_pos |= r_d;
+                dets.erase(dets.begin()+j);
+                j--; // revisit the same index next time around
+            }
+        }
+    }
+}
+
+namespace ml {
+template void associateDetections(TrackList&, std::vector<cv::Rect>&,
+        const cv::Mat&, double, bool);
+template void associateDetections(TrackList&, ArenaVector<cv::Rect>&,
+        const cv::Mat&, double, bool);
+};
+
+void ml::retireTracks(TrackList& tracks, unsigned int limit) {
+    tracks.remove_if(
+            [limit](const TrackingInfo& i) { return i.confirm_frames > limit; });
+}
@@ -0,0 +1,66 @@
+#ifndef ALGORITHM_TRACKING_HPP
+#define ALGORITHM_TRACKING_HPP
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/tracking.hpp"
+#include "arena.hpp"
+
+#include <vector>
+#include <list>
+#include <string>
+
+namespace ml {
+
+struct TrackingInfo {
+    cv::Ptr<cv::Tracker> tracker;
+    cv::Rect last_pos;
+    unsigned int id;
+    unsigned int confirm_frames;
+};
+
+typedef std::list<TrackingInfo> TrackList;
+
+/** \brief Create a tracker by name (TLD, KCF, MEDIANFLOW, ...)
+ *
+ * OpenCV 3.3 dropped cv::Tracker::create(name) for per-type factories; this
+ * works with either. Returns an empty pointer for unknown names.
+ */
+cv::Ptr<cv::Tracker> createTracker(const std::string& name);
+
+/** \brief Advance every tracker to the given frame
+ *
+ * Tracks whose tracker loses its target are removed. The others move to their
+ * new position and have their confirmation counter incremented.
+ */
+void updateTracks(TrackList& tracks, const cv::Mat& img);
+
+/** \brief Remove tracks which mostly overlap an earlier track
+ *
+ * A track is removed if at least \p threshold of its area is covered by a
+ * track that precedes it in the list.
+ */
+void dedupTracks(TrackList& tracks, double threshold);
+
+/** \brief Match fresh detections against existing tracks
+ *
+ * Detections which fall inside or overlap a track confirm it, and are removed
+ * from \p dets; whatever is left in \p dets afterwards is a new object.
+ *
+ * \param strict If set, an overlapping detection only counts when the overlap
+ *               covers \p threshold of both rectangles. Otherwise covering
+ *               either one is enough, and the track grows to include the
+ *               detection.
+ *
+ * Instantiated for std::allocator and ArenaAllocator vectors; \p dets only
+ * ever shrinks, so this doesn't allocate.
+ */
+template<typename Alloc>
+void associateDetections(TrackList& tracks, std::vector<cv::Rect, Alloc>& dets,
+        const cv::Mat& img, double threshold, bool strict);
+
+//! Remove tracks which haven't been confirmed for more than \p limit frames
+void retireTracks(TrackList& tracks, unsigned int limit);
+
+};
+
+#endif
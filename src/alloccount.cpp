@@ -0,0 +1,31 @@
+/* Replacement global operator new which counts calls per thread, for checking
+ * that per-frame work runs out of its arenas. Only built into executables
+ * configured with COUNT_ALLOCS; modules find threadAllocations() through the
+ * executable's exported symbols.
+ */
+
+#include "algorithms/arena.hpp"
+
+#ifdef PDDEMO_COUNT_ALLOCS
+#include <new>
+#include <stdlib.h>
+
+namespace {
+thread_local long t_allocs = 0;
+};
+
+long ml::threadAllocations() {
+    return t_allocs;
+}
+
+void* operator new(size_t n) {
+    t_allocs++;
+    void* p = malloc(n ? n : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+#endif
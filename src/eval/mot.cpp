@@ -0,0 +1,213 @@
+#include "mot.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <set>
+
+using namespace eval;
+
+GroundTruth GroundTruth::loadMOT(const std::string& fname) {
+    std::ifstream in(fname.c_str());
+    if(!in) throw std::invalid_argument("Cannot open ground truth file");
+
+    GroundTruth gt;
+    std::string line;
+    while(std::getline(in, line)) {
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+
+        long frame;
+        Object o;
+        double x, y, w, h;
+        if(!(fields >> frame >> o.id >> x >> y >> w >> h)) continue;
+
+        double flag = 1;
+        int cls = 1;
+        if(fields >> flag) fields >> cls;
+        if(flag == 0 || cls != 1) continue;
+
+        o.bounds = cv::Rect(cvRound(x), cvRound(y), cvRound(w), cvRound(h));
+        gt.add(frame - 1, o);
+    }
+    return gt;
+}
+
+void GroundTruth::add(long frame, const Object& obj) {
+    m_frames[frame].push_back(obj);
+}
+
+const FrameObjects& GroundTruth::operator[](long frame) const {
+    auto itr = m_frames.find(frame);
+    if(itr == m_frames.end()) return m_empty;
+    return itr->second;
+}
+
+void GroundTruth::saveMOT(const std::string& fname) const {
+    std::ofstream out(fname.c_str());
+    if(!out) throw std::invalid_argument("Cannot create ground truth file");
+
+    for(auto& f : m_frames) {
+        for(auto& o : f.second) {
+            out << f.first + 1 << ',' << o.id << ','
+                << o.bounds.x << ',' << o.bounds.y << ','
+                << o.bounds.width << ',' << o.bounds.height << ",1,1,1\n";
+        }
+    }
+}
+
+FrameObjects eval::hypotheses(const std::vector<ml::AlgorithmResult*>& res) {
+    FrameObjects out;
+    for(auto r : res) {
+        auto boxes = dynamic_cast<const ml::BoundingBoxesResult*>(r);
+        if(boxes == NULL) continue;
+        for(auto& b : boxes->boxes) {
+            Object o = { b.id, b.bounds };
+            out.push_back(o);
+        }
+    }
+    return out;
+}
+
+double eval::iou(const cv::Rect& a, const cv::Rect& b) {
+    double isect = (a & b).area();
+    double uni = a.area() + b.area() - isect;
+    return uni > 0 ? isect / uni : 0.0;
+}
+
+Accumulator::Accumulator(double threshold) : m_threshold(threshold),
+        m_frames(0), m_gt(0), m_hyp(0), m_tp(0), m_fp(0), m_fn(0), m_idsw(0),
+        m_iou_sum(0.0), m_sequences(1) {
+}
+
+void Accumulator::frame(const FrameObjects& gt, const FrameObjects& hyp,
+        double dtime) {
+    m_frames++;
+    m_gt += gt.size();
+    m_hyp += hyp.size();
+    m_times.push_back(dtime * 1000.0);
+
+    std::vector<bool> gt_used(gt.size(), false), hyp_used(hyp.size(), false);
+    std::vector<std::pair<size_t, size_t> > matches;
+
+    // keep last frame's correspondences where they still hold
+    for(size_t g = 0;g < gt.size();g++) {
+        auto last = m_last.find(gt[g].id);
+        if(last == m_last.end()) continue;
+        for(size_t h = 0;h < hyp.size();h++) {
+            if(hyp_used[h] || hyp[h].id != last->second) continue;
+            if(iou(gt[g].bounds, hyp[h].bounds) >= m_threshold) {
+                gt_used[g] = hyp_used[h] = true;
+                matches.push_back(std::make_pair(g, h));
+            }
+            break;
+        }
+    }
+
+    // greedily match the rest by descending IoU
+    std::vector<std::pair<double, std::pair<size_t, size_t> > > cands;
+    for(size_t g = 0;g < gt.size();g++) {
+        if(gt_used[g]) continue;
+        for(size_t h = 0;h < hyp.size();h++) {
+            if(hyp_used[h]) continue;
+            double v = iou(gt[g].bounds, hyp[h].bounds);
+            if(v >= m_threshold)
+                cands.push_back(std::make_pair(v, std::make_pair(g, h)));
+        }
+    }
+    std::sort(cands.rbegin(), cands.rend());
+    for(auto& c : cands) {
+        size_t g = c.second.first, h = c.second.second;
+        if(gt_used[g] || hyp_used[h]) continue;
+        gt_used[g] = hyp_used[h] = true;
+        matches.push_back(c.second);
+
+        auto last = m_last.find(gt[g].id);
+        if(last != m_last.end() && last->second != hyp[h].id) m_idsw++;
+    }
+
+    for(auto& m : matches) {
+        const Object& g = gt[m.first];
+        const Object& h = hyp[m.second];
+        m_last[g.id] = h.id;
+        m_iou_sum += iou(g.bounds, h.bounds);
+    }
+    m_tp += matches.size();
+    m_fn += gt.size() - matches.size();
+    m_fp += hyp.size() - matches.size();
+
+    // identity overlap counts for IDF1
+    for(auto& g : gt) m_gt_count[g.id]++;
+    for(auto& h : hyp) m_hyp_count[h.id]++;
+    for(auto& g : gt) {
+        for(auto& h : hyp) {
+            if(iou(g.bounds, h.bounds) >= m_threshold)
+                m_pairs[std::make_pair(g.id, h.id)]++;
+        }
+    }
+}
+
+void Accumulator::merge(const Accumulator& other) {
+    m_frames += other.m_frames;
+    m_gt += other.m_gt;
+    m_hyp += other.m_hyp;
+    m_tp += other.m_tp;
+    m_fp += other.m_fp;
+    m_fn += other.m_fn;
+    m_idsw += other.m_idsw;
+    m_iou_sum += other.m_iou_sum;
+    m_times.insert(m_times.end(), other.m_times.begin(), other.m_times.end());
+
+    // identities are per sequence, so renumber the other's sequences past ours
+    uint64_t off = (uint64_t)m_sequences << 32;
+    for(auto& e : other.m_gt_count) m_gt_count[e.first + off] += e.second;
+    for(auto& e : other.m_hyp_count) m_hyp_count[e.first + off] += e.second;
+    for(auto& e : other.m_pairs) {
+        m_pairs[std::make_pair(e.first.first + off, e.first.second + off)]
+            += e.second;
+    }
+    m_sequences += other.m_sequences;
+}
+
+Metrics Accumulator::summary() const {
+    Metrics m;
+    m.frames = m_frames;
+    m.gt = m_gt;
+    m.hyp = m_hyp;
+    m.tp = m_tp;
+    m.fp = m_fp;
+    m.fn = m_fn;
+    m.idsw = m_idsw;
+    m.mota = m_gt > 0 ? 1.0 - (double)(m_fn + m_fp + m_idsw) / m_gt : 0.0;
+    m.motp = m_tp > 0 ? m_iou_sum / m_tp : 0.0;
+    m.precision = m_hyp > 0 ? (double)m_tp / m_hyp : 0.0;
+    m.recall = m_gt > 0 ? (double)m_tp / m_gt : 0.0;
+    m.ap50 = m.precision * m.recall;
+
+    // greedy one-to-one identity assignment by overlap count
+    std::vector<std::pair<long, std::pair<uint64_t, uint64_t> > > ids;
+    for(auto& e : m_pairs) ids.push_back(std::make_pair(e.second, e.first));
+    std::sort(ids.rbegin(), ids.rend());
+    std::set<uint64_t> gt_done, hyp_done;
+    long idtp = 0;
+    for(auto& e : ids) {
+        if(gt_done.count(e.second.first) || hyp_done.count(e.second.second))
+            continue;
+        gt_done.insert(e.second.first);
+        hyp_done.insert(e.second.second);
+        idtp += e.first;
+    }
+    m.idf1 = (m_gt + m_hyp) > 0 ? 2.0 * idtp / (m_gt + m_hyp) : 0.0;
+
+    std::vector<double> t = m_times;
+    std::sort(t.begin(), t.end());
+    double sum = 0.0;
+    for(auto v : t) sum += v;
+    m.latency_mean = t.empty() ? 0.0 : sum / t.size();
+    m.latency_p50 = t.empty() ? 0.0 : t[t.size() / 2];
+    m.latency_p95 = t.empty() ? 0.0 :
+        t[std::min(t.size() - 1, (t.size() * 95) / 100)];
+    m.fps = sum > 0 ? 1000.0 * t.size() / sum : 0.0;
+    return m;
+}
@@ -0,0 +1,114 @@
+#ifndef EVAL_MOT_HPP
+#define EVAL_MOT_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+#include "opencv2/core/core.hpp"
+
+#include "../algorithm.hpp"
+
+namespace eval {
+
+//! A single annotated or hypothesized object in one frame
+struct Object {
+    unsigned int id;
+    cv::Rect bounds;
+};
+
+typedef std::vector<Object> FrameObjects;
+
+/** \brief Ground truth for one sequence, indexed by frame number
+ *
+ * Frame numbers start at zero, even though MOT files count from one.
+ */
+class GroundTruth {
+public:
+    /** \brief Load a MOTChallenge-style ground truth file
+     *
+     * Each line is `frame,id,x,y,w,h[,flag[,class[,visibility]]]`. Entries
+     * with a zero flag are ignored, as are entries with a class other than 1
+     * (pedestrian) when a class is given.
+     */
+    static GroundTruth loadMOT(const std::string& fname);
+
+    //! Add an object to a frame
+    void add(long frame, const Object& obj);
+
+    //! Get the objects in a frame. Frames without objects return an empty list
+    const FrameObjects& operator[](long frame) const;
+
+    //! Write the ground truth in MOTChallenge format
+    void saveMOT(const std::string& fname) const;
+
+private:
+    std::map<long, FrameObjects> m_frames;
+    FrameObjects m_empty;
+};
+
+//! Collect the bounding boxes in an algorithm's results as hypotheses
+FrameObjects hypotheses(const std::vector<ml::AlgorithmResult*>& res);
+
+//! Intersection over union of two rectangles
+double iou(const cv::Rect& a, const cv::Rect& b);
+
+//! Summary metrics over one or more sequences
+struct Metrics {
+    long frames;
+    long gt, hyp;             //!< Total ground truth and hypothesis boxes
+    long tp, fp, fn, idsw;    //!< CLEAR MOT counts
+    double mota, motp;
+    double idf1;
+    double precision, recall;
+
+    /** \brief Average precision at IoU 0.5
+     *
+     * Trackers don't score their boxes, so every hypothesis has the same
+     * confidence and the precision/recall curve is a single point. AP is then
+     * precision times recall.
+     */
+    double ap50;
+
+    double fps;               //!< Frames per second of analysis time
+    double latency_mean, latency_p50, latency_p95; //!< Per-frame time, in ms
+};
+
+/** \brief Accumulates tracking accuracy and timing over a sequence
+ *
+ * Matching follows CLEAR MOT: correspondences from the previous frame are
+ * kept while their IoU stays above the threshold, and the remaining objects
+ * are matched greedily by descending IoU. IDF1 is computed from per-identity
+ * overlap counts, also with a greedy identity assignment, which can slightly
+ * underestimate the optimal value.
+ */
+class Accumulator {
+public:
+    Accumulator(double threshold=0.5);
+
+    //! Score one frame
+    void frame(const FrameObjects& gt, const FrameObjects& hyp, double dtime);
+
+    //! Fold another accumulator's counts into this one
+    void merge(const Accumulator& other);
+
+    Metrics summary() const;
+
+private:
+    double m_threshold;
+    long m_frames, m_gt, m_hyp, m_tp, m_fp, m_fn, m_idsw;
+    double m_iou_sum;
+    std::map<unsigned int, unsigned int> m_last;   // gt id -> hyp id
+
+    // identity counts, keyed by sequence << 32 | id. Frames scored here are
+    // sequence 0, and merged accumulators' sequences are numbered after it.
+    unsigned int m_sequences;
+    std::map<std::pair<uint64_t, uint64_t>, long> m_pairs;
+    std::map<uint64_t, long> m_gt_count, m_hyp_count;
+    std::vector<double> m_times; // ms
+};
+
+};
+
+#endif
@@ -0,0 +1,414 @@
+#include "writer.hpp"
+#include "../log/log.hpp"
+
+#ifdef WITH_LIBURING
+#include <liburing.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// size of each write buffer, a multiple of any block size O_DIRECT wants
+#define BUFFER_SIZE (256 * 1024)
+
+// alignment of O_DIRECT buffers, offsets and lengths
+#define DIRECT_ALIGN 4096
+
+// free buffers kept for reuse, enough for a recording's frames in flight;
+// more than this are given back
+#define POOL_KEEP 128
+
+// threads writing files when io_uring isn't used. They spend their time
+// blocked in the kernel, so they aren't counted against the thread budget.
+#define WRITER_THREADS 2
+
+// io_uring submission queue entries
+#define RING_ENTRIES 64
+
+using namespace io;
+
+namespace {
+//! Called with the bytes written, or a negated errno
+typedef std::function<void(ssize_t)> Completion;
+
+std::string errorText(const std::string& what, const std::string& path,
+        int err) {
+    return what + " " + path + ": " + strerror(err);
+}
+
+//! Page-aligned write buffers, recycled between files
+class BufferPool {
+public:
+    char* acquire() {
+        {
+            std::lock_guard<std::mutex> l(m_lock);
+            if(!m_free.empty()) {
+                char* buf = m_free.back();
+                m_free.pop_back();
+                return buf;
+            }
+        }
+        void* buf;
+        if(posix_memalign(&buf, DIRECT_ALIGN, BUFFER_SIZE) != 0)
+            throw std::bad_alloc();
+        return (char*)buf;
+    }
+
+    void release(char* buf) {
+        std::lock_guard<std::mutex> l(m_lock);
+        if(m_free.size() < POOL_KEEP) m_free.push_back(buf);
+        else free(buf);
+    }
+
+private:
+    std::mutex m_lock;
+    std::vector<char*> m_free;
+};
+
+//! Performs writes and reports their completion on some other thread
+class Engine {
+public:
+    virtual ~Engine() {}
+
+    //! Write all of \p buf at \p offset, then call \p done
+    virtual void submit(int fd, const char* buf, size_t len, off_t offset,
+            Completion done)=0;
+
+    virtual const char* name() const=0;
+};
+
+//! Blocking pwrite() calls on a few threads of its own
+class ThreadEngine : public Engine {
+public:
+    ThreadEngine() {
+        // engines live as long as the process does
+        for(int i = 0;i < WRITER_THREADS;i++)
+            std::thread([this]() { run(); }).detach();
+    }
+
+    void submit(int fd, const char* buf, size_t len, off_t offset,
+            Completion done) {
+        std::lock_guard<std::mutex> l(m_lock);
+        m_tasks.push_back([=]() {
+            size_t written = 0;
+            while(written < len) {
+                ssize_t r = pwrite(fd, buf + written, len - written,
+                        offset + written);
+                if(r < 0 && errno == EINTR) continue;
+                if(r <= 0) {
+                    done(r < 0 ? -errno : -EIO);
+                    return;
+                }
+                written += r;
+            }
+            done(written);
+        });
+        m_cond.notify_one();
+    }
+
+    const char* name() const { return "threads"; }
+
+private:
+    void run() {
+        for(;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> l(m_lock);
+                m_cond.wait(l, [this]() { return !m_tasks.empty(); });
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::deque<std::function<void()> > m_tasks;
+};
+
+#ifdef WITH_LIBURING
+//! Writes submitted through one shared io_uring, reaped by a thread of its own
+class UringEngine : public Engine {
+public:
+    UringEngine() {
+        int r = io_uring_queue_init(RING_ENTRIES, &m_ring, 0);
+        if(r < 0) throw std::runtime_error(strerror(-r));
+
+        // plain writes only arrived in Linux 5.6, as did probing; older
+        // rings would fail every write with EINVAL
+        io_uring_probe* probe = io_uring_get_probe_ring(&m_ring);
+        bool writes = probe != NULL &&
+            io_uring_opcode_supported(probe, IORING_OP_WRITE);
+        if(probe != NULL) io_uring_free_probe(probe);
+        if(!writes) {
+            io_uring_queue_exit(&m_ring);
+            throw std::runtime_error("the kernel's io_uring can't write");
+        }
+        std::thread([this]() { reap(); }).detach();
+    }
+
+    void submit(int fd, const char* buf, size_t len, off_t offset,
+            Completion done) {
+        Op* op = new Op();
+        op->fd = fd;
+        op->buf = buf;
+        op->len = len;
+        op->offset = offset;
+        op->written = 0;
+        op->done = done;
+        queue(op);
+    }
+
+    const char* name() const { return "io_uring"; }
+
+private:
+    struct Op {
+        int fd;
+        const char* buf;
+        size_t len;
+        off_t offset;
+        size_t written;     // by earlier, short, writes
+        Completion done;
+    };
+
+    //! Queue the rest of an operation
+    void queue(Op* op) {
+        std::lock_guard<std::mutex> l(m_lock);
+        io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+        while(sqe == NULL) {
+            // the queue only fills up between a get and a submit
+            io_uring_submit(&m_ring);
+            sqe = io_uring_get_sqe(&m_ring);
+        }
+        io_uring_prep_write(sqe, op->fd, op->buf + op->written,
+                op->len - op->written, op->offset + op->written);
+        io_uring_sqe_set_data(sqe, op);
+        int r = io_uring_submit(&m_ring);
+        if(r < 0) LOG_ERROR("io", "io_uring submit: %s", strerror(-r));
+    }
+
+    void reap() {
+        for(;;) {
+            io_uring_cqe* cqe;
+            int r = io_uring_wait_cqe(&m_ring, &cqe);
+            if(r == -EINTR) continue;
+            if(r < 0) {
+                LOG_ERROR("io", "io_uring wait: %s", strerror(-r));
+                continue;
+            }
+            Op* op = (Op*)io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+            io_uring_cqe_seen(&m_ring, cqe);
+
+            if(res > 0 && op->written + res < op->len) {
+                op->written += res;
+                queue(op);
+                continue;
+            }
+            op->done(res < 0 ? res : res == 0 ? -EIO :
+                    (ssize_t)(op->written + res));
+            delete op;
+        }
+    }
+
+    std::mutex m_lock;  // guards the submission queue
+    io_uring m_ring;
+};
+#endif
+
+std::mutex engineLock;
+Engine* engine = NULL;
+Backend wantedBackend = BACKEND_AUTO;
+std::atomic<bool> wantDirect(false);
+
+Engine& getEngine() {
+    std::lock_guard<std::mutex> l(engineLock);
+    if(engine != NULL) return *engine;
+#ifdef WITH_LIBURING
+    if(wantedBackend != BACKEND_THREADS) {
+        try {
+            engine = new UringEngine();
+        } catch(const std::exception& e) {
+            if(wantedBackend == BACKEND_URING) {
+                LOG_WARN("io", "Cannot set up io_uring (%s); writing files "
+                        "with threads", e.what());
+            }
+        }
+    }
+#else
+    if(wantedBackend == BACKEND_URING) {
+        LOG_WARN("io", "This binary was built without io_uring support; "
+                "writing files with threads");
+    }
+#endif
+    if(engine == NULL) engine = new ThreadEngine();
+    LOG_DEBUG("io", "Writing files through %s", engine->name());
+    return *engine;
+}
+
+BufferPool& buffers() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+};
+
+bool io::parseBackend(const std::string& name, Backend& backend) {
+    if(name == "auto") backend = BACKEND_AUTO;
+    else if(name == "uring") backend = BACKEND_URING;
+    else if(name == "threads") backend = BACKEND_THREADS;
+    else return false;
+    return true;
+}
+
+const char* io::backendName() {
+    return getEngine().name();
+}
+
+void io::configure(Backend backend, bool direct) {
+    std::lock_guard<std::mutex> l(engineLock);
+    wantedBackend = backend;
+    wantDirect = direct;
+}
+
+size_t FileWriter::bufferSize() {
+    return BUFFER_SIZE;
+}
+
+FileWriter::FileWriter(const std::string& path, unsigned int inflight) :
+        m_path(path), m_fd(-1), m_direct(false),
+        m_inflightLimit(std::max(inflight, 1u)), m_buf(NULL), m_fill(0),
+        m_offset(0), m_inflight(0) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+    if(wantDirect) {
+        // filesystems without O_DIRECT support refuse it with EINVAL
+        m_fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if(m_fd >= 0) m_direct = true;
+        else if(errno != EINVAL)
+            throw std::runtime_error(errorText("Cannot open", path, errno));
+    }
+#endif
+    if(m_fd < 0) m_fd = ::open(path.c_str(), flags, 0644);
+    if(m_fd < 0) throw std::runtime_error(errorText("Cannot open", path, errno));
+}
+
+FileWriter::~FileWriter() {
+    try {
+        close();
+    } catch(const std::exception& e) {
+        LOG_ERROR("io", "%s", e.what());
+    }
+}
+
+void FileWriter::check() {
+    if(!m_error) return;
+    // report each error once
+    std::exception_ptr e = m_error;
+    m_error = std::exception_ptr();
+    std::rethrow_exception(e);
+}
+
+void FileWriter::write(const void* data, size_t len) {
+    std::unique_lock<std::mutex> l(m_lock);
+    check();
+    if(m_fd < 0) throw std::logic_error("Write to closed file " + m_path);
+
+    const char* p = (const char*)data;
+    while(len > 0) {
+        if(m_buf == NULL) {
+            m_cond.wait(l, [this]() {
+                return m_inflight < m_inflightLimit || m_error;
+            });
+            check();
+            m_buf = buffers().acquire();
+            m_fill = 0;
+        }
+        size_t n = std::min(len, (size_t)BUFFER_SIZE - m_fill);
+        memcpy(m_buf + m_fill, p, n);
+        m_fill += n;
+        p += n;
+        len -= n;
+        if(m_fill == BUFFER_SIZE) submit(m_fill);
+    }
+}
+
+void FileWriter::submit(size_t len) {
+    char* buf = m_buf;
+    off_t offset = m_offset;
+    if(len < m_fill) {
+        // only whole blocks can go with O_DIRECT; the rest starts a new buffer
+        m_buf = buffers().acquire();
+        memcpy(m_buf, buf + len, m_fill - len);
+        m_fill -= len;
+    } else {
+        m_buf = NULL;
+        m_fill = 0;
+    }
+    m_offset += len;
+    m_inflight++;
+    getEngine().submit(m_fd, buf, len, offset, [this, buf](ssize_t r) {
+        completed(buf, r);
+    });
+}
+
+void FileWriter::completed(char* buf, ssize_t result) {
+    buffers().release(buf);
+    std::lock_guard<std::mutex> l(m_lock);
+    m_inflight--;
+    if(result < 0 && !m_error) {
+        m_error = std::make_exception_ptr(std::runtime_error(
+                    errorText("Cannot write", m_path, -result)));
+    }
+    m_cond.notify_all();
+}
+
+void FileWriter::flush() {
+    std::unique_lock<std::mutex> l(m_lock);
+    check();
+    if(m_buf == NULL || m_fill == 0) return;
+    size_t len = m_direct ? m_fill & ~(size_t)(DIRECT_ALIGN - 1) : m_fill;
+    if(len > 0) submit(len);
+}
+
+void FileWriter::close() {
+    std::unique_lock<std::mutex> l(m_lock);
+    if(m_fd < 0) return;
+
+    off_t size = m_offset + m_fill;
+    if(m_buf != NULL && m_fill > 0) {
+        if(m_direct) {
+            // pad to a whole block, and trim the file afterwards
+            size_t len = (m_fill + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+            memset(m_buf + m_fill, 0, len - m_fill);
+            m_fill = len;
+        }
+        submit(m_fill);
+    } else if(m_buf != NULL) {
+        buffers().release(m_buf);
+        m_buf = NULL;
+    }
+    m_cond.wait(l, [this]() { return m_inflight == 0; });
+
+    if(m_offset != size && ftruncate(m_fd, size) != 0 && !m_error) {
+        m_error = std::make_exception_ptr(std::runtime_error(
+                    errorText("Cannot trim", m_path, errno)));
+    }
+    if(::close(m_fd) != 0 && !m_error) {
+        m_error = std::make_exception_ptr(std::runtime_error(
+                    errorText("Cannot close", m_path, errno)));
+    }
+    m_fd = -1;
+    check();
+}
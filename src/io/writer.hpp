@@ -0,0 +1,94 @@
+#ifndef IO_WRITER_HPP
+#define IO_WRITER_HPP
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+
+#include <sys/types.h>
+
+namespace io {
+
+//! How writes reach the disk
+enum Backend {
+    BACKEND_AUTO,       //!< io_uring where the kernel allows it, else threads
+    BACKEND_URING,      //!< Submitted through an io_uring
+    BACKEND_THREADS     //!< pwrite() on a small pool of writer threads
+};
+
+//! Parse `auto`, `uring` or `threads`. False if it's none of them.
+bool parseBackend(const std::string& name, Backend& backend);
+
+//! Name of the backend writes actually go through
+const char* backendName();
+
+/** \brief Choose how files are written from now on
+ *
+ * Only takes effect if no file has been written yet. Asking for io_uring when
+ * it isn't available, or the kernel won't set one up, falls back to threads.
+ *
+ * \param direct Open files with O_DIRECT, bypassing the page cache, where the
+ *               filesystem supports it
+ */
+void configure(Backend backend, bool direct);
+
+/** \brief An append-only file written in the background
+ *
+ * Data is copied into page-aligned buffers, and each buffer is submitted as
+ * one write as soon as it's full; write() only ever waits when all of the
+ * file's buffers are still in flight. Completed buffers go back to a shared
+ * pool for the next write, so steady-state writing doesn't allocate.
+ *
+ * With O_DIRECT, writes must cover whole blocks: a partial last block is held
+ * back until close(), which writes it padded and then trims the file.
+ *
+ * A write error is thrown from the next write(), flush() or close().
+ */
+class FileWriter {
+public:
+    /** \param inflight Buffers the file may have in flight at once */
+    explicit FileWriter(const std::string& path, unsigned int inflight=4);
+    ~FileWriter();
+
+    void write(const void* data, size_t len);
+    void write(const std::string& data) { write(data.data(), data.size()); }
+
+    //! Submit whatever is buffered, without waiting for it
+    void flush();
+
+    //! Wait for every write to complete, then close the file
+    void close();
+
+    const std::string& path() const { return m_path; }
+
+    //! Size of each write buffer. A file needs len / bufferSize() + 1 of them
+    //! in flight for a write of len bytes never to wait.
+    static size_t bufferSize();
+
+private:
+    //! Submit the current buffer's first \p len bytes. Call with m_lock held.
+    void submit(size_t len);
+
+    //! Called by the backend when a write finishes
+    void completed(char* buf, ssize_t result);
+
+    void check();
+
+    std::string m_path;
+    int m_fd;
+    bool m_direct;
+    unsigned int m_inflightLimit;
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    char* m_buf;            // the buffer being filled, if any
+    size_t m_fill;          // bytes in it
+    off_t m_offset;         // where it goes in the file
+    unsigned int m_inflight;
+    std::exception_ptr m_error;
+};
+
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include "log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_RING_SIZE 256       // records buffered per thread
+#define LOG_MESSAGE_SIZE 232    // longest message kept, with its terminator
+#define LOG_POLL_MS 50          // how often the writer looks for messages
+
+using namespace logging;
+using namespace std::chrono;
+
+std::atomic<int> logging::g_level(LEVEL_INFO);
+
+namespace {
+const char* LEVEL_NAMES[] = { "debug", "info", "warn", "error" };
+const char* LEVEL_LABELS[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+struct Record {
+    int64_t time;           // microseconds since the epoch
+    Level level;
+    const char* component;
+    char msg[LOG_MESSAGE_SIZE];
+};
+
+//! One thread's records. Only that thread writes, only the writer reads.
+struct Ring {
+    Record records[LOG_RING_SIZE];
+    std::atomic<size_t> head;   // next slot the owning thread fills
+    std::atomic<size_t> tail;   // next slot the writer empties
+    std::atomic<bool> owned;
+    std::atomic<unsigned long> dropped;
+    unsigned int thread;
+};
+
+struct State {
+    std::mutex lock;        // guards everything below but the output
+    std::vector<Ring*> rings;
+    std::atomic<bool> running;
+    std::thread writer;
+    std::condition_variable wake, flushed;
+    unsigned long flushRequested, flushDone;
+    Format format;
+
+    std::mutex outLock;
+    FILE* out;
+
+    State() : running(false), flushRequested(0), flushDone(0),
+            format(FORMAT_TEXT), out(stderr) { }
+};
+
+//! Never destroyed, since threads can still log during static destruction
+State& state() {
+    static State* s = new State();
+    return *s;
+}
+
+//! Gives a thread's ring back when the thread exits
+struct RingHandle {
+    Ring* ring;
+    ~RingHandle() { if(ring) ring->owned.store(false); }
+};
+thread_local RingHandle t_ring = { NULL };
+
+Ring* threadRing() {
+    if(t_ring.ring) return t_ring.ring;
+
+    State& s = state();
+    std::lock_guard<std::mutex> l(s.lock);
+    // take over the ring of a thread that has exited, once it's drained
+    for(auto r : s.rings) {
+        if(!r->owned.load() && r->head.load() == r->tail.load()) {
+            r->owned.store(true);
+            t_ring.ring = r;
+            return r;
+        }
+    }
+
+    Ring* r = new Ring();
+    r->head.store(0);
+    r->tail.store(0);
+    r->owned.store(true);
+    r->dropped.store(0);
+    r->thread = s.rings.size() + 1;
+    s.rings.push_back(r);
+    t_ring.ring = r;
+    return r;
+}
+
+void fill(Record& r, Level level, const char* component, const char* fmt,
+        va_list args) {
+    r.time = duration_cast<microseconds>(
+            system_clock::now().time_since_epoch()).count();
+    r.level = level;
+    r.component = component;
+    vsnprintf(r.msg, sizeof(r.msg), fmt, args);
+
+    // lines are terminated when they're written
+    size_t n = strlen(r.msg);
+    while(n > 0 && r.msg[n-1] == '\n') r.msg[--n] = 0;
+}
+
+void emit(FILE* out, Format format, const Record& r, unsigned int thread) {
+    time_t secs = r.time / 1000000;
+    int ms = (r.time / 1000) % 1000;
+    struct tm tm;
+    char ts[32];
+
+    if(format == FORMAT_TEXT) {
+        localtime_r(&secs, &tm);
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+        fprintf(out, "%s.%03d %-5s %s: %s\n", ts, ms, LEVEL_LABELS[r.level],
+                r.component, r.msg);
+        return;
+    }
+
+    gmtime_r(&secs, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+    fprintf(out, "ts=%s.%03dZ level=%s thread=%u component=%s msg=\"", ts, ms,
+            LEVEL_NAMES[r.level], thread, r.component);
+    for(const char* c = r.msg;*c;c++) {
+        if(*c == '"' || *c == '\\') fputc('\\', out);
+        if(*c == '\n') fputs("\\n", out);
+        else fputc(*c, out);
+    }
+    fputs("\"\n", out);
+}
+
+//! Write out everything waiting in the given rings, oldest first
+void drain(const std::vector<Ring*>& rings,
+        std::vector<std::pair<Record, unsigned int> >& batch) {
+    State& s = state();
+    batch.clear();
+    for(auto r : rings) {
+        size_t tail = r->tail.load(std::memory_order_relaxed);
+        size_t head = r->head.load(std::memory_order_acquire);
+        for(;tail != head;tail++)
+            batch.push_back(std::make_pair(r->records[tail % LOG_RING_SIZE],
+                        r->thread));
+        r->tail.store(tail, std::memory_order_release);
+
+        unsigned long dropped = r->dropped.exchange(0);
+        if(dropped > 0) {
+            Record d;
+            d.time = batch.empty() ? 0 : batch.back().first.time;
+            d.level = LEVEL_WARN;
+            d.component = "log";
+            snprintf(d.msg, sizeof(d.msg),
+                    "%lu messages dropped from a full buffer", dropped);
+            batch.push_back(std::make_pair(d, r->thread));
+        }
+    }
+    if(batch.empty()) return;
+
+    std::stable_sort(batch.begin(), batch.end(),
+            [](const std::pair<Record, unsigned int>& a,
+                const std::pair<Record, unsigned int>& b) {
+                return a.first.time < b.first.time; });
+
+    std::lock_guard<std::mutex> l(s.outLock);
+    for(auto& r : batch) emit(s.out, s.format, r.first, r.second);
+    fflush(s.out);
+}
+
+void writerLoop() {
+    State& s = state();
+    std::vector<std::pair<Record, unsigned int> > batch;
+    std::unique_lock<std::mutex> l(s.lock);
+    for(;;) {
+        std::vector<Ring*> rings = s.rings;
+        unsigned long requested = s.flushRequested;
+        bool running = s.running.load();
+        l.unlock();
+        drain(rings, batch);
+        l.lock();
+
+        s.flushDone = requested;
+        s.flushed.notify_all();
+        if(!running) break;
+        if(s.flushRequested == s.flushDone)
+            s.wake.wait_for(l, milliseconds(LOG_POLL_MS));
+    }
+}
+};
+
+void logging::setLevel(Level level) {
+    g_level.store(level);
+}
+
+bool logging::parseLevel(const std::string& name, Level& level) {
+    for(int i = LEVEL_DEBUG;i <= LEVEL_ERROR;i++) {
+        if(name == LEVEL_NAMES[i]) {
+            level = (Level)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void logging::write(Level level, const char* component, const char* fmt, ...) {
+    State& s = state();
+    va_list args;
+    va_start(args, fmt);
+
+    if(!s.running.load()) {
+        // no writer, so write it now
+        Record r;
+        fill(r, level, component, fmt, args);
+        va_end(args);
+        std::lock_guard<std::mutex> l(s.outLock);
+        emit(s.out, s.format, r, 0);
+        fflush(s.out);
+        return;
+    }
+
+    Ring* ring = threadRing();
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    if(head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+        ring->dropped++;
+        va_end(args);
+        return;
+    }
+    fill(ring->records[head % LOG_RING_SIZE], level, component, fmt, args);
+    va_end(args);
+    ring->head.store(head + 1, std::memory_order_release);
+
+    // errors may come right before the program gives up; don't wait to poll
+    if(level >= LEVEL_ERROR) s.wake.notify_one();
+}
+
+logging::RateLimit::RateLimit(double seconds) :
+        m_interval((int64_t)(seconds * 1e6)), m_next(0), m_skipped(0) {
+}
+
+bool logging::RateLimit::allow(unsigned long& skipped) {
+    int64_t now = duration_cast<microseconds>(
+            steady_clock::now().time_since_epoch()).count();
+    int64_t next = m_next.load();
+    if(now < next || !m_next.compare_exchange_strong(next, now + m_interval)) {
+        m_skipped++;
+        return false;
+    }
+    skipped = m_skipped.exchange(0);
+    return true;
+}
+
+void logging::start(FILE* out, Format format) {
+    State& s = state();
+    std::lock_guard<std::mutex> l(s.lock);
+    if(s.running.load()) return;
+    {
+        std::lock_guard<std::mutex> ol(s.outLock);
+        s.out = out;
+        s.format = format;
+    }
+    s.running.store(true);
+    s.writer = std::thread(writerLoop);
+}
+
+void logging::flush() {
+    State& s = state();
+    std::unique_lock<std::mutex> l(s.lock);
+    if(!s.running.load()) return;
+    unsigned long gen = ++s.flushRequested;
+    s.wake.notify_one();
+    s.flushed.wait(l, [&]() { return s.flushDone >= gen; });
+}
+
+void logging::stop() {
+    State& s = state();
+    {
+        std::lock_guard<std::mutex> l(s.lock);
+        if(!s.running.load()) return;
+        s.running.store(false);
+        s.wake.notify_one();
+    }
+    s.writer.join();
+
+    // pick up anything logged while the writer was finishing
+    std::vector<std::pair<Record, unsigned int> > batch;
+    std::vector<Ring*> rings;
+    {
+        std::lock_guard<std::mutex> l(s.lock);
+        rings = s.rings;
+    }
+    drain(rings, batch);
+}
@@ -0,0 +1,105 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace logging {
+
+enum Level { LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR };
+
+enum Format {
+    FORMAT_TEXT,    //!< `2018-03-01 12:00:00.000 WARN  network: message`
+    FORMAT_LOGFMT   //!< `ts=... level=warn thread=1 component=network msg="..."`
+};
+
+extern std::atomic<int> g_level;
+
+//! Whether messages at \p level are being logged
+inline bool enabled(Level level) {
+    return level >= g_level.load(std::memory_order_relaxed);
+}
+
+void setLevel(Level level);
+
+//! Parse `debug`, `info`, `warn` or `error`. False if it's none of them.
+bool parseLevel(const std::string& name, Level& level);
+
+/** \brief Log a message
+ *
+ * The message is formatted into the calling thread's ring buffer, and written
+ * out later by the background writer. Nothing blocks: if the ring is full the
+ * message is dropped and counted. Without a writer running (before start() or
+ * after stop()) messages are written immediately instead.
+ *
+ * \param component A string literal naming the part of the program logging
+ */
+void write(Level level, const char* component, const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/** \brief Limits how often a message is logged
+ *
+ * Used through LOG_EVERY, which keeps one per call site.
+ */
+class RateLimit {
+public:
+    RateLimit(double seconds);
+
+    /** \brief Whether a message may be logged now
+     *
+     * \param skipped Set to the number of messages held back since the last
+     *                one allowed through
+     */
+    bool allow(unsigned long& skipped);
+
+private:
+    int64_t m_interval;
+    std::atomic<int64_t> m_next;
+    std::atomic<unsigned long> m_skipped;
+};
+
+//! Start the background writer, writing to \p out
+void start(FILE* out, Format format=FORMAT_TEXT);
+
+//! Wait until everything logged so far has been written
+void flush();
+
+//! Write out what's left and stop the background writer
+void stop();
+
+//! Runs the background writer for as long as it exists
+class Session {
+public:
+    Session(FILE* out, Format format=FORMAT_TEXT) { start(out, format); }
+    ~Session() { stop(); }
+};
+};
+
+#define LOG_AT(level, component, ...) do { \
+        if(logging::enabled(level)) \
+            logging::write(level, component, __VA_ARGS__); \
+    } while(0)
+
+#define LOG_DEBUG(component, ...) \
+    LOG_AT(logging::LEVEL_DEBUG, component, __VA_ARGS__)
+#define LOG_INFO(component, ...) \
+    LOG_AT(logging::LEVEL_INFO, component, __VA_ARGS__)
+#define LOG_WARN(component, ...) \
+    LOG_AT(logging::LEVEL_WARN, component, __VA_ARGS__)
+#define LOG_ERROR(component, ...) \
+    LOG_AT(logging::LEVEL_ERROR, component, __VA_ARGS__)
+
+//! Log at most once every \p seconds from this call site
+#define LOG_EVERY(seconds, level, component, ...) do { \
+        static logging::RateLimit log_limit_(seconds); \
+        unsigned long log_skipped_; \
+        if(logging::enabled(level) && log_limit_.allow(log_skipped_)) { \
+            if(log_skipped_ > 0) logging::write(level, component, \
+                    "(%lu similar messages suppressed)", log_skipped_); \
+            logging::write(level, component, __VA_ARGS__); \
+        } \
+    } while(0)
+
+#endif
@@ -25,6 +25,9 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <list>
+#include <limits>
+#include <sstream>
 
 #include <boost/program_options.hpp>
 #include <boost/format.hpp>
@@ -33,9 +36,20 @@
 
 #include "media/capture.hpp"
 #include "media/sink.hpp"
+#include "media/record.hpp"
+#include "media/sampled.hpp"
+#include "media/dual.hpp"
+#include "media/gst.hpp"
+#include "media/rtsp.hpp"
 #include "ui.hpp"
 #include "algorithm.hpp"
 #include "results.hpp"
+#include "sched/autotune.hpp"
+#include "sched/budget.hpp"
+#include "sched/graph.hpp"
+#include "sched/shed.hpp"
+#include "sched/segments.hpp"
+#include "log/log.hpp"
 
 #ifdef __linux__
 #include <unistd.h>
@@ -56,8 +70,10 @@ double getTime() {
     return (double)t.tv_sec + (((double)t.tv_nsec) / 1.0e9);
 }
 
+// minimum IoU for a box to tie tracks together across batch segments
+#define BATCH_STITCH_THRESHOLD 0.5
+
 bool showtext = false;
-bool verbose = false;
 int level=13;
 
 /** Set up options description and parse command-line options */
@@ -69,7 +85,13 @@ po::variables_map read_options(int argc, char **argv) {
         ("help,h", "Print this help message")
         ("text,t", "Enable text display")
         ("no-window,w", "Run in command-line-only mode (non-windowed)")
-        ("verbose,v", "Enable verbose output")
+        ("verbose,v", "Enable verbose output (same as --log-level debug)")
+        ("log-level", po::value<string>(),
+            "Least severe messages to log: debug, info, warn or error")
+        ("log-file", po::value<string>(),
+            "Append log messages to this file instead of stderr")
+        ("log-format", po::value<string>()->default_value("text"),
+            "Log as plain text or as logfmt key=value pairs (text, logfmt)")
         ("infinite,i", "Try to make sure video stream doesn't terminate")
         ("vstream,V", po::value<string>(), 
 #ifdef NETWORK_OUTPUT
@@ -77,12 +99,54 @@ po::variables_map read_options(int argc, char **argv) {
 #else
         "Stream video to given host (disabled)")
 #endif
-        ("mstream,M", po::value<string>(), "Stream metadata to given host")
+        ("mstream,M", po::value<string>(),
+            "Stream metadata to given host, to a file with file:[path], or to "
+            "a detection store with store:[dir]")
+        ("threads,T", po::value<unsigned int>()->default_value(0),
+            "Total thread budget shared by detection, encoding and I/O "
+            "(0 = one per core)")
+        ("seed", po::value<unsigned int>(), "Seed for object ID generation")
+        ("record", po::value<string>(),
+            "Record input frames, results and timings to the given directory "
+            "for later replay with replay:[dir]")
+        ("io-backend", po::value<string>()->default_value("auto"),
+            "How recordings and metadata files are written: auto, uring or "
+            "threads")
+        ("io-direct", "Write those files with O_DIRECT, bypassing the page "
+            "cache")
+        ("batch", po::value<unsigned int>()->implicit_value(0),
+            "Analyze a video file offline as this many segments in parallel "
+            "(0 = one per worker thread)")
+        ("batch-overlap", po::value<long>()->default_value(50),
+            "Frames each batch segment shares with the previous one")
+        ("batch-gop", po::value<long>()->default_value(0),
+            "Align batch segments to multiples of this keyframe interval")
+        ("batch-log", po::value<string>()->default_value("results.log"),
+            "Where batch mode writes its results")
         ("algorithm,a",
              po::value<vector<string> >()->default_value({"ocv-hog-svm"},
                  "ocv-hog-svm"),
             "Specify video processing algorithm to use")
-        ("list-algos", "List all available algorithm modules");
+        ("param,p", po::value<vector<string> >(),
+            "Set an algorithm parameter, as name=value")
+        ("autotune", "Calibrate algorithm parameters and the thread budget "
+            "for this machine and input size, save them, and run with them")
+        ("autotune-clip", po::value<string>(),
+            "Calibrate on this input instead of a synthetic clip")
+        ("no-autotune", "Ignore saved calibrations")
+        ("slo", po::value<double>(),
+            "Latency objective from capture to result, in ms. Detection work "
+            "is shed in steps when it's missed.")
+        ("priority", po::value<int>()->default_value(0),
+            "Shedding priority; streams with lower numbers are shed first")
+        ("graph", po::value<string>(),
+            "Run the pipeline graph described in this file instead of the "
+            "built-in one")
+        ("dry-run", po::value<long>()->implicit_value(100),
+            "With --graph, run this many frames with outputs switched off, "
+            "then print the graph and what each node cost")
+        ("list-algos", "List all available algorithm modules")
+        ("list-nodes", "List the node types a graph can use");
 
     po::options_description hidden_desc;
     hidden_desc.add_options()
@@ -118,11 +182,30 @@ po::variables_map read_options(int argc, char **argv) {
             exit(0);
         }
 
+        if(vm.count("list-nodes") > 0) {
+            printf("Available graph nodes:\n");
+            for(auto& s : sched::stages()) {
+                string ports;
+                for(auto& p : s.ports) ports += " " + p.name;
+                printf("   %12s - %s (inputs:%s)\n", s.kind.c_str(),
+                        s.desc.c_str(), ports.empty() ? " none" : ports.c_str());
+            }
+            exit(0);
+        }
+
         // sanity checks
-        if(vm.count("input") == 0) {
+        if(vm.count("input") == 0 && vm.count("graph") == 0) {
             cerr << "Error: you must specify an input stream\n";
             exit(1);
         }
+        if(vm.count("param") > 0) {
+            for(auto& p : vm["param"].as<vector<string> >()) {
+                if(p.find('=') == string::npos) {
+                    cerr << "Error: Invalid algorithm parameter: " << p << '\n';
+                    exit(1);
+                }
+            }
+        }
 
         po::notify(vm);
     } catch(po::required_option& e) {
@@ -150,71 +233,421 @@ void configure_sink(const po::variables_map &vm, vio::FanoutSink& sink) {
     if(vm.count("vstream") > 0) {
 #ifdef NETWORK_OUTPUT
         vio::GStreamerSink* nsink = new vio::GStreamerSink(boost::str(
-                boost::format("appsrc ! videoconvert ! x264enc qp-min=18 !"
-                "rtph264pay ! udpsink host=%1% port=5501")
-                % vm["vstream"].as<string>()), 10);
+                boost::format("appsrc ! videoconvert ! x264enc qp-min=18 "
+                "threads=%2% ! rtph264pay ! udpsink host=%1% port=5501")
+                % vm["vstream"].as<string>()
+                % sched::ThreadBudget::get().encoderThreads()), 10);
         sink.addSink(nsink);
 #else
-        cerr << "Error: This binary was not built with network output support.\n";
+        LOG_ERROR("main", "This binary was not built with network output "
+                "support");
 #endif
     }
 }
 
-int main(int argc, char** argv) {
-    ml::AlgorithmRegistry& algoReg = ml::AlgorithmRegistry::get();
+/** Whether any result holds a bounding box */
+bool has_boxes(const std::vector<ml::AlgorithmResult*>& res) {
+    for(auto r : res) {
+        if(r->type == ml::RT_BOUNDING_BOXES &&
+                !static_cast<ml::BoundingBoxesResult*>(r)->boxes.empty())
+            return true;
+    }
+    return false;
+}
 
-    // process command-line options
-    po::variables_map vm = read_options(argc, argv);
+/** Copy results with their boxes moved into main stream coordinates */
+void rescale_results(const std::vector<ml::AlgorithmResult*>& in,
+        const vio::DualCaptureBackend& dual,
+        std::list<ml::BoundingBoxesResult>& store,
+        std::vector<ml::AlgorithmResult*>& out) {
+    store.clear();
+    out.clear();
+    for(auto r : in) {
+        if(r->type != ml::RT_BOUNDING_BOXES) {
+            out.push_back(r);
+            continue;
+        }
+        store.push_back(*static_cast<ml::BoundingBoxesResult*>(r));
+        for(auto& b : store.back().boxes) b.bounds = dual.toMain(b.bounds);
+        out.push_back(&store.back());
+    }
+}
 
-    verbose = vm.count("verbose") > 0;
-    showtext = vm.count("text") > 0;
+/** Parameters given with -p, as name/value pairs. Malformed ones are rejected
+ * along with the other options. */
+sched::ParamList user_params(const po::variables_map& vm) {
+    sched::ParamList params;
+    if(vm.count("param") == 0) return params;
+    for(auto p : vm["param"].as<vector<string> >()) {
+        size_t eq = p.find('=');
+        if(eq != string::npos)
+            params.push_back(make_pair(p.substr(0, eq), p.substr(eq+1)));
+    }
+    return params;
+}
 
-    // open video capture
-    vio::CaptureBackend* vcap = vio::openBackend(
-            vm["input"].as<string>(),
-            vm.count("infinite") > 0);
+/** Calibrate for this machine and input size, or load a saved calibration.
+ * Fills in the parameters and the total thread budget to use; the budget is
+ * left at zero when it shouldn't change. */
+bool apply_tuning(const po::variables_map& vm, const cv::Size& size,
+        sched::ParamList& params, unsigned int& threads) {
+    vector<string> algos = vm["algorithm"].as<vector<string> >();
+    bool fixedThreads = vm["threads"].as<unsigned int>() != 0;
+    string key = sched::tuneKey(algos, size), file = sched::tuneFile();
+
+    sched::TunedConfig cfg;
+    if(vm.count("autotune") > 0) {
+        try {
+            sched::Autotuner tuner(algos, user_params(vm));
+            if(vm.count("autotune-clip") > 0)
+                tuner.setClip(vm["autotune-clip"].as<string>());
+            tuner.setSearchThreads(!fixedThreads);
+            cfg = tuner.run(size);
+        } catch(const std::exception& e) {
+            LOG_ERROR("autotune", "Calibration failed: %s", e.what());
+            return false;
+        }
+        try {
+            sched::saveTuned(file, key, cfg);
+            LOG_INFO("autotune", "Saved as \"%s\" in %s", key.c_str(),
+                    file.c_str());
+        } catch(const std::exception& e) {
+            LOG_WARN("autotune", "Cannot save calibration: %s", e.what());
+        }
+    } else {
+        try {
+            if(!sched::loadTuned(file, key, cfg)) return true;
+        } catch(const std::exception& e) {
+            LOG_WARN("autotune", "Cannot read %s: %s", file.c_str(), e.what());
+            return true;
+        }
+        LOG_INFO("autotune", "Using the calibration for \"%s\" (%.1f fps)",
+                key.c_str(), cfg.fps);
+    }
 
-    // set up video sink
-    vio::FanoutSink sink;
-    configure_sink(vm, sink);
+    // -p and -T are applied on top, so they still win
+    params = cfg.params;
+    if(!fixedThreads) threads = cfg.threads;
+    return true;
+}
 
-    // create the algorithm(s)
-    ml::Algorithm* algo; // the main algorithm to use
-    algoReg.setSize(vcap->getSize());
+/** Load the given algorithm(s) and apply parameters, tuned ones first, then
+ * the user's. NULL on failure. */
+ml::Algorithm* create_algorithm(const vector<string>& goal,
+        const sched::ParamList& tuned, const sched::ParamList& user) {
+    ml::Algorithm* algo;
     try {
-        vector<string> goal = vm["algorithm"].as<vector<string> >();
         if(goal.size() == 1) { // just load the target algorithm
             algo = ml::AlgorithmRegistry::get().load(goal[0]);
             if(algo == NULL) {
-                fprintf(stderr, "Error: Cannot load algorithm: %s\n", goal[0].c_str());
-                fprintf(stderr, "       Use --list-algos to show available options\n");
-                return 1;
-            } else if(verbose) {
-                ml::Algorithm::Info inf = algo->getInfo();
-                printf("Loaded %s\n", inf.name.c_str());
+                LOG_ERROR("main", "Cannot load algorithm: %s. Use --list-algos "
+                        "to show available options", goal[0].c_str());
+                return NULL;
             }
+            LOG_DEBUG("main", "Loaded %s", algo->getInfo().name.c_str());
         } else { // load multiple algorithms
             // set up a composite group
             ml::CompositeAlgorithm* group = new ml::CompositeAlgorithm();
             algo = group;
             for(auto a : goal) {
-                auto r = ml::AlgorithmRegistry::get().load(goal[0]);
+                auto r = ml::AlgorithmRegistry::get().load(a);
                 if(r == NULL) {
-                    fprintf(stderr, "Error: Cannot find algorithm: %s\n", a.c_str());
+                    LOG_ERROR("main", "Cannot find algorithm: %s", a.c_str());
                 } else {
-                    if(verbose) {
-                        ml::Algorithm::Info inf = algo->getInfo();
-                        printf("Loaded %s\n", inf.name.c_str());
-                    }
+                    LOG_DEBUG("main", "Loaded %s", r->getInfo().name.c_str());
                     group->add(r);
                 }
             }
         }
     } catch(ml::algorithm_init_error& e) {
-        fprintf(stderr, "%s\nError: Failed to initialize algorithm: %s\n", e.what(),
-                vm["algorithm"].as<string>().c_str());
+        LOG_ERROR("main", "Failed to initialize algorithm %s: %s",
+                goal[0].c_str(), e.what());
+        return NULL;
+    }
+    for(auto& p : tuned) {
+        if(!algo->setParam(p.first, p.second)) {
+            LOG_WARN("autotune", "Tuned parameter %s=%s no longer applies",
+                    p.first.c_str(), p.second.c_str());
+        }
+    }
+    for(auto& p : user) {
+        if(!algo->setParam(p.first, p.second)) {
+            LOG_ERROR("main", "Invalid algorithm parameter: %s=%s",
+                    p.first.c_str(), p.second.c_str());
+            return NULL;
+        }
+    }
+    return algo;
+}
+
+/** Run a pipeline graph from a file, or dry-run it and print what it costs */
+int run_graph(const po::variables_map& vm) {
+    bool dry = vm.count("dry-run") > 0;
+    sched::ThreadBudget& budget = sched::ThreadBudget::get();
+    unsigned int threads = vm["threads"].as<unsigned int>();
+    budget.configure(threads);
+    try {
+        sched::Graph graph(vm["graph"].as<string>(), dry);
+
+        // every node may be busy at once; the pool isn't created until the
+        // graph runs, so it can still be sized for that
+        budget.configure(threads, graph.width());
+        LOG_DEBUG("main", "Thread budget: %u (opencv %u, workers %u)",
+                budget.total(), budget.opencvThreads(), budget.workerThreads());
+
+        long frames = graph.run(dry ? vm["dry-run"].as<long>() : -1);
+        if(dry) {
+            graph.print(std::cout);
+        } else {
+            std::ostringstream costs;
+            graph.print(costs);
+            LOG_DEBUG("graph", "Ran %ld frames:\n%s", frames,
+                    costs.str().c_str());
+        }
+    } catch(const std::exception& e) {
+        LOG_ERROR("graph", "%s", e.what());
+        return 1;
+    }
+    return 0;
+}
+
+/** Analyze a video file as segments in parallel, writing a result log */
+int run_batch(const po::variables_map& vm) {
+    string input = vm["input"].as<string>();
+    if(input.compare(0, 5, "file:") == 0) input = input.substr(5);
+
+    cv::VideoCapture probe(input);
+    long total = probe.get(CAP_PROP_FRAME_COUNT);
+    cv::Size size(probe.get(CAP_PROP_FRAME_WIDTH),
+            probe.get(CAP_PROP_FRAME_HEIGHT));
+    if(!probe.isOpened() || total <= 0) {
+        LOG_ERROR("main", "Batch mode needs a seekable video file");
+        return 1;
+    }
+    probe.release();
+
+    // the calibration is for the whole input, so it covers every segment
+    sched::ParamList tuned;
+    unsigned int threads = vm["threads"].as<unsigned int>();
+    if(vm.count("no-autotune") == 0 && !apply_tuning(vm, size, tuned, threads))
+        return 1;
+
+    // one stream per segment; zero segments means one per worker
+    sched::ThreadBudget& budget = sched::ThreadBudget::get();
+    unsigned int nsegs = vm["batch"].as<unsigned int>();
+    budget.configure(threads,
+            nsegs > 0 ? nsegs : std::numeric_limits<unsigned int>::max());
+    if(nsegs == 0) nsegs = budget.workerThreads();
+
+    vector<sched::Segment> segs = sched::planSegments(total, nsegs,
+            vm["batch-overlap"].as<long>(), vm["batch-gop"].as<long>());
+    LOG_DEBUG("main", "Batch: %ld frames in %lu segments on %u workers", total,
+            segs.size(), budget.workerThreads());
+
+    ml::AlgorithmRegistry& algoReg = ml::AlgorithmRegistry::get();
+    algoReg.setSize(size);
+    if(vm.count("seed") > 0) algoReg.setSeed(vm["seed"].as<unsigned int>());
+    vector<ml::Algorithm*> algos;
+    for(size_t i = 0;i < segs.size();i++) {
+        ml::Algorithm* a = create_algorithm(
+                vm["algorithm"].as<vector<string> >(), tuned, user_params(vm));
+        if(a == NULL) return 1;
+        algos.push_back(a);
+    }
+
+    double sttime = getTime();
+    vector<sched::SegmentResult> parts;
+    try {
+        parts = sched::processSegments(input, segs, algos, budget.workers());
+    } catch(const std::exception& e) {
+        LOG_ERROR("main", "%s", e.what());
         return 1;
     }
+    double elapsed = getTime() - sttime;
+
+    vector<double> times;
+    vector<sched::FrameBoxes> frames = sched::stitchSegments(parts, total,
+            BATCH_STITCH_THRESHOLD, times);
+
+    mdump::ResultLog log(vm["batch-log"].as<string>(),
+            mdump::ResultLog::RECORD);
+    ml::BoundingBoxesResult res;
+    res.type = ml::RT_BOUNDING_BOXES;
+    vector<ml::AlgorithmResult*> resList(1, &res);
+    for(long f = 0;f < total;f++) {
+        res.boxes = frames[f];
+        log.frame(f, resList, times[f]);
+    }
+
+    printf("Processed %ld frames in %.1f s (%.1f fps)\n", total, elapsed,
+            total / elapsed);
+    log.summary(stdout);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    ml::AlgorithmRegistry& algoReg = ml::AlgorithmRegistry::get();
+
+    // process command-line options
+    po::variables_map vm = read_options(argc, argv);
+
+    showtext = vm.count("text") > 0;
+
+    // start logging before anything else can have something to say
+    logging::Level logLevel = vm.count("verbose") > 0 ?
+        logging::LEVEL_DEBUG : logging::LEVEL_INFO;
+    if(vm.count("log-level") > 0 &&
+            !logging::parseLevel(vm["log-level"].as<string>(), logLevel)) {
+        cerr << "Error: Unknown log level: " << vm["log-level"].as<string>()
+            << '\n';
+        return 1;
+    }
+    logging::Format logFormat = logging::FORMAT_TEXT;
+    if(vm["log-format"].as<string>() == "logfmt") {
+        logFormat = logging::FORMAT_LOGFMT;
+    } else if(vm["log-format"].as<string>() != "text") {
+        cerr << "Error: Unknown log format: " << vm["log-format"].as<string>()
+            << '\n';
+        return 1;
+    }
+    FILE* logFile = stderr;
+    if(vm.count("log-file") > 0) {
+        logFile = fopen(vm["log-file"].as<string>().c_str(), "a");
+        if(!logFile) {
+            cerr << "Error: Cannot open log file: "
+                << vm["log-file"].as<string>() << '\n';
+            return 1;
+        }
+    }
+    logging::setLevel(logLevel);
+    logging::Session logSession(logFile, logFormat);
+
+    io::Backend ioBackend;
+    if(!io::parseBackend(vm["io-backend"].as<string>(), ioBackend)) {
+        LOG_ERROR("main", "Unknown I/O backend: %s",
+                vm["io-backend"].as<string>().c_str());
+        return 1;
+    }
+    io::configure(ioBackend, vm.count("io-direct") > 0);
+
+    if(vm.count("batch") > 0) return run_batch(vm);
+    if(vm.count("graph") > 0) return run_graph(vm);
+
+    // divide the thread budget before anything starts threads of its own
+    sched::ThreadBudget& budget = sched::ThreadBudget::get();
+    budget.configure(vm["threads"].as<unsigned int>());
+    LOG_DEBUG("main", "Thread budget: %u (opencv %u, workers %u, io %u, "
+            "encoder %u)", budget.total(), budget.opencvThreads(),
+            budget.workerThreads(), budget.ioThreads(), budget.encoderThreads());
+
+    // open video capture. Closing it on the way out finishes any recording.
+    std::unique_ptr<vio::CaptureBackend> vcap(vio::openBackend(
+            vm["input"].as<string>(),
+            vm.count("infinite") > 0));
+
+    vio::DualCaptureBackend* dual =
+        dynamic_cast<vio::DualCaptureBackend*>(vcap.get());
+    if(dual && vm.count("record") > 0) {
+        LOG_ERROR("main", "Dual-stream inputs cannot be recorded");
+        return 1;
+    }
+
+#ifdef WITH_LIBAV
+    vio::SampledCaptureBackend* sampled =
+        dynamic_cast<vio::SampledCaptureBackend*>(vcap.get());
+#endif
+
+    // GStreamer frames point into the pipeline's buffers and are read-only
+    bool sharedFrames = false;
+#ifdef WITH_GSTREAMER_CAPTURE
+    sharedFrames = dynamic_cast<vio::GstCaptureBackend*>(vcap.get()) != NULL;
+    vio::RtspCaptureBackend* rtsp =
+        dynamic_cast<vio::RtspCaptureBackend*>(vcap.get());
+#endif
+
+    // set up record/replay. Replays reuse the recorded seed unless told not to.
+    unsigned int seed = 1;
+    std::unique_ptr<mdump::ResultLog> resultLog;
+    vio::RecordingCaptureBackend* recorder = NULL;
+    vio::ReplayCaptureBackend* replay =
+        dynamic_cast<vio::ReplayCaptureBackend*>(vcap.get());
+    if(replay) seed = replay->getSeed();
+    if(vm.count("seed") > 0) seed = vm["seed"].as<unsigned int>();
+
+    // what gets shed depends on wall-clock time, which no replay reproduces
+    if(vm.count("slo") > 0 && (replay || vm.count("record") > 0)) {
+        LOG_ERROR("main", "--slo cannot be used when recording or replaying");
+        return 1;
+    }
+
+    try {
+        if(replay) {
+            resultLog.reset(new mdump::ResultLog(
+                    (replay->getDirectory() / "results.log").string(),
+                    mdump::ResultLog::VERIFY));
+        } else if(vm.count("record") > 0) {
+            // plain video files decode the same way every time, so only a
+            // reference to them needs to be kept
+            string input = vm["input"].as<string>(), source;
+            if(vm.count("infinite") == 0) {
+                if(input.find(':') == string::npos) source = input;
+                else if(input.compare(0, 5, "file:") == 0)
+                    source = input.substr(5);
+            }
+
+            boost::filesystem::path dir(vm["record"].as<string>());
+            recorder = new vio::RecordingCaptureBackend(vcap.release(), dir,
+                    seed, source);
+            vcap.reset(recorder);
+            resultLog.reset(new mdump::ResultLog(
+                    (dir / "results.log").string(), mdump::ResultLog::RECORD));
+        }
+    } catch(const std::exception& e) {
+        LOG_ERROR("main", "%s", e.what());
+        return 1;
+    }
+
+    // replays have to run the configuration they were recorded with
+    cv::Size algoSize = dual ? dual->getDetectionSize() : vcap->getSize();
+    sched::ParamList tuned;
+    unsigned int threads = 0;
+    if(replay) {
+        tuned = replay->getParams();
+        if(vm["threads"].as<unsigned int>() == 0)
+            threads = replay->getThreads();
+    } else if(vm.count("no-autotune") == 0 &&
+            !apply_tuning(vm, algoSize, tuned, threads)) {
+        return 1;
+    }
+    if(threads > 0 && threads != budget.total()) {
+        budget.configure(threads);
+        LOG_DEBUG("main", "Tuned thread budget: %u (opencv %u, workers %u)",
+                budget.total(), budget.opencvThreads(), budget.workerThreads());
+    }
+    if(recorder) recorder->setTuning(tuned, budget.total());
+
+    // replays run the recorded algorithms and -p settings unless given others
+    vector<string> algoNames = vm["algorithm"].as<vector<string> >();
+    sched::ParamList userParams = user_params(vm);
+    if(replay && !replay->getAlgorithms().empty()) {
+        if(vm["algorithm"].defaulted()) algoNames = replay->getAlgorithms();
+        else if(algoNames != replay->getAlgorithms())
+            LOG_WARN("replay", "Running other algorithms than were recorded");
+        if(vm.count("param") == 0) userParams = replay->getUserParams();
+        else if(userParams != replay->getUserParams())
+            LOG_WARN("replay", "Running other parameters than were recorded");
+    }
+    if(recorder) recorder->setAlgorithms(algoNames, userParams);
+    algoReg.setSeed(seed);
+
+    // set up video sink
+    vio::FanoutSink sink;
+    configure_sink(vm, sink);
+
+    // create the algorithm(s), sized for the frames they'll actually see
+    algoReg.setSize(algoSize);
+    ml::Algorithm* algo = create_algorithm(algoNames, tuned, userParams);
+    if(algo == NULL) return 1;
     bool isFPGAAlgo = algo->getInfo().fpga;
 
     // set up UI and register fields
@@ -251,52 +684,165 @@ int main(int argc, char** argv) {
     // set up metadata dumper if needed
     mdump::Metadumper* dumper = NULL;
     if(vm.count("mstream") > 0) {
-        std::unique_ptr<mdump::TCPTarget> tgt(new mdump::TCPTarget(
-                    vm["mstream"].as<string>().c_str(), "5500"));
+        string dest = vm["mstream"].as<string>();
+        std::unique_ptr<mdump::DumpTarget> tgt;
+        try {
+            if(dest.compare(0, 5, "file:") == 0)
+                tgt.reset(new mdump::FileTarget(dest.substr(5)));
+            else if(dest.compare(0, 6, "store:") == 0)
+                tgt.reset(new mdump::StoreTarget(dest.substr(6)));
+            else
+                tgt.reset(new mdump::TCPTarget(dest.c_str(), "5500",
+                            budget.reactor()));
+        } catch(const std::exception& e) {
+            LOG_ERROR("main", "%s", e.what());
+            return 1;
+        }
         dumper = new mdump::Metadumper(std::move(tgt));
     }
 
-    Mat img, algo_img;
+    // shed detection work when results fall behind the latency objective
+    sched::LoadShedder& shedder = sched::LoadShedder::get();
+    int shedStream = -1;
+    sched::ShedDecision shed = { false, true, 0 };
+    if(vm.count("slo") > 0) {
+        try {
+            shedStream = shedder.addStream(vm["input"].as<string>(),
+                    vm["slo"].as<double>(), vm["priority"].as<int>(),
+                    algo->setParam("detect", "1"),
+                    algo->setParam("max_levels", "0"));
+        } catch(const std::exception& e) {
+            LOG_ERROR("main", "%s", e.what());
+            return 1;
+        }
+    }
+
+    Mat img, canvas;
     double dtime;
+    std::list<ml::BoundingBoxesResult> scaledBoxes;
+    std::vector<ml::AlgorithmResult*> scaledRes;
+    const std::vector<ml::AlgorithmResult*> noResults; // for dropped frames
 
     // Frame-by-frame processing loop.
     double sttime = getTime();
     double ktime;
     long frame = 0;
-    while(vcap->getFrame(img))
+    for(;;)
     {
-        if(isFPGAAlgo) cvtColor(img, algo_img, CV_BGR2BGRA);
-        else algo_img = img;
+        // backends that don't timestamp frames captured them when asked
+        double asked = getTime();
+        if(!vcap->getFrame(img)) break;
+
+        // dual-stream inputs are analyzed on the detection stream
+        // algorithms convert the frame into whatever form they need
+        const Mat& src = dual ? dual->getDetectionFrame() : img;
+
+        double captured = vcap->getCaptureTime();
+        if(captured < 0) captured = asked;
+        bool dropped = false;
+        if(shedStream >= 0) {
+            sched::ShedDecision d = shedder.admit(shedStream, captured,
+                    getTime());
+            dropped = d.drop;
+            if(!dropped) {
+                if(d.detect != shed.detect)
+                    algo->setParam("detect", d.detect ? "1" : "0");
+                if(d.maxLevels != shed.maxLevels)
+                    algo->setParam("max_levels", std::to_string(d.maxLevels));
+                shed = d;
+            }
+        }
 
-        double time = getTime();
-        const std::vector<ml::AlgorithmResult*>* res;
-        try {
-            res = &algo->analyze(algo_img);
-        } catch(const std::exception& e) {
-            fprintf(stderr, "Error: %s\n", e.what());
-            break;
+        // a dropped frame still goes to the outputs, just without results,
+        // so frame numbers keep matching the input
+        const std::vector<ml::AlgorithmResult*>* res = &noResults;
+        dtime = 0;
+        if(!dropped) {
+            double time = getTime();
+            try {
+                res = &algo->analyze(src);
+            } catch(const std::exception& e) {
+                LOG_ERROR("main", "%s", e.what());
+                break;
+            }
+            if(dual) {
+                rescale_results(*res, *dual, scaledBoxes, scaledRes);
+                res = &scaledRes;
+            }
+            dtime = getTime() - time;
+            fps->addSample(1.0/dtime);
+            if(shedStream >= 0)
+                shedder.complete(shedStream, captured, getTime());
+        }
+        if(shedStream >= 0 && dumper) {
+            sched::ShedStats st = shedder.stats(shedStream);
+            dumper->setShedding(sched::shedLevelName(st.level),
+                    st.dropped, st.late);
         }
-        dtime = getTime() - time;
-        fps->addSample(1.0/dtime);
+        // file positions, for inputs whose frames don't simply follow the file
+        long source = vcap->getSourceFrame();
+        if(dumper) dumper->setSource(vcap->getMediaTime(), source);
+        if(resultLog && !resultLog->frame(frame, *res, dtime, source))
+            LOG_DEBUG("replay", "Frame %ld differs from the recording", frame);
+#ifdef WITH_LIBAV
+        // have sampled scans look closer wherever someone turns up
+        if(sampled && has_boxes(*res)) {
+            LOG_DEBUG("sampled", "Hit at %.2f s", sampled->getMediaTime());
+            sampled->hit();
+        }
+#endif
 
         if(showtext) {
             printf("\r%s", termStatus.render().c_str());
             fflush(stdout);
         }
         if(resultDraw) resultDraw->setResults(*res);
-        overlay.render(img);
+        if(sharedFrames) {
+            // draw on a BGR copy rather than into the pipeline's buffer
+            if(img.channels() == 1) cvtColor(img, canvas, CV_GRAY2BGR);
+            else if(img.channels() == 4) cvtColor(img, canvas, CV_BGRA2BGR);
+            else img.copyTo(canvas);
+        }
+        Mat& view = sharedFrames ? canvas : img;
+        overlay.render(view);
 
         if(dumper) dumper->accept(
                 *res, 15, frame, isFPGAAlgo,
-                cpuLoad->getValue(), 1.0/dtime, (int)(dtime*1000));
+                cpuLoad->getValue(), dropped ? 0.0 : 1.0/dtime,
+                (int)(dtime*1000), captured);
 
         // show or save the video result
-        sink << img;
+        sink << view;
         tuiMgr.update();
 
         frame++;
     }
     sink.close();
+    if(dumper) dumper->finish();
+    if(resultLog) resultLog->summary(stdout);
+#ifdef WITH_LIBAV
+    if(sampled) {
+        LOG_DEBUG("sampled", "Sampled %ld of %ld decoded frames", frame,
+                sampled->getDecodedFrames());
+    }
+#endif
+#ifdef WITH_GSTREAMER_CAPTURE
+    if(rtsp && logging::enabled(logging::LEVEL_DEBUG)) {
+        vio::RtspCaptureBackend::Stats st = rtsp->getStats();
+        LOG_DEBUG("rtsp", "%ld frames, %ld reconnects, %llu packets, %llu lost, "
+                "%llu late, jitter %.1f ms", st.frames, st.reconnects,
+                st.packets, st.lost, st.late, st.jitter);
+        LOG_DEBUG("rtsp", "Latency: %.1f ms mean, %.1f ms max",
+                st.latency, st.maxLatency);
+    }
+#endif
+    if(shedStream >= 0) {
+        sched::ShedStats st = shedder.stats(shedStream);
+        LOG_INFO("shed", "%ld frames: %ld late, %ld dropped, %ld tracker-only, "
+                "%ld on a coarser pyramid; %ld steps down, %ld back up",
+                st.frames, st.late, st.dropped, st.trackOnly, st.reduced,
+                st.escalations, st.relaxations);
+    }
     return 0;
 }
 
@@ -1,7 +1,13 @@
 #include "capture.hpp"
+#include "record.hpp"
+#include "synth.hpp"
+#include "sampled.hpp"
+#include "dual.hpp"
+#include "gst.hpp"
+#include "rtsp.hpp"
+#include "../log/log.hpp"
 
 #include <stdexcept>
-#include <stdio.h>
 #include <stdlib.h>
 
 using namespace vio;
@@ -46,7 +52,7 @@ void FileCaptureBackend::restart() {
     m_cap = new cv::VideoCapture(m_fname.c_str());
 
     if(!m_cap->isOpened() || !m_cap->grab()) {
-        fprintf(stderr, "Error: Cannot reset video stream\n");
+        LOG_ERROR("capture", "Cannot reset video stream");
         m_end = true;
     }
 }
@@ -89,7 +95,7 @@ void CameraCaptureBackend::restart() {
     m_cap = new cv::VideoCapture(m_index);
 
     if(!m_cap->isOpened() || !m_cap->grab()) {
-        fprintf(stderr, "Error: Cannot reset video stream\n");
+        LOG_ERROR("capture", "Cannot reset video stream");
         m_end = true;
     }
 }
@@ -130,6 +136,30 @@ CaptureBackend* vio::openBackend(std::string spec, bool infinite=false) {
         return new CameraCaptureBackend(n);
     } else if(scheme.compare("file") == 0) {
         return new FileCaptureBackend(rest, infinite);
+    } else if(scheme.compare("replay") == 0) {
+        return new ReplayCaptureBackend(rest);
+    } else if(scheme.compare("synth") == 0) {
+        return new SyntheticCaptureBackend(rest);
+    } else if(scheme.compare("dual") == 0) {
+        return new DualCaptureBackend(rest);
+    } else if(scheme.compare("sample") == 0) {
+#ifdef WITH_LIBAV
+        return new SampledCaptureBackend(rest);
+#else
+        throw std::invalid_argument("Built without libav; sampling unavailable");
+#endif
+    } else if(scheme.compare("gst") == 0) {
+#ifdef WITH_GSTREAMER_CAPTURE
+        return new GstCaptureBackend(rest, infinite);
+#else
+        throw std::invalid_argument("Built without GStreamer capture support");
+#endif
+    } else if(scheme.compare("rtsp") == 0) {
+#ifdef WITH_GSTREAMER_CAPTURE
+        return new RtspCaptureBackend(rest);
+#else
+        throw std::invalid_argument("Built without GStreamer capture support");
+#endif
     } else {
         throw std::invalid_argument("No such capture type");
     }
@@ -9,6 +9,8 @@ namespace vio {
 
 class CaptureBackend {
 public:
+    virtual ~CaptureBackend() { }
+
     /** \brief Get the next frame of input.
      *
      * \return Whether more input was available
@@ -21,6 +23,30 @@ public:
      */
     virtual cv::Size getSize()=0;
 
+    /** \brief When the last frame was captured, in seconds on the monotonic
+     * clock
+     *
+     * \return A negative value if the backend can't tell, in which case the
+     *         time getFrame() returned is as close as it gets
+     */
+    virtual double getCaptureTime() const { return -1; }
+
+    /** \brief Where the last frame is in the file it came from
+     *
+     * Only for backends whose frames can be out of step with a simple count
+     * of the frames returned.
+     *
+     * \return Seconds from the start of the file, or a negative value if the
+     *         backend doesn't report it
+     */
+    virtual double getMediaTime() const { return -1; }
+
+    /** \brief Index of the last frame in the file it came from
+     *
+     * \return A negative value if the backend doesn't report it
+     */
+    virtual long getSourceFrame() const { return -1; }
+
     /** \brief Restart the video capture
      */
     virtual void restart()=0;
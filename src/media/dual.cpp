@@ -0,0 +1,101 @@
+#include "dual.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+// how far ahead of a main frame a detection frame may be and still pair
+#define SYNC_TOLERANCE_MS 20.0
+
+using namespace vio;
+
+DualCaptureBackend::DualCaptureBackend(const std::string& spec) {
+    size_t bar = spec.find('|');
+    if(bar == std::string::npos)
+        throw std::invalid_argument("Dual spec needs two streams, split by |");
+    m_detUri = spec.substr(0, bar);
+    m_mainUri = spec.substr(bar + 1);
+    open();
+}
+
+DualCaptureBackend::~DualCaptureBackend() {
+}
+
+void DualCaptureBackend::open() {
+    if(!m_det.open(m_detUri))
+        throw std::invalid_argument("Failed to open detection stream");
+    if(!m_main.open(m_mainUri))
+        throw std::invalid_argument("Failed to open main stream");
+
+    m_detSize = cv::Size(m_det.get(cv::CAP_PROP_FRAME_WIDTH),
+            m_det.get(cv::CAP_PROP_FRAME_HEIGHT));
+    m_mainSize = cv::Size(m_main.get(cv::CAP_PROP_FRAME_WIDTH),
+            m_main.get(cv::CAP_PROP_FRAME_HEIGHT));
+    if(m_detSize.area() == 0 || m_mainSize.area() == 0)
+        throw std::invalid_argument("Cannot determine stream frame sizes");
+
+    m_detFrame.release();
+    m_haveNext = false;
+    m_timed = true;
+    m_detTime = m_nextTime = m_lastMain = m_skew = 0;
+    m_frames = 0;
+}
+
+int DualCaptureBackend::getFrame(cv::Mat& out) {
+    if(!m_main.read(out)) return 0;
+    double tm = m_main.get(cv::CAP_PROP_POS_MSEC);
+    if(m_frames++ > 0 && tm <= m_lastMain) m_timed = false;
+    m_lastMain = tm;
+
+    if(!m_timed) {
+        // no usable clock; assume the streams run in lockstep
+        if(!m_det.read(m_detFrame)) return 0;
+        m_skew = 0;
+        return 1;
+    }
+
+    // take detection frames up to this main frame's time
+    while(true) {
+        if(!m_haveNext) {
+            if(!m_det.read(m_nextDet)) break;
+            m_nextTime = m_det.get(cv::CAP_PROP_POS_MSEC);
+            m_haveNext = true;
+        }
+        if(m_nextTime > tm + SYNC_TOLERANCE_MS && !m_detFrame.empty()) break;
+        std::swap(m_detFrame, m_nextDet);
+        m_detTime = m_nextTime;
+        m_haveNext = false;
+    }
+    if(m_detFrame.empty()) return 0;
+
+    m_skew = tm - m_detTime;
+    return 1;
+}
+
+cv::Size DualCaptureBackend::getSize() {
+    return m_mainSize;
+}
+
+void DualCaptureBackend::restart() {
+    m_det.release();
+    m_main.release();
+    open();
+}
+
+const cv::Mat& DualCaptureBackend::getDetectionFrame() const {
+    return m_detFrame;
+}
+
+cv::Size DualCaptureBackend::getDetectionSize() const {
+    return m_detSize;
+}
+
+cv::Rect DualCaptureBackend::toMain(const cv::Rect& r) const {
+    double sx = (double)m_mainSize.width / m_detSize.width;
+    double sy = (double)m_mainSize.height / m_detSize.height;
+    return cv::Rect(cvRound(r.x * sx), cvRound(r.y * sy),
+            cvRound(r.width * sx), cvRound(r.height * sy));
+}
+
+double DualCaptureBackend::getSkew() const {
+    return m_skew;
+}
@@ -0,0 +1,59 @@
+#ifndef DUAL_HPP
+#define DUAL_HPP
+
+#include <string>
+
+#include "capture.hpp"
+
+namespace vio {
+
+/** \brief Capture backend pairing a detection stream with a main stream
+ *
+ * Cameras often offer a low-resolution substream alongside the main one.
+ * This opens both: getFrame() returns main stream frames for display and
+ * recording, and getDetectionFrame() the substream frame closest in time,
+ * which is what should be analyzed. Boxes found in it are mapped back with
+ * toMain().
+ *
+ * Frames are paired by presentation timestamp, taking the newest detection
+ * frame no later than the main frame plus a small tolerance. Streams which
+ * don't report increasing timestamps are paired frame by frame instead.
+ *
+ * Specs look like `dual:[detection uri]|[main uri]`.
+ */
+class DualCaptureBackend : public CaptureBackend {
+public:
+    DualCaptureBackend(const std::string& spec);
+    ~DualCaptureBackend();
+
+    int getFrame(cv::Mat& out);
+    cv::Size getSize();
+    void restart();
+
+    //! The detection frame paired with the last main frame
+    const cv::Mat& getDetectionFrame() const;
+
+    cv::Size getDetectionSize() const;
+
+    //! Map a rectangle from detection to main stream coordinates
+    cv::Rect toMain(const cv::Rect& r) const;
+
+    //! Main minus detection timestamp of the last pair, in milliseconds
+    double getSkew() const;
+
+private:
+    void open();
+
+    std::string m_detUri, m_mainUri;
+    cv::VideoCapture m_det, m_main;
+    cv::Size m_detSize, m_mainSize;
+
+    cv::Mat m_detFrame, m_nextDet;
+    double m_detTime, m_nextTime, m_lastMain, m_skew;
+    bool m_haveNext, m_timed;
+    long m_frames;
+};
+
+};
+
+#endif
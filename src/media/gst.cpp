@@ -0,0 +1,234 @@
+#include "gst.hpp"
+#include "../log/log.hpp"
+
+#ifdef WITH_GSTREAMER_CAPTURE
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include <stdexcept>
+
+using namespace vio;
+
+namespace {
+//! A mapped video frame and the sample that keeps its buffer alive
+struct MappedFrame {
+    GstSample* sample;
+    GstVideoFrame frame;
+};
+
+/** \brief Allocator for Mats that point into GstBuffers
+ *
+ * Mats only ever get this allocator from GstCaptureBackend::wrap(). When the
+ * last reference to one of those goes away the buffer is unmapped and the
+ * sample released, which hands the buffer back to the pipeline's pool.
+ */
+class GstFrameAllocator : public cv::MatAllocator {
+public:
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data,
+            size_t* step, int flags, cv::UMatUsageFlags usage) const {
+        // a wrapped Mat being recreated at a different size gets normal memory
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data,
+                step, flags, usage);
+    }
+
+    bool allocate(cv::UMatData* u, int access, cv::UMatUsageFlags usage) const {
+        return cv::Mat::getStdAllocator()->allocate(u, access, usage);
+    }
+
+    void deallocate(cv::UMatData* u) const {
+        if(!u) return;
+        MappedFrame* f = static_cast<MappedFrame*>(u->userdata);
+        gst_video_frame_unmap(&f->frame);
+        gst_sample_unref(f->sample);
+        delete f;
+        delete u;
+    }
+};
+
+GstFrameAllocator s_allocator;
+};
+
+GstCaptureBackend::GstCaptureBackend(const std::string& pipeline, bool looped) :
+        GstCaptureBackend(pipeline, looped, true) { }
+
+GstCaptureBackend::GstCaptureBackend(const std::string& pipeline, bool looped,
+        bool autostart) :
+        m_pipeline(NULL), m_sink(NULL), m_first(NULL),
+        m_timeout(GST_CLOCK_TIME_NONE), m_desc(pipeline), m_loop(looped) {
+    gst_init(NULL, NULL);
+
+    GError* err = NULL;
+    m_pipeline = gst_parse_launch(m_desc.c_str(), &err);
+    if(err) {
+        std::string msg(err->message);
+        g_error_free(err);
+        if(m_pipeline) gst_object_unref(m_pipeline);
+        throw std::invalid_argument("Invalid GStreamer pipeline: " + msg);
+    }
+    if(!GST_IS_BIN(m_pipeline)) {
+        gst_object_unref(m_pipeline);
+        throw std::invalid_argument("GStreamer pipeline has no appsink");
+    }
+
+    // prefer an appsink called "sink", otherwise take the first one found
+    m_sink = gst_bin_get_by_name(GST_BIN(m_pipeline), "sink");
+    if(m_sink && !GST_IS_APP_SINK(m_sink)) {
+        gst_object_unref(m_sink);
+        m_sink = NULL;
+    }
+    if(!m_sink) {
+        GstIterator* it = gst_bin_iterate_sinks(GST_BIN(m_pipeline));
+        GValue item = G_VALUE_INIT;
+        while(!m_sink && gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+            GstElement* e = GST_ELEMENT(g_value_get_object(&item));
+            if(GST_IS_APP_SINK(e)) m_sink = GST_ELEMENT(gst_object_ref(e));
+            g_value_reset(&item);
+        }
+        g_value_unset(&item);
+        gst_iterator_free(it);
+    }
+    if(!m_sink) {
+        gst_object_unref(m_pipeline);
+        throw std::invalid_argument("GStreamer pipeline has no appsink");
+    }
+
+    if(autostart) try {
+        start();
+    } catch(...) {
+        stop();
+        gst_object_unref(m_sink);
+        gst_object_unref(m_pipeline);
+        throw;
+    }
+}
+
+GstCaptureBackend::~GstCaptureBackend() {
+    stop();
+    gst_object_unref(m_sink);
+    gst_object_unref(m_pipeline);
+}
+
+void GstCaptureBackend::start() {
+    if(gst_element_set_state(m_pipeline, GST_STATE_PLAYING) ==
+            GST_STATE_CHANGE_FAILURE) {
+        reportErrors();
+        throw std::runtime_error("Failed to start the GStreamer pipeline");
+    }
+
+    // the first frame is held back until getFrame() so its size is known
+    m_first = gst_app_sink_try_pull_sample(GST_APP_SINK(m_sink), m_timeout);
+    if(!m_first) {
+        reportErrors();
+        throw std::runtime_error("GStreamer pipeline produced no frames");
+    }
+    GstVideoInfo info;
+    GstCaps* caps = gst_sample_get_caps(m_first);
+    if(!caps || !gst_video_info_from_caps(&info, caps))
+        throw std::runtime_error("GStreamer pipeline isn't producing raw video");
+    m_size = cv::Size(GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info));
+}
+
+void GstCaptureBackend::stop() {
+    if(m_first) gst_sample_unref(m_first);
+    m_first = NULL;
+    gst_element_set_state(m_pipeline, GST_STATE_NULL);
+}
+
+void GstCaptureBackend::wrap(GstSample* sample, cv::Mat& out) {
+    GstVideoInfo info;
+    GstCaps* caps = gst_sample_get_caps(sample);
+    if(!caps || !gst_video_info_from_caps(&info, caps)) {
+        gst_sample_unref(sample);
+        throw std::runtime_error("GStreamer pipeline isn't producing raw video");
+    }
+
+    int type;
+    switch(GST_VIDEO_INFO_FORMAT(&info)) {
+    case GST_VIDEO_FORMAT_BGR:
+        type = CV_8UC3;
+        break;
+    case GST_VIDEO_FORMAT_BGRx:
+    case GST_VIDEO_FORMAT_BGRA:
+        type = CV_8UC4;
+        break;
+    case GST_VIDEO_FORMAT_GRAY8:
+    case GST_VIDEO_FORMAT_I420:
+    case GST_VIDEO_FORMAT_NV12:
+        // the luma plane comes first; detectors only need that
+        type = CV_8UC1;
+        break;
+    default: {
+        std::string fmt(gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&info)));
+        gst_sample_unref(sample);
+        throw std::invalid_argument("Unsupported appsink format " + fmt +
+                "; convert to BGR, BGRx, GRAY8, I420 or NV12 first");
+    }
+    }
+
+    MappedFrame* f = new MappedFrame;
+    f->sample = sample;
+    if(!gst_video_frame_map(&f->frame, &info, gst_sample_get_buffer(sample),
+                GST_MAP_READ)) {
+        delete f;
+        gst_sample_unref(sample);
+        throw std::runtime_error("Failed to map GStreamer buffer");
+    }
+
+    uchar* data = static_cast<uchar*>(GST_VIDEO_FRAME_PLANE_DATA(&f->frame, 0));
+    size_t step = GST_VIDEO_FRAME_PLANE_STRIDE(&f->frame, 0);
+    int rows = GST_VIDEO_FRAME_HEIGHT(&f->frame);
+    cv::Mat m(rows, GST_VIDEO_FRAME_WIDTH(&f->frame), type, data, step);
+
+    // hand the mapping to the Mat's reference count
+    cv::UMatData* u = new cv::UMatData(&s_allocator);
+    u->data = u->origdata = data;
+    u->size = step * rows;
+    u->userdata = f;
+    u->refcount = 1;
+    m.u = u;
+    m.allocator = &s_allocator;
+    out = m;
+}
+
+void GstCaptureBackend::reportErrors() {
+    GstBus* bus = gst_element_get_bus(m_pipeline);
+    GstMessage* msg;
+    while((msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR)) != NULL) {
+        GError* err = NULL;
+        gchar* debug = NULL;
+        gst_message_parse_error(msg, &err, &debug);
+        LOG_ERROR("gstreamer", "%s", err->message);
+        g_error_free(err);
+        g_free(debug);
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+}
+
+int GstCaptureBackend::getFrame(cv::Mat& out) {
+    GstSample* sample = m_first;
+    m_first = NULL;
+    if(!sample) sample = gst_app_sink_pull_sample(GST_APP_SINK(m_sink));
+    if(!sample && m_loop && gst_app_sink_is_eos(GST_APP_SINK(m_sink))) {
+        restart();
+        sample = m_first;
+        m_first = NULL;
+    }
+    if(!sample) {
+        reportErrors();
+        return 0;
+    }
+
+    wrap(sample, out);
+    return 1;
+}
+
+cv::Size GstCaptureBackend::getSize() {
+    return m_size;
+}
+
+void GstCaptureBackend::restart() {
+    stop();
+    start();
+}
+#endif
@@ -0,0 +1,68 @@
+#ifndef GST_HPP
+#define GST_HPP
+
+#include <string>
+
+#include "capture.hpp"
+
+#ifdef WITH_GSTREAMER_CAPTURE
+#include <gst/gst.h>
+
+namespace vio {
+
+/** \brief Capture backend which pulls frames out of a GStreamer pipeline
+ *
+ * The spec is a gst-launch style pipeline description ending in an appsink,
+ * for example
+ * `gst:filesrc location=a.mp4 ! decodebin ! videoconvert ! video/x-raw,format=BGR ! appsink`.
+ * If there is more than one appsink, the one named `sink` is used.
+ *
+ * Frames aren't copied out of the pipeline: the returned cv::Mat points
+ * straight into the mapped GstBuffer, which stays referenced until the last
+ * Mat sharing it is released. These frames must be treated as read-only,
+ * since decoders may still be using the buffer as a reference picture.
+ *
+ * Supported appsink formats are BGR, BGRx/BGRA and GRAY8, plus I420 and NV12,
+ * for which only the luma plane is returned (as a single channel image).
+ */
+class GstCaptureBackend : public CaptureBackend {
+public:
+    GstCaptureBackend(const std::string& pipeline, bool looped=false);
+    virtual ~GstCaptureBackend();
+
+    int getFrame(cv::Mat& out);
+    cv::Size getSize();
+    void restart();
+
+protected:
+    /** \brief Build the pipeline, optionally without starting it
+     *
+     * Subclasses that need to add elements or connect signals first pass
+     * false for \p autostart and call start() themselves.
+     */
+    GstCaptureBackend(const std::string& pipeline, bool looped, bool autostart);
+
+    //! Set the pipeline playing and wait for its first frame
+    void start();
+    void stop();
+
+    //! Wrap a sample's first plane in a Mat. Takes ownership of \p sample.
+    void wrap(GstSample* sample, cv::Mat& out);
+
+    //! Print any error waiting on the pipeline's bus
+    void reportErrors();
+
+    GstElement* m_pipeline;
+    GstElement* m_sink;
+    GstSample* m_first;
+    GstClockTime m_timeout; // how long start() waits for a frame
+
+private:
+    std::string m_desc;
+    bool m_loop;
+    cv::Size m_size;
+};
+};
+#endif
+
+#endif
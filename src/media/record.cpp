@@ -0,0 +1,246 @@
+#include "record.hpp"
+
+#include <stdexcept>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+using namespace vio;
+
+#define RECORDING_MAGIC "pddemo-recording"
+#define RECORDING_VERSION 1
+
+// frame files still being written before the oldest is waited for
+#define FRAMES_IN_FLIGHT 8
+
+// how often the index is handed to the disk, in seconds, so a recording cut
+// short still has most of its index
+#define INDEX_FLUSH_INTERVAL 1.0
+
+static double monotonicTime() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (((double)t.tv_nsec) / 1.0e9);
+}
+
+fs::path vio::recordedFramePath(const fs::path& dir, long frame) {
+    char name[32];
+    snprintf(name, sizeof(name), "%08ld.png", frame);
+    return dir / name;
+}
+
+RecordingCaptureBackend::RecordingCaptureBackend(CaptureBackend* src,
+        const fs::path& dir, unsigned int seed, const std::string& source) :
+        m_src(src), m_dir(dir), m_store(source.empty()), m_frame(0) {
+    fs::create_directories(dir);
+    try {
+        m_index.reset(new io::FileWriter((dir / "session.idx").string()));
+    } catch(const std::runtime_error&) {
+        throw std::invalid_argument("Cannot create recording index");
+    }
+
+    cv::Size sz = m_src->getSize();
+    std::ostringstream header;
+    header << RECORDING_MAGIC << ' ' << RECORDING_VERSION << '\n';
+    header << "seed " << seed << '\n';
+    header << "size " << sz.width << ' ' << sz.height << '\n';
+    if(!m_store) header << "source " << fs::absolute(source).string() << '\n';
+    m_index->write(header.str());
+    m_index->flush();
+    m_start = monotonicTime();
+    m_flushed = m_start;
+}
+
+RecordingCaptureBackend::~RecordingCaptureBackend() {
+    // the frames' writers close themselves, and report their own errors
+    m_pending.clear();
+}
+
+void RecordingCaptureBackend::setTuning(const RecordedParams& params,
+        unsigned int threads) {
+    std::ostringstream out;
+    for(auto& p : params) out << "param " << p.first << ' ' << p.second << '\n';
+    out << "threads " << threads << '\n';
+    m_index->write(out.str());
+    m_index->flush();
+}
+
+void RecordingCaptureBackend::setAlgorithms(
+        const std::vector<std::string>& names, const RecordedParams& params) {
+    std::ostringstream out;
+    for(auto& n : names) out << "algorithm " << n << '\n';
+    for(auto& p : params)
+        out << "userparam " << p.first << ' ' << p.second << '\n';
+    m_index->write(out.str());
+    m_index->flush();
+}
+
+int RecordingCaptureBackend::getFrame(cv::Mat& out) {
+    if(!m_src->getFrame(out)) return 0;
+
+    // sources that know where a frame is in their file say so too
+    char line[96];
+    double now = monotonicTime(), media = m_src->getMediaTime();
+    if(media >= 0) {
+        snprintf(line, sizeof(line), "frame %ld %.6f %.6f %ld\n", m_frame,
+                now - m_start, media, m_src->getSourceFrame());
+    } else {
+        snprintf(line, sizeof(line), "frame %ld %.6f\n", m_frame,
+                now - m_start);
+    }
+    m_index->write(line, strlen(line));
+    if(now - m_flushed >= INDEX_FLUSH_INTERVAL) {
+        m_index->flush();
+        m_flushed = now;
+    }
+    if(m_store) {
+        if(!cv::imencode(".png", out, m_png))
+            throw std::runtime_error("Failed to encode recorded frame");
+        // enough buffers for the whole frame, so the capture thread never
+        // waits on the disk here
+        unsigned int buffers = m_png.size() / io::FileWriter::bufferSize() + 1;
+        m_pending.emplace_back(new io::FileWriter(
+                    recordedFramePath(m_dir, m_frame).string(), buffers));
+        m_pending.back()->write(m_png.data(), m_png.size());
+        m_pending.back()->flush();
+        if(m_pending.size() > FRAMES_IN_FLIGHT) {
+            m_pending.front()->close();
+            m_pending.pop_front();
+        }
+    }
+    m_frame++;
+    return 1;
+}
+
+cv::Size RecordingCaptureBackend::getSize() {
+    return m_src->getSize();
+}
+
+void RecordingCaptureBackend::restart() {
+    m_src->restart();
+}
+
+double RecordingCaptureBackend::getMediaTime() const {
+    return m_src->getMediaTime();
+}
+
+long RecordingCaptureBackend::getSourceFrame() const {
+    return m_src->getSourceFrame();
+}
+
+ReplayCaptureBackend::ReplayCaptureBackend(const fs::path& dir) : m_dir(dir),
+        m_seed(0), m_threads(0), m_frame(0) {
+    std::ifstream idx((dir / "session.idx").c_str());
+    if(!idx) throw std::invalid_argument("Not a recording directory");
+
+    std::string magic;
+    int version;
+    idx >> magic >> version;
+    if(magic != RECORDING_MAGIC || version != RECORDING_VERSION)
+        throw std::invalid_argument("Unsupported recording format");
+
+    std::string line, key;
+    while(std::getline(idx, line)) {
+        std::istringstream in(line);
+        if(!(in >> key)) continue;
+
+        if(key == "seed") {
+            in >> m_seed;
+        } else if(key == "size") {
+            in >> m_size.width >> m_size.height;
+        } else if(key == "param") {
+            std::string name, value;
+            in >> name;
+            std::getline(in >> std::ws, value);
+            m_params.push_back(std::make_pair(name, value));
+        } else if(key == "algorithm") {
+            std::string name;
+            std::getline(in >> std::ws, name);
+            m_algorithms.push_back(name);
+        } else if(key == "userparam") {
+            std::string name, value;
+            in >> name;
+            std::getline(in >> std::ws, value);
+            m_userParams.push_back(std::make_pair(name, value));
+        } else if(key == "threads") {
+            in >> m_threads;
+        } else if(key == "source") {
+            std::string src;
+            std::getline(in >> std::ws, src);
+            m_src = std::unique_ptr<CaptureBackend>(new FileCaptureBackend(src));
+        } else if(key == "frame") {
+            long n, src = -1;
+            double t, media = -1;
+            in >> n >> t;
+            if(!(in >> media >> src)) media = src = -1;
+            m_stamps.push_back(t);
+            m_media.push_back(media);
+            m_sourceFrames.push_back(src);
+        }
+    }
+}
+
+ReplayCaptureBackend::~ReplayCaptureBackend() {
+}
+
+int ReplayCaptureBackend::getFrame(cv::Mat& out) {
+    if(m_frame >= (long)m_stamps.size()) return 0;
+
+    if(m_src) {
+        if(!m_src->getFrame(out)) return 0;
+    } else {
+        out = cv::imread(recordedFramePath(m_dir, m_frame).string());
+        if(out.empty()) throw std::runtime_error("Missing recorded frame");
+    }
+    m_frame++;
+    return 1;
+}
+
+cv::Size ReplayCaptureBackend::getSize() {
+    return m_size;
+}
+
+void ReplayCaptureBackend::restart() {
+    m_frame = 0;
+    if(m_src) m_src->restart();
+}
+
+unsigned int ReplayCaptureBackend::getSeed() const {
+    return m_seed;
+}
+
+const RecordedParams& ReplayCaptureBackend::getParams() const {
+    return m_params;
+}
+
+const std::vector<std::string>& ReplayCaptureBackend::getAlgorithms() const {
+    return m_algorithms;
+}
+
+const RecordedParams& ReplayCaptureBackend::getUserParams() const {
+    return m_userParams;
+}
+
+unsigned int ReplayCaptureBackend::getThreads() const {
+    return m_threads;
+}
+
+double ReplayCaptureBackend::getTimestamp() const {
+    if(m_frame == 0) return 0.0;
+    return m_stamps[m_frame-1];
+}
+
+double ReplayCaptureBackend::getMediaTime() const {
+    if(m_frame == 0) return -1;
+    return m_media[m_frame-1];
+}
+
+long ReplayCaptureBackend::getSourceFrame() const {
+    if(m_frame == 0) return -1;
+    return m_sourceFrames[m_frame-1];
+}
+
+const fs::path& ReplayCaptureBackend::getDirectory() const {
+    return m_dir;
+}
@@ -0,0 +1,142 @@
+#ifndef RECORD_HPP
+#define RECORD_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "capture.hpp"
+#include "../io/writer.hpp"
+
+namespace vio {
+
+namespace fs = boost::filesystem;
+
+//! Algorithm parameters as name/value pairs, in the order they were applied
+typedef std::vector<std::pair<std::string, std::string> > RecordedParams;
+
+/** \brief Capture backend which records everything its source produces
+ *
+ * Frames pulled through this backend are written to a recording directory
+ * along with their capture timestamps, so they can be played back later by a
+ * ReplayCaptureBackend. The directory holds an index file (`session.idx`) and,
+ * unless the source is a plain video file, one lossless PNG per frame. Video
+ * files decode deterministically, so for those only a reference to the file
+ * is kept.
+ *
+ * Frames are encoded on the calling thread but written in the background, and
+ * a few frames' files are left to finish while later frames come in.
+ */
+class RecordingCaptureBackend : public CaptureBackend {
+public:
+    /** \brief Start a new recording
+     *
+     * \param src The backend to record. Ownership is passed to the recorder.
+     * \param dir The recording directory. It is created if needed.
+     * \param seed The ID generator seed used for this run
+     * \param source If not empty, the video file \p src reads from. Frames
+     *               aren't stored in that case.
+     */
+    RecordingCaptureBackend(CaptureBackend* src, const fs::path& dir,
+            unsigned int seed, const std::string& source="");
+    ~RecordingCaptureBackend();
+
+    /** \brief Store the tuned configuration the run uses
+     *
+     * Call before the first frame, so a replay can run the same way.
+     * \param params Tuned algorithm parameters
+     * \param threads The total thread budget
+     */
+    void setTuning(const RecordedParams& params, unsigned int threads);
+
+    /** \brief Store the algorithms the run uses and the user's settings
+     *
+     * Call before the first frame.
+     * \param names Algorithm names, as given with `-a`
+     * \param params Parameters given with `-p`, applied after tuned ones
+     */
+    void setAlgorithms(const std::vector<std::string>& names,
+            const RecordedParams& params);
+
+    int getFrame(cv::Mat& out);
+    cv::Size getSize();
+    void restart();
+    double getMediaTime() const;
+    long getSourceFrame() const;
+
+private:
+    std::unique_ptr<CaptureBackend> m_src;
+    fs::path m_dir;
+    std::unique_ptr<io::FileWriter> m_index;
+    std::deque<std::unique_ptr<io::FileWriter> > m_pending; // frame files
+    std::vector<uchar> m_png;
+    bool m_store;
+    long m_frame;
+    double m_start;
+    double m_flushed;   // when the index was last flushed
+};
+
+/** \brief Capture backend which plays back a recording
+ *
+ * Frames are returned as fast as they are requested; the recorded timestamps
+ * are available through getTimestamp() for anything that wants to pace itself.
+ */
+class ReplayCaptureBackend : public CaptureBackend {
+public:
+    ReplayCaptureBackend(const fs::path& dir);
+    ~ReplayCaptureBackend();
+
+    int getFrame(cv::Mat& out);
+    cv::Size getSize();
+    void restart();
+
+    //! Where the recorded source said the last frame was, if it did
+    double getMediaTime() const;
+    long getSourceFrame() const;
+
+    //! The ID generator seed stored in the recording
+    unsigned int getSeed() const;
+
+    //! The tuned algorithm parameters the recording was made with
+    const RecordedParams& getParams() const;
+
+    //! The algorithms the recording was made with; empty if not stored
+    const std::vector<std::string>& getAlgorithms() const;
+
+    //! The user's algorithm parameters the recording was made with
+    const RecordedParams& getUserParams() const;
+
+    //! The thread budget the recording was made with; zero if not stored
+    unsigned int getThreads() const;
+
+    //! The recorded capture timestamp of the last frame returned, in seconds
+    double getTimestamp() const;
+
+    //! The recording directory
+    const fs::path& getDirectory() const;
+
+private:
+    fs::path m_dir;
+    std::unique_ptr<CaptureBackend> m_src; // set for by-reference recordings
+    std::vector<double> m_stamps;
+    std::vector<double> m_media;        // negative where not recorded
+    std::vector<long> m_sourceFrames;
+    cv::Size m_size;
+    unsigned int m_seed;
+    RecordedParams m_params;
+    std::vector<std::string> m_algorithms;
+    RecordedParams m_userParams;
+    unsigned int m_threads;
+    long m_frame;
+};
+
+//! Path of the PNG holding a given frame of a recording
+fs::path recordedFramePath(const fs::path& dir, long frame);
+};
+
+#endif
@@ -0,0 +1,261 @@
+#include "rtsp.hpp"
+#include "../log/log.hpp"
+
+#ifdef WITH_GSTREAMER_CAPTURE
+#include <gst/app/gstappsink.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+#include <boost/algorithm/string.hpp>
+
+using namespace vio;
+
+RtspCaptureBackend::Options RtspCaptureBackend::Options::parse(
+        const std::string& spec) {
+    Options o;
+    o.latency = 100;
+    o.transport = "auto";
+    o.codec = "h264";
+    o.timeout = 2.0;
+    o.retries = -1;
+    o.drop = true;
+
+    // a bare rtsp://... URL, whose scheme has already been taken off
+    if(spec.compare(0, 2, "//") == 0) {
+        o.url = "rtsp:" + spec;
+        return o;
+    }
+
+    // [options]:[url]
+    size_t colon = spec.find(':');
+    if(colon == std::string::npos)
+        throw std::invalid_argument("RTSP spec needs a URL");
+    std::string opts(spec, 0, colon);
+    o.url = spec.substr(colon + 1);
+    if(o.url.compare(0, 7, "rtsp://") != 0)
+        throw std::invalid_argument("Not an RTSP URL: " + o.url);
+
+    std::vector<std::string> fields;
+    boost::split(fields, opts, boost::is_any_of(","));
+    for(auto& f : fields) {
+        size_t eq = f.find('=');
+        if(eq == std::string::npos)
+            throw std::invalid_argument("RTSP options look like key=value");
+        std::string key(f, 0, eq), val(f, eq + 1);
+        if(key == "latency") o.latency = strtoul(val.c_str(), NULL, 10);
+        else if(key == "transport") o.transport = val;
+        else if(key == "codec") o.codec = val;
+        else if(key == "timeout") o.timeout = strtod(val.c_str(), NULL);
+        else if(key == "retries") o.retries = strtol(val.c_str(), NULL, 10);
+        else if(key == "drop") o.drop = val != "0";
+        else throw std::invalid_argument("Unknown RTSP option: " + key);
+    }
+    if(o.transport != "auto" && o.transport != "udp" && o.transport != "tcp")
+        throw std::invalid_argument("RTSP transport must be udp, tcp or auto");
+    if(o.timeout <= 0)
+        throw std::invalid_argument("RTSP timeout must be positive");
+    return o;
+}
+
+std::string RtspCaptureBackend::describe(const Options& opts) {
+    std::string chain;
+    if(opts.codec == "h264")
+        chain = "rtph264depay name=depay ! h264parse ! decodebin";
+    else if(opts.codec == "h265")
+        chain = "rtph265depay name=depay ! h265parse ! decodebin";
+    else if(opts.codec == "mjpeg")
+        chain = "rtpjpegdepay name=depay ! jpegdec";
+    else
+        throw std::invalid_argument("RTSP codec must be h264, h265 or mjpeg");
+
+    // the source is added separately, so it can be restarted on its own
+    return chain + " ! videoconvert ! video/x-raw,format=BGR ! "
+        "appsink name=sink sync=false drop=true max-buffers=1";
+}
+
+RtspCaptureBackend::RtspCaptureBackend(const std::string& spec) :
+        RtspCaptureBackend(Options::parse(spec)) { }
+
+RtspCaptureBackend::RtspCaptureBackend(const Options& opts) :
+        GstCaptureBackend(describe(opts), false, false), m_opts(opts),
+        m_src(NULL), m_depay(NULL), m_jitter(NULL), m_stats(),
+        m_latencySum(0.0), m_latencyCount(0), m_captured(-1) {
+    m_timeout = (GstClockTime)(opts.timeout * GST_SECOND);
+
+    // the pipeline holds references to both elements for as long as we do
+    m_depay = gst_bin_get_by_name(GST_BIN(m_pipeline), "depay");
+    gst_object_unref(m_depay);
+
+    m_src = gst_element_factory_make("rtspsrc", NULL);
+    if(!m_src)
+        throw std::runtime_error("GStreamer's rtspsrc element isn't installed");
+    g_object_set(m_src, "location", opts.url.c_str(),
+            "latency", (guint)opts.latency,
+            "drop-on-latency", (gboolean)opts.drop, NULL);
+    if(opts.transport != "auto") {
+        gst_util_set_object_arg(G_OBJECT(m_src), "protocols",
+                opts.transport.c_str());
+    }
+    g_signal_connect(m_src, "select-stream", G_CALLBACK(onSelectStream), this);
+    g_signal_connect(m_src, "pad-added", G_CALLBACK(onPadAdded), this);
+    g_signal_connect(m_src, "new-manager", G_CALLBACK(onNewManager), this);
+    gst_bin_add(GST_BIN(m_pipeline), m_src);
+
+    try {
+        start();
+    } catch(...) {
+        stop();
+        if(m_jitter) gst_object_unref(m_jitter);
+        throw;
+    }
+}
+
+RtspCaptureBackend::~RtspCaptureBackend() {
+    // stop the streaming threads before the members they touch go away
+    stop();
+    if(m_jitter) gst_object_unref(m_jitter);
+}
+
+gboolean RtspCaptureBackend::onSelectStream(GstElement* src, guint num,
+        GstCaps* caps, gpointer self) {
+    // only set up the video stream, so nothing else has to be linked
+    const GstStructure* s = gst_caps_get_structure(caps, 0);
+    const gchar* media = gst_structure_get_string(s, "media");
+    return media != NULL && strcmp(media, "video") == 0;
+}
+
+void RtspCaptureBackend::onPadAdded(GstElement* src, GstPad* pad,
+        gpointer self) {
+    RtspCaptureBackend* b = static_cast<RtspCaptureBackend*>(self);
+    GstPad* sink = gst_element_get_static_pad(b->m_depay, "sink");
+    if(!gst_pad_is_linked(sink)) gst_pad_link(pad, sink);
+    gst_object_unref(sink);
+}
+
+void RtspCaptureBackend::onNewManager(GstElement* src, GstElement* manager,
+        gpointer self) {
+    g_signal_connect(manager, "new-jitterbuffer",
+            G_CALLBACK(onNewJitterBuffer), self);
+}
+
+void RtspCaptureBackend::onNewJitterBuffer(GstElement* manager,
+        GstElement* jb, guint session, guint ssrc, gpointer self) {
+    RtspCaptureBackend* b = static_cast<RtspCaptureBackend*>(self);
+    std::lock_guard<std::mutex> lock(b->m_lock);
+    if(!b->m_jitter) b->m_jitter = GST_ELEMENT(gst_object_ref(jb));
+}
+
+void RtspCaptureBackend::readJitterStats(GstElement* jb, Stats& stats) {
+    GstStructure* s = NULL;
+    g_object_get(jb, "stats", &s, NULL);
+    if(!s) return;
+
+    guint64 v;
+    if(gst_structure_get_uint64(s, "num-pushed", &v)) stats.packets += v;
+    if(gst_structure_get_uint64(s, "num-lost", &v)) stats.lost += v;
+    if(gst_structure_get_uint64(s, "num-late", &v)) stats.late += v;
+    if(gst_structure_get_uint64(s, "avg-jitter", &v)) stats.jitter = v / 1e6;
+    gst_structure_free(s);
+}
+
+void RtspCaptureBackend::measure(GstSample* sample) {
+    m_captured = -1;
+    GstBuffer* buf = gst_sample_get_buffer(sample);
+    const GstSegment* seg = gst_sample_get_segment(sample);
+    if(!buf || !seg || !GST_BUFFER_PTS_IS_VALID(buf)) return;
+    GstClock* clock = gst_element_get_clock(m_pipeline);
+    if(!clock) return;
+
+    // live RTP timestamps are the running time at which packets arrived
+    guint64 arrived = gst_segment_to_running_time(seg, GST_FORMAT_TIME,
+            GST_BUFFER_PTS(buf));
+    GstClockTime now = gst_clock_get_time(clock) -
+        gst_element_get_base_time(m_pipeline);
+    gst_object_unref(clock);
+    if(arrived == GST_CLOCK_TIME_NONE || now < arrived) return;
+
+    double ms = (now - arrived) / 1e6;
+    m_captured = std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() -
+        ms / 1000;
+    m_latencySum += ms;
+    m_latencyCount++;
+    m_stats.maxLatency = std::max(m_stats.maxLatency, ms);
+}
+
+bool RtspCaptureBackend::reconnect() {
+    reportErrors();
+    LOG_WARN("rtsp", "Reconnecting to %s", m_opts.url.c_str());
+    m_stats.reconnects++;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if(m_jitter) {
+            readJitterStats(m_jitter, m_stats);
+            gst_object_unref(m_jitter);
+            m_jitter = NULL;
+        }
+    }
+
+    // drop whatever the old connection left in flight, including an EOS,
+    // without taking the decoder down
+    GstPad* pad = gst_element_get_static_pad(m_depay, "sink");
+    gst_pad_send_event(pad, gst_event_new_flush_start());
+    gst_pad_send_event(pad, gst_event_new_flush_stop(FALSE));
+    gst_object_unref(pad);
+
+    gst_element_set_state(m_src, GST_STATE_NULL);
+    gst_element_sync_state_with_parent(m_src);
+
+    m_first = gst_app_sink_try_pull_sample(GST_APP_SINK(m_sink), m_timeout);
+    return m_first != NULL;
+}
+
+int RtspCaptureBackend::getFrame(cv::Mat& out) {
+    GstSample* sample = m_first;
+    m_first = NULL;
+    if(!sample)
+        sample = gst_app_sink_try_pull_sample(GST_APP_SINK(m_sink), m_timeout);
+
+    // stalled, failed or ended: bring the source back up
+    int attempts = 0;
+    while(!sample) {
+        if(m_opts.retries >= 0 && attempts >= m_opts.retries) {
+            reportErrors();
+            return 0;
+        }
+        attempts++;
+        if(reconnect()) {
+            sample = m_first;
+            m_first = NULL;
+        }
+    }
+
+    measure(sample);
+    m_stats.frames++;
+    wrap(sample, out);
+    return 1;
+}
+
+double RtspCaptureBackend::getCaptureTime() const {
+    return m_captured;
+}
+
+void RtspCaptureBackend::restart() {
+    if(m_first) gst_sample_unref(m_first);
+    m_first = NULL;
+    reconnect();
+}
+
+RtspCaptureBackend::Stats RtspCaptureBackend::getStats() {
+    Stats s = m_stats;
+    s.latency = m_latencyCount > 0 ? m_latencySum / m_latencyCount : 0.0;
+    std::lock_guard<std::mutex> lock(m_lock);
+    if(m_jitter) readJitterStats(m_jitter, s);
+    return s;
+}
+#endif
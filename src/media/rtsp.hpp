@@ -0,0 +1,103 @@
+#ifndef RTSP_HPP
+#define RTSP_HPP
+
+#include <mutex>
+#include <string>
+
+#include "gst.hpp"
+
+#ifdef WITH_GSTREAMER_CAPTURE
+namespace vio {
+
+/** \brief Capture backend for RTSP network cameras
+ *
+ * Specs are either a plain `rtsp://host/path` URL or options followed by the
+ * URL, like `rtsp:latency=50,transport=tcp:rtsp://host/path`. Options are:
+ *
+ *  - `latency`: size of the jitter buffer in ms (default 100)
+ *  - `transport`: `udp`, `tcp` or `auto` (default), which tries UDP first
+ *  - `codec`: `h264` (default), `h265` or `mjpeg`
+ *  - `timeout`: seconds without a frame before reconnecting (default 2)
+ *  - `retries`: reconnect attempts before giving up, -1 (default) for no limit
+ *  - `drop`: 1 (default) drops packets that arrive after the latency
+ *
+ * Only the RTSP source is restarted on reconnect. The depayloader, decoder
+ * and their buffer pools stay in the playing pipeline, so decoding resumes
+ * at the next keyframe without renegotiating.
+ */
+class RtspCaptureBackend : public GstCaptureBackend {
+public:
+    struct Options {
+        std::string url;
+        unsigned int latency;
+        std::string transport;
+        std::string codec;
+        double timeout;
+        int retries;
+        bool drop;
+
+        static Options parse(const std::string& spec);
+    };
+
+    struct Stats {
+        long frames;
+        long reconnects;
+        unsigned long long packets; // RTP packets pushed out of the jitter buffer
+        unsigned long long lost;
+        unsigned long long late;
+        double jitter;              // mean interarrival jitter, ms
+        double latency;             // mean arrival to decoded latency, ms
+        double maxLatency;
+    };
+
+    RtspCaptureBackend(const std::string& spec);
+    ~RtspCaptureBackend();
+
+    int getFrame(cv::Mat& out);
+
+    //! When the last frame's packets arrived
+    double getCaptureTime() const;
+
+    //! Reconnect to the camera
+    void restart();
+
+    //! Packet and latency statistics, across reconnects
+    Stats getStats();
+
+private:
+    RtspCaptureBackend(const Options& opts);
+
+    static std::string describe(const Options& opts);
+
+    //! Restart the source and wait up to the timeout for a frame
+    bool reconnect();
+
+    //! Track the latency of a frame that's about to be returned
+    void measure(GstSample* sample);
+
+    //! Add a jitter buffer's counters to \p stats
+    static void readJitterStats(GstElement* jb, Stats& stats);
+
+    static void onPadAdded(GstElement* src, GstPad* pad, gpointer self);
+    static gboolean onSelectStream(GstElement* src, guint num, GstCaps* caps,
+            gpointer self);
+    static void onNewManager(GstElement* src, GstElement* manager,
+            gpointer self);
+    static void onNewJitterBuffer(GstElement* manager, GstElement* jb,
+            guint session, guint ssrc, gpointer self);
+
+    Options m_opts;
+    GstElement* m_src;
+    GstElement* m_depay;
+
+    std::mutex m_lock;      // guards m_jitter, set from streaming threads
+    GstElement* m_jitter;
+    Stats m_stats;          // totals from earlier connections, plus frames
+    double m_latencySum;
+    long m_latencyCount;
+    double m_captured;      // arrival of the last frame, monotonic seconds
+};
+};
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+#include "sampled.hpp"
+
+#ifdef WITH_LIBAV
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/avutil.h>
+#include <libswscale/swscale.h>
+}
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+#include <boost/algorithm/string.hpp>
+
+using namespace vio;
+
+SampledCaptureBackend::SampledCaptureBackend(const std::string& spec) :
+        m_fmt(NULL), m_codec(NULL), m_frame(NULL), m_pkt(NULL), m_sws(NULL),
+        m_stream(-1), m_draining(false), m_mode(SM_KEYFRAMES),
+        m_interval(0.0), m_seekGap(2.0), m_search(0.0), m_next(0.0),
+        m_last(-1.0), m_pos(-1.0), m_seekTarget(-1.0), m_denseUntil(-1.0),
+        m_decoded(0) {
+    // [mode],[options]:[file]
+    size_t colon = spec.find(':');
+    if(colon == std::string::npos)
+        throw std::invalid_argument("Sample spec needs a mode and a file");
+    std::string opts(spec, 0, colon), fname(spec, colon + 1);
+
+    std::vector<std::string> fields;
+    boost::split(fields, opts, boost::is_any_of(","));
+    double every = 0, rate = 0;
+    for(auto& f : fields) {
+        size_t eq = f.find('=');
+        std::string key(f, 0, eq);
+        double v = eq == std::string::npos ? 0 : strtod(f.c_str() + eq + 1, NULL);
+        if(key == "keyframes") m_mode = SM_KEYFRAMES;
+        else if(key == "every") { m_mode = SM_EVERY_N; every = v; }
+        else if(key == "fps") { m_mode = SM_RATE; rate = v; }
+        else if(key == "seek") m_seekGap = v;
+        else if(key == "search") m_search = v;
+        else throw std::invalid_argument("Unknown sample option: " + key);
+    }
+    if((m_mode == SM_EVERY_N && every < 1) || (m_mode == SM_RATE && rate <= 0))
+        throw std::invalid_argument("Invalid sampling interval");
+
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+    av_register_all();
+#endif
+    if(avformat_open_input(&m_fmt, fname.c_str(), NULL, NULL) < 0)
+        throw std::invalid_argument("Failed to open video file");
+    if(avformat_find_stream_info(m_fmt, NULL) < 0)
+        throw std::invalid_argument("Failed to read stream information");
+
+    // FFmpeg 5 hands out decoders as const
+#if LIBAVFORMAT_VERSION_MAJOR >= 59
+    const AVCodec* dec = NULL;
+#else
+    AVCodec* dec = NULL;
+#endif
+    m_stream = av_find_best_stream(m_fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &dec, 0);
+    if(m_stream < 0 || dec == NULL)
+        throw std::invalid_argument("No decodable video stream in file");
+
+    AVStream* st = m_fmt->streams[m_stream];
+    m_codec = avcodec_alloc_context3(dec);
+    avcodec_parameters_to_context(m_codec, st->codecpar);
+    m_codec->thread_count = 0; // let the decoder pick
+    if(avcodec_open2(m_codec, dec, NULL) < 0)
+        throw std::invalid_argument("Failed to open video decoder");
+
+    m_fps = st->avg_frame_rate.num > 0 ? av_q2d(st->avg_frame_rate) : 25.0;
+    if(m_mode == SM_EVERY_N) m_interval = every / m_fps;
+    else if(m_mode == SM_RATE) m_interval = 1.0 / rate;
+
+    m_frame = av_frame_alloc();
+    m_pkt = av_packet_alloc();
+    applyDiscard();
+}
+
+SampledCaptureBackend::~SampledCaptureBackend() {
+    sws_freeContext(m_sws);
+    av_packet_free(&m_pkt);
+    av_frame_free(&m_frame);
+    avcodec_free_context(&m_codec);
+    avformat_close_input(&m_fmt);
+}
+
+void SampledCaptureBackend::applyDiscard() {
+    bool dense = m_last < m_denseUntil;
+    if(dense) m_codec->skip_frame = AVDISCARD_DEFAULT;
+    else if(m_mode == SM_KEYFRAMES) m_codec->skip_frame = AVDISCARD_NONKEY;
+    else m_codec->skip_frame = AVDISCARD_NONREF;
+}
+
+double SampledCaptureBackend::frameTime() const {
+    AVStream* st = m_fmt->streams[m_stream];
+    int64_t pts = m_frame->best_effort_timestamp;
+    if(st->start_time != AV_NOPTS_VALUE) pts -= st->start_time;
+    return pts * av_q2d(st->time_base);
+}
+
+bool SampledCaptureBackend::decodeNext() {
+    bool keysOnly = m_mode == SM_KEYFRAMES && m_last >= m_denseUntil;
+    while(true) {
+        int r = avcodec_receive_frame(m_codec, m_frame);
+        if(r == 0) {
+            m_decoded++;
+            return true;
+        }
+        if(r != AVERROR(EAGAIN) || m_draining) return false;
+
+        if(av_read_frame(m_fmt, m_pkt) < 0) {
+            // end of file; flush what the decoder still holds
+            avcodec_send_packet(m_codec, NULL);
+            m_draining = true;
+            continue;
+        }
+        if(m_pkt->stream_index == m_stream &&
+                (!keysOnly || (m_pkt->flags & AV_PKT_FLAG_KEY)))
+            avcodec_send_packet(m_codec, m_pkt);
+        av_packet_unref(m_pkt);
+    }
+}
+
+void SampledCaptureBackend::seek(double t) {
+    AVStream* st = m_fmt->streams[m_stream];
+    int64_t ts = (int64_t)(t / av_q2d(st->time_base));
+    if(st->start_time != AV_NOPTS_VALUE) ts += st->start_time;
+    av_seek_frame(m_fmt, m_stream, ts, AVSEEK_FLAG_BACKWARD);
+    avcodec_flush_buffers(m_codec);
+    m_draining = false;
+}
+
+int SampledCaptureBackend::getFrame(cv::Mat& out) {
+    while(true) {
+        bool dense = m_last < m_denseUntil;
+        bool timed = dense || m_mode != SM_KEYFRAMES;
+
+        // jump over long gaps, but only once per target so a long GOP can't
+        // keep sending us back to the same keyframe
+        if(!dense && timed && m_next - m_pos > m_seekGap &&
+                m_next > m_seekTarget) {
+            seek(m_next);
+            m_seekTarget = m_next;
+        }
+        if(!decodeNext()) return 0;
+
+        double t = frameTime();
+        m_pos = t;
+        if(timed && t < m_next) continue;
+
+        // a rescan after a hit passes frames the sparse scan returned; they
+        // move the scan along, but aren't returned twice
+        auto seen = m_returned.lower_bound(t - 0.5 / m_fps);
+        bool again = seen != m_returned.end() && *seen < t + 0.5 / m_fps;
+
+        m_last = t;
+        if(dense) {
+            m_next = t;
+            if(m_last >= m_denseUntil) {
+                // back to sparse sampling
+                m_next = t + m_interval;
+                applyDiscard();
+            }
+        } else {
+            m_next = t + m_interval;
+        }
+        if(again) continue;
+        m_returned.insert(t);
+        m_returned.erase(m_returned.begin(),
+                m_returned.lower_bound(t - 2 * m_search - 1.0));
+
+        // convert only the frames we hand out
+        m_sws = sws_getCachedContext(m_sws, m_frame->width, m_frame->height,
+                (AVPixelFormat)m_frame->format, m_frame->width,
+                m_frame->height, AV_PIX_FMT_BGR24, SWS_BILINEAR,
+                NULL, NULL, NULL);
+        out.create(m_frame->height, m_frame->width, CV_8UC3);
+        uint8_t* dst[1] = { out.data };
+        int stride[1] = { (int)out.step[0] };
+        sws_scale(m_sws, m_frame->data, m_frame->linesize, 0, m_frame->height,
+                dst, stride);
+        return 1;
+    }
+}
+
+cv::Size SampledCaptureBackend::getSize() {
+    return cv::Size(m_codec->width, m_codec->height);
+}
+
+void SampledCaptureBackend::restart() {
+    seek(0);
+    m_next = 0;
+    m_last = -1;
+    m_pos = -1;
+    m_seekTarget = -1;
+    m_denseUntil = -1;
+    m_returned.clear();
+    applyDiscard();
+}
+
+double SampledCaptureBackend::getMediaTime() const {
+    return m_last;
+}
+
+long SampledCaptureBackend::getSourceFrame() const {
+    return m_last < 0 ? -1 : (long)(m_last * m_fps + 0.5);
+}
+
+long SampledCaptureBackend::getDecodedFrames() const {
+    return m_decoded;
+}
+
+void SampledCaptureBackend::hit() {
+    if(m_search <= 0) return;
+    bool dense = m_last < m_denseUntil;
+    double covered = m_denseUntil; // end of the last dense window
+    m_denseUntil = std::max(m_denseUntil, m_last + m_search);
+    if(dense) return; // already covering the area, just extend it
+
+    // go back over what the sparse scan skipped, frame by frame, but not
+    // over an earlier dense window
+    double from = std::max(std::max(m_last - m_search, covered), 0.0);
+    if(from < m_last) {
+        seek(from);
+        m_seekTarget = -1;
+        m_next = from;
+        m_last = from - 1.0 / m_fps;
+    } else {
+        m_next = m_last;
+    }
+    applyDiscard();
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef SAMPLED_HPP
+#define SAMPLED_HPP
+
+#include <set>
+#include <string>
+
+#include "capture.hpp"
+
+#ifdef WITH_LIBAV
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+namespace vio {
+
+/** \brief Capture backend which decodes only a sample of a video file's frames
+ *
+ * Skipping happens in the demuxer and decoder, not after decoding, so frames
+ * that aren't wanted are never fully decoded or converted:
+ *
+ *  - `keyframes`: non-key packets are dropped before the decoder sees them
+ *  - `every=N`: every Nth frame, by time
+ *  - `fps=N`: N frames per second of video
+ *
+ * In the last two modes the decoder discards non-reference frames, and when
+ * the next wanted frame is further away than `seek` seconds (default 2) the
+ * demuxer seeks to the keyframe before it instead of decoding the gap.
+ *
+ * Specs look like `sample:fps=1,search=10:[file]`. With `search=S`, hit()
+ * switches to decoding every frame from S seconds before the current frame to
+ * S seconds after the last hit, then sparse sampling resumes. Frames the
+ * sparse scan already returned are not returned again, so frames arrive out of
+ * file order around hits; getMediaTime() and getSourceFrame() say where each
+ * one is.
+ */
+class SampledCaptureBackend : public CaptureBackend {
+public:
+    enum Mode { SM_KEYFRAMES, SM_EVERY_N, SM_RATE };
+
+    SampledCaptureBackend(const std::string& spec);
+    ~SampledCaptureBackend();
+
+    int getFrame(cv::Mat& out);
+    cv::Size getSize();
+    void restart();
+
+    //! Presentation time of the last frame returned
+    double getMediaTime() const;
+
+    //! Index of the last frame returned, at the file's nominal frame rate
+    long getSourceFrame() const;
+
+    //! Frames the decoder has produced so far, including ones not returned
+    long getDecodedFrames() const;
+
+    //! The last frame had something in it; sample its surroundings densely
+    void hit();
+
+private:
+    //! Get the next frame out of the decoder. False at the end of the file.
+    bool decodeNext();
+
+    //! Seek to the keyframe at or before t and restart decoding
+    void seek(double t);
+
+    //! Configure the demuxer and decoder filters for the current state
+    void applyDiscard();
+
+    double frameTime() const;
+
+    AVFormatContext* m_fmt;
+    AVCodecContext* m_codec;
+    AVFrame* m_frame;
+    AVPacket* m_pkt;
+    SwsContext* m_sws;
+    int m_stream;
+    bool m_draining;
+
+    Mode m_mode;
+    double m_interval;  // seconds between samples
+    double m_seekGap;   // seek rather than decode gaps longer than this
+    double m_search;    // dense window around hits, 0 to disable
+    double m_fps;
+
+    double m_next;      // time of the next wanted frame
+    double m_last;      // time of the last frame returned
+    double m_pos;       // time of the last frame decoded
+    double m_seekTarget;// where we last seeked to
+    double m_denseUntil;// decode everything up to here
+    long m_decoded;
+    std::set<double> m_returned; // recent frames' times, so rescans skip them
+};
+
+};
+#endif
+
+#endif
@@ -0,0 +1,220 @@
+#include "synth.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+
+using namespace vio;
+
+static double monotonicTime() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (((double)t.tv_nsec) / 1.0e9);
+}
+
+SyntheticCaptureBackend::SyntheticCaptureBackend(const std::string& spec) :
+        m_size(640, 480), m_fps(30), m_people(10), m_seed(1), m_limit(0),
+        m_frame(0), m_realtime(false), m_next(0.0) {
+    std::istringstream in(spec);
+    std::string field;
+    bool first = true;
+    while(std::getline(in, field, ',')) {
+        if(first) {
+            // size and frame rate: WxH[@fps]
+            first = false;
+            char* end;
+            m_size.width = strtol(field.c_str(), &end, 10);
+            if(*end != 'x') throw std::invalid_argument("Invalid synth size");
+            m_size.height = strtol(end+1, &end, 10);
+            if(*end == '@') m_fps = strtod(end+1, &end);
+            if(*end != 0 || m_size.width < 64 || m_size.height < 128 ||
+                    m_fps <= 0)
+                throw std::invalid_argument("Invalid synth size");
+            continue;
+        }
+
+        size_t eq = field.find('=');
+        if(eq == std::string::npos)
+            throw std::invalid_argument("Invalid synth option");
+        std::string key = field.substr(0, eq), val = field.substr(eq+1);
+        if(key == "people") m_people = atoi(val.c_str());
+        else if(key == "seed") m_seed = strtoul(val.c_str(), NULL, 10);
+        else if(key == "frames") m_limit = atol(val.c_str());
+        else if(key == "realtime") m_realtime = atoi(val.c_str()) != 0;
+        else if(key == "gt") {
+            m_gt.open(val.c_str());
+            if(!m_gt) throw std::invalid_argument("Cannot create synth ground truth");
+        } else {
+            throw std::invalid_argument("Unknown synth option");
+        }
+    }
+    if(m_people < 0) throw std::invalid_argument("Invalid synth people count");
+
+    restart();
+}
+
+SyntheticCaptureBackend::~SyntheticCaptureBackend() {
+}
+
+void SyntheticCaptureBackend::restart() {
+    m_rng.seed(m_seed);
+    m_frame = 0;
+    m_next = monotonicTime();
+
+    // smooth gradient with some block texture, so trackers have something to
+    // lock on to besides the sprites
+    m_background.create(m_size, CV_8UC3);
+    std::uniform_int_distribution<int> tex(-12, 12);
+    for(int y = 0;y < m_size.height;y++) {
+        cv::Vec3b* row = m_background.ptr<cv::Vec3b>(y);
+        int base = 90 + 80 * y / m_size.height;
+        for(int x = 0;x < m_size.width;x++) {
+            row[x][0] = cv::saturate_cast<unsigned char>(base + 10);
+            row[x][1] = cv::saturate_cast<unsigned char>(base);
+            row[x][2] = cv::saturate_cast<unsigned char>(base - 10);
+        }
+    }
+    for(int y = 0;y < m_size.height;y += 16) {
+        for(int x = 0;x < m_size.width;x += 16) {
+            int d = tex(m_rng);
+            cv::Rect blk(x, y, std::min(16, m_size.width - x),
+                    std::min(16, m_size.height - y));
+            cv::Mat roi = m_background(blk);
+            roi += cv::Scalar::all(d);
+        }
+    }
+
+    // people are between a sixth and a half of the frame height, keeping the
+    // HOG aspect ratio of 1:2, but never wider or taller than the frame
+    int hcap = std::min(m_size.height, 2 * m_size.width);
+    int hmin = std::min(std::max(128, m_size.height / 6), hcap);
+    int hmax = std::min(std::max(hmin, m_size.height / 2), hcap);
+    std::uniform_int_distribution<int> height(hmin, hmax);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_int_distribution<int> colour(0, 255);
+
+    m_sprites.clear();
+    for(int i = 0;i < m_people;i++) {
+        Sprite s;
+        s.id = i + 1;
+        s.size.height = height(m_rng);
+        s.size.width = s.size.height / 2;
+        s.pos.x = unit(m_rng) * (m_size.width - s.size.width);
+        s.pos.y = unit(m_rng) * (m_size.height - s.size.height);
+
+        // walking speed: about a body height every one to three seconds
+        float speed = s.size.height * (0.3f + unit(m_rng) * 0.7f) / m_fps;
+        float angle = unit(m_rng) * 2 * M_PI;
+        s.vel = cv::Point2f(speed * cos(angle), 0.3f * speed * sin(angle));
+        s.shirt = cv::Scalar(colour(m_rng), colour(m_rng), colour(m_rng));
+        s.trousers = cv::Scalar(colour(m_rng) / 3, colour(m_rng) / 3,
+                colour(m_rng) / 3);
+        s.phase = unit(m_rng) * 2 * M_PI;
+        m_sprites.push_back(s);
+    }
+}
+
+void SyntheticCaptureBackend::step() {
+    for(auto& s : m_sprites) {
+        s.pos += s.vel;
+        float maxx = m_size.width - s.size.width;
+        float maxy = m_size.height - s.size.height;
+        if(s.pos.x < 0 || s.pos.x > maxx) {
+            s.vel.x = -s.vel.x;
+            s.pos.x = std::min(std::max(s.pos.x, 0.0f), maxx);
+        }
+        if(s.pos.y < 0 || s.pos.y > maxy) {
+            s.vel.y = -s.vel.y;
+            s.pos.y = std::min(std::max(s.pos.y, 0.0f), maxy);
+        }
+        s.phase += 2 * M_PI * 1.5 / m_fps; // 1.5 strides per second
+    }
+}
+
+void SyntheticCaptureBackend::render(cv::Mat& out) {
+    m_background.copyTo(out);
+    m_truth.clear();
+
+    // draw back to front, so sprites lower in the frame overlap higher ones
+    std::vector<const Sprite*> order;
+    for(auto& s : m_sprites) order.push_back(&s);
+    std::sort(order.begin(), order.end(), [](const Sprite* a, const Sprite* b) {
+            return a->pos.y + a->size.height < b->pos.y + b->size.height; });
+
+    for(auto sp : order) {
+        const Sprite& s = *sp;
+        int x = cvRound(s.pos.x), y = cvRound(s.pos.y);
+        int w = s.size.width, h = s.size.height;
+        cv::Scalar skin(140, 170, 210);
+
+        // head, torso, arms and legs, with the legs swinging over the cycle
+        int head = h / 8;
+        cv::Point neck(x + w/2, y + h/8 + head/2);
+        cv::circle(out, cv::Point(x + w/2, y + h/8), head / 2 + 1, skin,
+                CV_FILLED);
+        cv::Rect torso(x + w/4, neck.y, w/2, h*3/8);
+        cv::rectangle(out, torso, s.shirt, CV_FILLED);
+
+        int hipy = torso.y + torso.height;
+        int swing = cvRound(sin(s.phase) * w / 4);
+        int limb = std::max(w / 8, 2);
+        cv::Point hip(x + w/2, hipy);
+        cv::line(out, hip, cv::Point(x + w/2 + swing, y + h - 1), s.trousers,
+                limb);
+        cv::line(out, hip, cv::Point(x + w/2 - swing, y + h - 1), s.trousers,
+                limb);
+        cv::line(out, cv::Point(torso.x, neck.y + limb),
+                cv::Point(torso.x - swing / 2, hipy), s.shirt, limb);
+        cv::line(out, cv::Point(torso.x + torso.width, neck.y + limb),
+                cv::Point(torso.x + torso.width + swing / 2, hipy), s.shirt,
+                limb);
+
+        Truth t = { s.id, cv::Rect(x, y, w, h) };
+        m_truth.push_back(t);
+    }
+
+    if(m_gt.is_open()) {
+        for(auto& t : m_truth) {
+            m_gt << m_frame + 1 << ',' << t.id << ',' << t.bounds.x << ','
+                << t.bounds.y << ',' << t.bounds.width << ','
+                << t.bounds.height << ",1,1,1\n";
+        }
+    }
+}
+
+int SyntheticCaptureBackend::getFrame(cv::Mat& out) {
+    if(m_limit > 0 && m_frame >= m_limit) return 0;
+
+    if(m_realtime) {
+        double now = monotonicTime();
+        if(m_next > now) {
+            timespec ts;
+            double wait = m_next - now;
+            ts.tv_sec = (time_t)wait;
+            ts.tv_nsec = (long)((wait - ts.tv_sec) * 1.0e9);
+            nanosleep(&ts, NULL);
+        }
+        m_next += 1.0 / m_fps;
+    }
+
+    if(m_frame > 0) step();
+    render(out);
+    m_frame++;
+    return 1;
+}
+
+cv::Size SyntheticCaptureBackend::getSize() {
+    return m_size;
+}
+
+const std::vector<SyntheticCaptureBackend::Truth>&
+SyntheticCaptureBackend::getTruth() const {
+    return m_truth;
+}
+
+double SyntheticCaptureBackend::getFrameRate() const {
+    return m_fps;
+}
@@ -0,0 +1,80 @@
+#ifndef SYNTH_HPP
+#define SYNTH_HPP
+
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+
+#include "capture.hpp"
+
+namespace vio {
+
+/** \brief Capture backend which renders synthetic pedestrians
+ *
+ * Frames show a fixed textured background with a configurable number of
+ * pedestrian-like sprites (head, torso and legs) walking across it at
+ * constant velocities, bouncing off the frame edges. Everything is driven by
+ * a seeded generator, so the same spec always produces the same frames, and
+ * the true position of every sprite is known.
+ *
+ * Specs look like `synth:640x480@30,people=20,seed=1,frames=300`. All
+ * fields after the size are optional:
+ *
+ *  - `people`: number of sprites (default 10)
+ *  - `seed`: generator seed (default 1)
+ *  - `frames`: frames before the stream ends, 0 for endless (default 0)
+ *  - `realtime`: if 1, getFrame() sleeps to hold the frame rate (default 0)
+ *  - `gt`: write MOTChallenge ground truth to this file as frames are made
+ */
+class SyntheticCaptureBackend : public CaptureBackend {
+public:
+    //! A sprite's identity and bounds in the last rendered frame
+    struct Truth {
+        unsigned int id;
+        cv::Rect bounds;
+    };
+
+    SyntheticCaptureBackend(const std::string& spec);
+    ~SyntheticCaptureBackend();
+
+    int getFrame(cv::Mat& out);
+    cv::Size getSize();
+    void restart();
+
+    //! Ground truth for the last frame returned by getFrame()
+    const std::vector<Truth>& getTruth() const;
+
+    double getFrameRate() const;
+
+private:
+    struct Sprite {
+        unsigned int id;
+        cv::Point2f pos; // top-left corner
+        cv::Point2f vel; // pixels per frame
+        cv::Size size;
+        cv::Scalar shirt, trousers;
+        float phase;     // walk cycle phase
+    };
+
+    void render(cv::Mat& out);
+    void step();
+
+    cv::Size m_size;
+    double m_fps;
+    int m_people;
+    unsigned int m_seed;
+    long m_limit, m_frame;
+    bool m_realtime;
+    double m_next;
+
+    std::mt19937 m_rng;
+    cv::Mat m_background;
+    std::vector<Sprite> m_sprites;
+    std::vector<Truth> m_truth;
+    std::ofstream m_gt;
+};
+
+};
+
+#endif
@@ -1,3 +1,6 @@
 #include "results/metadump.hpp"
 #include "results/network.hpp"
 #include "results/http.hpp"
+#include "results/replay.hpp"
+#include "results/file.hpp"
+#include "results/store.hpp"
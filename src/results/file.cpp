@@ -0,0 +1,32 @@
+#include "file.hpp"
+#include "../log/log.hpp"
+
+#include <stdexcept>
+
+using namespace mdump;
+
+FileTarget::FileTarget(const std::string& path) {
+    try {
+        m_out.reset(new io::FileWriter(path));
+    } catch(const std::runtime_error& e) {
+        throw std::invalid_argument(e.what());
+    }
+}
+
+void FileTarget::write(const std::string& data) {
+    try {
+        m_out->write(data);
+        m_out->write("\n", 1);
+    } catch(const std::exception& e) {
+        // a lost object shouldn't stop the pipeline
+        LOG_ERROR("mdump", "%s", e.what());
+    }
+}
+
+void FileTarget::finish() {
+    try {
+        m_out->close();
+    } catch(const std::exception& e) {
+        LOG_ERROR("mdump", "%s", e.what());
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef RES_FILE_HPP
+#define RES_FILE_HPP
+
+#include <memory>
+#include <string>
+
+#include "metadump.hpp"
+#include "../io/writer.hpp"
+
+namespace mdump {
+/** \brief Dump target appending each object to a file, one per line
+ *
+ * Writes go out in the background, so a slow disk doesn't hold up the frame
+ * that produced them.
+ */
+class FileTarget : public DumpTarget {
+public:
+    /** \throw std::invalid_argument If the file can't be created */
+    FileTarget(const std::string& path);
+
+    void write(const std::string& data);
+    void finish();
+
+private:
+    std::unique_ptr<io::FileWriter> m_out;
+};
+};
+#endif
@@ -1,4 +1,5 @@
 #include "http.hpp"
+#include "../log/log.hpp"
 
 using namespace mdump::http;
 using namespace std;
@@ -82,7 +83,8 @@ HTTPConnection::~HTTPConnection() {
 void HTTPConnection::async_connect(ip::tcp::endpoint tgt,
         function<void(const boost::system::error_code&)> f,
         function<void()> on_close) {
-    cout << tgt << '\n';
+    LOG_DEBUG("http", "Connecting to %s:%u",
+            tgt.address().to_string().c_str(), tgt.port());
     m_sock.async_connect(tgt, [f](const boost::system::error_code& ec) { f(ec); });
     m_onclose = on_close;
 }
@@ -260,7 +262,8 @@ void HTTPConnection::on_body_recvd(int http_version,
 }
 
 void HTTPConnection::fail_request(const boost::system::error_code& ec) {
-    printf("Request failed: %s\n", ec.message().c_str());
+    LOG_EVERY(5, logging::LEVEL_WARN, "http", "Request failed: %s",
+            ec.message().c_str());
     if(ec == asio::error::connection_reset ||
             ec == asio::error::broken_pipe ||
             ec == asio::error::eof) {
@@ -329,7 +332,8 @@ void HTTPTarget::submit(shared_ptr<Request> req,
                 shared_ptr<HTTPConnection> c) {
             unique_ptr<Request> p(new Request(*req));
             if(e) {
-                printf("Connection error: %s\n", e.message().c_str());
+                LOG_EVERY(5, logging::LEVEL_WARN, "http", "Connection error: %s",
+                        e.message().c_str());
                 handler(nullptr);
             } else {
                 c->async_request(move(p),
@@ -353,7 +357,8 @@ void HTTPTarget::get_conn(const URL& u,
         auto itr = m_conns.find(key);
         if(itr != m_conns.end()) {
             handler(boost::system::error_code(), itr->second);
-                printf("written\n");
+            LOG_DEBUG("http", "Reusing connection to %s:%d",
+                    key.first.c_str(), key.second);
             return;
         }
     }
@@ -376,7 +381,8 @@ void HTTPTarget::get_conn(const URL& u,
                     ip::tcp::resolver::iterator r) {
                 if(ec) {
                     // TODO: handle error
-                    printf("Error: %s\n", ec.message().c_str());
+                    LOG_EVERY(5, logging::LEVEL_WARN, "http", "Cannot resolve %s: %s",
+                            key.first.c_str(), ec.message().c_str());
                     dispose_conn(key, conn);
                     return;
                 }
@@ -415,7 +421,8 @@ POSTTarget::~POSTTarget() {
 void POSTTarget::write(const std::string& data) {
     shared_ptr<Request> req(new Request(Request::post(m_url)));
     submit(req, [this](unique_ptr<Response> h) {
-            if(h && *h) printf("OK\n"); else printf("ERR\n");
+            if(h && *h) LOG_DEBUG("http", "POST succeeded");
+            else LOG_EVERY(5, logging::LEVEL_WARN, "http", "POST failed");
             });
 }
 
@@ -130,17 +130,37 @@ void JSONWriter::object(const std::string &key) {
 void JSONWriter::end() {
     emit_close(m_stack.back());
     m_stack.pop_back();
+    m_first.pop_back();
 }
 
-Metadumper::Metadumper(std::unique_ptr<DumpTarget>&& tgt) {
+Metadumper::Metadumper(std::unique_ptr<DumpTarget>&& tgt) : m_shed(false),
+        m_dropped(0), m_late(0), m_mediaTime(-1), m_sourceFrame(-1) {
     m_tgt = std::move(tgt);
 }
 
+void Metadumper::setShedding(const std::string& level, long dropped,
+        long late) {
+    m_shed = true;
+    m_shedLevel = level;
+    m_dropped = dropped;
+    m_late = late;
+}
+
+void Metadumper::setSource(double time, long frame) {
+    m_mediaTime = time;
+    m_sourceFrame = frame;
+}
+
 Metadumper::~Metadumper() {
 }
 
 void Metadumper::accept(const std::vector<ml::AlgorithmResult*>& res, int fps,
-        int frame, bool fpga, double cpu_use, double framerate, int fr_time) {
+        int frame, bool fpga, double cpu_use, double framerate, int fr_time,
+        double captured) {
+    if(m_tgt->accept(res, m_sourceFrame >= 0 ? m_sourceFrame : frame,
+                captured))
+        return;
+
     // build the JSON
     std::stringstream strm;
 
@@ -150,10 +170,19 @@ void Metadumper::accept(const std::vector<ml::AlgorithmResult*>& res, int fps,
     json.object("frame");
         json("fps", fps);
         json("fpga", fpga);
+        if(m_mediaTime >= 0) {
+            json("media_time", m_mediaTime);
+            json("source_frame", m_sourceFrame);
+        }
         json.object("perf");
             json("cpu_use", cpu_use);
             json("fps", framerate);
             json("fr_time", fr_time);
+            if(m_shed) {
+                json("shed_level", m_shedLevel);
+                json("dropped", m_dropped);
+                json("late", m_late);
+            }
         json.end();
         json.array("results");
         for(auto r : res) write_result(json, *r);
@@ -50,11 +50,25 @@ public:
 
 class DumpTarget {
 public:
+    virtual ~DumpTarget() {}
+
     /** \brief Write a single data object to the dump target
      *
      * All implementations of this method must be asynchronous.
      */
     virtual void write(const std::string& data)=0;
+
+    /** \brief Take a frame's results directly, instead of as JSON
+     *
+     * \param captured When the frame was captured, in seconds on the
+     *                 monotonic clock; negative for now
+     * \return Whether the target took them. If not, they're sent to write().
+     */
+    virtual bool accept(const std::vector<ml::AlgorithmResult*>& res,
+            long frame, double captured) { return false; }
+
+    //! Write out anything still held back. Called once results stop coming.
+    virtual void finish() {}
 };
 
 class Metadumper {
@@ -62,14 +76,47 @@ public:
     Metadumper(std::unique_ptr<DumpTarget>&& tgt);
     ~Metadumper();
 
+    /** \brief Dump a frame's results
+     *
+     * \param captured When the frame was captured, in seconds on the
+     *                 monotonic clock; negative if unknown
+     */
     void accept(const std::vector<ml::AlgorithmResult*>& res, int fps, int frame,
-            bool fpga, double cpu_use, double framerate, int fr_time);
+            bool fpga, double cpu_use, double framerate, int fr_time,
+            double captured=-1);
+
+    /** \brief Report load shedding in the perf section of following frames
+     *
+     * \param level The stream's current shedding step
+     * \param dropped Frames dropped so far
+     * \param late Results so far that missed their deadline
+     */
+    void setShedding(const std::string& level, long dropped, long late);
+
+    /** \brief Say where in the input file the following frame is
+     *
+     * Written with the frame, and given to targets taking results directly
+     * in place of the frame number. Negative values clear it.
+     *
+     * \param time Seconds from the start of the file
+     * \param frame Index of the frame in the file
+     */
+    void setSource(double time, long frame);
+
+    //! Finish the target, once there are no more frames
+    void finish() { m_tgt->finish(); }
 
 private:
     void write_result(JSONWriter& strm, const ml::AlgorithmResult& res);
     void write_boundboxes(JSONWriter& strm, const ml::BoundingBoxesResult& res);
 
     std::unique_ptr<DumpTarget> m_tgt;
+
+    bool m_shed;
+    std::string m_shedLevel;
+    long m_dropped, m_late;
+    double m_mediaTime;
+    long m_sourceFrame;
 };
 };
 #endif
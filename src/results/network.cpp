@@ -2,6 +2,7 @@
 #include <mutex>
 
 #include "network.hpp"
+#include "../log/log.hpp"
 
 using namespace std;
 using namespace mdump;
@@ -23,7 +24,8 @@ shared_ptr<asio::io_service>& AsioDumpTarget::get_service() {
     return m_svc;
 }
 
-SocketTarget::SocketTarget(shared_ptr<asio::io_service> svc) {
+SocketTarget::SocketTarget(shared_ptr<asio::io_service> svc)
+        : AsioDumpTarget(svc) {
     m_pending = false;
     m_retry_timer = unique_ptr<asio::deadline_timer>(
             new asio::deadline_timer(*m_svc));
@@ -144,7 +146,8 @@ bool TCPTarget::attempt_send(const asio::const_buffer buf) {
                 if(ec) {
                     if(ec == asio::error::connection_reset ||
                             ec == asio::error::broken_pipe) {
-                        printf("Connection lost - trying to reconnect...\n");
+                        LOG_EVERY(5, logging::LEVEL_WARN, "network",
+                                "Connection lost - trying to reconnect...");
                         // try to reconnect
                         {
                             lock_guard<mutex> l(m_connected_mtx);
@@ -154,7 +157,8 @@ bool TCPTarget::attempt_send(const asio::const_buffer buf) {
                                         this, _1));
                         }
                     } else {
-                        printf("Err: %s\n", ec.message().c_str());
+                        LOG_EVERY(5, logging::LEVEL_WARN, "network", "Send failed: %s",
+                                ec.message().c_str());
                     }
                     this->on_transmit_fail();
                 } else {
@@ -172,7 +176,8 @@ void TCPTarget::handle_connect_result(const boost::system::error_code& ec) {
     }
 
     // connection failure. try again in a bit.
-    printf("Connection failed - retrying...\n");
+    LOG_EVERY(30, logging::LEVEL_WARN, "network",
+            "Connection failed - retrying...");
     if(m_retry_timer->expires_from_now().is_negative())
         m_retry_timer->expires_from_now(boost::posix_time::seconds(5));
     m_retry_timer->async_wait([this](const boost::system::error_code& ec) {
@@ -0,0 +1,98 @@
+#include "replay.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace mdump;
+
+ResultLog::ResultLog(const std::string& fname, Mode mode) : m_mode(mode),
+        m_frames(0), m_mismatches(0) {
+    if(mode == RECORD) {
+        try {
+            m_out.reset(new io::FileWriter(fname));
+        } catch(const std::runtime_error& e) {
+            throw std::invalid_argument(e.what());
+        }
+        return;
+    }
+    m_in.open(fname.c_str());
+    if(!m_in) throw std::invalid_argument("Cannot open result log");
+}
+
+ResultLog::~ResultLog() {
+}
+
+std::string ResultLog::format(long frame, long source,
+        const std::vector<ml::AlgorithmResult*>& res) {
+    std::ostringstream out;
+    out << frame;
+    if(source >= 0) out << '@' << source;
+    for(auto r : res) {
+        auto boxes = dynamic_cast<const ml::BoundingBoxesResult*>(r);
+        if(boxes == NULL) continue;
+
+        out << " |";
+        for(auto b : boxes->boxes) {
+            out << ' ' << b.id << ':' << b.tag << ':'
+                << b.bounds.x << ',' << b.bounds.y << ','
+                << b.bounds.width << ',' << b.bounds.height;
+        }
+    }
+    return out.str();
+}
+
+bool ResultLog::frame(long frame, const std::vector<ml::AlgorithmResult*>& res,
+        double dtime, long source) {
+    m_frames++;
+    m_times.push_back(dtime * 1000.0);
+
+    std::string line = format(frame, source, res);
+    if(m_mode == RECORD) {
+        std::ostringstream out;
+        out << dtime * 1000.0 << ' ' << line << '\n';
+        m_out->write(out.str());
+        return true;
+    }
+
+    // compare against the recorded line
+    std::string recorded;
+    double ms = 0.0;
+    if(!std::getline(m_in, recorded)) {
+        m_mismatches++;
+        return false;
+    }
+    std::istringstream in(recorded);
+    in >> ms;
+    std::getline(in >> std::ws, recorded);
+    m_recorded.push_back(ms);
+
+    if(recorded != line) {
+        m_mismatches++;
+        return false;
+    }
+    return true;
+}
+
+// print mean, median, 95th percentile and maximum of a set of timings
+static void printTimings(FILE* out, const char* label, std::vector<double> v) {
+    if(v.empty()) return;
+
+    std::sort(v.begin(), v.end());
+    double sum = 0.0;
+    for(auto t : v) sum += t;
+    fprintf(out, "  %-8s mean %8.2f  p50 %8.2f  p95 %8.2f  max %8.2f ms\n",
+            label, sum / v.size(), v[v.size() / 2],
+            v[std::min(v.size() - 1, (v.size() * 95) / 100)], v.back());
+}
+
+void ResultLog::summary(FILE* out) const {
+    fprintf(out, "%ld frames", m_frames);
+    if(m_mode == VERIFY)
+        fprintf(out, ", %ld with results differing from the recording",
+                m_mismatches);
+    fprintf(out, "\n");
+
+    printTimings(out, "this run", m_times);
+    printTimings(out, "recorded", m_recorded);
+}
@@ -0,0 +1,61 @@
+#ifndef RES_REPLAY_HPP
+#define RES_REPLAY_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <memory>
+#include <stdio.h>
+
+#include "../algorithm.hpp"
+#include "../io/writer.hpp"
+
+namespace mdump {
+
+/** \brief Per-frame log of algorithm results and timings
+ *
+ * In RECORD mode, every frame's bounding boxes and analysis time are appended
+ * to the log. In VERIFY mode, the log is read back instead and each frame's
+ * results are compared against what was recorded, so a replayed run can be
+ * checked for identical output and its timings compared with the original.
+ * Recording writes in the background, so disk stalls don't show up in the
+ * timings being recorded.
+ */
+class ResultLog {
+public:
+    enum Mode { RECORD, VERIFY };
+
+    ResultLog(const std::string& fname, Mode mode);
+    ~ResultLog();
+
+    /** \brief Log or verify one frame
+     *
+     * \param frame The frame number
+     * \param res The algorithm's results for the frame
+     * \param dtime Time spent analyzing the frame, in seconds
+     * \param source The frame's index in its input file, if the input says;
+     *               logged as frame@source
+     * \return Whether the results match the recording. Always true when
+     *         recording.
+     */
+    bool frame(long frame, const std::vector<ml::AlgorithmResult*>& res,
+            double dtime, long source=-1);
+
+    //! Print frame counts, mismatches and a timing breakdown
+    void summary(FILE* out) const;
+
+private:
+    //! Render results into the log's line format, minus the timing field
+    static std::string format(long frame, long source,
+            const std::vector<ml::AlgorithmResult*>& res);
+
+    Mode m_mode;
+    std::ifstream m_in;                 // VERIFY only
+    std::unique_ptr<io::FileWriter> m_out; // RECORD only
+    long m_frames, m_mismatches;
+    std::vector<double> m_times;    // this run, in ms
+    std::vector<double> m_recorded; // recorded run, in ms (VERIFY only)
+};
+
+};
+#endif
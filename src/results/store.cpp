@@ -0,0 +1,358 @@
+#include "store.hpp"
+#include "../log/log.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <boost/filesystem.hpp>
+
+using namespace mdump;
+using namespace mdump::store;
+namespace fs = boost::filesystem;
+
+// "PDST", at the start of every block
+#define BLOCK_MAGIC 0x54534450
+
+// a block is written once it holds this many frames or detections...
+#define BLOCK_FRAMES 512
+#define BLOCK_DETECTIONS 8192
+// ...or would span more than this many microseconds
+#define BLOCK_SPAN 10000000LL
+
+// a new segment is started once the current one spans this many microseconds
+#define SEGMENT_SPAN 3600000000LL
+
+// the spatial index is a grid of this many cells across and down, each this
+// many pixels square. Boxes beyond it count as being in its edge cells.
+#define GRID_CELLS 16
+#define GRID_CELL_SIZE 128
+
+namespace {
+//! The order of a block's columns
+enum { COL_TIMES, COL_FRAMES, COL_COUNTS, COL_IDS, COL_X, COL_Y, COL_W, COL_H,
+    COLUMNS };
+
+int64_t wallTime() {
+    timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (int64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+double monotonicTime() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (((double)t.tv_nsec) / 1.0e9);
+}
+
+void putVarint(std::string& out, uint64_t v) {
+    while(v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+//! Signed values are zigzag encoded, so small negative deltas stay short
+void putSigned(std::string& out, int64_t v) {
+    putVarint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+//! Reads the varints in one column of a block
+class Column {
+public:
+    Column() : m_p(NULL), m_end(NULL) {}
+    Column(const char* p, const char* end) : m_p((const uint8_t*)p),
+        m_end((const uint8_t*)end) {}
+
+    bool empty() const { return m_p == m_end; }
+
+    uint64_t next() {
+        uint64_t v = 0;
+        for(int shift = 0;shift < 64;shift += 7) {
+            if(m_p == m_end) break;
+            uint8_t b = *m_p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if(!(b & 0x80)) return v;
+        }
+        throw std::runtime_error("Corrupt detection block");
+    }
+
+    int64_t nextSigned() {
+        uint64_t v = next();
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+
+    //! Split off the next \p len bytes as a column of their own
+    Column take(uint64_t len) {
+        if(len > (uint64_t)(m_end - m_p))
+            throw std::runtime_error("Corrupt detection block");
+        Column c((const char*)m_p, (const char*)(m_p + len));
+        m_p += len;
+        return c;
+    }
+
+private:
+    const uint8_t* m_p;
+    const uint8_t* m_end;
+};
+
+int cell(int v) {
+    return std::min(std::max(v / GRID_CELL_SIZE, 0), GRID_CELLS - 1);
+}
+
+//! Set the bits of the grid cells \p r touches
+void mark(uint64_t* cells, const cv::Rect& r) {
+    int x1 = cell(r.x + std::max(r.width, 1) - 1);
+    int y1 = cell(r.y + std::max(r.height, 1) - 1);
+    for(int y = cell(r.y);y <= y1;y++) {
+        for(int x = cell(r.x);x <= x1;x++) {
+            int i = y * GRID_CELLS + x;
+            cells[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+}
+
+std::string segmentPath(const std::string& dir, int64_t start) {
+    // fixed width, so names sort by time
+    char name[32];
+    snprintf(name, sizeof(name), "%016lld", (long long)start);
+    return (fs::path(dir) / name).string();
+}
+
+//! A segment's complete index entries, in order
+std::vector<BlockEntry> readIndex(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if(!in) throw std::runtime_error("Cannot open " + path);
+    std::vector<BlockEntry> index;
+    BlockEntry e;
+    while(in.read((char*)&e, sizeof(e))) {
+        // entries still being written read as zeroes
+        if(e.length > 0) index.push_back(e);
+    }
+    return index;
+}
+
+/** Call \p visit for each detection in \p block that's in the time range and
+ * zone. Returns the number of detections decoded.
+ */
+unsigned long decode(const std::string& block, int64_t first, int64_t last,
+        const cv::Rect& zone, const std::function<void(const Detection&)>& visit) {
+    uint32_t header[2];
+    memcpy(header, block.data(), sizeof(header));
+    if(header[0] == 0 && header[1] == 0) return 0; // not written yet
+    if(header[0] != BLOCK_MAGIC || header[1] + sizeof(header) != block.size())
+        throw std::runtime_error("Corrupt detection block");
+
+    Column in(block.data() + sizeof(header), block.data() + block.size());
+    Column c[COLUMNS];
+    for(int i = 0;i < COLUMNS;i++) c[i] = in.take(in.next());
+
+    std::unordered_map<unsigned int, cv::Rect> prev;
+    unsigned long n = 0;
+    Detection d = { 0, 0, 0, cv::Rect() };
+    while(!c[COL_TIMES].empty() && d.time <= last) {
+        d.time += c[COL_TIMES].next();
+        d.frame += c[COL_FRAMES].nextSigned();
+        for(uint64_t i = c[COL_COUNTS].next();i > 0;i--) {
+            // every box is decoded, as later ones are deltas from it
+            d.id += c[COL_IDS].nextSigned();
+            cv::Rect& r = prev[d.id];
+            r.x += c[COL_X].nextSigned();
+            r.y += c[COL_Y].nextSigned();
+            r.width += c[COL_W].nextSigned();
+            r.height += c[COL_H].nextSigned();
+            n++;
+
+            if(d.time < first || d.time > last) continue;
+            if(zone.area() > 0 && (r & zone).area() == 0) continue;
+            d.bounds = r;
+            visit(d);
+        }
+    }
+    return n;
+}
+};
+
+Reader::Reader(const std::string& dir) : m_dir(dir) {
+    if(!fs::is_directory(dir))
+        throw std::invalid_argument("Not a detection store: " + dir);
+    for(fs::directory_iterator it(dir), end;it != end;++it) {
+        if(it->path().extension() != ".idx") continue;
+        std::string stem = it->path().stem().string();
+        char* e;
+        long long start = strtoll(stem.c_str(), &e, 10);
+        if(!stem.empty() && *e == '\0') m_segments.push_back(start);
+    }
+    std::sort(m_segments.begin(), m_segments.end());
+}
+
+QueryStats Reader::query(int64_t first, int64_t last, const cv::Rect& zone,
+        const std::function<void(const Detection&)>& visit) const {
+    QueryStats stats = { 0, 0, 0, 0 };
+    uint64_t cells[4] = { ~0ULL, ~0ULL, ~0ULL, ~0ULL };
+    if(zone.area() > 0) {
+        memset(cells, 0, sizeof(cells));
+        mark(cells, zone);
+    }
+
+    std::string block;
+    for(size_t s = 0;s < m_segments.size();s++) {
+        // a segment ends where the next one starts
+        if(m_segments[s] > last) break;
+        if(s + 1 < m_segments.size() && m_segments[s + 1] < first) continue;
+
+        std::string base = segmentPath(m_dir, m_segments[s]);
+        std::vector<BlockEntry> index = readIndex(base + ".idx");
+        stats.segments++;
+        std::ifstream det((base + ".det").c_str(), std::ios::binary);
+        if(!det) throw std::runtime_error("Cannot open " + base + ".det");
+        det.seekg(0, std::ios::end);
+        uint64_t size = det.tellg();
+
+        // block times never go back, so the range can be found by bisection
+        auto it = std::lower_bound(index.begin(), index.end(), first,
+                [](const BlockEntry& e, int64_t t) { return e.last < t; });
+        for(;it != index.end() && it->first <= last;++it) {
+            stats.blocks++;
+            bool hit = false;
+            for(int i = 0;i < 4;i++) hit = hit || (it->cells[i] & cells[i]);
+            if(!hit || it->offset + it->length > size) continue;
+
+            block.resize(it->length);
+            det.seekg(it->offset);
+            if(!det.read(&block[0], it->length))
+                throw std::runtime_error("Cannot read " + base + ".det");
+            stats.read++;
+            stats.detections += decode(block, first, last, zone, visit);
+        }
+    }
+    return stats;
+}
+
+StoreTarget::StoreTarget(const std::string& dir) : m_dir(dir),
+        m_segment(0), m_offset(0), m_clock(0) {
+    try {
+        fs::create_directories(dir);
+    } catch(const fs::filesystem_error& e) {
+        throw std::invalid_argument(e.what());
+    }
+    clear();
+}
+
+StoreTarget::~StoreTarget() {
+    finish();
+}
+
+void StoreTarget::finish() {
+    flush();
+    // the writers report their own errors as they close
+    m_det.reset();
+    m_idx.reset();
+}
+
+void StoreTarget::clear() {
+    memset(&m_entry, 0, sizeof(m_entry));
+    for(std::string* c : { &m_times, &m_frames, &m_counts, &m_ids,
+            &m_x, &m_y, &m_w, &m_h })
+        c->clear();
+    m_lastTime = 0;
+    m_lastFrame = 0;
+    m_lastId = 0;
+    m_lastBox.clear();
+}
+
+bool StoreTarget::accept(const std::vector<ml::AlgorithmResult*>& res,
+        long frame, double captured) {
+    // back-date the frame by how long it took to get here
+    int64_t t = wallTime();
+    if(captured >= 0) t -= (int64_t)((monotonicTime() - captured) * 1.0e6);
+
+    // the index relies on times never going back, whatever the clock does
+    t = std::max(t, m_clock);
+    m_clock = t;
+    if(m_entry.frames >= BLOCK_FRAMES ||
+            m_entry.detections >= BLOCK_DETECTIONS ||
+            (m_entry.frames > 0 && t - m_entry.first > BLOCK_SPAN))
+        flush();
+
+    if(m_entry.frames == 0) m_entry.first = t;
+    putVarint(m_times, t - m_lastTime);
+    putSigned(m_frames, frame - m_lastFrame);
+    m_lastTime = t;
+    m_lastFrame = frame;
+
+    uint32_t count = 0;
+    for(auto r : res) {
+        auto boxes = dynamic_cast<const ml::BoundingBoxesResult*>(r);
+        if(boxes == NULL) continue;
+
+        for(auto& b : boxes->boxes) {
+            putSigned(m_ids, (int64_t)b.id - m_lastId);
+            m_lastId = b.id;
+            cv::Rect& prev = m_lastBox[b.id];
+            putSigned(m_x, b.bounds.x - prev.x);
+            putSigned(m_y, b.bounds.y - prev.y);
+            putSigned(m_w, b.bounds.width - prev.width);
+            putSigned(m_h, b.bounds.height - prev.height);
+            prev = b.bounds;
+            mark(m_entry.cells, b.bounds);
+            count++;
+        }
+    }
+    putVarint(m_counts, count);
+    m_entry.last = t;
+    m_entry.frames++;
+    m_entry.detections += count;
+    return true;
+}
+
+void StoreTarget::open(int64_t time) {
+    // finish the last segment first, so it's complete once the next one exists
+    m_det.reset();
+    m_idx.reset();
+
+    std::string base = segmentPath(m_dir, time);
+    m_det.reset(new io::FileWriter(base + ".det"));
+    m_idx.reset(new io::FileWriter(base + ".idx"));
+    m_segment = time;
+    m_offset = 0;
+    LOG_DEBUG("store", "Started segment %s", base.c_str());
+}
+
+void StoreTarget::flush() {
+    if(m_entry.frames == 0) return;
+
+    std::string payload;
+    for(const std::string* c : { &m_times, &m_frames, &m_counts, &m_ids,
+            &m_x, &m_y, &m_w, &m_h }) {
+        putVarint(payload, c->size());
+        payload += *c;
+    }
+    uint32_t header[2] = { BLOCK_MAGIC, (uint32_t)payload.size() };
+
+    try {
+        if(!m_det || m_entry.first - m_segment >= SEGMENT_SPAN)
+            open(m_entry.first);
+        m_entry.offset = m_offset;
+        m_entry.length = sizeof(header) + payload.size();
+        m_det->write(header, sizeof(header));
+        m_det->write(payload);
+        m_idx->write(&m_entry, sizeof(m_entry));
+        m_det->flush();
+        m_idx->flush();
+        m_offset += m_entry.length;
+    } catch(const std::exception& e) {
+        // carry on in a fresh segment rather than lose everything after
+        LOG_ERROR("store", "Lost %u frames of detections: %s", m_entry.frames,
+                e.what());
+        m_det.reset();
+        m_idx.reset();
+    }
+    clear();
+}
@@ -0,0 +1,137 @@
+#ifndef RES_STORE_HPP
+#define RES_STORE_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "metadump.hpp"
+#include "../io/writer.hpp"
+
+namespace mdump {
+
+/** \brief An append-only, indexed log of detections on disk
+ *
+ * A store is a directory of segments, each covering up to an hour and named
+ * after the time it starts. A segment's `.det` file holds blocks of frames,
+ * each stored column by column: timestamps, frame numbers and track IDs as
+ * deltas from the previous entry, and box coordinates as deltas from the same
+ * track's previous box, all as variable-length integers. Its `.idx` file has a
+ * fixed-size entry per block with the block's time span, where it is, and
+ * which cells of a coarse grid over the image its boxes touch.
+ *
+ * Queries skip whole segments by name, binary search the index for the time
+ * range, and only read blocks whose grid cells overlap the zone, so they cost
+ * little more than the detections they return.
+ *
+ * Times are microseconds since the epoch.
+ */
+namespace store {
+
+//! One stored detection
+struct Detection {
+    int64_t time;
+    long frame;
+    unsigned int id;    //!< Track ID, or zero for untracked boxes
+    cv::Rect bounds;
+};
+
+//! What a query had to read
+struct QueryStats {
+    unsigned long segments;     //!< Segments whose index was read
+    unsigned long blocks;       //!< Blocks in the time range
+    unsigned long read;         //!< Blocks read after the zone check
+    unsigned long detections;   //!< Detections decoded from them
+};
+
+//! Index entry for one block. Written as is, in host byte order.
+struct BlockEntry {
+    int64_t first, last;    // frame times
+    uint64_t offset;        // of the block in the .det file
+    uint32_t length;        // of the block, header included
+    uint32_t frames;
+    uint32_t detections;
+    uint32_t reserved;
+    uint64_t cells[4];      // grid cells touched, one bit each
+};
+
+/** \brief Reads a store
+ *
+ * Segments can still be growing while they're read; blocks that haven't been
+ * completely written yet are left out.
+ */
+class Reader {
+public:
+    /** \throw std::invalid_argument If \p dir isn't a store */
+    explicit Reader(const std::string& dir);
+
+    /** \brief Find detections by time and place
+     *
+     * \param first,last The time range, inclusive
+     * \param zone Only detections whose boxes overlap this; an empty rectangle
+     *             matches anywhere
+     * \param visit Called for each match, in time order
+     * \throw std::runtime_error If a segment can't be read or is corrupt
+     */
+    QueryStats query(int64_t first, int64_t last, const cv::Rect& zone,
+            const std::function<void(const Detection&)>& visit) const;
+
+private:
+    std::string m_dir;
+    std::vector<int64_t> m_segments;    // start times, in order
+};
+
+};
+
+/** \brief Dump target writing results to a detection store
+ *
+ * Only bounding boxes are kept. Results are taken directly rather than as JSON,
+ * and buffered a block at a time; full blocks are written in the background.
+ */
+class StoreTarget : public DumpTarget {
+public:
+    /** \throw std::invalid_argument If the store can't be created */
+    StoreTarget(const std::string& dir);
+    ~StoreTarget();
+
+    //! Stores the results under the wall clock time the frame was captured
+    bool accept(const std::vector<ml::AlgorithmResult*>& res, long frame,
+            double captured);
+
+    //! Everything arrives through accept()
+    void write(const std::string& data) {}
+
+    //! Write the last block, and close the segment
+    void finish();
+
+private:
+    //! Encode the buffered frames, and write them with their index entry
+    void flush();
+
+    //! Start a new segment at \p time
+    void open(int64_t time);
+
+    //! Start an empty block
+    void clear();
+
+    std::string m_dir;
+    std::unique_ptr<io::FileWriter> m_det, m_idx;
+    int64_t m_segment;      // when the current segment started
+    uint64_t m_offset;      // bytes written to it so far
+    int64_t m_clock;        // latest time stored
+
+    // the block being built, and what its deltas are from
+    store::BlockEntry m_entry;
+    std::string m_times, m_frames, m_counts;
+    std::string m_ids, m_x, m_y, m_w, m_h;
+    int64_t m_lastTime;
+    long m_lastFrame;
+    unsigned int m_lastId;
+    std::unordered_map<unsigned int, cv::Rect> m_lastBox; // per track
+};
+
+};
+#endif
@@ -0,0 +1,374 @@
+#include "autotune.hpp"
+#include "budget.hpp"
+#include "../algorithm.hpp"
+#include "../media/capture.hpp"
+#include "../media/synth.hpp"
+#include "../log/log.hpp"
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <thread>
+
+// a faster configuration has to beat the current one by this much, so timing
+// noise doesn't decide between equals
+#define MIN_GAIN 1.03
+
+// the synthetic clip used when none is given
+#define SYNTH_CLIP "%dx%d@30,people=8,seed=7,frames=%ld"
+
+using namespace sched;
+namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
+
+struct Autotuner::Clip {
+    cv::Size size;
+    std::vector<cv::Mat> frames;
+    std::vector<eval::FrameObjects> truth; //!< Empty if the clip has none
+};
+
+namespace {
+double now() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//! Set \p name in \p params, replacing an earlier value
+void setParam(ParamList& params, const std::string& name,
+        const std::string& value) {
+    for(auto& p : params) {
+        if(p.first == name) {
+            p.second = value;
+            return;
+        }
+    }
+    params.push_back(std::make_pair(name, value));
+}
+
+//! The value \p params gives \p name, or \p def if it doesn't
+std::string getParam(const ParamList& params, const std::string& name,
+        const std::string& def) {
+    for(auto& p : params) if(p.first == name) return p.second;
+    return def;
+}
+
+std::string describe(const ParamList& params) {
+    std::ostringstream out;
+    for(auto& p : params) out << p.first << '=' << p.second << ' ';
+    std::string s = out.str();
+    return s.empty() ? "defaults" : s.substr(0, s.size() - 1);
+}
+
+//! Section names can't hold ini syntax, or the path separator used for them
+std::string sectionName(const std::string& key) {
+    std::string s;
+    for(char c : key) {
+        if(c == '[' || c == ']' || c == '|' || c == '=' || c == '\n') c = '_';
+        s += c;
+    }
+    return s;
+}
+
+//! A ptree path that takes dots and spaces in names literally
+pt::ptree::path_type entry(const std::string& name) {
+    return pt::ptree::path_type(name, '|');
+}
+};
+
+Autotuner::Autotuner(const std::vector<std::string>& algorithms,
+        const ParamList& fixed) : m_algorithms(algorithms), m_fixed(fixed),
+        m_frames(90), m_tolerance(0.02), m_searchThreads(true) {
+    if(algorithms.size() == 1) m_axes = defaultAxes(algorithms[0]);
+}
+
+void Autotuner::setClip(const std::string& spec) { m_clip = spec; }
+
+void Autotuner::setFrames(long frames) {
+    if(frames <= 0) throw std::invalid_argument("Need at least one frame");
+    m_frames = frames;
+}
+
+void Autotuner::setTolerance(double tolerance) { m_tolerance = tolerance; }
+
+void Autotuner::setSearchThreads(bool search) { m_searchThreads = search; }
+
+void Autotuner::setAxes(const std::vector<TuneAxis>& axes) { m_axes = axes; }
+
+std::vector<TuneAxis> Autotuner::defaultAxes(const std::string& algorithm) {
+    // the first value of each axis is the algorithm's own default
+    std::vector<TuneAxis> axes;
+    if(algorithm == "ocv-hog-svm") {
+        axes.push_back({ "win_stride", { "8", "16", "4" } });
+        axes.push_back({ "scale", { "0", "1.05", "1.1", "1.2" } });
+        axes.push_back({ "two_stage", { "0", "1" } });
+        axes.push_back({ "mode", { "full", "local" } });
+        axes.push_back({ "tracker", { "TLD", "KCF", "MEDIANFLOW" } });
+    } else if(algorithm == "hog-cpu") {
+        axes.push_back({ "stride", { "1", "2" } });
+        axes.push_back({ "scale", { "0", "1.05", "1.1", "1.2" } });
+        axes.push_back({ "input_scale", { "1", "1.5", "2" } });
+    } else if(algorithm == "acf-detector") {
+        axes.push_back({ "scales_per_octave", { "8", "4" } });
+        axes.push_back({ "stride", { "1", "2" } });
+    } else if(algorithm == "dnn-detector") {
+        axes.push_back({ "tracker", { "TLD", "KCF", "MEDIANFLOW" } });
+    } else if(algorithm == "hog-ocl-fpga") {
+        axes.push_back({ "two_stage", { "0", "1" } });
+    }
+    return axes;
+}
+
+Autotuner::Trial Autotuner::measure(const Clip& clip, const ParamList& params,
+        std::vector<eval::FrameObjects>* found) {
+    ml::AlgorithmRegistry& reg = ml::AlgorithmRegistry::get();
+    reg.setSize(clip.size);
+    reg.setSeed(1);
+
+    // the parts of a composite run side by side, as CompositeAlgorithm would
+    std::vector<ml::Algorithm*> algos;
+    auto unload = [&]() { for(auto a : algos) reg.unload(a); };
+    try {
+        for(auto& name : m_algorithms) {
+            ml::Algorithm* a = reg.load(name);
+            if(a == NULL) throw std::runtime_error("Cannot load " + name);
+            algos.push_back(a);
+        }
+        ParamList all = m_fixed;
+        all.insert(all.end(), params.begin(), params.end());
+        for(auto& p : all) {
+            bool accepted = false;
+            for(auto a : algos) accepted |= a->setParam(p.first, p.second);
+            if(!accepted)
+                throw std::invalid_argument("Parameter rejected: " + p.first);
+        }
+
+        eval::Accumulator acc;
+        eval::FrameObjects none;
+        for(size_t i = 0;i < clip.frames.size();i++) {
+            double t = now();
+            eval::FrameObjects hyp;
+            for(auto a : algos) {
+                eval::FrameObjects h = eval::hypotheses(
+                        a->analyze(clip.frames[i]));
+                hyp.insert(hyp.end(), h.begin(), h.end());
+            }
+            double dtime = now() - t;
+            acc.frame(clip.truth.empty() ? none : clip.truth[i], hyp, dtime);
+            if(found) found->push_back(hyp);
+        }
+        unload();
+
+        eval::Metrics m = acc.summary();
+        Trial trial = { m.fps, m.ap50 };
+        return trial;
+    } catch(...) {
+        unload();
+        throw;
+    }
+}
+
+TunedConfig Autotuner::run(const cv::Size& size) {
+    // hold the clip in memory so only analysis is timed
+    Clip clip;
+    clip.size = size;
+    std::unique_ptr<vio::CaptureBackend> cap;
+    vio::SyntheticCaptureBackend* synth = NULL;
+    if(m_clip.empty()) {
+        char spec[64];
+        snprintf(spec, sizeof(spec), SYNTH_CLIP, size.width, size.height,
+                m_frames);
+        cap.reset(synth = new vio::SyntheticCaptureBackend(spec));
+    } else if(m_clip.compare(0, 6, "synth:") == 0) {
+        cap.reset(synth = new vio::SyntheticCaptureBackend(m_clip.substr(6)));
+    } else {
+        cap.reset(vio::openBackend(m_clip, false));
+    }
+
+    cv::Mat img;
+    for(long f = 0;f < m_frames && cap->getFrame(img);f++) {
+        double sx = (double)size.width / img.cols;
+        double sy = (double)size.height / img.rows;
+        if(img.size() != size) {
+            cv::Mat scaled;
+            cv::resize(img, scaled, size);
+            clip.frames.push_back(scaled);
+        } else {
+            clip.frames.push_back(img.clone());
+        }
+        if(synth == NULL) continue;
+
+        eval::FrameObjects truth;
+        for(auto& t : synth->getTruth()) {
+            eval::Object o = { t.id, cv::Rect(cvRound(t.bounds.x * sx),
+                    cvRound(t.bounds.y * sy), cvRound(t.bounds.width * sx),
+                    cvRound(t.bounds.height * sy)) };
+            truth.push_back(o);
+        }
+        clip.truth.push_back(truth);
+    }
+    if(clip.frames.empty())
+        throw std::runtime_error("The calibration clip has no frames");
+    LOG_INFO("autotune", "Calibrating on %lu frames at %dx%d",
+            clip.frames.size(), size.width, size.height);
+
+    // without ground truth, the untuned detections are the reference
+    TunedConfig best;
+    best.threads = 0;
+    std::vector<eval::FrameObjects> found;
+    Trial base = measure(clip, best.params, clip.truth.empty() ? &found : NULL);
+    if(clip.truth.empty()) {
+        clip.truth = found;
+        long boxes = 0;
+        for(auto& f : found) boxes += f.size();
+        base.accuracy = boxes > 0 ? 1.0 : 0.0;
+    }
+    const double floor = base.accuracy - m_tolerance;
+    LOG_INFO("autotune", "defaults: %.1f fps, AP50 %.3f", base.fps,
+            base.accuracy);
+
+    Trial bestTrial = base;
+    for(auto& axis : m_axes) {
+        if(getParam(m_fixed, axis.name, "") != "") continue;
+        const std::string current = getParam(best.params, axis.name,
+                axis.values[0]);
+        ParamList chosen = best.params;
+        for(auto& v : axis.values) {
+            if(v == current) continue;
+            ParamList cand = best.params;
+            setParam(cand, axis.name, v);
+            Trial t;
+            try {
+                t = measure(clip, cand, NULL);
+            } catch(const std::invalid_argument& e) {
+                // e.g. a tracker this OpenCV doesn't have
+                LOG_DEBUG("autotune", "%s=%s: %s", axis.name.c_str(),
+                        v.c_str(), e.what());
+                continue;
+            }
+            LOG_DEBUG("autotune", "%s: %.1f fps, AP50 %.3f",
+                    describe(cand).c_str(), t.fps, t.accuracy);
+            if(t.accuracy >= floor && t.fps > bestTrial.fps * MIN_GAIN) {
+                chosen = cand;
+                bestTrial = t;
+            }
+        }
+        best.params = chosen;
+    }
+
+    if(m_searchThreads) {
+        ThreadBudget& budget = ThreadBudget::get();
+        unsigned int original = budget.total();
+        unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<unsigned int> counts;
+        for(unsigned int n = 1;n < cores;n *= 2) counts.push_back(n);
+        counts.push_back(cores);
+
+        // the current budget is what everything so far was measured with
+        unsigned int chosen = original;
+        for(auto n : counts) {
+            if(n == original) continue;
+            budget.configure(n);
+            Trial t = measure(clip, best.params, NULL);
+            LOG_DEBUG("autotune", "%u threads: %.1f fps, AP50 %.3f", n, t.fps,
+                    t.accuracy);
+            if(t.accuracy >= floor && t.fps > bestTrial.fps * MIN_GAIN) {
+                chosen = n;
+                bestTrial = t;
+            }
+        }
+        budget.configure(chosen);
+        best.threads = chosen;
+    }
+
+    best.fps = bestTrial.fps;
+    best.accuracy = bestTrial.accuracy;
+    LOG_INFO("autotune", "Chose %s, %u threads: %.1f fps, AP50 %.3f",
+            describe(best.params).c_str(), best.threads, best.fps,
+            best.accuracy);
+    return best;
+}
+
+std::string sched::cpuModel() {
+    // x86 names the model, most ARM kernels only the hardware
+    std::ifstream in("/proc/cpuinfo");
+    std::string line, hardware;
+    while(std::getline(in, line)) {
+        size_t colon = line.find(':');
+        if(colon == std::string::npos) continue;
+        std::string key = line.substr(0, line.find_last_not_of(" \t",
+                    colon - 1) + 1);
+        size_t start = line.find_first_not_of(" \t", colon + 1);
+        std::string value = start == std::string::npos ? "" :
+            line.substr(start);
+        if(key == "model name") return value;
+        if(key == "Hardware") hardware = value;
+    }
+    return hardware.empty() ? "unknown" : hardware;
+}
+
+std::string sched::tuneKey(const std::vector<std::string>& algorithms,
+        const cv::Size& size) {
+    std::ostringstream key;
+    key << cpuModel() << " / ";
+    for(size_t i = 0;i < algorithms.size();i++)
+        key << (i > 0 ? "+" : "") << algorithms[i];
+    key << " / " << size.width << 'x' << size.height;
+    return key.str();
+}
+
+std::string sched::tuneFile() {
+    const char* xdg = getenv("XDG_CONFIG_HOME");
+    const char* home = getenv("HOME");
+    fs::path dir = xdg && *xdg ? fs::path(xdg) :
+        fs::path(home ? home : ".") / ".config";
+    return (dir / "pddemo" / "autotune.ini").string();
+}
+
+bool sched::loadTuned(const std::string& file, const std::string& key,
+        TunedConfig& cfg) {
+    if(!fs::exists(file)) return false;
+    pt::ptree ini;
+    pt::read_ini(file, ini);
+
+    auto section = ini.get_child_optional(entry(sectionName(key)));
+    if(!section) return false;
+    cfg = TunedConfig();
+    cfg.threads = section->get<unsigned int>(entry("threads"), 0);
+    cfg.fps = section->get<double>(entry("fps"), 0.0);
+    cfg.accuracy = section->get<double>(entry("accuracy"), 0.0);
+    for(auto& e : *section) {
+        if(e.first.compare(0, 6, "param.") == 0) {
+            cfg.params.push_back(std::make_pair(e.first.substr(6),
+                        e.second.data()));
+        }
+    }
+    return true;
+}
+
+void sched::saveTuned(const std::string& file, const std::string& key,
+        const TunedConfig& cfg) {
+    pt::ptree ini;
+    if(fs::exists(file)) pt::read_ini(file, ini);
+    else fs::create_directories(fs::path(file).parent_path());
+
+    std::string name = sectionName(key);
+    ini.erase(name);
+    pt::ptree section;
+    section.put(entry("threads"), cfg.threads);
+    section.put(entry("fps"), cfg.fps);
+    section.put(entry("accuracy"), cfg.accuracy);
+    for(auto& p : cfg.params)
+        section.put(entry("param." + p.first), p.second);
+    ini.push_back(std::make_pair(name, section));
+    pt::write_ini(file, ini);
+}
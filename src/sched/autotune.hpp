@@ -0,0 +1,111 @@
+#ifndef SCHED_AUTOTUNE_HPP
+#define SCHED_AUTOTUNE_HPP
+
+#include "opencv2/core/core.hpp"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../eval/mot.hpp"
+
+namespace sched {
+
+typedef std::vector<std::pair<std::string, std::string> > ParamList;
+
+//! One algorithm parameter and the values worth trying for it
+struct TuneAxis {
+    std::string name;
+    std::vector<std::string> values;
+};
+
+//! The configuration calibration settled on
+struct TunedConfig {
+    ParamList params;       //!< Algorithm parameters, applied in order
+    unsigned int threads;   //!< Total thread budget; zero to leave it alone
+    double fps;             //!< Throughput during calibration
+    double accuracy;        //!< AP at IoU 0.5 during calibration
+};
+
+/** \brief Picks detector parameters and a thread budget for this machine
+ *
+ * Calibration runs the algorithm over a short clip, held in memory so decoding
+ * isn't timed, once per candidate configuration. Parameters are searched one
+ * at a time, each keeping the value with the best throughput whose accuracy
+ * is within the tolerance of the untuned configuration's; the thread budget is
+ * searched last in the same way.
+ *
+ * Accuracy is measured against the clip's ground truth when it has one, which
+ * synthetic clips always do. For other clips the untuned configuration's own
+ * detections stand in for it, so tuning keeps what it found.
+ */
+class Autotuner {
+public:
+    /** \param algorithms Names of the algorithm(s) as given to the registry
+     *  \param fixed Parameters set by the user, applied to every run and never
+     *               searched
+     */
+    Autotuner(const std::vector<std::string>& algorithms,
+            const ParamList& fixed);
+
+    /** \brief Use a clip other than the default synthetic one
+     *
+     * \param spec Anything vio::openBackend() accepts. Frames are resized to
+     *             the tuning size.
+     */
+    void setClip(const std::string& spec);
+
+    void setFrames(long frames);        //!< Frames of the clip to use
+    void setTolerance(double tolerance);//!< Accuracy that may be given up
+    void setSearchThreads(bool search); //!< Whether to search thread counts
+
+    //! Replace the parameters searched, which default to defaultAxes()
+    void setAxes(const std::vector<TuneAxis>& axes);
+
+    //! Calibrate for frames of the given size
+    TunedConfig run(const cv::Size& size);
+
+    //! Parameters worth searching for a known algorithm; empty if none are
+    static std::vector<TuneAxis> defaultAxes(const std::string& algorithm);
+
+private:
+    struct Clip;
+    struct Trial {
+        double fps;
+        double accuracy;
+    };
+
+    //! Run one configuration over the clip
+    Trial measure(const Clip& clip, const ParamList& params,
+            std::vector<eval::FrameObjects>* found);
+
+    std::vector<std::string> m_algorithms;
+    ParamList m_fixed;
+    std::string m_clip;
+    long m_frames;
+    double m_tolerance;
+    bool m_searchThreads;
+    std::vector<TuneAxis> m_axes;
+};
+
+//! The CPU model, as the kernel names it
+std::string cpuModel();
+
+//! Key for a stored configuration: CPU model, algorithms and input size
+std::string tuneKey(const std::vector<std::string>& algorithms,
+        const cv::Size& size);
+
+//! Where configurations are stored, under $XDG_CONFIG_HOME or ~/.config
+std::string tuneFile();
+
+//! Look up a stored configuration. False if there isn't one.
+bool loadTuned(const std::string& file, const std::string& key,
+        TunedConfig& cfg);
+
+//! Store a configuration, replacing any under the same key
+void saveTuned(const std::string& file, const std::string& key,
+        const TunedConfig& cfg);
+
+};
+
+#endif
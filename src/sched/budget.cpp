@@ -0,0 +1,85 @@
+#include "budget.hpp"
+
+#include "opencv2/core/core.hpp"
+
+#include <algorithm>
+
+using namespace sched;
+
+WorkerPool::WorkerPool(unsigned int threads) {
+    m_work = std::unique_ptr<asio::io_service::work>(
+            new asio::io_service::work(m_svc));
+    for(unsigned int i = 0;i < std::max(threads, 1u);i++)
+        m_threads.push_back(std::thread([this]() { m_svc.run(); }));
+}
+
+WorkerPool::~WorkerPool() {
+    m_work.reset(); // let run() return once the queue drains
+    for(auto& t : m_threads) t.join();
+}
+
+unsigned int WorkerPool::size() const {
+    return m_threads.size();
+}
+
+static ThreadBudget* budgetInstance = NULL;
+
+ThreadBudget::ThreadBudget() {
+    configure(0);
+}
+
+ThreadBudget::~ThreadBudget() {
+}
+
+ThreadBudget& ThreadBudget::get() {
+    if(budgetInstance == NULL)
+        budgetInstance = new ThreadBudget();
+    return *budgetInstance;
+}
+
+void ThreadBudget::configure(unsigned int total, unsigned int streams) {
+    if(total == 0) total = std::thread::hardware_concurrency();
+    if(total == 0) total = 1;
+    streams = std::max(streams, 1u);
+
+    // One reactor thread is plenty for every dump target we have, and encoders
+    // get a quarter of the budget. Whatever is left is compute, which is split
+    // between per-stream workers and OpenCV's pool so that the two don't
+    // multiply into more threads than there are cores.
+    m_total = total;
+    m_io = 1;
+    m_encoders = std::max(total / 4, 1u);
+
+    unsigned int compute = total > m_io + m_encoders ?
+        total - m_io - m_encoders : 1;
+    m_workers = std::min(streams, compute);
+    m_opencv = std::max(compute / m_workers, 1u);
+
+    cv::setNumThreads(m_opencv);
+}
+
+unsigned int ThreadBudget::total() const { return m_total; }
+unsigned int ThreadBudget::opencvThreads() const { return m_opencv; }
+unsigned int ThreadBudget::workerThreads() const { return m_workers; }
+unsigned int ThreadBudget::ioThreads() const { return m_io; }
+unsigned int ThreadBudget::encoderThreads() const { return m_encoders; }
+
+WorkerPool& ThreadBudget::workers() {
+    std::lock_guard<std::mutex> l(m_mut);
+    if(!m_pool) m_pool = std::unique_ptr<WorkerPool>(new WorkerPool(m_workers));
+    return *m_pool;
+}
+
+std::shared_ptr<asio::io_service> ThreadBudget::reactor() {
+    std::lock_guard<std::mutex> l(m_mut);
+    if(!m_reactor) {
+        m_reactor = std::make_shared<asio::io_service>();
+        m_reactor_work = std::unique_ptr<asio::io_service::work>(
+                new asio::io_service::work(*m_reactor));
+        // the reactor lives as long as the process does
+        std::shared_ptr<asio::io_service> svc = m_reactor;
+        for(unsigned int i = 0;i < m_io;i++)
+            std::thread([svc]() { svc->run(); }).detach();
+    }
+    return m_reactor;
+}
@@ -0,0 +1,100 @@
+#ifndef SCHED_BUDGET_HPP
+#define SCHED_BUDGET_HPP
+
+#include <boost/asio.hpp>
+#include <boost/thread/future.hpp>
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <type_traits>
+
+namespace sched {
+namespace asio = boost::asio;
+
+/** \brief A fixed-size pool of worker threads
+ *
+ * Work items are run in submission order on whichever worker is free. A single
+ * pool is meant to be shared by every stream in the process, so that adding
+ * streams doesn't add threads.
+ */
+class WorkerPool {
+public:
+    WorkerPool(unsigned int threads);
+    ~WorkerPool();
+
+    /** \brief Queue a callable for execution on the pool
+     *
+     * \return A future which becomes ready once the callable has run.
+     */
+    template<typename F>
+    boost::future<typename std::result_of<F()>::type> submit(F f) {
+        typedef typename std::result_of<F()>::type R;
+        auto task = std::make_shared<boost::packaged_task<R()> >(f);
+        boost::future<R> fut = task->get_future();
+        m_svc.post([task]() { (*task)(); });
+        return fut;
+    }
+
+    //! Return the number of worker threads in the pool
+    unsigned int size() const;
+
+private:
+    asio::io_service m_svc;
+    std::unique_ptr<asio::io_service::work> m_work;
+    std::vector<std::thread> m_threads;
+};
+
+/** \brief Process-wide thread budget
+ *
+ * Holds one total thread count and divides it between everything in the
+ * process that runs threads: OpenCV's parallel_for_ pool, the detector/tracker
+ * worker pool, the network reactor used by metadata dump targets, and video
+ * encoders. Consumers ask the budget for their share instead of picking their
+ * own thread counts.
+ */
+class ThreadBudget {
+public:
+    static ThreadBudget& get();
+
+    /** \brief Set the total budget and recompute all shares
+     *
+     * This must be called before workers() or reactor() are first used; the
+     * pool and reactor are sized when they're created and won't shrink later.
+     *
+     * \param total The total number of threads. Zero means one per core.
+     * \param streams The number of streams which will be processed in parallel
+     */
+    void configure(unsigned int total, unsigned int streams=1);
+
+    unsigned int total() const;        //!< The total thread budget
+    unsigned int opencvThreads() const;//!< Threads given to OpenCV
+    unsigned int workerThreads() const;//!< Threads in the shared worker pool
+    unsigned int ioThreads() const;    //!< Threads running the network reactor
+    unsigned int encoderThreads() const; //!< Threads per video encoder
+
+    //! Get the shared detector/tracker worker pool, creating it if needed
+    WorkerPool& workers();
+
+    /** \brief Get the shared network reactor, creating it if needed
+     *
+     * Dump targets given this service won't start threads of their own.
+     */
+    std::shared_ptr<asio::io_service> reactor();
+
+private:
+    ThreadBudget();
+    ~ThreadBudget();
+
+    unsigned int m_total, m_opencv, m_workers, m_io, m_encoders;
+
+    std::mutex m_mut;
+    std::unique_ptr<WorkerPool> m_pool;
+    std::shared_ptr<asio::io_service> m_reactor;
+    std::unique_ptr<asio::io_service::work> m_reactor_work;
+};
+
+};
+
+#endif
@@ -0,0 +1,487 @@
+#include "graph.hpp"
+#include "budget.hpp"
+#include "../log/log.hpp"
+
+#include <boost/property_tree/ini_parser.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <stdio.h>
+#include <stdexcept>
+
+// packets that may wait on an edge unless the config says otherwise
+#define DEFAULT_QUEUE_DEPTH 2
+
+using namespace sched;
+namespace pt = boost::property_tree;
+
+namespace {
+double now() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//! A ptree path that takes dots in names literally
+pt::ptree::path_type entry(const std::string& name) {
+    return pt::ptree::path_type(name, '|');
+}
+
+std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t"), e = s.find_last_not_of(" \t");
+    return b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+}
+
+//! Split a port's source list into names and queue depths
+std::vector<std::pair<std::string, size_t> > parseSources(
+        const std::string& list, size_t depth, const std::string& where) {
+    std::vector<std::pair<std::string, size_t> > sources;
+    size_t pos = 0;
+    while(pos <= list.size()) {
+        size_t comma = list.find(',', pos);
+        if(comma == std::string::npos) comma = list.size();
+        std::string s = trim(list.substr(pos, comma - pos));
+        pos = comma + 1;
+        if(s.empty()) continue;
+
+        size_t colon = s.find(':'), d = depth;
+        if(colon != std::string::npos) {
+            try {
+                long v = std::stol(s.substr(colon + 1));
+                if(v <= 0) throw std::invalid_argument("");
+                d = v;
+            } catch(const std::logic_error&) {
+                throw std::invalid_argument(where + ": bad queue depth in \"" +
+                        s + "\"");
+            }
+            s = trim(s.substr(0, colon));
+        }
+        sources.push_back(std::make_pair(s, d));
+    }
+    return sources;
+}
+};
+
+const char* sched::portTypeName(PortType type) {
+    switch(type) {
+    case PORT_FRAME: return "frame";
+    case PORT_RESULTS: return "results";
+    default: return "unknown";
+    }
+}
+
+Packet::Packet() : frame(0), captured(0), scale(1, 1), offset(0, 0) {
+}
+
+cv::Rect Packet::toCapture(const cv::Rect& r) const {
+    return cv::Rect(cvRound(r.x * scale.x + offset.x),
+            cvRound(r.y * scale.y + offset.y),
+            cvRound(r.width * scale.x), cvRound(r.height * scale.y));
+}
+
+cv::Rect Packet::fromCapture(const cv::Rect& r) const {
+    return cv::Rect(cvRound((r.x - offset.x) / scale.x),
+            cvRound((r.y - offset.y) / scale.y),
+            cvRound(r.width / scale.x), cvRound(r.height / scale.y));
+}
+
+void ResultSet::assign(const std::vector<ml::AlgorithmResult*>& res,
+        const Packet& frame) {
+    m_owned.clear();
+    m_view.clear();
+    for(auto r : res) {
+        std::shared_ptr<ml::AlgorithmResult> copy;
+        if(r->type == ml::RT_BOUNDING_BOXES) {
+            auto b = std::make_shared<ml::BoundingBoxesResult>(
+                    *static_cast<ml::BoundingBoxesResult*>(r));
+            for(auto& box : b->boxes) box.bounds = frame.toCapture(box.bounds);
+            copy = b;
+        } else if(r->type == ml::RT_CLASSIFICATION) {
+            copy = std::make_shared<ml::ClassificationResult>(
+                    *static_cast<ml::ClassificationResult*>(r));
+        } else {
+            continue;
+        }
+        m_owned.push_back(copy);
+        m_view.push_back(copy.get());
+    }
+}
+
+void ResultSet::addBoxes(const std::vector<ml::BoundingBox>& boxes) {
+    auto b = std::make_shared<ml::BoundingBoxesResult>();
+    b->type = ml::RT_BOUNDING_BOXES;
+    b->boxes = boxes;
+    m_owned.push_back(b);
+    m_view.push_back(b.get());
+}
+
+void ResultSet::boxes(std::vector<ml::BoundingBox>& out) const {
+    for(auto r : m_view) {
+        if(r->type != ml::RT_BOUNDING_BOXES) continue;
+        auto& b = static_cast<ml::BoundingBoxesResult*>(r)->boxes;
+        out.insert(out.end(), b.begin(), b.end());
+    }
+}
+
+Graph::Graph(const std::string& file, bool dryRun) : m_running(0),
+        m_limit(-1), m_stopping(false), m_ran(false), m_elapsed(0) {
+    load(file, dryRun);
+}
+
+Graph::~Graph() {
+}
+
+void Graph::load(const std::string& file, bool dryRun) {
+    pt::ptree ini;
+    try {
+        pt::read_ini(file, ini);
+    } catch(const pt::ini_parser_error& e) {
+        throw std::invalid_argument(e.what());
+    }
+
+    // one vertex per section, in file order for now
+    std::vector<Vertex> verts;
+    std::vector<const pt::ptree*> sections;
+    std::map<std::string, size_t> index;
+    for(auto& s : ini) {
+        if(s.second.empty()) {
+            throw std::invalid_argument(file + ": \"" + s.first +
+                    "\" is outside any node's section");
+        }
+        std::string kind = s.second.get<std::string>(entry("type"), "");
+        const Stage* stage = findStage(kind);
+        if(stage == NULL) {
+            throw std::invalid_argument("Node " + s.first + " has " +
+                    (kind.empty() ? "no type" : "unknown type " + kind));
+        }
+        Vertex v;
+        v.name = s.first;
+        v.stage = stage;
+        v.inputs.resize(stage->ports.size());
+        v.running = v.done = false;
+        v.frames = 0;
+        v.busy = 0;
+        index[v.name] = verts.size();
+        verts.push_back(std::move(v));
+        sections.push_back(&s.second);
+    }
+    if(verts.empty()) throw std::invalid_argument(file + " has no nodes");
+
+    // connect each port to its sources, checking their types
+    std::vector<Edge> edges;
+    for(size_t i = 0;i < verts.size();i++) {
+        const Stage* stage = verts[i].stage;
+        size_t depth = sections[i]->get<size_t>(entry("queue"),
+                DEFAULT_QUEUE_DEPTH);
+        if(depth == 0) {
+            throw std::invalid_argument("Node " + verts[i].name +
+                    " has a queue depth of zero");
+        }
+        for(size_t p = 0;p < stage->ports.size();p++) {
+            const Port& port = stage->ports[p];
+            std::string where = verts[i].name + "." + port.name;
+            auto sources = parseSources(sections[i]->get<std::string>(
+                        entry(port.name), ""), depth, where);
+            if(sources.empty())
+                throw std::invalid_argument(where + " has no source");
+            if(sources.size() > 1 && !port.many)
+                throw std::invalid_argument(where + " takes one source");
+
+            for(auto& s : sources) {
+                auto itr = index.find(s.first);
+                if(itr == index.end()) {
+                    throw std::invalid_argument(where + ": no node named " +
+                            s.first);
+                }
+                const Stage* from = verts[itr->second].stage;
+                if(!from->produces || from->output != port.type) {
+                    throw std::invalid_argument(where + " needs " +
+                            portTypeName(port.type) + " input, which " +
+                            s.first + " (" + from->kind + ") doesn't produce");
+                }
+                Edge e;
+                e.from = itr->second;
+                e.to = i;
+                e.port = p;
+                e.depth = s.second;
+                e.peak = 0;
+                verts[i].inputs[p].push_back(edges.size());
+                verts[itr->second].outputs.push_back(edges.size());
+                edges.push_back(e);
+            }
+        }
+    }
+
+    // sort topologically, keeping file order where it's free to
+    std::vector<size_t> pending(verts.size(), 0), order;
+    for(auto& e : edges) pending[e.to]++;
+    std::vector<bool> placed(verts.size(), false);
+    while(order.size() < verts.size()) {
+        size_t next = verts.size();
+        for(size_t i = 0;i < verts.size() && next == verts.size();i++)
+            if(!placed[i] && pending[i] == 0) next = i;
+        if(next == verts.size()) {
+            std::string cycle;
+            for(size_t i = 0;i < verts.size();i++)
+                if(!placed[i]) cycle += " " + verts[i].name;
+            throw std::invalid_argument("The graph has a cycle through" +
+                    cycle);
+        }
+        placed[next] = true;
+        order.push_back(next);
+        for(size_t e : verts[next].outputs) pending[edges[e].to]--;
+    }
+
+    std::vector<size_t> position(verts.size());
+    for(size_t i = 0;i < order.size();i++) position[order[i]] = i;
+    for(auto& e : edges) {
+        e.from = position[e.from];
+        e.to = position[e.to];
+    }
+    m_edges = std::move(edges);
+    for(size_t i : order) m_vertices.push_back(std::move(verts[i]));
+
+    // create the nodes in order, so each can size itself for its input
+    for(size_t i = 0;i < m_vertices.size();i++) {
+        Vertex& v = m_vertices[i];
+        NodeConfig cfg;
+        cfg.name = v.name;
+        cfg.index = order[i];
+        cfg.keys = sections[order[i]];
+        cfg.dryRun = dryRun;
+        for(size_t p = 0;p < v.inputs.size();p++) {
+            if(v.stage->ports[p].type != PORT_FRAME) continue;
+            cfg.frameSize = m_vertices[m_edges[v.inputs[p][0]].from].node->
+                frameSize();
+            break;
+        }
+        try {
+            v.node.reset(v.stage->create(cfg));
+        } catch(const std::exception& e) {
+            throw std::invalid_argument("Node " + v.name + ": " + e.what());
+        }
+        if(v.stage->produces && v.outputs.empty())
+            LOG_WARN("graph", "Nothing uses the output of %s", v.name.c_str());
+    }
+    LOG_DEBUG("graph", "Loaded %lu nodes and %lu edges from %s",
+            m_vertices.size(), m_edges.size(), file.c_str());
+}
+
+bool Graph::exhausted(const Vertex& v) const {
+    if(m_stopping) return true;
+    bool source = true;
+    for(auto& port : v.inputs) {
+        for(size_t e : port) {
+            source = false;
+            const Edge& edge = m_edges[e];
+            if(edge.queue.empty() && m_vertices[edge.from].done) return true;
+        }
+    }
+    // nothing would take what it makes
+    if(!v.outputs.empty()) {
+        bool wanted = false;
+        for(size_t e : v.outputs)
+            if(!m_vertices[m_edges[e].to].done) wanted = true;
+        if(!wanted) return true;
+    }
+    return source && m_limit >= 0 && v.frames >= m_limit;
+}
+
+bool Graph::ready(const Vertex& v) const {
+    for(auto& port : v.inputs)
+        for(size_t e : port) if(m_edges[e].queue.empty()) return false;
+    for(size_t e : v.outputs)
+        if(m_edges[e].queue.size() >= m_edges[e].depth) return false;
+    return true;
+}
+
+void Graph::schedule() {
+    // taking a node's inputs can make room for the nodes before it
+    bool progress = true;
+    while(progress) {
+        progress = false;
+        for(size_t i = 0;i < m_vertices.size();i++) {
+            Vertex& v = m_vertices[i];
+            if(v.done || v.running) continue;
+            if(exhausted(v)) {
+                v.done = true;
+                for(auto& port : v.inputs)
+                    for(size_t e : port) m_edges[e].queue.clear();
+                progress = true;
+            } else if(ready(v)) {
+                dispatch(i);
+                progress = true;
+            }
+        }
+    }
+}
+
+void Graph::dispatch(size_t i) {
+    Vertex& v = m_vertices[i];
+    std::vector<std::vector<PacketPtr> > in(v.inputs.size());
+    for(size_t p = 0;p < v.inputs.size();p++) {
+        for(size_t e : v.inputs[p]) {
+            in[p].push_back(m_edges[e].queue.front());
+            m_edges[e].queue.pop_front();
+        }
+    }
+    v.running = true;
+    m_running++;
+
+    Node* node = v.node.get();
+    auto task = [this, i, node, in]() {
+        Packet* out = new Packet();
+        if(!in.empty()) {
+            const Packet& first = *in[0][0];
+            out->frame = first.frame;
+            out->captured = first.captured;
+            out->scale = first.scale;
+            out->offset = first.offset;
+        }
+        bool more = false;
+        std::exception_ptr error;
+        double start = now();
+        try {
+            more = node->process(in, *out);
+        } catch(...) {
+            error = std::current_exception();
+        }
+        double time = now() - start;
+
+        std::lock_guard<std::mutex> l(m_lock);
+        complete(i, out, more, time, error);
+    };
+    if(node->mainThread()) {
+        m_mainTasks.push_back(task);
+        m_cond.notify_all();
+    } else {
+        ThreadBudget::get().workers().submit(task);
+    }
+}
+
+void Graph::complete(size_t i, Packet* out, bool more, double time,
+        std::exception_ptr error) {
+    PacketPtr packet(out);
+    Vertex& v = m_vertices[i];
+    v.running = false;
+    m_running--;
+    v.busy += time;
+
+    if(error) {
+        if(!m_error) m_error = error;
+        m_stopping = true;
+    } else if(!more) {
+        v.done = true;
+    } else {
+        v.frames++;
+        for(size_t e : v.outputs) {
+            // a retired node's edges stay empty, or they'd fill up and stall
+            // the nodes still feeding it
+            if(m_vertices[m_edges[e].to].done) continue;
+            m_edges[e].queue.push_back(packet);
+            m_edges[e].peak = std::max(m_edges[e].peak,
+                    m_edges[e].queue.size());
+        }
+    }
+    schedule();
+    m_cond.notify_all();
+}
+
+long Graph::run(long frames) {
+    std::unique_lock<std::mutex> l(m_lock);
+    if(m_ran) throw std::logic_error("A graph can only be run once");
+    m_ran = true;
+    m_limit = frames;
+
+    double start = now();
+    schedule();
+    while(m_running > 0) {
+        // windows and the like run here, everything else on the pool
+        if(!m_mainTasks.empty()) {
+            auto task = m_mainTasks.front();
+            m_mainTasks.pop_front();
+            l.unlock();
+            task();
+            l.lock();
+            continue;
+        }
+        m_cond.wait(l);
+    }
+    m_elapsed = now() - start;
+
+    // nodes only wait for each other, so this can only mean a bug
+    for(auto& v : m_vertices) {
+        if(!v.done && !m_error) {
+            m_error = std::make_exception_ptr(std::logic_error(
+                        "The graph stalled at " + v.name));
+        }
+    }
+    l.unlock();
+
+    for(auto& v : m_vertices) {
+        try {
+            v.node->finish();
+        } catch(...) {
+            if(!m_error) m_error = std::current_exception();
+        }
+    }
+    if(m_error) std::rethrow_exception(m_error);
+
+    long captured = 0;
+    for(auto& v : m_vertices)
+        if(v.inputs.empty()) captured = std::max(captured, v.frames);
+    return captured;
+}
+
+unsigned int Graph::width() const {
+    unsigned int n = 0;
+    for(auto& v : m_vertices) if(!v.node->mainThread()) n++;
+    return n;
+}
+
+void Graph::print(std::ostream& out) const {
+    // the busiest node is the one holding the others back
+    const Vertex* busiest = NULL;
+    for(auto& v : m_vertices)
+        if(v.frames > 0 && (busiest == NULL || v.busy > busiest->busy))
+            busiest = &v;
+
+    char line[512];
+    snprintf(line, sizeof(line), "%-14s %-11s %-32s %-8s %9s %5s\n", "node",
+            "type", "inputs (peak/depth)", "output", "ms/frame", "busy");
+    out << line;
+    for(auto& v : m_vertices) {
+        std::string inputs;
+        for(size_t p = 0;p < v.inputs.size();p++) {
+            inputs += (p > 0 ? " " : "") + v.stage->ports[p].name + "=";
+            for(size_t k = 0;k < v.inputs[p].size();k++) {
+                const Edge& e = m_edges[v.inputs[p][k]];
+                inputs += (k > 0 ? "," : "") + m_vertices[e.from].name + ":" +
+                    std::to_string(e.peak) + "/" + std::to_string(e.depth);
+            }
+        }
+        const char* output = v.stage->produces ?
+            portTypeName(v.stage->output) : "-";
+        if(v.frames > 0 && m_elapsed > 0) {
+            snprintf(line, sizeof(line), "%-14s %-11s %-32s %-8s %9.2f %4.0f%%%s\n",
+                    v.name.c_str(), v.stage->kind.c_str(), inputs.c_str(),
+                    output, v.busy * 1000 / v.frames,
+                    v.busy * 100 / m_elapsed, &v == busiest ? " *" : "");
+        } else {
+            snprintf(line, sizeof(line), "%-14s %-11s %-32s %-8s %9s %5s\n",
+                    v.name.c_str(), v.stage->kind.c_str(), inputs.c_str(),
+                    output, "-", "-");
+        }
+        out << line;
+    }
+
+    long captured = 0;
+    for(auto& v : m_vertices)
+        if(v.inputs.empty()) captured = std::max(captured, v.frames);
+    if(captured > 0 && m_elapsed > 0) {
+        snprintf(line, sizeof(line), "%ld frames in %.2f s (%.1f fps); "
+                "* marks the busiest node\n", captured, m_elapsed,
+                captured / m_elapsed);
+        out << line;
+    }
+}
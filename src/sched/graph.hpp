@@ -0,0 +1,228 @@
+#ifndef SCHED_GRAPH_HPP
+#define SCHED_GRAPH_HPP
+
+#include "opencv2/core/core.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include "../algorithm.hpp"
+
+namespace sched {
+
+//! What an edge carries
+enum PortType {
+    PORT_FRAME,     //!< Video frames
+    PORT_RESULTS    //!< Algorithm results for a frame
+};
+
+//! Name of a port type, for configs and messages
+const char* portTypeName(PortType type);
+
+struct Packet;
+
+//! Results for one frame, independent of the algorithm that produced them
+class ResultSet {
+public:
+    /** \brief Copy an algorithm's results
+     *
+     * Boxes are moved from \p frame's coordinates into the capture's.
+     * Results other than boxes and classifications are skipped.
+     */
+    void assign(const std::vector<ml::AlgorithmResult*>& res,
+            const Packet& frame);
+
+    //! Add boxes, already in capture coordinates
+    void addBoxes(const std::vector<ml::BoundingBox>& boxes);
+
+    //! Append every box in the set to \p out
+    void boxes(std::vector<ml::BoundingBox>& out) const;
+
+    const std::vector<ml::AlgorithmResult*>& get() const { return m_view; }
+
+private:
+    std::vector<std::shared_ptr<ml::AlgorithmResult> > m_owned;
+    std::vector<ml::AlgorithmResult*> m_view;
+};
+
+//! One frame's worth of data on an edge
+struct Packet {
+    Packet();
+
+    long frame;         //!< Index of the captured frame this came from
+    double captured;    //!< When it was captured, on the monotonic clock
+
+    //! For frame ports. Never written once it has been sent.
+    cv::Mat image;
+
+    //! For frame ports: capture coordinates are image ones times this...
+    cv::Point2d scale;
+    //! ...plus this
+    cv::Point2d offset;
+
+    //! For result ports. Boxes are always in capture coordinates.
+    ResultSet results;
+
+    cv::Rect toCapture(const cv::Rect& r) const;
+    cv::Rect fromCapture(const cv::Rect& r) const;
+};
+
+typedef std::shared_ptr<const Packet> PacketPtr;
+
+//! An input of a node. Each names its sources under its own config key.
+struct Port {
+    std::string name;
+    PortType type;
+    bool many;          //!< Whether it takes more than one source
+};
+
+/** \brief A stage of a pipeline graph
+ *
+ * A node is only ever processing one frame at a time, so it can keep state
+ * between frames without locking, but that may be on any thread.
+ */
+class Node {
+public:
+    virtual ~Node() {}
+
+    /** \brief Process one frame
+     *
+     * \param in One entry per port, holding a packet per source of that port.
+     *           All packets are for the same frame.
+     * \param out The node's output. Frame, capture time and coordinates are
+     *            already copied from the first input.
+     * \return False from a source once it has run out of frames
+     */
+    virtual bool process(const std::vector<std::vector<PacketPtr> >& in,
+            Packet& out)=0;
+
+    //! Size of the frames the node produces, if it produces frames
+    virtual cv::Size frameSize() const { return cv::Size(); }
+
+    //! Whether it must run on the thread that runs the graph, as windows must
+    virtual bool mainThread() const { return false; }
+
+    //! Called once after the last frame
+    virtual void finish() {}
+};
+
+//! What a node is created from
+struct NodeConfig {
+    std::string name;
+    size_t index;       //!< Position of its section in the file
+    const boost::property_tree::ptree* keys; //!< The node's section
+    cv::Size frameSize; //!< Size of the frames on its first frame port
+    bool dryRun;        //!< Whether outputs should go nowhere
+};
+
+//! A kind of node that can appear in a graph
+struct Stage {
+    std::string kind;
+    std::string desc;
+    std::vector<Port> ports;
+    bool produces;      //!< Whether it has an output...
+    PortType output;    //!< ...and of what type
+    std::function<Node*(const NodeConfig&)> create;
+};
+
+//! Look up a node kind. NULL if there's no such kind.
+const Stage* findStage(const std::string& kind);
+
+//! All node kinds, for help text
+const std::vector<Stage>& stages();
+
+/** \brief A pipeline of nodes connected by typed, bounded edges
+ *
+ * The graph is read from an ini file with one section per node. Each section
+ * gives the node's `type` and, for each of its ports, the nodes feeding it as
+ * a comma-separated list of names, each optionally followed by `:depth` to set
+ * how many packets may queue on that edge (`queue` sets the node's default).
+ *
+ * Nodes run on the shared worker pool as soon as they have a packet on every
+ * input and room on every output, so independent branches run side by side
+ * and consecutive stages work on different frames at once. Each node handles
+ * frames in order, and sees its inputs paired by frame index.
+ */
+class Graph {
+public:
+    /** \brief Load and build a graph
+     *
+     * \param dryRun Build sinks and dump targets that discard what they get
+     * \throw std::invalid_argument If the graph is malformed
+     */
+    Graph(const std::string& file, bool dryRun=false);
+    ~Graph();
+
+    /** \brief Run the graph until its sources end
+     *
+     * If a node throws, the graph stops and the exception is rethrown once
+     * every running node has returned. A graph can only be run once.
+     *
+     * \param frames If not negative, stop each source after this many frames
+     * \return The number of frames captured
+     */
+    long run(long frames=-1);
+
+    //! Write the graph, with what each node cost if it has been run
+    void print(std::ostream& out) const;
+
+    //! How many nodes can be busy on the worker pool at once
+    unsigned int width() const;
+
+private:
+    struct Edge {
+        size_t from, to;
+        size_t port;
+        size_t depth;
+        size_t peak;        // deepest the queue got
+        std::deque<PacketPtr> queue;
+    };
+
+    struct Vertex {
+        std::string name;
+        const Stage* stage;
+        std::unique_ptr<Node> node;
+        std::vector<std::vector<size_t> > inputs; // edges, per port
+        std::vector<size_t> outputs;
+        bool running, done;
+        long frames;        // frames processed
+        double busy;        // seconds spent processing them
+    };
+
+    void load(const std::string& file, bool dryRun);
+
+    //! Retire finished vertices and start ready ones. Call with m_lock held.
+    void schedule();
+    bool ready(const Vertex& v) const;
+    bool exhausted(const Vertex& v) const;
+    void dispatch(size_t v);
+
+    //! Record the outcome of one process() call
+    void complete(size_t v, Packet* out, bool more, double time,
+            std::exception_ptr error);
+
+    std::vector<Vertex> m_vertices; // in topological order
+    std::vector<Edge> m_edges;
+
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::deque<std::function<void()> > m_mainTasks;
+    size_t m_running;
+    long m_limit;
+    bool m_stopping, m_ran;
+    std::exception_ptr m_error;
+    double m_elapsed;
+};
+
+};
+
+#endif
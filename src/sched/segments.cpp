@@ -0,0 +1,150 @@
+#include "segments.hpp"
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <time.h>
+
+using namespace sched;
+
+static double now() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (((double)t.tv_nsec) / 1.0e9);
+}
+
+static double iou(const cv::Rect& a, const cv::Rect& b) {
+    double isect = (a & b).area();
+    double uni = a.area() + b.area() - isect;
+    return uni > 0 ? isect / uni : 0.0;
+}
+
+std::vector<Segment> sched::planSegments(long frames, unsigned int count,
+        long overlap, long align) {
+    std::vector<Segment> segs;
+    if(frames <= 0) return segs;
+    count = std::max(1u, std::min<unsigned int>(count, frames));
+
+    auto boundary = [&](unsigned int i) {
+        long b = frames * i / count;
+        if(align > 1 && i < count) b = b / align * align;
+        return b;
+    };
+    for(unsigned int i = 0;i < count;i++) {
+        Segment s;
+        s.begin = boundary(i);
+        s.end = boundary(i + 1);
+        if(s.begin >= s.end) continue;
+        s.start = std::max(0L, s.begin - overlap);
+        if(align > 1) s.start = s.start / align * align;
+        segs.push_back(s);
+    }
+    return segs;
+}
+
+//! Decode and analyze one segment
+static SegmentResult runSegment(const std::string& fname, const Segment& seg,
+        ml::Algorithm* algo) {
+    SegmentResult out;
+    out.seg = seg;
+
+    cv::VideoCapture cap(fname);
+    if(!cap.isOpened())
+        throw std::invalid_argument("Failed to open video file");
+    if(seg.start > 0) cap.set(cv::CAP_PROP_POS_FRAMES, seg.start);
+
+    cv::Mat img;
+    for(long f = seg.start;f < seg.end && cap.read(img);f++) {
+        double t = now();
+        const std::vector<ml::AlgorithmResult*>& res = algo->analyze(img);
+        out.times.push_back(now() - t);
+
+        FrameBoxes boxes;
+        for(auto r : res) {
+            if(r->type != ml::RT_BOUNDING_BOXES) continue;
+            const ml::BoundingBoxesResult* b =
+                static_cast<const ml::BoundingBoxesResult*>(r);
+            boxes.insert(boxes.end(), b->boxes.begin(), b->boxes.end());
+        }
+        out.frames.push_back(boxes);
+    }
+    return out;
+}
+
+std::vector<SegmentResult> sched::processSegments(const std::string& fname,
+        const std::vector<Segment>& segs,
+        const std::vector<ml::Algorithm*>& algos, WorkerPool& pool) {
+    std::vector<boost::future<SegmentResult> > pending;
+    for(size_t i = 0;i < segs.size();i++) {
+        Segment s = segs[i];
+        ml::Algorithm* a = algos[i];
+        pending.push_back(pool.submit(
+                    [fname, s, a]() { return runSegment(fname, s, a); }));
+    }
+
+    std::vector<SegmentResult> parts;
+    for(auto& f : pending) parts.push_back(f.get());
+    return parts;
+}
+
+std::vector<FrameBoxes> sched::stitchSegments(
+        const std::vector<SegmentResult>& parts, long total, double threshold,
+        std::vector<double>& times) {
+    std::vector<FrameBoxes> out(total);
+    times.assign(total, 0.0);
+    std::map<unsigned int, unsigned int> prevIds; // previous segment -> global
+
+    for(size_t k = 0;k < parts.size();k++) {
+        const SegmentResult& cur = parts[k];
+        std::map<unsigned int, unsigned int> ids;
+
+        if(k > 0) {
+            // score track pairs over the frames both segments decoded
+            const SegmentResult& prev = parts[k-1];
+            std::map<std::pair<unsigned int, unsigned int>, double> score;
+            for(long f = cur.seg.start;f < cur.seg.begin;f++) {
+                size_t pi = f - prev.seg.start, ci = f - cur.seg.start;
+                if(pi >= prev.frames.size() || ci >= cur.frames.size()) break;
+                for(auto& a : prev.frames[pi]) {
+                    if(a.id == 0) continue; // untracked
+                    for(auto& b : cur.frames[ci]) {
+                        if(b.id == 0) continue;
+                        double o = iou(a.bounds, b.bounds);
+                        if(o >= threshold) score[std::make_pair(a.id, b.id)] += o;
+                    }
+                }
+            }
+
+            // greedily take the best-supported pairs
+            std::vector<std::pair<double, std::pair<unsigned int,
+                unsigned int> > > ranked;
+            for(auto& s : score) ranked.push_back(std::make_pair(s.second,
+                        s.first));
+            std::sort(ranked.rbegin(), ranked.rend());
+            std::map<unsigned int, bool> usedPrev;
+            for(auto& r : ranked) {
+                unsigned int a = r.second.first, b = r.second.second;
+                if(usedPrev[a] || ids.count(b)) continue;
+                usedPrev[a] = true;
+                ids[b] = prevIds.count(a) ? prevIds[a] : a;
+            }
+        }
+
+        // everything unmatched keeps its own ID
+        for(auto& fb : cur.frames)
+            for(auto& b : fb)
+                if(!ids.count(b.id)) ids[b.id] = b.id;
+
+        for(long f = cur.seg.begin;f < cur.seg.end && f < total;f++) {
+            size_t ci = f - cur.seg.start;
+            if(ci >= cur.frames.size()) break;
+            out[f] = cur.frames[ci];
+            for(auto& b : out[f]) b.id = ids[b.id];
+            times[f] = cur.times[ci];
+        }
+        prevIds.swap(ids);
+    }
+    return out;
+}
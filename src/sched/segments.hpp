@@ -0,0 +1,75 @@
+#ifndef SCHED_SEGMENTS_HPP
+#define SCHED_SEGMENTS_HPP
+
+#include "opencv2/core/core.hpp"
+
+#include <string>
+#include <vector>
+
+#include "../algorithm.hpp"
+#include "budget.hpp"
+
+namespace sched {
+
+/** \brief A run of frames in a video file processed on its own
+ *
+ * Frames [begin, end) belong to the segment. Decoding starts earlier, at
+ * start, so the segment's trackers are already running by the time it
+ * reaches frames it owns, and so its tracks can be matched against the
+ * previous segment's over the frames both saw.
+ */
+struct Segment {
+    long start; //!< First frame decoded
+    long begin; //!< First frame owned
+    long end;   //!< One past the last frame owned
+};
+
+//! Boxes found in one frame
+typedef std::vector<ml::BoundingBox> FrameBoxes;
+
+//! What one segment produced, indexed from its start frame
+struct SegmentResult {
+    Segment seg;
+    std::vector<FrameBoxes> frames;
+    std::vector<double> times; //!< Analysis time per frame, in seconds
+};
+
+/** \brief Split a file into segments
+ *
+ * \param frames The number of frames in the file
+ * \param count How many segments to make
+ * \param overlap How many frames each segment shares with the one before
+ * \param align If more than 1, segment boundaries and decode start points
+ *              are moved back to multiples of this. Set it to the file's
+ *              keyframe interval so seeks land on keyframes.
+ */
+std::vector<Segment> planSegments(long frames, unsigned int count,
+        long overlap, long align);
+
+/** \brief Run each segment through its own algorithm instance
+ *
+ * Segments are decoded with separate captures and analyzed on the pool's
+ * workers, so as many run at once as the pool has threads.
+ *
+ * \param algos One algorithm per segment. Each is only used by one worker.
+ */
+std::vector<SegmentResult> processSegments(const std::string& fname,
+        const std::vector<Segment>& segs,
+        const std::vector<ml::Algorithm*>& algos, WorkerPool& pool);
+
+/** \brief Join segment results into one sequence with consistent IDs
+ *
+ * Over the frames two neighbouring segments both decoded, each track in the
+ * later segment is matched to the track in the earlier one it overlaps most
+ * (boxes with IoU of at least \p threshold, summed over frames), and takes
+ * that track's ID. Each frame's boxes come from the segment owning it.
+ *
+ * \param total The number of frames in the file
+ * \param times Filled with each frame's analysis time
+ */
+std::vector<FrameBoxes> stitchSegments(const std::vector<SegmentResult>& parts,
+        long total, double threshold, std::vector<double>& times);
+
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "shed.hpp"
+#include "../log/log.hpp"
+
+#include <stdexcept>
+
+// when only tracking, detect on one frame in this many
+#define DETECT_INTERVAL 3
+
+// pyramid levels searched once the pyramid is coarsened
+#define REDUCED_LEVELS 8
+
+// never drop more frames than this in a row, so results keep coming
+#define MAX_DROP_RUN 3
+
+// streams step back once their latency is below this fraction of the SLO,
+// and only after this many hold periods without a change, so a stream that
+// only just copes doesn't flap between two steps
+#define RELAX_FRACTION 0.6
+#define RELAX_HOLDS 3
+
+// smoothing for latency and analysis time
+#define EWMA_ALPHA 0.2
+
+using namespace sched;
+
+static LoadShedder* shedderInstance = NULL;
+
+const char* sched::shedLevelName(ShedLevel level) {
+    switch(level) {
+    case SHED_NONE: return "none";
+    case SHED_TRACK_ONLY: return "track-only";
+    case SHED_FEWER_LEVELS: return "fewer-levels";
+    case SHED_DROP: return "drop";
+    default: return "unknown";
+    }
+}
+
+LoadShedder::LoadShedder() : m_nextId(0), m_hold(1.0), m_lastChange(0.0) {
+}
+
+LoadShedder& LoadShedder::get() {
+    if(shedderInstance == NULL)
+        shedderInstance = new LoadShedder();
+    return *shedderInstance;
+}
+
+int LoadShedder::addStream(const std::string& name, double slo, int priority,
+        bool trackOnly, bool fewerLevels) {
+    if(slo <= 0) throw std::invalid_argument("Latency objective must be positive");
+
+    Stream s;
+    s.name = name;
+    s.slo = slo / 1000;
+    s.priority = priority;
+    s.trackOnly = trackOnly;
+    s.fewerLevels = fewerLevels;
+    s.service = 0;
+    s.admitted = 0;
+    s.sequence = 0;
+    s.dropRun = 0;
+    s.stats = ShedStats();
+    s.stats.level = SHED_NONE;
+
+    std::lock_guard<std::mutex> l(m_lock);
+    int id = m_nextId++;
+    m_streams[id] = s;
+    LOG_DEBUG("shed", "%s: SLO %.0f ms, priority %d%s%s", name.c_str(), slo,
+            priority, trackOnly ? "" : ", can't skip detection",
+            fewerLevels ? "" : ", can't coarsen its pyramid");
+    return id;
+}
+
+void LoadShedder::removeStream(int id) {
+    std::lock_guard<std::mutex> l(m_lock);
+    m_streams.erase(id);
+}
+
+void LoadShedder::setHold(double seconds) {
+    std::lock_guard<std::mutex> l(m_lock);
+    m_hold = seconds;
+}
+
+ShedStats LoadShedder::stats(int id) const {
+    std::lock_guard<std::mutex> l(m_lock);
+    auto itr = m_streams.find(id);
+    if(itr == m_streams.end()) throw std::out_of_range("No such stream");
+    return itr->second.stats;
+}
+
+ShedDecision LoadShedder::admit(int id, double captured, double now) {
+    std::lock_guard<std::mutex> l(m_lock);
+    Stream& s = m_streams.at(id);
+    ShedLevel level = s.stats.level;
+    s.stats.frames++;
+
+    ShedDecision d;
+    d.drop = false;
+    d.detect = true;
+    d.maxLevels = 0;
+
+    // a frame that would finish past its deadline isn't worth starting
+    if(level >= SHED_DROP && s.dropRun < MAX_DROP_RUN &&
+            now + s.service > captured + s.slo) {
+        d.drop = true;
+        s.dropRun++;
+        s.stats.dropped++;
+        return d;
+    }
+    s.dropRun = 0;
+
+    if(level >= SHED_TRACK_ONLY && s.trackOnly &&
+            s.sequence++ % DETECT_INTERVAL != 0) {
+        d.detect = false;
+        s.stats.trackOnly++;
+    }
+    if(level >= SHED_FEWER_LEVELS && s.fewerLevels && d.detect) {
+        d.maxLevels = REDUCED_LEVELS;
+        s.stats.reduced++;
+    }
+    s.admitted = now;
+    return d;
+}
+
+void LoadShedder::complete(int id, double captured, double now) {
+    std::lock_guard<std::mutex> l(m_lock);
+    Stream& s = m_streams.at(id);
+    double latency = now - captured;
+    if(latency > s.slo) s.stats.late++;
+
+    // the first frame seeds the averages
+    double a = s.stats.latency > 0 ? EWMA_ALPHA : 1.0;
+    s.stats.latency += a * (latency * 1000 - s.stats.latency);
+    s.service += a * ((now - s.admitted) - s.service);
+    rebalance(now);
+}
+
+ShedLevel LoadShedder::nextLevel(const Stream& s) const {
+    for(int l = s.stats.level + 1;l < SHED_LEVEL_COUNT;l++) {
+        if(l == SHED_TRACK_ONLY && !s.trackOnly) continue;
+        if(l == SHED_FEWER_LEVELS && !s.fewerLevels) continue;
+        return (ShedLevel)l;
+    }
+    return s.stats.level;
+}
+
+ShedLevel LoadShedder::prevLevel(const Stream& s) const {
+    for(int l = s.stats.level - 1;l > SHED_NONE;l--) {
+        if(l == SHED_TRACK_ONLY && !s.trackOnly) continue;
+        if(l == SHED_FEWER_LEVELS && !s.fewerLevels) continue;
+        return (ShedLevel)l;
+    }
+    return SHED_NONE;
+}
+
+void LoadShedder::rebalance(double now) {
+    if(now - m_lastChange < m_hold) return;
+
+    // the most important stream missing its objective
+    Stream* missing = NULL;
+    bool relaxed = true;
+    for(auto& e : m_streams) {
+        Stream& s = e.second;
+        double latency = s.stats.latency / 1000;
+        if(latency > s.slo &&
+                (missing == NULL || s.priority > missing->priority))
+            missing = &s;
+        if(latency > s.slo * RELAX_FRACTION) relaxed = false;
+    }
+
+    if(missing) {
+        // the least important stream that can still shed, itself included
+        Stream* victim = NULL;
+        for(auto& e : m_streams) {
+            Stream& s = e.second;
+            if(s.priority > missing->priority || nextLevel(s) == s.stats.level)
+                continue;
+            if(victim == NULL || s.priority < victim->priority)
+                victim = &s;
+        }
+        if(victim == NULL) return;
+        victim->stats.escalations++;
+        setLevel(*victim, nextLevel(*victim));
+        m_lastChange = now;
+    } else if(relaxed && now - m_lastChange >= m_hold * RELAX_HOLDS) {
+        // give back to the most important stream first
+        Stream* lucky = NULL;
+        for(auto& e : m_streams) {
+            Stream& s = e.second;
+            if(s.stats.level == SHED_NONE) continue;
+            if(lucky == NULL || s.priority > lucky->priority) lucky = &s;
+        }
+        if(lucky == NULL) return;
+        lucky->stats.relaxations++;
+        setLevel(*lucky, prevLevel(*lucky));
+        m_lastChange = now;
+    }
+}
+
+void LoadShedder::setLevel(Stream& s, ShedLevel level) {
+    LOG_INFO("shed", "%s: %s -> %s (latency %.0f ms, SLO %.0f ms)",
+            s.name.c_str(), shedLevelName(s.stats.level),
+            shedLevelName(level), s.stats.latency, s.slo * 1000);
+    s.stats.level = level;
+    s.sequence = 0;
+    s.dropRun = 0;
+}
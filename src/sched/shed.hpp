@@ -0,0 +1,116 @@
+#ifndef SCHED_SHED_HPP
+#define SCHED_SHED_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace sched {
+
+//! Steps of load shedding, each including the ones before it
+enum ShedLevel {
+    SHED_NONE = 0,      //!< Full detection on every frame
+    SHED_TRACK_ONLY,    //!< Detect on some frames, only track on the rest
+    SHED_FEWER_LEVELS,  //!< Also search a coarser detection pyramid
+    SHED_DROP,          //!< Also drop frames that can't meet their deadline
+    SHED_LEVEL_COUNT
+};
+
+//! Name of a shedding level, for logs and metrics
+const char* shedLevelName(ShedLevel level);
+
+//! How to handle one frame
+struct ShedDecision {
+    bool drop;          //!< Skip the frame entirely
+    bool detect;        //!< Run detection, not just trackers
+    int maxLevels;      //!< Pyramid level limit; zero for the algorithm's own
+};
+
+//! A stream's shedding state and counters
+struct ShedStats {
+    ShedLevel level;
+    long frames;        //!< Frames admitted, dropped or not
+    long late;          //!< Results that missed their deadline
+    long dropped;
+    long trackOnly;     //!< Frames that only updated trackers
+    long reduced;       //!< Detections on a coarser pyramid
+    long escalations, relaxations;
+    double latency;     //!< Smoothed capture to result latency, ms
+};
+
+/** \brief Deadline-aware load shedding across streams
+ *
+ * Each stream has a latency objective, from capture to result, and a
+ * priority. A stream whose smoothed latency exceeds its objective makes the
+ * lowest-priority stream, of those no more important than itself, shed one
+ * more step; that can be the stream itself once the others have nothing left
+ * to give. When every stream is comfortably inside its objective, the most
+ * important stream still shedding steps back. Only one change is made per hold
+ * period, so each has time to show its effect, and stepping back waits for
+ * several.
+ *
+ * Steps an algorithm can't take are passed over. Times are in seconds on the
+ * monotonic clock.
+ */
+class LoadShedder {
+public:
+    static LoadShedder& get();
+
+    /** \brief Register a stream
+     *
+     * \param slo Latency objective in milliseconds
+     * \param priority Higher numbers are shed later
+     * \param trackOnly Whether the algorithm can skip detection on a frame
+     * \param fewerLevels Whether it can limit its pyramid levels
+     * \return The stream's ID
+     */
+    int addStream(const std::string& name, double slo, int priority,
+            bool trackOnly, bool fewerLevels);
+
+    void removeStream(int id);
+
+    //! Decide how to handle a frame captured at \p captured
+    ShedDecision admit(int id, double captured, double now);
+
+    //! Record that the results of an admitted frame were ready at \p now
+    void complete(int id, double captured, double now);
+
+    ShedStats stats(int id) const;
+
+    //! Set the minimum time between shedding changes
+    void setHold(double seconds);
+
+private:
+    LoadShedder();
+
+    struct Stream {
+        std::string name;
+        double slo;         // seconds
+        int priority;
+        bool trackOnly, fewerLevels;
+        double service;     // smoothed analysis time, seconds
+        double admitted;    // when the frame in flight was admitted
+        long sequence;      // frames admitted at the current level
+        int dropRun;        // frames dropped in a row
+        ShedStats stats;
+    };
+
+    //! The next step \p s can take from its current level; itself if none
+    ShedLevel nextLevel(const Stream& s) const;
+    ShedLevel prevLevel(const Stream& s) const;
+
+    //! Move one stream a step, if it's been long enough since the last move
+    void rebalance(double now);
+
+    void setLevel(Stream& s, ShedLevel level);
+
+    mutable std::mutex m_lock;
+    std::map<int, Stream> m_streams;
+    int m_nextId;
+    double m_hold;
+    double m_lastChange;
+};
+
+};
+
+#endif
@@ -0,0 +1,477 @@
+#include "graph.hpp"
+#include "budget.hpp"
+#include "shed.hpp"
+#include "../algorithms/preprocess.hpp"
+#include "../algorithms/tracking.hpp"
+#include "../media/capture.hpp"
+#include "../media/gst.hpp"
+#include "../media/sink.hpp"
+#include "../results/metadump.hpp"
+#include "../results/network.hpp"
+#include "../results/http.hpp"
+#include "../results/file.hpp"
+#include "../results/store.hpp"
+#include "../ui/overlay.hpp"
+#include "../log/log.hpp"
+
+#include "config.h"
+
+#include <boost/format.hpp>
+
+#include <chrono>
+#include <random>
+#include <stdexcept>
+
+// tracker stages match and merge boxes overlapping by this much
+#define TRACK_OVERLAP 0.5
+
+// frames a track survives without a detection confirming it
+#define TRACK_LIMIT 20
+
+using namespace sched;
+namespace pt = boost::property_tree;
+
+namespace {
+double now() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//! A ptree path that takes dots in names literally
+pt::ptree::path_type entry(const std::string& name) {
+    return pt::ptree::path_type(name, '|');
+}
+
+template<typename T>
+T get(const NodeConfig& cfg, const std::string& key, const T& def) {
+    return cfg.keys->get<T>(entry(key), def);
+}
+
+//! A seed of the node's own, so nodes don't hand out the same IDs
+unsigned int defaultSeed(const NodeConfig& cfg) {
+    return 1 + (unsigned int)cfg.index;
+}
+
+std::string require(const NodeConfig& cfg, const std::string& key) {
+    std::string v = cfg.keys->get<std::string>(entry(key), "");
+    if(v.empty()) throw std::invalid_argument("needs a " + key);
+    return v;
+}
+
+//! Every box from every packet on a results port
+std::vector<ml::BoundingBox> gather(const std::vector<PacketPtr>& in) {
+    std::vector<ml::BoundingBox> boxes;
+    for(auto& p : in) p->results.boxes(boxes);
+    return boxes;
+}
+
+//! Reads frames from any input vio::openBackend() accepts
+class CaptureNode : public Node {
+public:
+    CaptureNode(const NodeConfig& cfg) : m_frame(0), m_copy(false) {
+        m_cap.reset(vio::openBackend(require(cfg, "input"),
+                    get<bool>(cfg, "infinite", false)));
+#ifdef WITH_GSTREAMER_CAPTURE
+        // pipeline buffers are recycled by the decoder, and packets can
+        // outlive them
+        m_copy = dynamic_cast<vio::GstCaptureBackend*>(m_cap.get()) != NULL;
+#endif
+    }
+
+    bool process(const std::vector<std::vector<PacketPtr> >& in,
+            Packet& out) {
+        cv::Mat img;
+        if(!m_cap->getFrame(img)) return false;
+        out.image = m_copy ? img.clone() : img;
+        out.frame = m_frame++;
+        out.captured = m_cap->getCaptureTime();
+        if(out.captured < 0) out.captured = now();
+        return true;
+    }
+
+    cv::Size frameSize() const { return m_cap->getSize(); }
+
+private:
+    std::unique_ptr<vio::CaptureBackend> m_cap;
+    long m_frame;
+    bool m_copy;
+};
+
+//! Converts, scales and pads frames in one pass
+class PreprocessNode : public Node {
+public:
+    PreprocessNode(const NodeConfig& cfg) : m_in(cfg.frameSize) {
+        ml::InputSpec spec(get<int>(cfg, "channels", 3),
+                get<double>(cfg, "scale", 1.0), get<int>(cfg, "border", 0));
+        spec.size = cv::Size(get<int>(cfg, "width", 0),
+                get<int>(cfg, "height", 0));
+        m_prep.setSpec(spec);
+    }
+
+    bool process(const std::vector<std::vector<PacketPtr> >& in,
+            Packet& out) {
+        const cv::Mat& frame = in[0][0]->image;
+        const ml::InputSpec& spec = m_prep.spec();
+        cv::Size sz = m_prep.outputSize(frame.size());
+        if(frame.channels() == spec.channels && spec.border == 0 &&
+                sz == frame.size()) {
+            out.image = frame;
+            return true;
+        }
+        // a fresh buffer each time, since the last one may still be queued
+        m_prep.run(frame, out.image);
+
+        // chain the mapping back to capture coordinates
+        double fx = (double)frame.cols / (sz.width - 2 * spec.border);
+        double fy = (double)frame.rows / (sz.height - 2 * spec.border);
+        out.offset.x -= spec.border * fx * out.scale.x;
+        out.offset.y -= spec.border * fy * out.scale.y;
+        out.scale.x *= fx;
+        out.scale.y *= fy;
+        return true;
+    }
+
+    cv::Size frameSize() const { return m_prep.outputSize(m_in); }
+
+private:
+    ml::Preprocessor m_prep;
+    cv::Size m_in;
+};
+
+//! Runs one algorithm, or several as a composite
+class AlgorithmNode : public Node {
+public:
+    AlgorithmNode(const NodeConfig& cfg) : m_name(cfg.name) {
+        std::vector<std::string> names;
+        std::string list = require(cfg, "algorithm");
+        size_t pos = 0;
+        while(pos <= list.size()) {
+            size_t comma = list.find(',', pos);
+            if(comma == std::string::npos) comma = list.size();
+            std::string n = list.substr(pos, comma - pos);
+            n.erase(0, n.find_first_not_of(" \t"));
+            n.erase(n.find_last_not_of(" \t") + 1);
+            if(!n.empty()) names.push_back(n);
+            pos = comma + 1;
+        }
+
+        ml::AlgorithmRegistry& reg = ml::AlgorithmRegistry::get();
+        reg.setSize(cfg.frameSize);
+        reg.setSeed(get<unsigned int>(cfg, "seed", defaultSeed(cfg)));
+        if(names.size() == 1) {
+            m_algo = reg.load(names[0]);
+        } else {
+            ml::CompositeAlgorithm* group = new ml::CompositeAlgorithm();
+            m_algo = group;
+            for(auto& n : names) {
+                ml::Algorithm* a = reg.load(n);
+                if(a == NULL) {
+                    delete group;
+                    throw std::invalid_argument("cannot load algorithm " + n);
+                }
+                group->add(a);
+            }
+        }
+        if(m_algo == NULL)
+            throw std::invalid_argument("cannot load algorithm " + list);
+
+        // param.<name> keys, in the order they're given
+        for(auto& k : *cfg.keys) {
+            if(k.first.compare(0, 6, "param.") != 0) continue;
+            std::string name = k.first.substr(6), value = k.second.data();
+            if(!m_algo->setParam(name, value)) {
+                throw std::invalid_argument("invalid algorithm parameter " +
+                        name + "=" + value);
+            }
+        }
+
+        // nodes with a latency objective shed work like separate instances
+        // do, lowest priority first
+        m_shedStream = -1;
+        m_shed.drop = false;
+        m_shed.detect = true;
+        m_shed.maxLevels = 0;
+        if(cfg.keys->count("slo") > 0) {
+            m_shedStream = sched::LoadShedder::get().addStream(cfg.name,
+                    get<double>(cfg, "slo", 0), get<int>(cfg, "priority", 0),
+                    m_algo->setParam("detect", "1"),
+                    m_algo->setParam("max_levels", "0"));
+        }
+    }
+
+    ~AlgorithmNode() {
+        if(m_shedStream >= 0)
+            sched::LoadShedder::get().removeStream(m_shedStream);
+    }
+
+    bool process(const std::vector<std::vector<PacketPtr> >& in,
+            Packet& out) {
+        const Packet& frame = *in[0][0];
+        sched::LoadShedder& shedder = sched::LoadShedder::get();
+        if(m_shedStream >= 0) {
+            sched::ShedDecision d = shedder.admit(m_shedStream,
+                    frame.captured, now());
+            // dropped frames still go downstream, just without results
+            if(d.drop) {
+                out.results.assign(m_none, frame);
+                return true;
+            }
+            if(d.detect != m_shed.detect)
+                m_algo->setParam("detect", d.detect ? "1" : "0");
+            if(d.maxLevels != m_shed.maxLevels)
+                m_algo->setParam("max_levels", std::to_string(d.maxLevels));
+            m_shed = d;
+        }
+        out.results.assign(m_algo->analyze(frame.image), frame);
+        if(m_shedStream >= 0)
+            shedder.complete(m_shedStream, frame.captured, now());
+        return true;
+    }
+
+    void finish() {
+        if(m_shedStream < 0) return;
+        sched::ShedStats st = sched::LoadShedder::get().stats(m_shedStream);
+        LOG_INFO("shed", "%s: %ld frames: %ld late, %ld dropped, "
+                "%ld tracker-only, %ld on a coarser pyramid", m_name.c_str(),
+                st.frames, st.late, st.dropped, st.trackOnly, st.reduced);
+    }
+
+private:
+    std::string m_name;
+    ml::Algorithm* m_algo; // owned by the registry
+    const std::vector<ml::AlgorithmResult*> m_none;
+    int m_shedStream;
+    sched::ShedDecision m_shed;
+};
+
+//! Follows boxes from any number of detectors between frames
+class TrackerNode : public Node {
+public:
+    TrackerNode(const NodeConfig& cfg) :
+        m_type(get<std::string>(cfg, "tracker", "TLD")),
+        m_limit(get<unsigned int>(cfg, "retire", TRACK_LIMIT)),
+        m_rng(get<unsigned int>(cfg, "seed", defaultSeed(cfg))) {
+        if(!ml::createTracker(m_type))
+            throw std::invalid_argument("unknown tracker " + m_type);
+    }
+
+    bool process(const std::vector<std::vector<PacketPtr> >& in,
+            Packet& out) {
+        const Packet& frame = *in[0][0];
+        const cv::Mat& img = frame.image;
+
+        // detections arrive in capture coordinates, trackers see the frame
+        std::vector<cv::Rect> dets;
+        for(auto& b : gather(in[1])) dets.push_back(frame.fromCapture(b.bounds));
+
+        ml::updateTracks(m_tracks, img);
+        ml::dedupTracks(m_tracks, TRACK_OVERLAP);
+        ml::associateDetections(m_tracks, dets, img, TRACK_OVERLAP, false);
+        ml::retireTracks(m_tracks, m_limit);
+        for(auto& r : dets) {
+            ml::TrackingInfo inf;
+            inf.tracker = ml::createTracker(m_type);
+            inf.last_pos = r;
+            inf.id = nextId();
+            inf.confirm_frames = 0;
+            inf.tracker->init(img, r);
+            m_tracks.push_back(inf);
+        }
+
+        std::vector<ml::BoundingBox> boxes;
+        for(auto& t : m_tracks) {
+            ml::BoundingBox b;
+            b.id = t.id;
+            b.tag = 0;
+            b.bounds = frame.toCapture(t.last_pos);
+            boxes.push_back(b);
+        }
+        out.results.addBoxes(boxes);
+        return true;
+    }
+
+private:
+    unsigned int nextId() {
+        unsigned int id;
+        do { id = m_rng(); } while(id == 0);
+        return id;
+    }
+
+    std::string m_type;
+    unsigned int m_limit;
+    std::mt19937 m_rng;
+    ml::TrackList m_tracks;
+};
+
+//! Draws results onto a copy of the frame
+class OverlayNode : public Node {
+public:
+    OverlayNode(const NodeConfig& cfg) : m_size(cfg.frameSize) {
+        m_draw = new ui::ResultRenderElement();
+        m_overlay.add(m_draw);
+    }
+
+    bool process(const std::vector<std::vector<PacketPtr> >& in,
+            Packet& out) {
+        const Packet& frame = *in[0][0];
+        const cv::Mat& img = frame.image;
+        if(img.channels() == 1) cv::cvtColor(img, out.image, CV_GRAY2BGR);
+        else if(img.channels() == 4) cv::cvtColor(img, out.image, CV_BGRA2BGR);
+        else img.copyTo(out.image);
+
+        std::vector<ml::BoundingBox> boxes = gather(in[1]);
+        for(auto& b : boxes) b.bounds = frame.fromCapture(b.bounds);
+        ResultSet res;
+        res.addBoxes(boxes);
+        m_draw->setResults(res.get());
+        m_overlay.render(out.image);
+        return true;
+    }
+
+    cv::Size frameSize() const { return m_size; }
+
+private:
+    ui::Overlay m_overlay;
+    ui::ResultRenderElement* m_draw; // owned by the overlay
+    cv::Size m_size;
+};
+
+//! Shows, saves or streams frames
+class SinkNode : public Node {
+public:
+    SinkNode(const NodeConfig& cfg) : m_window(false) {
+        std::string kind = get<std::string>(cfg, "output", "window");
+        if(cfg.dryRun) {
+            m_sink.reset(new vio::NullSink());
+        } else if(kind == "window") {
+            m_sink.reset(new vio::HighGUISink(
+                        get<std::string>(cfg, "title", cfg.name)));
+            m_window = true;
+        } else if(kind == "file") {
+            m_sink.reset(new vio::FileSink(require(cfg, "path"),
+                        vio::FileSink::MPEG4));
+        } else if(kind == "stream") {
+#ifdef NETWORK_OUTPUT
+            m_sink.reset(new vio::GStreamerSink(boost::str(
+                    boost::format("appsrc ! videoconvert ! x264enc qp-min=18 "
+                    "threads=%2% ! rtph264pay ! udpsink host=%1% port=%3%")
+                    % require(cfg, "host")
+                    % ThreadBudget::get().encoderThreads()
+                    % get<int>(cfg, "port", 5501)), 10));
+#else
+            throw std::invalid_argument("this binary was not built with "
+                    "network output support");
+#endif
+        } else {
+            throw std::invalid_argument("unknown output " + kind);
+        }
+    }
+
+    bool process(const std::vector<std::vector<PacketPtr> >& in,
+            Packet& out) {
+        *m_sink << in[0][0]->image;
+        return true;
+    }
+
+    bool mainThread() const { return m_window; }
+
+    void finish() { m_sink->close(); }
+
+private:
+    std::unique_ptr<vio::VideoSink> m_sink;
+    bool m_window;
+};
+
+//! Target for dry runs
+class DiscardTarget : public mdump::DumpTarget {
+public:
+    void write(const std::string& data) {}
+};
+
+//! Sends results as metadata
+class DumpNode : public Node {
+public:
+    DumpNode(const NodeConfig& cfg) : m_last(0), m_rate(0) {
+        std::string kind = get<std::string>(cfg, "target", "tcp");
+        std::unique_ptr<mdump::DumpTarget> tgt;
+        if(cfg.dryRun) {
+            tgt.reset(new DiscardTarget());
+        } else if(kind == "tcp" || kind == "udp") {
+            std::string host = require(cfg, "host");
+            std::string port = get<std::string>(cfg, "port", "5500");
+            auto reactor = ThreadBudget::get().reactor();
+            if(kind == "tcp")
+                tgt.reset(new mdump::TCPTarget(host, port, reactor));
+            else
+                tgt.reset(new mdump::UDPTarget(host, port, reactor));
+        } else if(kind == "post") {
+            tgt.reset(new mdump::http::POSTTarget(require(cfg, "url")));
+        } else if(kind == "file") {
+            tgt.reset(new mdump::FileTarget(require(cfg, "path")));
+        } else if(kind == "store") {
+            tgt.reset(new mdump::StoreTarget(require(cfg, "path")));
+        } else {
+            throw std::invalid_argument("unknown target " + kind);
+        }
+        m_dumper.reset(new mdump::Metadumper(std::move(tgt)));
+    }
+
+    bool process(const std::vector<std::vector<PacketPtr> >& in,
+            Packet& out) {
+        std::vector<ml::AlgorithmResult*> res;
+        for(auto& p : in[0])
+            res.insert(res.end(), p->results.get().begin(),
+                    p->results.get().end());
+
+        // throughput as seen here, and latency since capture
+        double t = now();
+        if(m_last > 0) m_rate = 0.9 * m_rate + 0.1 / (t - m_last);
+        m_last = t;
+        m_cpu.update();
+        m_dumper->accept(res, 15, (int)out.frame, false, m_cpu.getValue(),
+                m_rate, (int)((t - out.captured) * 1000), out.captured);
+        return true;
+    }
+
+    void finish() { m_dumper->finish(); }
+
+private:
+    std::unique_ptr<mdump::Metadumper> m_dumper;
+    ui::CPULoad m_cpu;
+    double m_last, m_rate;
+};
+
+template<typename T>
+Node* make(const NodeConfig& cfg) { return new T(cfg); }
+
+std::vector<Stage> makeStages() {
+    const Port frames = { "frames", PORT_FRAME, false };
+    const Port results = { "results", PORT_RESULTS, true };
+    std::vector<Stage> s;
+    s.push_back({ "capture", "Reads frames from an input",
+            {}, true, PORT_FRAME, make<CaptureNode> });
+    s.push_back({ "preprocess", "Converts, scales and pads frames",
+            { frames }, true, PORT_FRAME, make<PreprocessNode> });
+    s.push_back({ "algorithm", "Runs detection algorithms",
+            { frames }, true, PORT_RESULTS, make<AlgorithmNode> });
+    s.push_back({ "tracker", "Tracks boxes between frames",
+            { frames, results }, true, PORT_RESULTS, make<TrackerNode> });
+    s.push_back({ "overlay", "Draws results onto frames",
+            { frames, results }, true, PORT_FRAME, make<OverlayNode> });
+    s.push_back({ "sink", "Shows, saves or streams frames",
+            { frames }, false, PORT_FRAME, make<SinkNode> });
+    s.push_back({ "dump", "Sends results as metadata",
+            { results }, false, PORT_RESULTS, make<DumpNode> });
+    return s;
+}
+};
+
+const std::vector<Stage>& sched::stages() {
+    static const std::vector<Stage> all = makeStages();
+    return all;
+}
+
+const Stage* sched::findStage(const std::string& kind) {
+    for(auto& s : stages()) if(s.kind == kind) return &s;
+    return NULL;
+}
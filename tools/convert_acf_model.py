@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+import argparse
+import cv2
+import numpy
+import scipy.io
+
+args = argparse.ArgumentParser(
+        "Utility to convert Piotr's Toolbox ACF detectors for acf-detector")
+args.add_argument("mat", nargs=1, type=str,
+        help="MATLAB file containing a trained 'detector' struct")
+args.add_argument("-o", "--output", type=str, default="acf_model.yml",
+        help="Output to a specific file")
+args = args.parse_args()
+
+det = scipy.io.loadmat(args.mat[0], squeeze_me=True,
+        struct_as_record=False)["detector"]
+clf = det.clf
+opts = det.opts
+shrink = int(opts.pPyramid.pChns.shrink)
+orients = int(opts.pPyramid.pChns.pGradHist.nOrients)
+height, width = [int(x) for x in opts.modelDsPad]
+depth = int(numpy.max(clf.depth))
+wh, ww = height // shrink, width // shrink
+
+# Toolbox channels are column-major (y fastest, then x, then channel);
+# acf-detector wants row-major planes.
+def remap(f):
+    c, r = divmod(int(f), wh*ww)
+    x, y = divmod(r, wh)
+    return (c*wh + y)*ww + x
+
+# Toolbox trees are stored with explicit child links and may stop early;
+# lay them out as complete breadth-first trees, padding short branches with
+# nodes that always go left.
+nodes = (1 << (depth + 1)) - 1
+fids = numpy.atleast_2d(clf.fids)
+trees = fids.shape[1]
+out_fids = numpy.zeros((trees, nodes), numpy.int32)
+out_thrs = numpy.full((trees, nodes), numpy.inf, numpy.float32)
+out_hs = numpy.zeros((trees, nodes), numpy.float32)
+thrs = numpy.atleast_2d(clf.thrs)
+hs = numpy.atleast_2d(clf.hs)
+child = numpy.atleast_2d(clf.child)
+
+def fill(t, src, dst, d):
+    if d == depth or child[src, t] == 0:
+        # leaf; replicate down to full depth
+        stack = [(dst, d)]
+        while stack:
+            k, kd = stack.pop()
+            out_hs[t, k] = hs[src, t]
+            if kd < depth:
+                stack += [(2*k + 1, kd + 1), (2*k + 2, kd + 1)]
+        return
+    out_fids[t, dst] = remap(fids[src, t])
+    out_thrs[t, dst] = thrs[src, t]
+    left = int(child[src, t]) - 1
+    fill(t, left, 2*dst + 1, d + 1)
+    fill(t, left + 1, 2*dst + 2, d + 1)
+
+for t in range(trees):
+    fill(t, 0, 0, 0)
+out_thrs[numpy.isinf(out_thrs)] = numpy.finfo(numpy.float32).max
+
+fs = cv2.FileStorage(args.output, cv2.FILE_STORAGE_WRITE)
+fs.write("window_width", width)
+fs.write("window_height", height)
+fs.write("shrink", shrink)
+fs.write("orients", orients)
+fs.write("depth", depth)
+fs.write("cascade_threshold", float(opts.cascThr))
+fs.write("fids", out_fids)
+fs.write("thresholds", out_thrs)
+fs.write("leaves", out_hs)
+fs.release()
+print("Wrote {} trees of depth {} to {}".format(trees, depth, args.output))
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+import argparse
+import struct
+import cv2
+
+# must match HogModelHeader in src/algorithms/models.hpp
+MAGIC = b"PDHOGSVM"
+VERSION = 1
+HEADER = struct.Struct("<8sII9iIfI64s")
+ALIGN = 64
+
+args = argparse.ArgumentParser(
+        "Utility to export HOG linear SVMs as .hogmodel files for ocv-hog-svm")
+args.add_argument("source", nargs=1, type=str,
+        help="'default' or 'daimler' for OpenCV's built-in people detectors, "
+        "a file written by HOGDescriptor.save(), or with --svm, a linear SVM "
+        "saved by cv2.ml")
+args.add_argument("-o", "--output", type=str, default="model.hogmodel",
+        help="Output to a specific file")
+args.add_argument("-n", "--name", type=str, default=None,
+        help="Description stored in the model")
+args.add_argument("--svm", action="store_true",
+        help="The source is a cv2.ml SVM trained on HOG descriptors")
+args.add_argument("--win", type=str, default="64x128",
+        help="Detection window of an --svm source, as WxH")
+args = args.parse_args()
+source = args.source[0]
+
+if source == "default":
+    hog = cv2.HOGDescriptor((64, 128), (16, 16), (8, 8), (8, 8), 9)
+    detector = list(cv2.HOGDescriptor_getDefaultPeopleDetector().flatten())
+elif source == "daimler":
+    hog = cv2.HOGDescriptor((48, 96), (16, 16), (8, 8), (8, 8), 9)
+    detector = list(cv2.HOGDescriptor_getDaimlerPeopleDetector().flatten())
+elif args.svm:
+    # the same conversion as OpenCV's train_HOG sample
+    w, h = [int(x) for x in args.win.split("x")]
+    hog = cv2.HOGDescriptor((w, h), (16, 16), (8, 8), (8, 8), 9)
+    svm = cv2.ml.SVM_load(source)
+    if svm.getKernelType() != cv2.ml.SVM_LINEAR:
+        raise SystemExit("Only linear SVMs can be used for HOG detection")
+    sv = svm.getSupportVectors()
+    rho, _, _ = svm.getDecisionFunction(0)
+    detector = list(sv[0].flatten()) + [-rho]
+else:
+    hog = cv2.HOGDescriptor()
+    if not hog.load(source):
+        raise SystemExit("Cannot read HOG descriptor from " + source)
+    detector = list(hog.svmDetector.flatten())
+
+length = hog.getDescriptorSize()
+if len(detector) != length + 1:
+    raise SystemExit("Detector has {} weights; a {}x{} window needs {}".format(
+        len(detector) - 1, hog.winSize[0], hog.winSize[1], length))
+
+# OpenCV's detectors are already in descriptor order, which is what the
+# scoring loop wants, so the weights are written as they are
+name = args.name if args.name is not None else source
+offset = (HEADER.size + ALIGN - 1) // ALIGN * ALIGN
+header = HEADER.pack(MAGIC, VERSION, HEADER.size,
+        hog.winSize[0], hog.winSize[1],
+        hog.blockSize[0], hog.blockSize[1],
+        hog.blockStride[0], hog.blockStride[1],
+        hog.cellSize[0], hog.cellSize[1],
+        hog.nbins, length, float(detector[-1]), offset,
+        name.encode("utf-8")[:63])
+
+with open(args.output, "wb") as f:
+    f.write(header)
+    f.write(b"\0" * (offset - HEADER.size))
+    f.write(struct.pack("<{}f".format(length), *detector[:-1]))
+print("Wrote {}x{} model '{}' ({} weights) to {}".format(
+    hog.winSize[0], hog.winSize[1], name, length, args.output))
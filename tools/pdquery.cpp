@@ -0,0 +1,165 @@
+/* Queries a detection store written with --mstream store:[dir].
+ *
+ * Lists the detections, or with --tracks the tracks, seen in a zone of the
+ * image between two times. Only the parts of the store that can hold matches
+ * are read, so a query over weeks of data returns about as fast as it can
+ * print its results.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include "results/store.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+static double getTime() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (((double)t.tv_nsec) / 1.0e9);
+}
+
+/** Parse a local date and time, or seconds since the epoch, into microseconds
+ * since the epoch.
+ */
+static int64_t parseTime(const string& s) {
+    char* end;
+    double secs = strtod(s.c_str(), &end);
+    if(!s.empty() && *end == '\0') return (int64_t)(secs * 1.0e6);
+
+    static const char* formats[] = { "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S",
+        "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+    for(auto f : formats) {
+        tm t = tm();
+        const char* rest = strptime(s.c_str(), f, &t);
+        if(rest == NULL || *rest != '\0') continue;
+        t.tm_isdst = -1;
+        return (int64_t)mktime(&t) * 1000000;
+    }
+    throw invalid_argument("Cannot read time " + s);
+}
+
+static string formatTime(int64_t us) {
+    time_t secs = us / 1000000;
+    tm t;
+    localtime_r(&secs, &t);
+    char buf[48];
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &t);
+    snprintf(buf + n, sizeof(buf) - n, ".%03d", (int)(us % 1000000 / 1000));
+    return buf;
+}
+
+static cv::Rect parseZone(const string& s) {
+    cv::Rect r;
+    char tail;
+    if(sscanf(s.c_str(), "%d,%d,%d,%d%c", &r.x, &r.y, &r.width, &r.height,
+                &tail) != 4 || r.width <= 0 || r.height <= 0)
+        throw invalid_argument("Zones must be x,y,width,height");
+    return r;
+}
+
+//! What was seen of a track
+struct Track {
+    int64_t first, last;
+    long frames;
+    cv::Rect bounds;    // of everything it covered in the zone
+};
+
+int main(int argc, char** argv) {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Print this help message")
+        ("store,s", po::value<string>()->required(), "Detection store directory")
+        ("from,f", po::value<string>(),
+            "Start of the time range, as local 'YYYY-MM-DD HH:MM:SS' or "
+            "seconds since the epoch (default: the beginning)")
+        ("to,t", po::value<string>(),
+            "End of the time range, inclusive (default: the end)")
+        ("zone,z", po::value<string>(),
+            "Only detections overlapping this area, as x,y,width,height")
+        ("tracks", "List the tracks seen, instead of every detection")
+        ("stats", "Report how much of the store the query read");
+
+    po::positional_options_description pos_opts;
+    pos_opts.add("store", 1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv)
+                .options(desc).positional(pos_opts).run(), vm);
+        if(vm.count("help") > 0) {
+            cout << desc << '\n';
+            return 0;
+        }
+        po::notify(vm);
+    } catch(po::error& e) {
+        cerr << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    bool tracks = vm.count("tracks") > 0;
+    map<unsigned int, Track> seen;
+    mdump::store::QueryStats stats;
+    double elapsed;
+    try {
+        int64_t first = vm.count("from") > 0 ?
+            parseTime(vm["from"].as<string>()) : INT64_MIN;
+        int64_t last = vm.count("to") > 0 ?
+            parseTime(vm["to"].as<string>()) : INT64_MAX;
+        cv::Rect zone = vm.count("zone") > 0 ?
+            parseZone(vm["zone"].as<string>()) : cv::Rect();
+
+        mdump::store::Reader store(vm["store"].as<string>());
+        double start = getTime();
+        stats = store.query(first, last, zone,
+                [&](const mdump::store::Detection& d) {
+            if(!tracks) {
+                printf("%s %ld %u %d %d %d %d\n", formatTime(d.time).c_str(),
+                        d.frame, d.id, d.bounds.x, d.bounds.y, d.bounds.width,
+                        d.bounds.height);
+                return;
+            }
+            if(d.id == 0) return;   // untracked
+            auto it = seen.find(d.id);
+            if(it == seen.end()) {
+                Track t = { d.time, d.time, 1, d.bounds };
+                seen[d.id] = t;
+            } else {
+                it->second.last = d.time;
+                it->second.frames++;
+                it->second.bounds |= d.bounds;
+            }
+        });
+        elapsed = getTime() - start;
+    } catch(const exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    if(tracks) {
+        printf("%-8s %-23s %-23s %7s  %s\n", "track", "first seen", "last seen",
+                "frames", "area covered");
+        for(auto& t : seen) {
+            printf("%-8u %-23s %-23s %7ld  %d,%d,%d,%d\n", t.first,
+                    formatTime(t.second.first).c_str(),
+                    formatTime(t.second.last).c_str(), t.second.frames,
+                    t.second.bounds.x, t.second.bounds.y,
+                    t.second.bounds.width, t.second.bounds.height);
+        }
+    }
+    if(vm.count("stats") > 0) {
+        fprintf(stderr, "%lu segments, %lu of %lu blocks read, %lu detections "
+                "decoded in %.1f ms\n", stats.segments, stats.read,
+                stats.blocks, stats.detections, elapsed * 1000.0);
+    }
+    return 0;
+}
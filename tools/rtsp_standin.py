@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+import argparse
+import gi
+gi.require_version("Gst", "1.0")
+gi.require_version("GstRtspServer", "1.0")
+from gi.repository import GLib, Gst, GstRtspServer
+
+args = argparse.ArgumentParser(
+        "Local RTSP server standing in for a network camera, for testing rtsp: inputs")
+args.add_argument("-i", "--input", type=str,
+        help="Video file to serve instead of a test pattern")
+args.add_argument("-p", "--port", type=int, default=8554,
+        help="Port to listen on")
+args.add_argument("--path", type=str, default="/test",
+        help="Mount point of the stream")
+args.add_argument("--size", type=str, default="640x480",
+        help="Frame size of the stream")
+args.add_argument("--fps", type=int, default=15,
+        help="Frame rate of the stream")
+args.add_argument("--codec", choices=["h264", "mjpeg"], default="h264",
+        help="Encoding of the stream")
+args.add_argument("--loss", type=float, default=0.0,
+        help="Percentage of RTP packets to drop")
+args.add_argument("--disconnect", type=float, default=0.0,
+        help="Drop all clients every this many seconds, to exercise reconnects")
+args = args.parse_args()
+
+Gst.init(None)
+width, height = [int(x) for x in args.size.split("x")]
+
+if args.input:
+    source = ("filesrc location=\"{}\" ! decodebin ! videoconvert ! "
+            "videoscale ! videorate").format(args.input)
+else:
+    source = "videotestsrc is-live=true pattern=ball"
+source += " ! video/x-raw,width={},height={},framerate={}/1".format(
+        width, height, args.fps)
+
+if args.codec == "h264":
+    encode = ("x264enc tune=zerolatency speed-preset=ultrafast key-int-max={} ! "
+            "rtph264pay config-interval=1 pt=96").format(args.fps * 2)
+else:
+    encode = "jpegenc ! rtpjpegpay pt=26"
+
+# the server sends whatever comes out of the element named pay0, so loss is
+# simulated by putting a lossy identity there instead of the payloader
+if args.loss > 0:
+    encode += " ! identity drop-probability={} name=pay0".format(args.loss / 100)
+else:
+    encode = encode.replace(" pt=", " name=pay0 pt=")
+
+factory = GstRtspServer.RTSPMediaFactory()
+factory.set_launch("( {} ! {} )".format(source, encode))
+factory.set_shared(True)
+
+server = GstRtspServer.RTSPServer()
+server.set_service(str(args.port))
+server.get_mount_points().add_factory(args.path, factory)
+server.attach(None)
+
+def disconnect():
+    server.client_filter(
+            lambda srv, client: GstRtspServer.RTSPFilterResult.REMOVE)
+    print("Dropped all clients")
+    return True
+
+if args.disconnect > 0:
+    GLib.timeout_add(int(args.disconnect * 1000), disconnect)
+
+print("Serving rtsp://127.0.0.1:{}{}".format(args.port, args.path))
+GLib.MainLoop().run()